@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocation for data that only lives for a frame or two, visible
+ * lists, sort keys and the like.
+ *
+ * Every thread allocates from its own pair of buffers, so nothing is
+ * locked. The first allocation of a frame switches the thread to its other
+ * buffer and empties it, what it allocated the frame before stays valid
+ * until the end of the current one. Nothing is ever freed one by one.
+ *
+ * A buffer that runs out spills into backup blocks and counts an overflow.
+ * The buffer is grown to what the frame needed when it is emptied next,
+ * so once frames stop growing they stop touching the heap.
+ * */
+
+// Threads that can allocate at once, slots are reused once a thread exits
+#define FRAME_ARENA_MAX_THREADS 64
+// Per buffer, before any growth
+#define FRAME_ARENA_BYTES (64*1024)
+#define FRAME_ARENA_ALIGN 16
+
+struct FrameArenaStats
+{
+    uint64_t frame;
+    // spills since start, every one means a buffer was too small that frame
+    uint64_t overflows;
+    // buffers of every thread together
+    size_t reserved_bytes;
+    // most any thread allocated in one frame
+    size_t peak_frame_bytes;
+    int threads;
+};
+
+/*
+ * Once at the start of every frame, by the thread stepping the world.
+ * Threads that allocate on their own schedule may see two frames pass
+ * while they use what they allocated.
+ * */
+void frame_arena_begin(void);
+uint64_t frame_arena_frame(void);
+
+/*
+ * Any thread. align must be a power of two. Valid until the end of the
+ * next frame, NULL if even a backup block couldn't be allocated.
+ * */
+void *frame_alloc(size_t size, size_t align);
+#define FRAME_ALLOC(type, count) ((type *) frame_alloc((count)*sizeof(type), _Alignof(type)))
+
+/*
+ * Sorted by ascending key, equal keys keep their order. Scratch space
+ * comes from the frame arena. Returns -1 if it couldn't be allocated,
+ * items are untouched then.
+ * */
+struct FrameSortItem
+{
+    float key;
+    void *value;
+};
+int frame_sort(struct FrameSortItem *items, size_t count);
+
+void frame_arena_get_stats(struct FrameArenaStats *out);
+void frame_arena_print_stats(void);
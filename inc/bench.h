@@ -0,0 +1,96 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Microbenchmark harness for the bench binary, see `make bench`.
+ *
+ * A case is timed in repetitions of a calibrated number of calls, each
+ * repetition long enough for the clock to resolve it. Reported are the
+ * median time per call and the median absolute deviation of the
+ * repetitions from it, both robust against the odd preempted repetition.
+ * */
+#define BENCH_DEFAULT_WARMUP 3
+#define BENCH_DEFAULT_REPETITIONS 15
+#define BENCH_MAX_REPETITIONS 101
+// Calls per repetition are doubled until a repetition takes this long
+#define BENCH_DEFAULT_MIN_REPETITION_MS 10.0
+#define BENCH_DEFAULT_FILE "bench_results.json"
+
+// A slowdown counts once it is larger than this share of the baseline,
+#define BENCH_COMPARE_DEFAULT_PERCENT 5.0
+// and larger than this many standard errors of the difference, both
+// estimated from the MADs and repetitions of the runs
+#define BENCH_COMPARE_SIGMAS 3.0
+#define BENCH_MAX_RESULTS 64
+#define BENCH_MAX_NAME 48
+
+typedef void (*BenchRun)(void *user);
+
+struct BenchCase
+{
+    const char *name;
+    BenchRun run;
+    void *user;
+    // work done by one call, voxels, boxes, bytes..., 0 for none
+    double items;
+};
+
+struct BenchOptions
+{
+    int warmup, repetitions;
+    double min_repetition_ms;
+    // only cases whose name contains this, NULL for all
+    const char *filter;
+};
+
+struct BenchResult
+{
+    const char *name;
+    int repetitions;
+    uint64_t calls;
+    double median_ns, mad_ns, min_ns, max_ns;
+    double items;
+};
+
+/*
+ * A whole run, as written by bench_write_json or read back from it.
+ * Loaded results point their names into names.
+ * */
+struct BenchReport
+{
+    struct BenchResult results[BENCH_MAX_RESULTS];
+    char names[BENCH_MAX_RESULTS][BENCH_MAX_NAME];
+    size_t count;
+};
+
+void bench_default_options(struct BenchOptions *options);
+bool bench_selected(const struct BenchOptions *options, const char *name);
+
+/*
+ * Calibrates, warms up and times the case. Returns -1 if it couldn't.
+ * */
+int bench_run(const struct BenchCase *bench, const struct BenchOptions *options, struct BenchResult *out);
+void bench_print(const struct BenchResult *result);
+int bench_write_json(const char *path, const struct BenchOptions *options, const struct BenchResult *results, size_t count);
+
+int bench_load_json(const char *path, struct BenchReport *report);
+
+/*
+ * Prints a delta table of every benchmark in either run. Returns the
+ * number of significant slowdowns, a benchmark missing from the current
+ * run is reported but doesn't count.
+ * */
+int bench_compare(const struct BenchReport *baseline, const struct BenchReport *current, double min_percent);
+
+/*
+ * Sorts values. The median, and the median of the distances to it.
+ * */
+double bench_median(double *values, size_t count);
+double bench_mad(double *values, size_t count, double median);
+
+/*
+ * Keeps a result alive so the compiler can't drop the work behind it.
+ * */
+void bench_consume(uint64_t value);
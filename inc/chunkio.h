@@ -0,0 +1,126 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <voxel.h>
+#include <world.h>
+#include <job.h>
+#include <region.h>
+
+#define CHUNK_IO_DEFAULT_THREADS 2
+// Requests an I/O thread takes at once, reads and writes are coalesced within it
+#define CHUNK_IO_BATCH 64
+// Reads this close together become one pread, the gap is read and dropped
+#define CHUNK_IO_MAX_GAP (16*REGION_SECTOR_SIZE)
+#define CHUNK_IO_MAX_SPAN (1024*1024)
+
+enum ChunkIoKind
+{
+    CHUNK_IO_LOAD,
+    CHUNK_IO_SAVE
+};
+
+struct ChunkIoRequest;
+
+/*
+ * Runs on the thread calling chunk_io_poll, the request is freed afterwards.
+ * */
+typedef void (*ChunkIoDone)(struct ChunkIoRequest *request);
+
+struct ChunkIoRequest
+{
+    enum ChunkIoKind kind;
+    struct ChunkCoord coord;
+    // filled by loads, read by saves until they are encoded
+    struct Chunk *chunk;
+    ChunkIoDone done;
+    void *user;
+
+    enum RegionResult result;
+    // loads only, a cancelled load may or may not have filled chunk
+    bool cancelled;
+
+    struct ChunkIo *io;
+    struct ChunkCoord region;
+    int index;
+    struct RegionEntry entry;
+    // encoded chunk, owned for saves and a slice of a shared read for loads
+    uint8_t *payload;
+    struct ChunkIoBuffer *buffer;
+    struct ChunkIoRequest *next;
+    // saves only, see chunk_io_save
+    struct ChunkIoRequest *save_next, *chained;
+};
+
+struct ChunkIoStats
+{
+    uint64_t loads, saves, missing, corrupt, cancelled;
+    // system calls issued, fewer than requests when they were coalesced
+    uint64_t preads, pwrites;
+    uint64_t bytes_read, bytes_written;
+};
+
+/*
+ * Chunk loads and saves off the render thread. I/O threads batch the
+ * requests per region file into as few preads and pwrites as possible,
+ * encoding and decoding happen on the job pool.
+ * */
+typedef struct ChunkIo
+{
+    struct RegionStore *store;
+    struct JobPool *workers;
+
+    pthread_t *threads;
+    int thread_count;
+    bool running;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    // waiting for an I/O thread
+    struct ChunkIoRequest *pending_head, *pending_tail;
+    // waiting for chunk_io_poll
+    struct ChunkIoRequest *completed_head, *completed_tail;
+    // submitted and not completed yet
+    size_t in_flight;
+    // the save in flight of every chunk, later ones are chained behind it
+    struct ChunkIoRequest *saving;
+
+    struct ChunkIoStats stats;
+} ChunkIo;
+
+int chunk_io_init(struct ChunkIo *io, struct RegionStore *store, struct JobPool *workers, int thread_count);
+
+/*
+ * chunk must stay valid until done runs. Loads of chunks that were never
+ * saved complete with REGION_MISSING. Saves of one chunk land in the order
+ * they were made, a save is only encoded once the one before completed.
+ * Returns NULL if nothing was queued.
+ * */
+struct ChunkIoRequest *chunk_io_load(struct ChunkIo *io, struct ChunkCoord coord, struct Chunk *chunk, ChunkIoDone done, void *user);
+struct ChunkIoRequest *chunk_io_save(struct ChunkIo *io, struct ChunkCoord coord, struct Chunk *chunk, ChunkIoDone done, void *user);
+
+/*
+ * Skips whatever work of a load is left, done still runs with cancelled
+ * set. Only valid until done ran.
+ * */
+void chunk_io_cancel(struct ChunkIo *io, struct ChunkIoRequest *request);
+
+/*
+ * Runs the done callbacks of completed requests, never blocks.
+ * */
+void chunk_io_poll(struct ChunkIo *io);
+
+void chunk_io_get_stats(struct ChunkIo *io, struct ChunkIoStats *out);
+
+/*
+ * Finishes every request, joins the I/O threads and runs the remaining
+ * done callbacks. The job pool must still be running.
+ * */
+void chunk_io_shutdown(struct ChunkIo *io);
+
+/*
+ * Saves and loads count chunks asynchronously, cancels some loads on the
+ * way and checks what comes back. Returns the number of failures.
+ * */
+int chunk_io_benchmark(const struct Terrain *terrain, struct JobPool *workers, const char *directory, int count);
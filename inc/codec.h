@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <voxel.h>
+#include <terrain.h>
+
+/*
+ * Chunk codec, three passes tuned for voxel data:
+ *   palette, the distinct voxel types of the chunk
+ *   runs of palette indices in CHUNK_INDEX order, a nibble each when the
+ *   palette is small
+ *   a small LZ pass over the runs, repeated rows and layers collapse into matches
+ *
+ * Layout:
+ *   u8 flags, u8 palette size - 1, palette
+ *   varint length of the runs, only with CODEC_FLAG_LZ
+ *   runs, or the LZ stream of them
+ * */
+#define CODEC_FLAG_LZ 1
+#define CODEC_FLAG_NIBBLES 2
+
+// Inputs are whole chunks, the scratch buffers are sized for this
+#define CODEC_MAX_INPUT CHUNK_DATA_SIZE
+// Worst case of the run pass, 2 bytes per voxel plus a varint of slack
+#define CODEC_RUNS_BOUND (2*CODEC_MAX_INPUT + 16)
+
+/*
+ * One shot, into caller buffers. encode returns the encoded size, or 0 if
+ * it doesn't fit in capacity. decode returns 0 once exactly out_size bytes
+ * were produced, -1 on malformed input. Match the RegionEncode and
+ * RegionDecode signatures.
+ * */
+size_t codec_encode(const uint8_t *in, size_t size, uint8_t *out, size_t capacity);
+int codec_decode(const uint8_t *in, size_t size, uint8_t *out, size_t out_size);
+
+/*
+ * Many chunks packed back to back into one caller buffer, each behind
+ * a 32 bit length. For keeping cold chunks in memory. To read a stream
+ * back, init it over the bytes that were written.
+ * */
+struct CodecStream
+{
+    uint8_t *buffer;
+    size_t capacity;
+    // write position, or read position while decoding
+    size_t used;
+    // voxel bytes written or read so far
+    size_t raw_bytes;
+};
+
+void codec_stream_init(struct CodecStream *stream, uint8_t *buffer, size_t capacity);
+
+/*
+ * Returns -1 once the buffer is full, the stream is left as it was.
+ * */
+int codec_stream_write(struct CodecStream *stream, const struct Chunk *chunk);
+
+/*
+ * Reads the next chunk, returns 1 at the end of the stream and -1 on
+ * malformed data.
+ * */
+int codec_stream_read(struct CodecStream *stream, struct Chunk *chunk);
+
+/*
+ * Round trips generated and synthetic chunks, including the worst cases,
+ * and compares the vector run detection against the scalar one.
+ * Returns the number of failures.
+ * */
+int codec_verify(const struct Terrain *terrain);
+
+/*
+ * Compression ratio and encode/decode throughput on generated terrain.
+ * */
+void codec_benchmark(const struct Terrain *terrain, int count);
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <terrain.h>
+
+// Columns kept around while nobody holds them, about 8KB each
+#define COLUMN_CACHE_DEFAULT_CAPACITY 1024
+// Must be a power of two
+#define COLUMN_CACHE_HASH_BUCKETS 2048
+
+struct CachedColumn
+{
+    int32_t x, z;
+    struct TerrainColumn data;
+
+    int references;
+    // false while the first thread to ask is still computing it
+    bool ready;
+
+    struct CachedColumn *hash_next;
+    // only linked while references is 0, most recently released first
+    struct CachedColumn *lru_prev, *lru_next;
+};
+
+struct ColumnCacheStats
+{
+    uint64_t hits, misses, evictions;
+    size_t columns, held;
+};
+
+/*
+ * Heightmaps shared by vertically stacked chunks. Columns are reference
+ * counted while in use and evicted least recently used once released.
+ * Safe to use from the workers.
+ * */
+typedef struct ColumnCache
+{
+    const struct Terrain *terrain;
+    size_t capacity;
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct CachedColumn **buckets;
+    struct CachedColumn *lru_head, *lru_tail;
+
+    struct ColumnCacheStats stats;
+} ColumnCache;
+
+int column_cache_init(struct ColumnCache *cache, const struct Terrain *terrain, size_t capacity);
+
+/*
+ * Returns the column, computing it if nobody has yet. Every acquire needs
+ * a matching release, the column stays valid until then.
+ * */
+const struct TerrainColumn *column_cache_acquire(struct ColumnCache *cache, int32_t chunk_x, int32_t chunk_z);
+void column_cache_release(struct ColumnCache *cache, const struct TerrainColumn *column);
+
+void column_cache_get_stats(struct ColumnCache *cache, struct ColumnCacheStats *out);
+
+/*
+ * Every column must have been released.
+ * */
+void column_cache_free(struct ColumnCache *cache);
+
+/*
+ * Fills a world width x width columns wide and height chunks tall with and
+ * without the cache, reports the 2D noise evaluations and time saved.
+ * */
+void column_cache_benchmark(const struct Terrain *terrain, int width, int height);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32 (IEEE, the zlib one). Start from 0 and feed the previous
+ * result back in to checksum data in pieces.
+ * */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
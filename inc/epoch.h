@@ -0,0 +1,63 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Epoch based reclamation for world data shared between threads.
+ *
+ * A thread pins the epoch while it looks at shared data and unpins once it
+ * holds no more plain pointers into it. Memory unlinked from everything
+ * shared is retired instead of freed, and only freed once every thread
+ * pinned at the time has unpinned. Readers never take a lock or touch a
+ * reference count.
+ *
+ * The global epoch only advances when every pinned thread has seen the
+ * current one, so whatever was retired two epochs ago is unreachable.
+ * */
+
+// Threads that can be registered at once, slots are reused once a thread exits
+#define EPOCH_MAX_THREADS 128
+// Retiring more than this since the last collection tries to collect right away
+#define EPOCH_COLLECT_THRESHOLD 256
+
+typedef void (*EpochFree)(void *pointer);
+
+struct EpochStats
+{
+    uint64_t epoch;
+    uint64_t retired, freed;
+    // waiting for readers
+    uint64_t pending;
+    // collections that couldn't advance because a thread was still pinned behind
+    uint64_t stalls;
+};
+
+/*
+ * Pins nest, only the outermost pair publishes anything. Any thread, it
+ * registers itself on first use.
+ * */
+void epoch_pin(void);
+void epoch_unpin(void);
+bool epoch_pinned(void);
+
+/*
+ * pointer must already be unreachable for threads that pin from now on.
+ * free runs on whichever thread collects, without the caller's context.
+ * */
+void epoch_retire(void *pointer, EpochFree free_func);
+
+/*
+ * Advances the epoch if every pinned thread caught up and frees what no
+ * thread can see anymore. Cheap, the render thread calls it every frame.
+ * Returns the number of frees.
+ * */
+size_t epoch_collect(void);
+
+/*
+ * Waits until everything retired so far is freed. Must not be called while
+ * pinned, and only returns once the other threads unpin.
+ * */
+void epoch_barrier(void);
+
+void epoch_get_stats(struct EpochStats *out);
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Headless benchmark, the camera flies a scripted path through generated
+ * terrain for a fixed number of frames and the time of every phase goes
+ * to a JSON file.
+ *
+ * Runs on GLFW's null platform. The frames are drawn through OSMesa when
+ * GLFW can load it, otherwise through the null GL device, which still
+ * runs culling and command building but rasterizes nothing. The path
+ * advances a fixed step per frame, so every run asks for the same chunks
+ * in the same order whatever the machine. Frames are paced to
+ * FLYTHROUGH_FRAME_DELTA like with vsync, the workers run against the
+ * same clock as in the engine. The sleep is reported as a phase of its
+ * own, frame times and their percentiles are the work alone.
+ * */
+#define FLYTHROUGH_DEFAULT_FRAMES 600
+#define FLYTHROUGH_FRAME_DELTA (1.0f/60.0f)
+// world units per second, about two chunks
+#define FLYTHROUGH_SPEED 6.0f
+#define FLYTHROUGH_DEFAULT_FILE "bench.json"
+
+/*
+ * Returns 0 if the run completed and the results were written.
+ * */
+int flythrough_run(int frames, const char *path);
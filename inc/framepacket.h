@@ -0,0 +1,105 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <render.h>
+#include <stream.h>
+#include <framestats.h>
+
+/*
+ * What the simulation hands the renderer for a frame, and the triple
+ * buffer passing it along.
+ *
+ * The simulation fills the packet it owns and publishes it, which hands
+ * back the one published before for refilling. The renderer swaps in the
+ * newest packet whenever there is one and draws the one it has otherwise.
+ * Only an index changes hands, neither side ever waits on the other: a
+ * slow simulation step draws the last packet again, a slow frame drops
+ * packets nobody drew.
+ *
+ * A packet is immutable once published, everything in it is a copy. The
+ * textures of its draws stay alive until the renderer reports its frame
+ * drawn, see gpu_reclaim_frame_drawn.
+ * */
+
+#define FRAME_PACKET_SLOTS 3
+
+struct FramePacket
+{
+    // simulation frame from 1 on, retirements are tagged with it
+    uint64_t frame;
+    // when the input this frame moved by was sampled
+    uint64_t input_ns;
+    // the simulated camera, matrices included
+    struct Camera camera;
+    // front to back, the list stays allocated across refills
+    struct ChunkDraw *draws;
+    size_t draw_count, draw_capacity;
+};
+
+struct FrameExchangeStats
+{
+    // counted by the simulation
+    uint64_t published;
+    // replaced before the renderer took them
+    uint64_t dropped;
+    // counted by the renderer, frames that drew a packet drawn before
+    uint64_t presented, repeated;
+};
+
+typedef struct FrameExchange
+{
+    struct FramePacket packets[FRAME_PACKET_SLOTS];
+    // slots of the simulation and the renderer, only their owner touches them
+    int write, read;
+    // the slot in between, flagged fresh until the renderer took it
+    int ready;
+    // the renderer's packet was presented at least once
+    bool presented;
+    struct FrameExchangeStats stats;
+    // input sample to the end of the swap, in milliseconds, renderer only
+    struct FrameStats latency;
+} FrameExchange;
+
+int frame_exchange_init(struct FrameExchange *exchange);
+
+/*
+ * Simulation. The packet to fill next, holding whatever it held when it
+ * was last published.
+ * */
+struct FramePacket *frame_exchange_write(struct FrameExchange *exchange);
+
+/*
+ * Room for count draws, what is in the list is kept. Returns -1 if it
+ * couldn't grow.
+ * */
+int frame_packet_reserve(struct FramePacket *packet, size_t count);
+
+/*
+ * Simulation. The packet from frame_exchange_write can't be touched
+ * afterwards.
+ * */
+void frame_exchange_publish(struct FrameExchange *exchange);
+
+/*
+ * Renderer. The newest packet published, NULL before the first one. Valid
+ * until the next call.
+ * */
+struct FramePacket *frame_exchange_acquire(struct FrameExchange *exchange);
+
+/*
+ * Renderer, right after the swap that showed packet.
+ * */
+void frame_exchange_presented(struct FrameExchange *exchange, const struct FramePacket *packet);
+
+void frame_exchange_get_stats(struct FrameExchange *exchange, struct FrameExchangeStats *out);
+
+/*
+ * Renderer, the latency percentiles go with it.
+ * */
+void frame_exchange_print_stats(struct FrameExchange *exchange);
+
+/*
+ * Once neither side uses it anymore.
+ * */
+void frame_exchange_free(struct FrameExchange *exchange);
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frames the percentiles are taken over
+#define FRAME_STATS_WINDOW 1024
+// Frames slower than this count as hitches, 30 fps
+#define FRAME_STATS_DEFAULT_HITCH_MS 33.3
+// Seconds between summary lines, 0 turns them off
+#define FRAME_STATS_DEFAULT_SUMMARY_SECONDS 10.0
+
+struct FrameStatsSummary
+{
+    // over the window
+    size_t frames;
+    double min_ms, avg_ms, p50_ms, p95_ms, p99_ms, max_ms;
+    size_t hitches;
+
+    // since start
+    uint64_t total_frames, total_hitches;
+};
+
+/*
+ * Frame times of the last FRAME_STATS_WINDOW frames. Pushing is a store
+ * and a compare, the percentiles are only sorted out when asked for.
+ * */
+typedef struct FrameStats
+{
+    double times_ms[FRAME_STATS_WINDOW];
+    size_t count, next;
+
+    double hitch_ms;
+    uint64_t total_frames, total_hitches;
+
+    double summary_seconds;
+    double since_summary;
+
+    // sorting space for the percentiles
+    double sorted[FRAME_STATS_WINDOW];
+} FrameStats;
+
+void frame_stats_init(struct FrameStats *stats);
+
+/*
+ * Returns true once every summary_seconds, print a summary then.
+ * */
+bool frame_stats_push(struct FrameStats *stats, double frame_ms);
+
+void frame_stats_compute(struct FrameStats *stats, struct FrameStatsSummary *out);
+void frame_stats_print(struct FrameStats *stats);
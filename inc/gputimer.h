@@ -0,0 +1,83 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * GPU time of named passes, from GL_TIMESTAMP queries.
+ *
+ * Every frame writes its queries into one of GPU_TIMER_FRAMES sets and
+ * reads back the sets whose results arrived, so nothing waits on the GPU.
+ * A set that still isn't ready when its turn comes again makes the frame
+ * go unmeasured instead. Resolved passes also go to the profiler, on the
+ * GPU track of the CPU timeline.
+ *
+ * Without GL 3.3 every call is a no-op.
+ * */
+#define GPU_TIMER_FRAMES 3
+// per frame, the frame itself counts as one
+#define GPU_TIMER_MAX_PASSES 32
+#define GPU_TIMER_MAX_DEPTH 8
+// Frames between GPU to CPU clock resyncs
+#define GPU_TIMER_SYNC_FRAMES 240
+
+struct GpuTimerSet
+{
+    unsigned int queries[GPU_TIMER_MAX_PASSES*2];
+    const char *names[GPU_TIMER_MAX_PASSES];
+    uint8_t depths[GPU_TIMER_MAX_PASSES];
+    int pass_count;
+    // queries written and not read back yet
+    bool pending;
+};
+
+struct GpuTimerPass
+{
+    const char *name;
+    int depth;
+    double ms;
+};
+
+struct GpuTimerStats
+{
+    // of the last resolved frame, the frame is passes[0]
+    struct GpuTimerPass passes[GPU_TIMER_MAX_PASSES];
+    int pass_count;
+    double frame_ms;
+
+    uint64_t frames, skipped;
+    double total_ms, max_ms;
+};
+
+typedef struct GpuTimer
+{
+    bool available;
+    struct GpuTimerSet sets[GPU_TIMER_FRAMES];
+    // set of the frame being recorded, -1 if it goes unmeasured
+    int current;
+    int next;
+    int stack[GPU_TIMER_MAX_DEPTH];
+    int depth;
+
+    // CLOCK_MONOTONIC minus GPU time, in ns
+    int64_t clock_offset;
+    int frames_since_sync;
+
+    struct GpuTimerStats stats;
+} GpuTimer;
+
+/*
+ * With the context current. Returns -1 and stays a no-op without queries.
+ * */
+int gpu_timer_init(struct GpuTimer *timer);
+
+/*
+ * Bracket every frame, passes nest inside. name must outlive the readback.
+ * */
+void gpu_timer_begin_frame(struct GpuTimer *timer);
+void gpu_timer_end_frame(struct GpuTimer *timer);
+void gpu_timer_begin(struct GpuTimer *timer, const char *name);
+void gpu_timer_end(struct GpuTimer *timer);
+
+void gpu_timer_get_stats(struct GpuTimer *timer, struct GpuTimerStats *out);
+void gpu_timer_print(struct GpuTimer *timer);
+void gpu_timer_free(struct GpuTimer *timer);
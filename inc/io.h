@@ -1,7 +1,55 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 
 /*
  * Linux implementation to read a file
  * relies of POSIX standards to read file size
+ * The buffer is NUL terminated, free it when done.
  * */
 int read_file(const char * path, char** out);
+
+enum MapAdvice
+{
+    MAP_ADVICE_NORMAL,
+    // read front to back once, pages behind the reader can be dropped
+    MAP_ADVICE_SEQUENTIAL,
+    // jumping around, don't read ahead
+    MAP_ADVICE_RANDOM,
+    // start paging it in now
+    MAP_ADVICE_WILLNEED
+};
+
+/*
+ * Read only view of a whole file. Pages are loaded on first touch so
+ * large files cost nothing until read. The data is NOT NUL terminated,
+ * always go by size. Falls back to read_file where mmap isn't available.
+ * */
+struct MappedFile
+{
+    const char *data;
+    size_t size;
+    // false when data is a heap copy from the fallback
+    bool mapped;
+};
+
+int map_file(const char *path, enum MapAdvice advice, struct MappedFile *out);
+
+/*
+ * Hints how a range of the file is about to be used, offset is rounded
+ * down to a page.
+ * */
+void map_file_advise(struct MappedFile *file, size_t offset, size_t length, enum MapAdvice advice);
+
+void unmap_file(struct MappedFile *file);
+
+#ifndef _WIN32
+/*
+ * pread and pwrite may stop short or be interrupted, these retry until
+ * all of size is done. -1 on an error or end of file.
+ * */
+int pread_full(int fd, void *buffer, size_t size, off_t offset);
+int pwrite_full(int fd, const void *buffer, size_t size, off_t offset);
+#endif
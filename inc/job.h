@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef void (*JobFunc)(void *user);
+
+struct Job
+{
+    JobFunc run;
+    void *user;
+    struct Job *next;
+};
+
+/*
+ * Fixed set of worker threads pulling jobs from a shared FIFO.
+ * Jobs must not touch GL, none of the workers has a context.
+ * */
+typedef struct JobPool
+{
+    pthread_t *threads;
+    int thread_count;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    struct Job *head, *tail;
+    // queued plus currently running
+    size_t outstanding;
+} JobPool;
+
+/*
+ * thread_count 0 picks one worker per core, leaving one for the render thread.
+ * */
+int job_pool_init(struct JobPool *pool, int thread_count);
+int job_pool_submit(struct JobPool *pool, JobFunc run, void *user);
+
+/*
+ * Blocks until every submitted job, including jobs submitted by jobs, has finished.
+ * */
+void job_pool_wait(struct JobPool *pool);
+void job_pool_shutdown(struct JobPool *pool);
+
+int job_pool_default_threads(void);
@@ -0,0 +1,155 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <voxel.h>
+#include <world.h>
+#include <region.h>
+
+/*
+ * Append only journal of voxel edits, kept next to the region files.
+ *
+ * Layout, little endian, a sequence of frames:
+ *   JournalFrame, 24 bytes
+ *   VoxelEdit[count], 16 bytes each
+ *
+ * A frame is one group commit. Its CRC covers the header and the edits, so
+ * a torn or partly written frame ends the journal on replay and everything
+ * after it is dropped. Checkpoints fold the edits into the region files and
+ * start the journal over.
+ * */
+#define JOURNAL_FILE "edits.journal"
+#define JOURNAL_MAGIC 0x4c4e524au
+
+// Pending edits are committed at least this often
+#define JOURNAL_COMMIT_MS 20
+// or as soon as this many are waiting
+#define JOURNAL_COMMIT_EDITS 4096
+// Checkpoint once the file grew this large, 0 turns automatic checkpoints off
+#define JOURNAL_CHECKPOINT_BYTES (4*1024*1024)
+
+struct VoxelEdit
+{
+    struct ChunkCoord chunk;
+    // CHUNK_INDEX within the chunk
+    uint16_t index;
+    uint8_t old_type, new_type;
+};
+
+struct JournalFrame
+{
+    uint32_t magic;
+    uint32_t count;
+    uint64_t sequence;
+    // of the header with crc 0, then the edits
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+/*
+ * Produces a chunk that was never saved, edits to it are applied on top.
+ * */
+typedef void (*JournalGenerate)(struct Chunk *chunk, struct ChunkCoord coord, void *user);
+
+struct JournalStats
+{
+    uint64_t edits, commits, checkpoints;
+    // replayed from the previous session
+    uint64_t recovered;
+    uint64_t bytes_written;
+    // edits left in the journal by a checkpoint, their chunks weren't saved yet
+    uint64_t carried;
+};
+
+typedef struct Journal
+{
+    struct RegionStore *store;
+    JournalGenerate generate;
+    void *generate_user;
+    char *path;
+    int fd;
+
+    pthread_t thread;
+    bool running;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t committed;
+    // appended and not written yet, swapped with the commit buffer
+    struct VoxelEdit *pending;
+    size_t pending_count, pending_capacity;
+    // frame the pending edits go out in, and the last one on disk
+    uint64_t next_sequence, durable_sequence;
+    bool flush_requested;
+    // see journal_truncate, 0 when nothing was asked for
+    uint64_t truncate_sequence;
+
+    // held while the file is written, checkpointed or replayed
+    pthread_mutex_t file_lock;
+    struct VoxelEdit *writing;
+    size_t writing_capacity;
+    uint64_t size;
+    // automatic checkpoints, the next one happens once size reaches checkpoint_at
+    size_t checkpoint_bytes;
+    uint64_t checkpoint_at;
+
+    struct JournalStats stats;
+} Journal;
+
+/*
+ * Opens the journal in the directory of store and replays what the
+ * previous session left into the region files, generating chunks that
+ * were never saved. Starts the commit thread afterwards.
+ * */
+int journal_open(struct Journal *journal, struct RegionStore *store, JournalGenerate generate, void *user);
+
+/*
+ * Never blocks on the disk. Returns the sequence of the frame the edits
+ * go out in, journal_wait on it to know they are durable.
+ * */
+uint64_t journal_append(struct Journal *journal, const struct VoxelEdit *edits, size_t count);
+void journal_wait(struct Journal *journal, uint64_t sequence);
+
+/*
+ * Commits everything appended so far and waits for it.
+ * */
+void journal_flush(struct Journal *journal);
+
+/*
+ * Folds every committed edit into the region files and empties the journal.
+ * Generates missing chunks, so it runs on the thread that owns generate.
+ * The commit thread checkpoints on its own as the file grows, keeping
+ * edits to chunks that were never saved for the next full checkpoint.
+ * */
+int journal_checkpoint(struct Journal *journal);
+
+/*
+ * For callers saving the edited chunks themselves. Once the chunks with
+ * edits up to sequence are saved, this drops those frames on the commit
+ * thread, after syncing the region files. Frames still taking appends are
+ * kept, returns the sequence it actually drops up to. Turn automatic
+ * checkpoints off then, they would race the saves.
+ * */
+uint64_t journal_truncate(struct Journal *journal, uint64_t sequence);
+void journal_set_checkpoint_bytes(struct Journal *journal, size_t bytes);
+
+void journal_get_stats(struct Journal *journal, struct JournalStats *out);
+
+/*
+ * Commits and checkpoints everything, then stops the commit thread.
+ * */
+void journal_close(struct Journal *journal);
+
+/*
+ * Kills a process while it is committing edits and checks that replay
+ * recovers every acknowledged edit, then that torn and corrupted frames
+ * are dropped. Files are created in directory and removed again.
+ * Returns the number of failures.
+ * */
+int journal_verify(const char *directory);
+
+/*
+ * Edits per second through group commit with several writers.
+ * */
+void journal_benchmark(const char *directory, int writers, int edits_per_writer);
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdbool.h>
+#include <pthread.h>
+#include <GLFW/glfw3.h>
+
+// Completed jobs whose fence has not signaled yet are retried next poll.
+// When running without a loader thread this many jobs are executed per poll.
+#define LOADER_MAIN_THREAD_JOBS_PER_POLL 2
+
+/*
+ * GL work that can be moved off the render thread.
+ *
+ * work runs with a GL context current: the hidden shared context on the
+ * loader thread, or the main context when we fell back to the main thread.
+ * Only shareable objects (buffers, textures, shaders, programs) may be created
+ * in work, vertex arrays are per context and have to be built in done.
+ *
+ * done runs once the GPU finished the work, on the thread calling
+ * loader_finish. That is the render thread unless the world is simulated on
+ * a thread of its own, see loader_collect.
+ * */
+typedef void (*LoaderWork)(void *user);
+typedef void (*LoaderDone)(void *user);
+
+struct LoaderJob
+{
+    LoaderWork work;
+    LoaderDone done;
+    void *user;
+    void *fence;
+    struct LoaderJob *next;
+};
+
+typedef struct Loader
+{
+    // false when no shared context could be created (headless, null platform)
+    bool threaded;
+    bool running;
+    GLFWwindow *context;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    // jobs waiting for the loader, FIFO
+    struct LoaderJob *pending_head, *pending_tail;
+    // jobs executed by the loader, waiting on their fence
+    struct LoaderJob *completed_head, *completed_tail;
+    // jobs the GPU finished, waiting for loader_finish to run done
+    struct LoaderJob *finished_head, *finished_tail;
+} Loader;
+
+/*
+ * Creates a hidden window sharing objects with main_window and starts the
+ * loader thread on it. Must be called from the main thread with main_window's
+ * context current. Falls back to a main thread queue if want_thread is false
+ * or the shared context or its thread can't be created, the loader works
+ * either way.
+ * */
+int loader_init(struct Loader *loader, GLFWwindow *main_window, bool want_thread);
+void loader_submit(struct Loader *loader, LoaderWork work, LoaderDone done, void *user);
+
+/*
+ * Called once per frame on the render thread. Hands finished objects back
+ * through their done callbacks without ever blocking on the GPU.
+ * Same as loader_collect followed by loader_finish.
+ * */
+void loader_poll(struct Loader *loader);
+
+/*
+ * loader_poll in two halves, for when the callbacks belong to another
+ * thread than the context. loader_collect needs the main context, it checks
+ * the fences and runs the work of the main thread queue. loader_finish runs
+ * the done callbacks of what was collected, on any one thread.
+ * */
+void loader_collect(struct Loader *loader);
+void loader_finish(struct Loader *loader);
+
+/*
+ * Stops the loader thread, finishes outstanding jobs on the render thread
+ * and destroys the shared context. Must be called before glfwTerminate,
+ * and after the thread calling loader_finish stopped.
+ * */
+void loader_shutdown(struct Loader *loader);
@@ -0,0 +1,134 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous logging. A log call formats the message into a record on
+ * the calling thread's ring and returns, a background thread writes the
+ * records out in timestamp order. Logging never blocks on the terminal,
+ * a pipe or another thread. When a ring is full the record is dropped
+ * and counted instead.
+ *
+ * Calls below LOG_MIN_LEVEL compile to nothing, their arguments are
+ * never evaluated.
+ *
+ *   LOG_INFO(LOG_IO, "Read %s", path);
+ *
+ * Messages go without a trailing newline, the writer adds the category.
+ * Nothing has to be initialized, the writer starts with the first record
+ * and flushes what is left at exit.
+ * */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_COUNT 5
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Records kept per thread, must be a power of two
+#define LOG_RING_RECORDS 512
+// Longer messages are cut
+#define LOG_MESSAGE_BYTES 176
+// How often the writer wakes up to drain the rings
+#define LOG_FLUSH_MS 5
+
+// One per subsystem, the name is the [tag] in front of every line
+enum LogCategory
+{
+    LOG_CORE,
+    LOG_RENDER,
+    LOG_IO,
+    LOG_LOADER,
+    LOG_SCHEDULER,
+    LOG_JOB,
+    LOG_STREAM,
+    LOG_WORLDGEN,
+    LOG_TERRAIN,
+    LOG_COLUMNS,
+    LOG_REGION,
+    LOG_CODEC,
+    LOG_CHUNKIO,
+    LOG_JOURNAL,
+    LOG_EPOCH,
+    LOG_SNAPSHOT,
+    LOG_RECLAIM,
+    LOG_PROFILE,
+    LOG_GPUTIMER,
+    LOG_FRAME,
+    LOG_MEMORY,
+    LOG_BENCH,
+    LOG_CATEGORY_COUNT
+};
+
+struct LogRecord
+{
+    uint64_t time_ns;
+    uint8_t level, category;
+    uint16_t length;
+    char message[LOG_MESSAGE_BYTES];
+};
+
+struct LogStats
+{
+    uint64_t written, dropped;
+    int rings;
+};
+
+void log_write(int level, enum LogCategory category, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/*
+ * Runtime filter on top of LOG_MIN_LEVEL, it can only raise it.
+ * */
+void log_set_level(int level);
+
+/*
+ * Writes everything recorded so far before returning, any thread.
+ * */
+void log_flush(void);
+
+/*
+ * Flushes and stops the writer, later records are written synchronously.
+ * Registered with atexit on the first record.
+ * */
+void log_shutdown(void);
+
+void log_get_stats(struct LogStats *out);
+
+/*
+ * Never defined, only looked at by sizeof. A compiled out call still
+ * checks its format and uses its arguments, without evaluating them.
+ * */
+int log_discard(enum LogCategory category, const char *format, ...) __attribute__((format(printf, 2, 3)));
+#define LOG_DISCARD(category, ...) ((void) sizeof(log_discard((category), __VA_ARGS__)))
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(category, ...) log_write(LOG_LEVEL_TRACE, (category), __VA_ARGS__)
+#else
+#define LOG_TRACE(category, ...) LOG_DISCARD(category, __VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, ...) log_write(LOG_LEVEL_DEBUG, (category), __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...) LOG_DISCARD(category, __VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(category, ...) log_write(LOG_LEVEL_INFO, (category), __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...) LOG_DISCARD(category, __VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(category, ...) log_write(LOG_LEVEL_WARN, (category), __VA_ARGS__)
+#else
+#define LOG_WARN(category, ...) LOG_DISCARD(category, __VA_ARGS__)
+#endif
+
+#define LOG_ERROR(category, ...) log_write(LOG_LEVEL_ERROR, (category), __VA_ARGS__)
@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Tagged allocations, for knowing what a loaded world costs and where.
+ *
+ * Every tag counts its live bytes, their peak and its allocations. A
+ * header in front of each block remembers its size and tag, so mem_free
+ * only needs the pointer. Blocks from mem_alloc must go back through
+ * mem_free and nothing else.
+ *
+ * GL objects aren't allocated here, the GL tags are estimates accounted
+ * by whoever creates and deletes them, see mem_account.
+ * */
+
+enum MemoryTag
+{
+    // voxel types of struct Chunk, and whatever else shares their block
+    MEM_CHUNK_VOXELS,
+    // occupancy bitmasks, they live in the same struct Chunk as the voxels
+    MEM_BITMASKS,
+    // vertex data on its way into a buffer
+    MEM_MESH_STAGING,
+    // texels on their way into a texture
+    MEM_TEXTURE_STAGING,
+    // region payloads, read spans and journal frames
+    MEM_IO_BUFFERS,
+    // buffers and spills of the per-thread frame arenas
+    MEM_FRAME_ARENAS,
+    MEM_GL_BUFFERS,
+    MEM_GL_TEXTURES,
+    MEM_TAG_COUNT
+};
+
+// Tags before this one are heap memory, the rest live on the GPU
+#define MEM_FIRST_GL_TAG MEM_GL_BUFFERS
+
+struct MemoryTagStats
+{
+    int64_t live_bytes, peak_bytes;
+    // since start, and the ones not freed yet
+    uint64_t allocations, live_allocations;
+};
+
+struct MemoryStats
+{
+    struct MemoryTagStats tags[MEM_TAG_COUNT];
+    // summed over the heap tags and the GL tags
+    int64_t heap_bytes, gl_bytes;
+};
+
+/*
+ * Any thread. NULL if the allocation failed, nothing is counted then.
+ * */
+void *mem_alloc(enum MemoryTag tag, size_t size);
+void *mem_calloc(enum MemoryTag tag, size_t count, size_t size);
+
+/*
+ * A block of size bytes holding count whole struct Chunk. Their bitmasks
+ * are counted under MEM_BITMASKS, the rest under MEM_CHUNK_VOXELS.
+ * */
+void *mem_alloc_chunks(size_t size, size_t count);
+
+/*
+ * Any block from the functions above, NULL is ignored.
+ * */
+void mem_free(void *pointer);
+
+/*
+ * For memory allocated elsewhere, the GL tags mainly. Positive bytes
+ * count one allocation, negative ones take it back. 0 is ignored.
+ * */
+void mem_account(enum MemoryTag tag, int64_t bytes);
+
+const char *mem_tag_name(enum MemoryTag tag);
+void mem_get_stats(struct MemoryStats *out);
+void mem_print_stats(void);
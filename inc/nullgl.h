@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * A GL device that accepts every command and draws nothing, for running
+ * the renderer where no context can be created. Object names are handed
+ * out and status queries succeed, so the engine runs its usual paths and
+ * the command stream can be counted.
+ *
+ * Reports GL 3.2, features that need more turn themselves off. Calls from
+ * the render thread only.
+ * */
+struct NullGlStats
+{
+    uint64_t draws, vertices;
+    uint64_t textures, texture_bytes;
+    uint64_t buffers, buffer_bytes;
+    uint64_t program_binds, uniform_sets;
+};
+
+/*
+ * Points every glad entry point at the null device instead of a context.
+ * */
+int null_gl_load(void);
+void null_gl_get_stats(struct NullGlStats *out);
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include <world.h>
+
+// How far ahead the camera path is extrapolated, in seconds
+#define PREFETCH_DEFAULT_HORIZON 3.0f
+#define PREFETCH_SAMPLES 12
+// Chunks around each predicted position that get boosted
+#define PREFETCH_RADIUS 1
+// Priority multiplier for chunks on the path right now, fades out to 1 at the horizon
+#define PREFETCH_BOOST 0.35f
+// Exponential smoothing of the measured velocity, per second
+#define PREFETCH_SMOOTHING 8.0f
+// Below this speed (world units per second) nothing is predicted
+#define PREFETCH_MIN_SPEED 0.05f
+
+/*
+ * Predicts where the camera is going from its recent motion
+ * so streaming can start on chunks before they are needed.
+ * */
+typedef struct Prefetch
+{
+    float horizon;
+    bool has_position;
+    vec3 last_position;
+    vec3 velocity;
+
+    // predicted chunk along the path and the time it is reached at
+    struct ChunkCoord path[PREFETCH_SAMPLES];
+    float path_time[PREFETCH_SAMPLES];
+    int path_count;
+
+    // chunks entering the frustum for the first time since they were
+    // requested, and the ones not ready when they did. Requested while
+    // already in view counts as a miss.
+    uint64_t frustum_entries;
+    uint64_t misses;
+} Prefetch;
+
+void prefetch_init(struct Prefetch *prefetch);
+
+/*
+ * Samples the camera motion of the last frame and rebuilds the predicted path.
+ * */
+void prefetch_update(struct Prefetch *prefetch, vec3 position, float frame_delta);
+
+/*
+ * Priority multiplier for a chunk, 1 when it is off the predicted path.
+ * */
+float prefetch_weight(struct Prefetch *prefetch, struct ChunkCoord coord);
+
+void prefetch_record_entry(struct Prefetch *prefetch, bool ready);
+float prefetch_miss_rate(struct Prefetch *prefetch);
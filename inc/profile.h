@@ -0,0 +1,123 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Zones, counters and frame markers recorded into per-thread rings and
+ * dumped in the Chrome trace event format, open the file in
+ * chrome://tracing or ui.perfetto.dev.
+ *
+ * Built without PROFILE_ENABLED every macro expands to nothing, zones can
+ * stay in the hot paths. Names must be string literals or otherwise live
+ * until the dump, only the pointer is recorded.
+ *
+ *   PROFILE_ZONE("stream_update");    until the end of the enclosing block
+ *   PROFILE_COUNTER("in flight", n);
+ *   PROFILE_FRAME();                  once per frame on the render thread
+ * */
+
+// Events kept per thread, the oldest are overwritten. Must be a power of two.
+#define PROFILE_RING_EVENTS (1 << 15)
+#define PROFILE_TRACE_FILE "trace.json"
+
+enum ProfileEventType
+{
+    PROFILE_EVENT_ZONE,
+    PROFILE_EVENT_COUNTER,
+    PROFILE_EVENT_FRAME
+};
+
+// Times are in profile_now ticks, converted to microseconds by the dump
+struct ProfileEvent
+{
+    const char *name;
+    // start of a zone, or when the counter or marker was recorded
+    uint64_t timestamp;
+    // duration of a zone, the value of a counter
+    int64_t value;
+    uint32_t type;
+};
+
+struct ProfileScope
+{
+    const char *name;
+    uint64_t start;
+};
+
+#ifdef PROFILE_ENABLED
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_ZONE(name) \
+    struct ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__) \
+        __attribute__((cleanup(profile_scope_end))) = profile_scope_begin(name)
+// For spans that don't match a block
+#define PROFILE_ZONE_BEGIN(scope, name) struct ProfileScope scope = profile_scope_begin(name)
+#define PROFILE_ZONE_END(scope) profile_scope_end(&(scope))
+#define PROFILE_COUNTER(name, value) profile_record(PROFILE_EVENT_COUNTER, (name), profile_now(), (int64_t) (value))
+#define PROFILE_FRAME() profile_record(PROFILE_EVENT_FRAME, "frame", profile_now(), 0)
+#define PROFILE_THREAD(name) profile_thread_name(name)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+// Half the cost of clock_gettime, assumes an invariant TSC
+static inline uint64_t profile_now(void)
+{
+    return __rdtsc();
+}
+#else
+#include <timer.h>
+static inline uint64_t profile_now(void)
+{
+    return timer_now_ns();
+}
+#endif
+
+void profile_record(enum ProfileEventType type, const char *name, uint64_t timestamp, int64_t value);
+void profile_thread_name(const char *name);
+
+static inline struct ProfileScope profile_scope_begin(const char *name)
+{
+    return (struct ProfileScope){ name, profile_now() };
+}
+
+static inline void profile_scope_end(struct ProfileScope *scope)
+{
+    profile_record(PROFILE_EVENT_ZONE, scope->name, scope->start, (int64_t) (profile_now() - scope->start));
+}
+
+#else
+
+#define PROFILE_ZONE(name) ((void) 0)
+#define PROFILE_ZONE_BEGIN(scope, name) ((void) 0)
+#define PROFILE_ZONE_END(scope) ((void) 0)
+#define PROFILE_COUNTER(name, value) ((void) 0)
+#define PROFILE_FRAME() ((void) 0)
+#define PROFILE_THREAD(name) ((void) 0)
+
+#endif
+
+/*
+ * A zone timed somewhere else, the GPU, on a track of its own. Times are
+ * CLOCK_MONOTONIC nanoseconds, as in timer_now_ns. Render thread only.
+ * */
+void profile_gpu_zone(const char *name, uint64_t start_ns, uint64_t duration_ns);
+
+/*
+ * Writes what every thread still has in its ring, threads may keep
+ * recording meanwhile. Returns -1 if profiling was compiled out or the
+ * file couldn't be written.
+ * */
+int profile_dump(const char *path);
+
+/*
+ * Frees every ring, only once no thread records anymore.
+ * */
+void profile_shutdown(void);
+
+/*
+ * Cost of an empty zone, and a dump of nested zones on several threads.
+ * */
+int profile_benchmark(const char *path);
@@ -0,0 +1,82 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * GL objects that are no longer drawn, deleted once the GPU finished
+ * every command issued before they were retired.
+ *
+ * Retired names are collected into a batch until the next fence. A batch is
+ * only deleted after its fence signaled, so draws still in flight never see
+ * their texture or buffer vanish and the driver never has to stall on them.
+ *
+ * The thread retiring may run ahead of the one drawing, the simulation
+ * builds frames the render thread hasn't drawn yet. Batches remember the
+ * frame they were retired in and aren't fenced before that frame was drawn,
+ * older frames still in the queue may still use their names.
+ * */
+
+struct GpuReclaimBatch
+{
+    // frame the names were retired in, see gpu_reclaim_set_frame
+    uint64_t frame;
+    // NULL while the batch still takes retirements
+    void *fence;
+    unsigned int *textures, *buffers;
+    size_t texture_count, texture_capacity;
+    size_t buffer_count, buffer_capacity;
+    struct GpuReclaimBatch *next;
+};
+
+struct GpuReclaimStats
+{
+    // waiting on a fence
+    size_t pending_textures, pending_buffers, pending_batches;
+    uint64_t deleted_textures, deleted_buffers;
+};
+
+typedef struct GpuReclaim
+{
+    pthread_mutex_t lock;
+    // oldest first, the tail is the open batch
+    struct GpuReclaimBatch *head, *tail;
+    // what retirements are tagged with
+    uint64_t frame;
+    struct GpuReclaimStats stats;
+} GpuReclaim;
+
+void gpu_reclaim_init(struct GpuReclaim *reclaim);
+
+/*
+ * Any thread, no GL calls. Zero names are ignored.
+ * */
+void gpu_reclaim_texture(struct GpuReclaim *reclaim, unsigned int texture);
+void gpu_reclaim_buffer(struct GpuReclaim *reclaim, unsigned int buffer);
+
+/*
+ * The retiring thread, before the work of frame. Names retired from here
+ * on wait until frame was drawn. Frames must not go backwards.
+ * */
+void gpu_reclaim_set_frame(struct GpuReclaim *reclaim, uint64_t frame);
+
+/*
+ * Render thread, once per frame after the last draw. Fences what was
+ * retired up to and including frame and deletes the batches whose fences
+ * signaled, never waits.
+ * */
+void gpu_reclaim_frame_drawn(struct GpuReclaim *reclaim, uint64_t frame);
+
+/*
+ * gpu_reclaim_frame_drawn for everything retired so far, for loops that
+ * retire and draw on the same thread.
+ * */
+void gpu_reclaim_frame(struct GpuReclaim *reclaim);
+
+void gpu_reclaim_get_stats(struct GpuReclaim *reclaim, struct GpuReclaimStats *out);
+
+/*
+ * Waits for every fence and deletes everything. Render thread, once
+ * nothing retires anymore, before glfwTerminate.
+ * */
+void gpu_reclaim_shutdown(struct GpuReclaim *reclaim);
@@ -0,0 +1,211 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <voxel.h>
+#include <world.h>
+#include <terrain.h>
+
+/*
+ * Region files store REGION_WIDTH**3 chunks each.
+ *
+ * Layout, little endian:
+ *   RegionHeader, 16 bytes
+ *   RegionEntry[REGION_CHUNKS], indexed REGION_INDEX(local x, y, z)
+ *   payloads, each starting on a sector boundary
+ *
+ * An entry points at its payload, so a chunk is one pread away without
+ * scanning. Rewritten chunks are appended and the old sectors become
+ * garbage until the file is compacted.
+ * */
+#define REGION_WIDTH 32
+#define REGION_CHUNKS (REGION_WIDTH*REGION_WIDTH*REGION_WIDTH)
+#define REGION_INDEX(x, y, z) ((x) + (y)*REGION_WIDTH + (z)*REGION_WIDTH*REGION_WIDTH)
+
+#define REGION_SECTOR_SIZE 4096
+#define REGION_MAGIC "VXRG"
+#define REGION_VERSION 1
+
+// Compacted on close once garbage outgrows live data by this factor
+#define REGION_COMPACT_RATIO 1.0f
+// and there is at least this much of it
+#define REGION_COMPACT_MIN_SECTORS 64
+
+// Region files kept open by a store
+#define REGION_STORE_MAX_OPEN 16
+
+enum RegionCompression
+{
+    REGION_COMPRESSION_NONE,
+    // palette, runs and LZ, see codec.h
+    REGION_COMPRESSION_CODEC,
+    REGION_COMPRESSION_COUNT
+};
+
+enum RegionResult
+{
+    REGION_OK = 0,
+    // never written
+    REGION_MISSING = 1,
+    REGION_ERROR = -1,
+    // checksum or decoding failed, the chunk should be regenerated
+    REGION_CORRUPT = -2
+};
+
+struct RegionHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t reserved;
+};
+
+struct RegionEntry
+{
+    // first payload sector, 0 when the chunk isn't stored
+    uint32_t sector;
+    // payload bytes
+    uint32_t length;
+    // of the payload as stored
+    uint32_t crc;
+    uint8_t compression;
+    uint8_t reserved[3];
+};
+
+#define REGION_SECTORS(bytes) (((bytes) + REGION_SECTOR_SIZE-1) / REGION_SECTOR_SIZE)
+// Payloads never grow past a raw chunk
+#define REGION_PAYLOAD_MAX sizeof(((struct Chunk *) 0)->voxel_type)
+#define REGION_DATA_SECTOR ((sizeof(struct RegionHeader) + REGION_CHUNKS*sizeof(struct RegionEntry) + REGION_SECTOR_SIZE-1) / REGION_SECTOR_SIZE)
+
+/*
+ * Compression is pluggable per chunk. encode returns the encoded size,
+ * 0 if the result wouldn't fit in capacity, decode returns 0 once exactly
+ * out_size bytes were produced.
+ * */
+typedef size_t (*RegionEncode)(const uint8_t *in, size_t size, uint8_t *out, size_t capacity);
+typedef int (*RegionDecode)(const uint8_t *in, size_t size, uint8_t *out, size_t out_size);
+
+void region_register_compression(enum RegionCompression compression, const char *name, RegionEncode encode, RegionDecode decode);
+const char *region_compression_name(enum RegionCompression compression);
+
+typedef struct Region
+{
+    struct ChunkCoord coord;
+    char *path;
+    int fd;
+
+    // held shared by chunk reads and writes, exclusively by compaction
+    pthread_rwlock_t file_lock;
+    pthread_mutex_t table_lock;
+    struct RegionEntry *table;
+    uint32_t next_sector;
+    uint32_t live_sectors, garbage_sectors;
+} Region;
+
+/*
+ * Opens the region file at path. Without create, a missing file
+ * returns 1 quietly.
+ * */
+int region_open(struct Region *region, const char *path, struct ChunkCoord coord, bool create);
+
+/*
+ * Compacts first if enough garbage piled up.
+ * */
+void region_close(struct Region *region);
+
+/*
+ * One pread, the payload is checked against its CRC before decoding.
+ * */
+enum RegionResult region_read_chunk(struct Region *region, struct ChunkCoord coord, struct Chunk *chunk);
+enum RegionResult region_write_chunk(struct Region *region, struct ChunkCoord coord, const struct Chunk *chunk, enum RegionCompression compression);
+
+/*
+ * The steps of the two calls above, for batching I/O across chunks.
+ *
+ * Payload reads and writes go between begin and end io, which keeps
+ * compaction from moving the file underneath. A write reserves sectors,
+ * writes the payload and only then commits the entry pointing at it.
+ * Commit with written false releases the reservation as garbage.
+ * */
+void region_begin_io(struct Region *region);
+void region_end_io(struct Region *region);
+struct RegionEntry region_lookup(struct Region *region, int index);
+uint32_t region_reserve(struct Region *region, uint32_t sectors);
+int region_pread(struct Region *region, void *buffer, size_t size, uint32_t sector);
+int region_pwrite(struct Region *region, const void *buffer, size_t size, uint32_t sector);
+enum RegionResult region_commit(struct Region *region, int index, const struct RegionEntry *entry, bool written);
+
+/*
+ * out holds at least REGION_PAYLOAD_MAX bytes. Fills in everything
+ * but the sector of the entry.
+ * */
+void region_encode(const struct Chunk *chunk, enum RegionCompression compression, uint8_t *out, struct RegionEntry *entry);
+enum RegionResult region_decode(const struct RegionEntry *entry, const uint8_t *payload, struct Chunk *chunk);
+
+/*
+ * Makes every committed chunk durable. The file itself only survives a
+ * crash once its directory was synced too.
+ * */
+int region_sync(struct Region *region);
+
+/*
+ * Rewrites the file with every live payload packed back to back.
+ * */
+int region_compact(struct Region *region);
+
+void region_from_chunk(struct ChunkCoord chunk, struct ChunkCoord *region, int *index);
+
+/*
+ * Open region files of a save directory, least recently used ones are closed.
+ * */
+typedef struct RegionStore
+{
+    char *directory;
+    enum RegionCompression compression;
+
+    pthread_mutex_t lock;
+    struct Region *open[REGION_STORE_MAX_OPEN];
+    // users of every open region, it can't be closed while they hold it
+    int users[REGION_STORE_MAX_OPEN];
+    uint64_t last_use[REGION_STORE_MAX_OPEN];
+    uint64_t clock;
+} RegionStore;
+
+int region_store_init(struct RegionStore *store, const char *directory);
+void region_store_close(struct RegionStore *store);
+
+/*
+ * Every acquire needs a release, the region stays open until then.
+ * Without create, regions that were never saved give NULL.
+ * */
+struct Region *region_store_acquire(struct RegionStore *store, struct ChunkCoord region_coord, bool create);
+void region_store_release(struct RegionStore *store, struct Region *region);
+
+/*
+ * Closes the region if it is open and removes its file.
+ * */
+void region_store_delete(struct RegionStore *store, struct ChunkCoord region_coord);
+
+/*
+ * Syncs every open region and the directory, regions closed earlier were
+ * synced on close.
+ * */
+int region_store_sync(struct RegionStore *store);
+
+enum RegionResult region_store_load(struct RegionStore *store, struct ChunkCoord coord, struct Chunk *chunk);
+enum RegionResult region_store_save(struct RegionStore *store, struct ChunkCoord coord, const struct Chunk *chunk);
+
+/*
+ * Round trips chunks through a store in directory, across regions, rewrites,
+ * compaction and reopening, then checks corrupted payloads are caught.
+ * Returns the number of failures. The region files are removed again, and
+ * directory as well if that leaves it empty.
+ * */
+int region_verify(const char *directory);
+
+/*
+ * Saves count generated chunks and times loading them back, cleaning up
+ * like region_verify.
+ * */
+void region_benchmark(const struct Terrain *terrain, const char *directory, int count);
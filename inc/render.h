@@ -1,6 +1,8 @@
 #pragma once
+#include <stdbool.h>
 #include <GLFW/glfw3.h>
 #include <cglm/struct.h>
+#include <loader.h>
 
 #define MAX_RENDER_DISTANCE 4000.0f
 
@@ -34,6 +36,8 @@ typedef struct Lattice
     unsigned int vbo, vao, shader, texture;
     size_t vbo_size;
     mat4 object_transform;
+    // set once the loader built the buffer and the shader
+    bool loaded;
 } Lattice;
 
 void camera_process(struct Camera *camera);
@@ -45,13 +49,31 @@ void set_shader_value_vec2(const char *loc, vec2 value, unsigned int shader_prog
 void set_shader_value_vec3(const char *loc, vec3 value, unsigned int shader_program);
 void set_shader_value_matrix4(const char *loc, mat4 value, unsigned int shader_program);
 
+/*
+ * What a texture takes on the GPU, from the size of its base level as the
+ * driver reports it. Binds and unbinds the texture on target.
+ * */
+size_t estimate_texture_bytes(unsigned int target, unsigned int texture);
+
 struct Mesh create_mesh(float *vbo_data, size_t vbo_size, const char* vertex_shader_path, const char* fragment_shader_path);
 
 void render_mesh(struct Mesh *i, struct Camera *camera);
 void render_mesh_2d(struct Mesh *i);
 void render_lattice(struct Lattice *i, struct Camera *camera);
 
-struct Lattice create_lattice(const char *vertex_path, const char *fragment_path, uint16_t size);
+/*
+ * Builds the buffer and the shader of the lattice through the loader, the
+ * lattice must stay where it is until then. Nothing is drawn with it
+ * before lattice_ready.
+ * */
+void load_lattice(struct Lattice *lattice, struct Loader *loader, const char *vertex_path, const char *fragment_path, uint16_t size);
+
+/*
+ * On the drawing thread. Whether the loader is done with the lattice,
+ * vertex arrays aren't shared so the first call that finds it done builds
+ * one for the current context.
+ * */
+bool lattice_ready(struct Lattice *lattice);
 void create_lattice_mesh_data(uint16_t scale, float voxel_scale, float **out, size_t *out_size);
 
 void window_resize_callback(GLFWwindow* window, int width, int height);
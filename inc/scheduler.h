@@ -0,0 +1,80 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <cglm/cglm.h>
+
+/*
+ * Classes of deferred main thread work. Each one gets its own budget so a
+ * burst of uploads can't starve unloads and the other way around.
+ * */
+enum WorkClass
+{
+    WORK_UPLOAD,
+    WORK_MESH,
+    WORK_TEXTURE,
+    WORK_UNLOAD,
+    WORK_CLASS_COUNT
+};
+
+// Default per frame budgets in microseconds
+#define SCHEDULER_DEFAULT_UPLOAD_US 2000
+#define SCHEDULER_DEFAULT_MESH_US 1500
+#define SCHEDULER_DEFAULT_TEXTURE_US 1000
+#define SCHEDULER_DEFAULT_UNLOAD_US 500
+// Range the budget keys move a budget in
+#define SCHEDULER_MIN_BUDGET_US 100
+#define SCHEDULER_MAX_BUDGET_US 32000
+
+typedef void (*ScheduledWork)(void *user);
+
+struct ScheduledTask
+{
+    ScheduledWork run;
+    void *user;
+    // world position the work belongs to, used for the distance priority
+    vec3 position;
+    float priority;
+    // submission order, breaks ties so equal priorities stay FIFO
+    uint64_t sequence;
+};
+
+struct WorkQueue
+{
+    // binary min heap on priority
+    struct ScheduledTask *tasks;
+    size_t count, capacity;
+    uint32_t budget_us;
+
+    // last frame
+    uint32_t executed;
+    uint64_t spent_us;
+};
+
+typedef struct FrameScheduler
+{
+    struct WorkQueue queues[WORK_CLASS_COUNT];
+    uint64_t sequence;
+    // camera position of the last frame, scores work submitted in between
+    vec3 camera_position;
+} FrameScheduler;
+
+void scheduler_init(struct FrameScheduler *scheduler);
+void scheduler_free(struct FrameScheduler *scheduler);
+
+/*
+ * Budgets can be changed at any time, they apply from the next frame.
+ * */
+void scheduler_set_budget(struct FrameScheduler *scheduler, enum WorkClass work_class, uint32_t budget_us);
+uint32_t scheduler_get_budget(struct FrameScheduler *scheduler, enum WorkClass work_class);
+
+int scheduler_submit(struct FrameScheduler *scheduler, enum WorkClass work_class, ScheduledWork run, void *user, vec3 position);
+size_t scheduler_pending(struct FrameScheduler *scheduler, enum WorkClass work_class);
+
+/*
+ * Runs queued work closest to the camera first until each class has spent
+ * its budget. At least one task per class runs every frame so nothing starves,
+ * whatever is left carries over to the next frame.
+ * */
+void scheduler_run_frame(struct FrameScheduler *scheduler, vec3 camera_position);
+
+const char *scheduler_class_name(enum WorkClass work_class);
@@ -0,0 +1,79 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <voxel.h>
+#include <epoch.h>
+
+/*
+ * Immutable version of a chunk. Published versions are never written
+ * again, whoever holds one has a stable view no matter what the owner
+ * does to the chunk meanwhile.
+ * */
+struct ChunkVersion
+{
+    // holders, the owner counts as one while the version is current
+    int references;
+    uint32_t generation;
+    struct Chunk chunk;
+};
+
+/*
+ * A chunk edited by one owner thread and read by any other.
+ *
+ * The owner edits a private draft. The first edit after a publish copies
+ * the current version into a new draft, later ones write to it directly.
+ * Publishing swaps the draft in, the version it replaced is retired
+ * through the epoch and freed once its last holder released it.
+ * */
+struct SharedChunk
+{
+    struct ChunkVersion *current;
+    // owner only, NULL without unpublished edits
+    struct ChunkVersion *draft;
+    uint32_t generation;
+};
+
+/*
+ * Starts with an empty draft and nothing published.
+ * */
+int shared_chunk_init(struct SharedChunk *shared);
+
+/*
+ * Owner only. The chunk to write to, copied on the first write after a
+ * publish. NULL if the copy couldn't be allocated.
+ * */
+struct Chunk *shared_chunk_edit(struct SharedChunk *shared);
+void shared_chunk_publish(struct SharedChunk *shared);
+
+/*
+ * Owner only. What the owner sees, the draft if there is one.
+ * */
+struct Chunk *shared_chunk_view(struct SharedChunk *shared);
+
+/*
+ * Owner only. Readers may still be looking at the current version, it is
+ * retired rather than freed. The SharedChunk itself has to outlive them
+ * the same way.
+ * */
+void shared_chunk_free(struct SharedChunk *shared);
+
+/*
+ * Any thread, while pinned. Valid until epoch_unpin, no reference taken.
+ * NULL before the first publish.
+ * */
+const struct ChunkVersion *shared_chunk_peek(const struct SharedChunk *shared);
+
+/*
+ * Any thread. A reference to the current version, for holding on past an
+ * unpin or handing to another thread. NULL before the first publish.
+ * */
+struct ChunkVersion *shared_chunk_acquire(const struct SharedChunk *shared);
+void chunk_version_acquire(struct ChunkVersion *version);
+void chunk_version_release(struct ChunkVersion *version);
+
+/*
+ * Reader threads check every version they see is whole while
+ * the owner edits and publishes for the given time. Meant for running
+ * under ThreadSanitizer. Returns the number of torn or freed reads seen.
+ * */
+int shared_chunk_stress(int threads, double seconds);
@@ -0,0 +1,319 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <voxel.h>
+#include <render.h>
+#include <world.h>
+#include <job.h>
+#include <loader.h>
+#include <scheduler.h>
+#include <prefetch.h>
+#include <worldgen.h>
+#include <chunkio.h>
+#include <journal.h>
+#include <snapshot.h>
+#include <reclaim.h>
+
+// Radii are in chunks, the gap between them keeps chunks on the
+// border from being loaded and unloaded over and over
+#define STREAM_DEFAULT_LOAD_RADIUS 6
+#define STREAM_DEFAULT_UNLOAD_RADIUS 8
+// Chunks handed to the workers at the same time
+#define STREAM_DEFAULT_MAX_IN_FLIGHT 32
+// Must be a power of two
+#define STREAM_HASH_BUCKETS 4096
+
+// Seconds between saves of the edited chunks
+#define STREAM_SAVE_INTERVAL 5.0f
+
+// Priority multipliers, lower loads sooner
+#define STREAM_OUTSIDE_FRUSTUM_WEIGHT 2.0f
+#define STREAM_DIRECTION_WEIGHT 0.3f
+
+enum StreamState
+{
+    // waiting for a worker
+    STREAM_QUEUED,
+    // owned by the I/O service, generated instead if it was never saved
+    STREAM_LOADING,
+    // owned by a worker
+    STREAM_GENERATING,
+    // generated and meshed, waiting for its upload slot
+    STREAM_GENERATED,
+    // owned by the loader
+    STREAM_UPLOADING,
+    STREAM_READY
+};
+
+/*
+ * Fills the voxels of a freshly allocated chunk. Runs on worker threads.
+ * */
+typedef void (*StreamGenerate)(struct Chunk *chunk, struct ChunkCoord coord, void *user);
+
+/*
+ * Voxels of an edited chunk on their way to disk. Outlives the chunk if it
+ * is unloaded in the meantime, a reload picks the snapshot up instead of
+ * reading what may still be stale.
+ * */
+struct StreamSave
+{
+    struct ChunkCoord coord;
+    // a reference to the version that was current, edits after it copy
+    struct ChunkVersion *snapshot;
+    // NULL once the chunk was unloaded
+    struct StreamChunk *entry;
+    uint32_t generation;
+    // oldest journal frame with edits in the snapshot, 0 without a journal
+    uint64_t first_sequence;
+    struct ChunkStream *stream;
+    struct StreamSave *next;
+};
+
+/*
+ * Freed through the epoch, a thread that found the entry while pinned can
+ * keep reading it after the chunk was unloaded.
+ * */
+struct StreamChunk
+{
+    struct ChunkCoord coord;
+    enum StreamState state;
+    // what the render thread sees of voxels, the draft while it has edits
+    // that aren't published yet. Other threads acquire the current version.
+    struct Chunk *chunk;
+    struct SharedChunk voxels;
+    unsigned int texture;
+    // estimated, accounted under MEM_GL_TEXTURES until the texture is retired
+    size_t texture_bytes;
+    // while loading
+    struct ChunkIoRequest *io_request;
+
+    // bumped by every voxel write, and the last one that made it to disk
+    uint32_t generation, saved_generation;
+    // oldest journal frame with edits no save picked up yet, 0 for none
+    uint64_t dirty_sequence;
+    // voxels changed since the texture was built
+    bool remesh;
+    // the loader builds a new texture from remesh_version, the old one is
+    // drawn until it is done. unloaded if the unload ran in the meantime,
+    // the remesh frees the chunk then.
+    bool remeshing, unloaded;
+    struct ChunkVersion *remesh_version;
+    unsigned int remesh_texture;
+    size_t remesh_texture_bytes;
+    struct StreamSave *save;
+    // on the dirty list until it is saved and remeshed
+    bool dirty;
+    struct StreamChunk *dirty_prev, *dirty_next;
+
+    float priority;
+    bool in_frustum;
+    // counted as a frustum entry for the prefetch miss rate
+    bool entered;
+    // left the unload radius while a worker, the scheduler or the loader owned it
+    bool cancelled;
+    // worldgen couldn't produce it, queued again once drained
+    bool failed;
+    bool visible;
+    uint64_t request_us;
+
+    struct ChunkStream *stream;
+    struct StreamChunk *hash_next;
+    struct StreamChunk *done_next;
+    // every live entry, including cancelled ones still owned elsewhere
+    struct StreamChunk *all_prev, *all_next;
+};
+
+/*
+ * Time spent on the workers and the loader, counted with atomics.
+ * */
+struct StreamWorkStats
+{
+    // generate callback, worldgen keeps its own
+    uint64_t generated, generate_ns;
+    // occupancy bitmasks
+    uint64_t meshed, mesh_ns;
+    // lattice textures built by the loader
+    uint64_t textures, texture_ns;
+};
+
+struct StreamStats
+{
+    // current queue depths
+    size_t queued, generating, uploading, resident, visible;
+    size_t resident_bytes;
+    // drafts, and versions only saves and remeshes still hold on to
+    size_t version_bytes;
+    // stages the worldgen keeps for neighbourhoods, 0 without it
+    size_t worldgen_bytes;
+
+    // totals since start
+    uint64_t loaded, unloaded, cancelled;
+
+    // requested while already in the frustum, prefetch had no chance on these
+    uint64_t late_requests;
+
+    // found on disk instead of generated
+    uint64_t disk_loads;
+
+    // incremental saves, skipped counts the clean ready chunks every save left alone
+    uint64_t saves, save_bytes, save_skipped, save_failures;
+    // stream_update time of the last save
+    double last_save_ms;
+
+    // request to first collected for drawing
+    uint64_t latency_samples;
+    double latency_total_ms, latency_max_ms;
+
+    struct StreamWorkStats work;
+};
+
+typedef struct ChunkStream
+{
+    int load_radius, unload_radius, max_in_flight;
+
+    StreamGenerate generate;
+    void *generate_user;
+    // replaces generate when set, see stream_use_worldgen
+    struct Worldgen *worldgen;
+    // saved chunks are loaded from here before generating, see stream_use_io
+    struct ChunkIo *io;
+    // voxel writes are logged here before they are saved, see stream_use_journal
+    struct Journal *journal;
+
+    struct JobPool *pool;
+    struct Loader *loader;
+    struct GpuReclaim *reclaim;
+    struct FrameScheduler *scheduler;
+
+    // written by the thread running stream_update only, other threads walk
+    // them pinned
+    struct StreamChunk **buckets;
+    struct StreamChunk *all;
+
+    // chunks waiting for a worker, sorted by priority every frame
+    struct StreamChunk **queue;
+    size_t queue_count, queue_capacity;
+    size_t in_flight;
+
+    // finished by the workers, drained on the main thread
+    pthread_mutex_t done_lock;
+    struct StreamChunk *done_head;
+
+    // edited chunks, saves only look at these
+    struct StreamChunk *dirty_head;
+    // newest first
+    struct StreamSave *saves;
+    size_t ready_count;
+    float save_timer;
+    // journal frames, the last one written to, the oldest only the journal
+    // has after a failed save, and what was dropped so far
+    uint64_t last_sequence, unsaved_sequence, truncated_sequence;
+
+    struct ChunkCoord center;
+    bool has_center;
+    vec4 frustum[6];
+
+    struct Prefetch prefetch;
+
+    struct StreamStats stats;
+    // written off the render thread, stream_get_stats copies it into stats
+    struct StreamWorkStats work;
+} ChunkStream;
+
+/*
+ * Textures of unloaded and remeshed chunks go through reclaim, call
+ * gpu_reclaim_frame after the frame's draws.
+ * */
+int stream_init(struct ChunkStream *stream, struct JobPool *pool, struct Loader *loader, struct GpuReclaim *reclaim, struct FrameScheduler *scheduler, StreamGenerate generate, void *generate_user);
+
+/*
+ * Generates chunks through the staged pipeline instead of the generate
+ * callback. The worldgen must use the same pool and outlive the stream.
+ * */
+void stream_use_worldgen(struct ChunkStream *stream, struct Worldgen *worldgen);
+
+/*
+ * Tries to load every chunk before generating it. Call chunk_io_shutdown
+ * before stream_shutdown.
+ * */
+void stream_use_io(struct ChunkStream *stream, struct ChunkIo *io);
+
+/*
+ * Logs every voxel write before it is saved and drops the journal frames
+ * once the chunks they touched are on disk. Turns the automatic journal
+ * checkpoints off. Needs stream_use_io.
+ * */
+void stream_use_journal(struct ChunkStream *stream, struct Journal *journal);
+
+/*
+ * Writes one voxel of a ready chunk, index is CHUNK_INDEX within it.
+ * Returns -1 if the chunk isn't ready.
+ * */
+int stream_set_voxel(struct ChunkStream *stream, struct ChunkCoord coord, int index, uint8_t type);
+
+/*
+ * Any thread. A reference to the voxels of a loaded chunk as they were last
+ * published, for meshing, saving or raycasting off the render thread while
+ * the chunk keeps being edited or gets unloaded. NULL if it isn't loaded.
+ * Release with chunk_version_release.
+ * */
+struct ChunkVersion *stream_acquire_chunk(struct ChunkStream *stream, struct ChunkCoord coord);
+
+/*
+ * Saves every chunk edited since its last save, the others are skipped
+ * without looking at them. Runs every STREAM_SAVE_INTERVAL seconds from
+ * stream_update. Returns the number of saves started.
+ * */
+size_t stream_save(struct ChunkStream *stream);
+
+/*
+ * Requests chunks in the load radius around the camera and along its
+ * predicted path, unloads the ones past the unload radius and hands the most
+ * important requests to the workers. Call once per frame after camera_process.
+ * */
+void stream_update(struct ChunkStream *stream, struct Camera *camera, float frame_delta);
+
+/*
+ * A ready chunk as the renderer needs it, with no pointer back into the
+ * stream. The texture stays valid until the frame the list was collected
+ * in was drawn, see gpu_reclaim_set_frame.
+ * */
+struct ChunkDraw
+{
+    struct ChunkCoord coord;
+    unsigned int texture;
+};
+
+/*
+ * Every ready chunk in the frustum, front to back. Writes the nearest
+ * capacity of them to out and returns how many there are,
+ * stream->ready_count is always enough.
+ * */
+size_t stream_collect_draws(struct ChunkStream *stream, struct Camera *camera, struct ChunkDraw *out, size_t capacity);
+
+/*
+ * Draws a collected list with the shared lattice mesh, nothing until the
+ * loader built it. Any thread with the main context, nothing of the stream
+ * is touched.
+ * */
+void stream_draw_list(const struct ChunkDraw *draws, size_t count, struct Lattice *lattice, struct Camera *camera);
+
+void stream_get_stats(struct ChunkStream *stream, struct StreamStats *out);
+void stream_print_stats(struct ChunkStream *stream);
+
+/*
+ * Waits for the workers and frees every chunk. Call after loader_shutdown
+ * and before scheduler_free, the scheduler must not run afterwards. No
+ * other thread may call stream_acquire_chunk anymore, the chunks are only
+ * gone after an epoch_barrier.
+ * */
+void stream_shutdown(struct ChunkStream *stream);
+
+/*
+ * Edits a few chunks on the null GL device, saves and reloads them over
+ * two sessions and checks only the edited chunks were written. Region
+ * files are created in directory and removed again. Returns the number
+ * of failures.
+ * */
+int stream_verify(const char *directory);
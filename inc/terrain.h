@@ -0,0 +1,97 @@
+#pragma once
+#include <stdint.h>
+#include <voxel.h>
+#include <world.h>
+
+#define TERRAIN_MAX_OCTAVES 8
+
+/*
+ * Instruction sets the noise kernels are built for. Every level produces
+ * bit for bit the same output as TERRAIN_SCALAR, the reference.
+ * */
+enum TerrainLevel
+{
+    TERRAIN_SCALAR,
+    // 4 samples per instruction
+    TERRAIN_SSE41,
+    // 8 samples per instruction
+    TERRAIN_AVX2,
+    TERRAIN_LEVEL_COUNT
+};
+
+/*
+ * Seeded terrain generator, a 2D fractal gradient noise heightmap with
+ * 3D gradient noise caves carved out below the surface.
+ * Read only after terrain_init so it can be shared by the workers.
+ * */
+typedef struct Terrain
+{
+    uint32_t seed;
+    enum TerrainLevel level;
+
+    // heightmap, frequencies are per voxel and heights in voxels
+    int octaves;
+    float frequency, lacunarity, persistence;
+    float base_height, height_scale;
+    // derived from the above in terrain_init
+    float octave_frequency[TERRAIN_MAX_OCTAVES];
+    float octave_amplitude[TERRAIN_MAX_OCTAVES];
+
+    int dirt_depth;
+    float cave_frequency, cave_threshold;
+} Terrain;
+
+/*
+ * Everything a chunk needs from the 2D noise, shared by every chunk
+ * stacked in the same column. Indexed x + z*CHUNK_WIDTH.
+ * */
+struct TerrainColumn
+{
+    float heights[CHUNK_WIDTH*CHUNK_WIDTH];
+    // heights rounded down, the y of the grass voxel
+    int32_t surface[CHUNK_WIDTH*CHUNK_WIDTH];
+    int32_t highest, lowest;
+};
+
+/*
+ * Picks the widest level the CPU supports.
+ * */
+void terrain_init(struct Terrain *terrain, uint32_t seed);
+bool terrain_level_supported(enum TerrainLevel level);
+const char *terrain_level_name(enum TerrainLevel level);
+
+/*
+ * Surface heights of a chunk column, indexed x + z*CHUNK_WIDTH.
+ * */
+void terrain_heightmap(const struct Terrain *terrain, enum TerrainLevel level, int32_t chunk_x, int32_t chunk_z, float *out);
+
+void terrain_column(const struct Terrain *terrain, enum TerrainLevel level, int32_t chunk_x, int32_t chunk_z, struct TerrainColumn *out);
+
+/*
+ * The generation steps that only need the chunk itself. Density fills stone,
+ * dirt and grass up to the heightmap, caves carve into stone and dirt.
+ * */
+void terrain_fill_density(const struct Terrain *terrain, enum TerrainLevel level, struct Chunk *chunk, struct ChunkCoord coord);
+void terrain_carve_caves(const struct Terrain *terrain, enum TerrainLevel level, struct Chunk *chunk, struct ChunkCoord coord);
+
+/*
+ * Density from a column computed earlier, see column.h for the cache.
+ * */
+void terrain_fill_density_column(const struct Terrain *terrain, const struct TerrainColumn *column, struct Chunk *chunk, struct ChunkCoord coord);
+
+/*
+ * Both steps at once, for chunks generated in isolation.
+ * */
+void terrain_generate_chunk(const struct Terrain *terrain, struct Chunk *chunk, struct ChunkCoord coord);
+void terrain_generate_chunk_level(const struct Terrain *terrain, enum TerrainLevel level, struct Chunk *chunk, struct ChunkCoord coord);
+
+/*
+ * Compares every supported level against the scalar reference over
+ * count chunks, raw noise and voxels. Returns the number of mismatches.
+ * */
+int terrain_verify(const struct Terrain *terrain, int count);
+
+/*
+ * Generates count chunks on the calling thread, returns voxels per second.
+ * */
+double terrain_benchmark(const struct Terrain *terrain, enum TerrainLevel level, int count);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Monotonic clock readings, safe to call before glfwInit and from any thread.
+ * */
+uint64_t timer_now_ns(void);
+uint64_t timer_now_us(void);
+double timer_now_seconds(void);
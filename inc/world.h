@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <cglm/cglm.h>
+
+// Voxels along one edge of a chunk, 32**3 = 32768 = CHUNK_DATA_SIZE
+#define CHUNK_WIDTH 32
+// World units per voxel, matches the lattice scale
+#define WORLD_VOXEL_SCALE 0.1f
+#define CHUNK_WORLD_SIZE (CHUNK_WIDTH*WORLD_VOXEL_SCALE)
+
+#define WORLD_DEFAULT_SEED 1337u
+
+#define CHUNK_INDEX(x, y, z) ((x) + (y)*CHUNK_WIDTH + (z)*CHUNK_WIDTH*CHUNK_WIDTH)
+
+enum VoxelType
+{
+    VOXEL_AIR,
+    VOXEL_STONE,
+    VOXEL_DIRT,
+    VOXEL_GRASS,
+    VOXEL_LOG,
+    VOXEL_LEAVES
+};
+
+struct ChunkCoord
+{
+    int32_t x, y, z;
+};
+
+bool chunk_coord_equal(struct ChunkCoord a, struct ChunkCoord b);
+uint32_t chunk_coord_hash(struct ChunkCoord coord);
+
+/*
+ * The lattice is built along negative Z, so chunk Z coordinates
+ * grow towards negative world Z.
+ * */
+void world_chunk_from_position(vec3 position, struct ChunkCoord *out);
+void world_chunk_aabb(struct ChunkCoord coord, vec3 box[2]);
+void world_chunk_center(struct ChunkCoord coord, vec3 out);
+void world_chunk_transform(struct ChunkCoord coord, mat4 out);
@@ -0,0 +1,135 @@
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include <voxel.h>
+#include <world.h>
+#include <terrain.h>
+#include <column.h>
+#include <job.h>
+
+#define WORLDGEN_HASH_BUCKETS 4096
+// Chunk buffers every node together may hold, past it new stages wait for
+// room and worldgen_evict frees the furthest idle nodes. The default stream
+// radii keep about 7500 around.
+#define WORLDGEN_DEFAULT_MAX_BUFFERS 8192
+// One in this many columns grows a tree
+#define WORLDGEN_TREE_RARITY 97
+
+/*
+ * A chunk has completed every stage up to and including its number.
+ * Stage N only runs once the chunk and its 26 neighbours have completed
+ * stage N-1, so a stage may read the whole 3x3x3 neighbourhood.
+ * */
+enum WorldgenStage
+{
+    WORLDGEN_EMPTY,
+    WORLDGEN_DENSITY,
+    WORLDGEN_CAVES,
+    WORLDGEN_SURFACE,
+    WORLDGEN_STRUCTURES,
+    WORLDGEN_STAGE_COUNT
+};
+
+#define WORLDGEN_FINAL_STAGE (WORLDGEN_STAGE_COUNT-1)
+
+/*
+ * Neighbourhood handed to a stage, indexed (dx+1) + (dy+1)*3 + (dz+1)*9.
+ * Entry 13 is the chunk itself. Everything is the output of the previous stage.
+ * */
+#define WORLDGEN_NEIGHBOURHOOD 27
+#define WORLDGEN_NEIGHBOUR(dx, dy, dz) (((dx)+1) + ((dy)+1)*3 + ((dz)+1)*9)
+#define WORLDGEN_SELF WORLDGEN_NEIGHBOUR(0, 0, 0)
+
+/*
+ * Called on a worker once the chunk reached the final stage. The chunk
+ * is only valid during the call, NULL if a stage it depends on couldn't
+ * run. Requesting it again retries.
+ * */
+typedef void (*WorldgenDone)(const struct Chunk *chunk, struct ChunkCoord coord, void *user);
+
+struct WorldgenWaiter
+{
+    WorldgenDone done;
+    struct ChunkCoord coord;
+    void *user;
+    struct WorldgenWaiter *next;
+};
+
+struct WorldgenNode
+{
+    struct ChunkCoord coord;
+    // last completed stage, and the highest stage anyone asked for
+    int stage, target;
+    bool running;
+    // waiting for room under the buffer cap
+    bool held;
+    // stage N is written to buffers[N&1] while the neighbours still read
+    // stage N-1 from buffers[(N-1)&1]. Either is freed once nobody reads
+    // it anymore, the final stage as soon as the waiters have their copy.
+    struct Chunk *buffers[2];
+    struct WorldgenWaiter *waiters;
+    struct Worldgen *worldgen;
+    struct WorldgenNode *hash_next;
+};
+
+typedef struct Worldgen
+{
+    const struct Terrain *terrain;
+    struct JobPool *pool;
+    struct ColumnCache columns;
+
+    pthread_mutex_t lock;
+    struct WorldgenNode **buckets;
+    size_t node_count;
+    // buffers held by the nodes, and the cap on them
+    size_t buffer_count, max_buffers;
+    // stage jobs in flight, and nodes held back by the cap
+    size_t running, held;
+    // nodes that had to start over, a neighbour was evicted under them
+    uint64_t resets;
+
+    // how often every stage ran and for how long, for profiling the pipeline
+    uint64_t stage_runs[WORLDGEN_STAGE_COUNT];
+    uint64_t stage_ns[WORLDGEN_STAGE_COUNT];
+} Worldgen;
+
+int worldgen_init(struct Worldgen *worldgen, const struct Terrain *terrain, struct JobPool *pool);
+
+/*
+ * Asks for a chunk at its final stage, pulling in the neighbours it
+ * depends on. done runs once it is there. A chunk delivered before only
+ * runs its final stage again, the stages below are kept while neighbours
+ * may need them. Returns -1 if the request couldn't be queued, done is
+ * never called then.
+ * */
+int worldgen_request(struct Worldgen *worldgen, struct ChunkCoord coord, WorldgenDone done, void *user);
+
+/*
+ * Blocks until the chunk reached its final stage and copies it to out.
+ * Same thread as worldgen_evict only, never from a worker. Returns -1 if
+ * it couldn't be generated.
+ * */
+int worldgen_generate(struct Worldgen *worldgen, struct ChunkCoord coord, struct Chunk *out);
+
+/*
+ * Frees idle chunks further than radius chunks from center, then the
+ * furthest idle ones while the buffers are past the cap. Chunks that
+ * unfinished neighbours still read are kept, as are the ones next to
+ * chunks within the radius that went past density. Anything else still
+ * needed is regenerated on demand, nodes that were ahead of an evicted
+ * neighbour start over with it, so the output doesn't depend on the order.
+ * Chunks are requested within a load radius, the stages they depend on
+ * reach WORLDGEN_FINAL_STAGE chunks further.
+ * */
+void worldgen_evict(struct Worldgen *worldgen, struct ChunkCoord center, int radius);
+
+/*
+ * Pending waiters are dropped without being called. The pool must be idle.
+ * */
+void worldgen_shutdown(struct Worldgen *worldgen);
+
+/*
+ * Generates the same region with 1 up to max_threads workers and compares
+ * the output against the single threaded run. Returns the number of chunks that differ.
+ * */
+int worldgen_verify(const struct Terrain *terrain, int max_threads);
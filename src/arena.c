@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arena.h>
+#include <memtrack.h>
+#include <log.h>
+
+// Taken when the buffer itself is full, freed when it is emptied next
+struct FrameArenaSpill
+{
+    struct FrameArenaSpill *next;
+    size_t size, used;
+};
+
+struct FrameArenaBuffer
+{
+    uint8_t *base;
+    size_t size, used;
+    struct FrameArenaSpill *spills;
+    // bytes handed out from spills, the buffer grows by this much
+    size_t spilled;
+};
+
+// One per thread, only its owner writes it
+struct FrameArenaThread
+{
+    struct FrameArenaBuffer buffers[2];
+    int current;
+    // frame the current buffer was emptied for
+    uint64_t frame;
+    uint64_t overflows;
+    size_t peak_bytes;
+    bool used;
+} __attribute__((aligned(64)));
+
+static uint64_t global_frame = 1;
+static struct FrameArenaThread threads[FRAME_ARENA_MAX_THREADS];
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static __thread struct FrameArenaThread *thread_arena;
+
+// The next thread in the slot keeps the buffers, they already have the right size
+static void release_thread(void *pointer)
+{
+    struct FrameArenaThread *arena = (struct FrameArenaThread *) pointer;
+    __atomic_store_n(&arena->used, false, __ATOMIC_RELEASE);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&thread_key, release_thread);
+}
+
+static struct FrameArenaThread *register_thread(void)
+{
+    pthread_once(&key_once, create_key);
+
+    for (int i = 0 ; i < FRAME_ARENA_MAX_THREADS ; i++)
+    {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&threads[i].used, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            thread_arena = &threads[i];
+            // switches buffers on the first allocation, what the last owner
+            // allocated this frame stays valid
+            thread_arena->frame = 0;
+            pthread_setspecific(thread_key, thread_arena);
+            return thread_arena;
+        }
+    }
+
+    LOG_ERROR(LOG_MEMORY, "More than %d threads use frame arenas.", FRAME_ARENA_MAX_THREADS);
+    return NULL;
+}
+
+static size_t grown_size(size_t needed)
+{
+    size_t size = FRAME_ARENA_BYTES;
+    while (size < needed)
+        size *= 2;
+    return size;
+}
+
+static void reset_buffer(struct FrameArenaThread *arena, struct FrameArenaBuffer *buffer)
+{
+    size_t needed = buffer->used + buffer->spilled;
+    if (needed > arena->peak_bytes)
+        __atomic_store_n(&arena->peak_bytes, needed, __ATOMIC_RELAXED);
+
+    while (buffer->spills)
+    {
+        struct FrameArenaSpill *spill = buffer->spills;
+        buffer->spills = spill->next;
+        mem_free(spill);
+    }
+
+    if (buffer->spilled)
+    {
+        size_t size = grown_size(needed);
+        uint8_t *base = (uint8_t *) mem_alloc(MEM_FRAME_ARENAS, size);
+        if (base)
+        {
+            mem_free(buffer->base);
+            buffer->base = base;
+            __atomic_store_n(&buffer->size, size, __ATOMIC_RELAXED);
+            LOG_DEBUG(LOG_MEMORY, "Frame arena grew to %zu KiB.", size / 1024);
+        }
+    }
+
+    buffer->used = 0;
+    buffer->spilled = 0;
+}
+
+static uintptr_t align_up(uintptr_t value, size_t align)
+{
+    return (value + align - 1) & ~(uintptr_t) (align - 1);
+}
+
+static void *spill(struct FrameArenaThread *arena, struct FrameArenaBuffer *buffer, size_t size, size_t align)
+{
+    struct FrameArenaSpill *last = buffer->spills;
+    if (last)
+    {
+        uintptr_t start = align_up((uintptr_t) (last + 1) + last->used, align);
+        uintptr_t end = (uintptr_t) (last + 1) + last->size;
+        if (start + size <= end)
+        {
+            last->used = start + size - (uintptr_t) (last + 1);
+            buffer->spilled += size;
+            return (void *) start;
+        }
+    }
+
+    size_t block = size + align > FRAME_ARENA_BYTES ? size + align : FRAME_ARENA_BYTES;
+    struct FrameArenaSpill *fresh = (struct FrameArenaSpill *) mem_alloc(MEM_FRAME_ARENAS, sizeof(struct FrameArenaSpill) + block);
+    if (fresh == NULL)
+        return NULL;
+
+    __atomic_add_fetch(&arena->overflows, 1, __ATOMIC_RELAXED);
+    uintptr_t start = align_up((uintptr_t) (fresh + 1), align);
+    fresh->size = block;
+    fresh->used = start + size - (uintptr_t) (fresh + 1);
+    fresh->next = buffer->spills;
+    buffer->spills = fresh;
+    buffer->spilled += size;
+    return (void *) start;
+}
+
+void frame_arena_begin(void)
+{
+    __atomic_add_fetch(&global_frame, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t frame_arena_frame(void)
+{
+    return __atomic_load_n(&global_frame, __ATOMIC_ACQUIRE);
+}
+
+void *frame_alloc(size_t size, size_t align)
+{
+    struct FrameArenaThread *arena = thread_arena ? thread_arena : register_thread();
+    if (arena == NULL)
+        return NULL;
+
+    uint64_t frame = __atomic_load_n(&global_frame, __ATOMIC_ACQUIRE);
+    if (arena->frame != frame)
+    {
+        // The other buffer holds what was allocated two frames ago or earlier
+        arena->frame = frame;
+        arena->current ^= 1;
+        reset_buffer(arena, &arena->buffers[arena->current]);
+    }
+
+    struct FrameArenaBuffer *buffer = &arena->buffers[arena->current];
+    if (buffer->base == NULL)
+    {
+        buffer->base = (uint8_t *) mem_alloc(MEM_FRAME_ARENAS, FRAME_ARENA_BYTES);
+        __atomic_store_n(&buffer->size, buffer->base ? FRAME_ARENA_BYTES : 0, __ATOMIC_RELAXED);
+    }
+
+    if (buffer->base)
+    {
+        uintptr_t start = align_up((uintptr_t) buffer->base + buffer->used, align);
+        if (start + size <= (uintptr_t) buffer->base + buffer->size)
+        {
+            buffer->used = start + size - (uintptr_t) buffer->base;
+            return (void *) start;
+        }
+    }
+    return spill(arena, buffer, size, align);
+}
+
+// Flips floats so their bits sort as unsigned integers
+static uint32_t sort_bits(float key)
+{
+    uint32_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+int frame_sort(struct FrameSortItem *items, size_t count)
+{
+    // Insertion sort wins below this, and needs no scratch
+    if (count <= 32)
+    {
+        for (size_t i = 1 ; i < count ; i++)
+        {
+            struct FrameSortItem item = items[i];
+            size_t j = i;
+            for ( ; j > 0 && items[j-1].key > item.key ; j--)
+                items[j] = items[j-1];
+            items[j] = item;
+        }
+        return 0;
+    }
+
+    struct FrameSortItem *scratch = FRAME_ALLOC(struct FrameSortItem, count);
+    uint32_t *bits = FRAME_ALLOC(uint32_t, count*2);
+    if (scratch == NULL || bits == NULL)
+        return -1;
+
+    // LSD radix sort, a byte per pass, the keys move along with the items
+    uint32_t *from_bits = bits, *to_bits = bits + count;
+    struct FrameSortItem *from = items, *to = scratch;
+    for (size_t i = 0 ; i < count ; i++)
+        from_bits[i] = sort_bits(items[i].key);
+
+    for (int shift = 0 ; shift < 32 ; shift += 8)
+    {
+        size_t offsets[256] = {0};
+        for (size_t i = 0 ; i < count ; i++)
+            offsets[(from_bits[i] >> shift) & 0xff]++;
+        size_t total = 0;
+        for (int b = 0 ; b < 256 ; b++)
+        {
+            size_t bucket = offsets[b];
+            offsets[b] = total;
+            total += bucket;
+        }
+        for (size_t i = 0 ; i < count ; i++)
+        {
+            size_t slot = offsets[(from_bits[i] >> shift) & 0xff]++;
+            to[slot] = from[i];
+            to_bits[slot] = from_bits[i];
+        }
+
+        struct FrameSortItem *items_swap = from;
+        from = to;
+        to = items_swap;
+        uint32_t *bits_swap = from_bits;
+        from_bits = to_bits;
+        to_bits = bits_swap;
+    }
+
+    // Four passes, the result is back in items
+    return 0;
+}
+
+void frame_arena_get_stats(struct FrameArenaStats *out)
+{
+    *out = (struct FrameArenaStats){
+        .frame = __atomic_load_n(&global_frame, __ATOMIC_RELAXED)
+    };
+    for (int i = 0 ; i < FRAME_ARENA_MAX_THREADS ; i++)
+    {
+        struct FrameArenaThread *arena = &threads[i];
+        size_t reserved = __atomic_load_n(&arena->buffers[0].size, __ATOMIC_RELAXED) + __atomic_load_n(&arena->buffers[1].size, __ATOMIC_RELAXED);
+        if (reserved == 0)
+            continue;
+        out->threads += __atomic_load_n(&arena->used, __ATOMIC_RELAXED);
+        out->reserved_bytes += reserved;
+        out->overflows += __atomic_load_n(&arena->overflows, __ATOMIC_RELAXED);
+        size_t peak = __atomic_load_n(&arena->peak_bytes, __ATOMIC_RELAXED);
+        if (peak > out->peak_frame_bytes)
+            out->peak_frame_bytes = peak;
+    }
+}
+
+void frame_arena_print_stats(void)
+{
+    struct FrameArenaStats stats;
+    frame_arena_get_stats(&stats);
+    LOG_INFO(LOG_MEMORY, "frame arenas | %d threads, %.1f KiB reserved, at most %.1f KiB in a frame | %llu overflows",
+            stats.threads, stats.reserved_bytes / 1024.0, stats.peak_frame_bytes / 1024.0, (unsigned long long) stats.overflows);
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <bench.h>
+#include <io.h>
+#include <timer.h>
+
+static volatile uint64_t sink;
+
+void bench_consume(uint64_t value)
+{
+    sink += value;
+}
+
+void bench_default_options(struct BenchOptions *options)
+{
+    *options = (struct BenchOptions){
+        .warmup = BENCH_DEFAULT_WARMUP,
+        .repetitions = BENCH_DEFAULT_REPETITIONS,
+        .min_repetition_ms = BENCH_DEFAULT_MIN_REPETITION_MS,
+        .filter = NULL
+    };
+}
+
+bool bench_selected(const struct BenchOptions *options, const char *name)
+{
+    return options->filter == NULL || strstr(name, options->filter) != NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+double bench_median(double *values, size_t count)
+{
+    if (count == 0)
+        return 0.0;
+    qsort(values, count, sizeof(double), compare_double);
+    if (count & 1)
+        return values[count/2];
+    return (values[count/2 - 1] + values[count/2]) * 0.5;
+}
+
+double bench_mad(double *values, size_t count, double median)
+{
+    double distances[BENCH_MAX_REPETITIONS];
+    if (count > BENCH_MAX_REPETITIONS)
+        count = BENCH_MAX_REPETITIONS;
+    for (size_t i = 0 ; i < count ; i++)
+        distances[i] = fabs(values[i] - median);
+    return bench_median(distances, count);
+}
+
+static uint64_t time_calls(const struct BenchCase *bench, uint64_t calls)
+{
+    uint64_t start = timer_now_ns();
+    for (uint64_t i = 0 ; i < calls ; i++)
+        bench->run(bench->user);
+    return timer_now_ns() - start;
+}
+
+int bench_run(const struct BenchCase *bench, const struct BenchOptions *options, struct BenchResult *out)
+{
+    int repetitions = options->repetitions;
+    if (repetitions < 1 || repetitions > BENCH_MAX_REPETITIONS)
+    {
+        printf("[Bench] Repetitions have to be between 1 and %d.\n", BENCH_MAX_REPETITIONS);
+        return -1;
+    }
+
+    // calibrating warms up as well
+    uint64_t calls = 1;
+    uint64_t min_ns = (uint64_t) (options->min_repetition_ms * 1e6);
+    while (time_calls(bench, calls) < min_ns && calls < (1ull << 32))
+        calls *= 2;
+
+    for (int i = 0 ; i < options->warmup ; i++)
+        time_calls(bench, calls);
+
+    double times[BENCH_MAX_REPETITIONS];
+    for (int i = 0 ; i < repetitions ; i++)
+        times[i] = (double) time_calls(bench, calls) / calls;
+
+    *out = (struct BenchResult){
+        .name = bench->name,
+        .repetitions = repetitions,
+        .calls = calls,
+        .items = bench->items
+    };
+    out->median_ns = bench_median(times, repetitions);
+    out->min_ns = times[0];
+    out->max_ns = times[repetitions-1];
+    out->mad_ns = bench_mad(times, repetitions, out->median_ns);
+    return 0;
+}
+
+void bench_print(const struct BenchResult *result)
+{
+    printf("[Bench] %-24s %12.1f ns +- %8.1f (%4.1f%%)", result->name,
+            result->median_ns, result->mad_ns, result->median_ns > 0.0 ? 100.0 * result->mad_ns / result->median_ns : 0.0);
+    if (result->items > 0.0 && result->median_ns > 0.0)
+        printf(" | %10.2f M items/s", result->items / result->median_ns * 1e3);
+    printf("\n");
+}
+
+int bench_write_json(const char *path, const struct BenchOptions *options, const struct BenchResult *results, size_t count)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("[Bench] Unable to write %s.\n", path);
+        return -1;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"suite\": \"micro\",\n");
+    fprintf(file, "  \"warmup\": %d,\n", options->warmup);
+    fprintf(file, "  \"repetitions\": %d,\n", options->repetitions);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0 ; i < count ; i++)
+    {
+        const struct BenchResult *result = &results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"repetitions\": %d, \"calls\": %llu, \"median_ns\": %.3f, \"mad_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f, \"items\": %.0f}%s\n",
+                result->name, result->repetitions, (unsigned long long) result->calls, result->median_ns, result->mad_ns,
+                result->min_ns, result->max_ns, result->items, i+1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    fclose(file);
+    return 0;
+}
+
+// Searches key within [object, end) and reads the number after it
+static bool read_number(const char *object, const char *end, const char *key, double *out)
+{
+    const char *found = strstr(object, key);
+    if (found == NULL || found >= end)
+        return false;
+    char *parsed;
+    *out = strtod(found + strlen(key), &parsed);
+    return parsed != found + strlen(key);
+}
+
+/*
+ * Only understands what bench_write_json writes, one object per result
+ * with flat fields.
+ * */
+int bench_load_json(const char *path, struct BenchReport *report)
+{
+    char *text;
+    if (read_file(path, &text))
+        return -1;
+
+    report->count = 0;
+    const char *cursor = strstr(text, "\"results\"");
+    // files written before results carried their own count share the run's
+    double run_repetitions = 1.0;
+    if (cursor)
+        read_number(text, cursor, "\"repetitions\":", &run_repetitions);
+    while (cursor && (cursor = strchr(cursor, '{')) != NULL)
+    {
+        const char *end = strchr(cursor, '}');
+        if (end == NULL)
+            break;
+
+        const char *name = strstr(cursor, "\"name\": \"");
+        if (name == NULL || name >= end)
+        {
+            cursor = end;
+            continue;
+        }
+        if (report->count == BENCH_MAX_RESULTS)
+        {
+            printf("[Bench] %s has more than %d results, ignoring the rest.\n", path, BENCH_MAX_RESULTS);
+            break;
+        }
+
+        name += strlen("\"name\": \"");
+        size_t length = strcspn(name, "\"");
+        if (length >= BENCH_MAX_NAME)
+            length = BENCH_MAX_NAME - 1;
+        char *copy = report->names[report->count];
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+
+        struct BenchResult *result = &report->results[report->count];
+        *result = (struct BenchResult){ .name = copy };
+        double calls = 0.0, repetitions = run_repetitions;
+        bool valid = read_number(cursor, end, "\"median_ns\":", &result->median_ns);
+        valid = valid && read_number(cursor, end, "\"mad_ns\":", &result->mad_ns);
+        read_number(cursor, end, "\"min_ns\":", &result->min_ns);
+        read_number(cursor, end, "\"max_ns\":", &result->max_ns);
+        read_number(cursor, end, "\"items\":", &result->items);
+        read_number(cursor, end, "\"calls\":", &calls);
+        read_number(cursor, end, "\"repetitions\":", &repetitions);
+        result->calls = (uint64_t) calls;
+        result->repetitions = repetitions >= 1.0 ? (int) repetitions : 1;
+
+        if (valid)
+            report->count++;
+        else
+            printf("[Bench] %s: %s has no median or MAD, skipping it.\n", path, copy);
+        cursor = end;
+    }
+
+    free(text);
+    if (report->count == 0)
+    {
+        printf("[Bench] No results in %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static const struct BenchResult *find_result(const struct BenchReport *report, const char *name)
+{
+    for (size_t i = 0 ; i < report->count ; i++)
+    {
+        if (strcmp(report->results[i].name, name) == 0)
+            return &report->results[i];
+    }
+    return NULL;
+}
+
+/*
+ * Standard error of the median over the repetitions. The MAD is about two
+ * thirds of a standard deviation for normal noise, and a median scatters
+ * sqrt(pi/2) times as much as a mean of as many samples.
+ * */
+static double median_error(const struct BenchResult *result)
+{
+    int repetitions = result->repetitions > 0 ? result->repetitions : 1;
+    return 1.2533 * 1.4826 * result->mad_ns / sqrt((double) repetitions);
+}
+
+int bench_compare(const struct BenchReport *baseline, const struct BenchReport *current, double min_percent)
+{
+    int slowdowns = 0;
+    printf("[Bench] %-24s %14s %14s %9s %9s  %s\n", "benchmark", "baseline ns", "current ns", "delta", "noise", "verdict");
+
+    for (size_t i = 0 ; i < baseline->count ; i++)
+    {
+        const struct BenchResult *before = &baseline->results[i];
+        const struct BenchResult *after = find_result(current, before->name);
+        if (after == NULL)
+        {
+            printf("[Bench] %-24s %14.1f %14s %9s %9s  missing\n", before->name, before->median_ns, "-", "-", "-");
+            continue;
+        }
+
+        double error_before = median_error(before), error_after = median_error(after);
+        double sigma = sqrt(error_before * error_before + error_after * error_after);
+        double threshold = fmax(before->median_ns * min_percent / 100.0, BENCH_COMPARE_SIGMAS * sigma);
+        double delta = after->median_ns - before->median_ns;
+        double scale = before->median_ns > 0.0 ? 100.0 / before->median_ns : 0.0;
+
+        const char *verdict = "ok";
+        if (delta > threshold)
+        {
+            verdict = "SLOWER";
+            slowdowns++;
+        }
+        else if (-delta > threshold)
+        {
+            verdict = "faster";
+        }
+        printf("[Bench] %-24s %14.1f %14.1f %+8.1f%% %8.1f%%  %s\n", before->name,
+                before->median_ns, after->median_ns, delta * scale, threshold * scale, verdict);
+    }
+
+    for (size_t i = 0 ; i < current->count ; i++)
+    {
+        const struct BenchResult *after = &current->results[i];
+        if (find_result(baseline, after->name) == NULL)
+            printf("[Bench] %-24s %14s %14.1f %9s %9s  new\n", after->name, "-", after->median_ns, "-", "-");
+    }
+
+    printf("[Bench] %d significant slowdown%s\n", slowdowns, slowdowns == 1 ? "" : "s");
+    return slowdowns;
+}
@@ -0,0 +1,708 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chunkio.h>
+#include <profile.h>
+#include <timer.h>
+#include <memtrack.h>
+#include <log.h>
+
+// One coalesced read, shared by the payloads in it until they are decoded
+struct ChunkIoBuffer
+{
+    uint8_t *data;
+    int references;
+};
+
+static void *io_thread(void *arg);
+
+int chunk_io_init(struct ChunkIo *io, struct RegionStore *store, struct JobPool *workers, int thread_count)
+{
+    *io = (struct ChunkIo){
+        .store = store,
+        .workers = workers
+    };
+
+    if (thread_count <= 0)
+        thread_count = CHUNK_IO_DEFAULT_THREADS;
+
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->wake, NULL);
+    pthread_cond_init(&io->idle, NULL);
+
+    io->threads = (pthread_t *) calloc(thread_count, sizeof(pthread_t));
+    if (io->threads == NULL)
+    {
+        LOG_ERROR(LOG_CHUNKIO, "Unable to allocate I/O threads.");
+        return -1;
+    }
+
+    io->running = true;
+    for (int i = 0 ; i < thread_count ; i++)
+    {
+        if (pthread_create(&io->threads[i], NULL, io_thread, io))
+        {
+            LOG_ERROR(LOG_CHUNKIO, "Unable to start I/O thread %d.", i);
+            break;
+        }
+        io->thread_count++;
+    }
+
+    if (io->thread_count == 0)
+    {
+        chunk_io_shutdown(io);
+        return -1;
+    }
+    return 0;
+}
+
+static void queue_pending(struct ChunkIo *io, struct ChunkIoRequest *request)
+{
+    pthread_mutex_lock(&io->lock);
+    request->next = NULL;
+    if (io->pending_tail)
+        io->pending_tail->next = request;
+    else
+        io->pending_head = request;
+    io->pending_tail = request;
+    pthread_cond_signal(&io->wake);
+    pthread_mutex_unlock(&io->lock);
+}
+
+static void encode_job(void *user);
+
+/*
+ * The save of the chunk completed, the next one in line takes its place.
+ * Holding the lock, returns the save to start.
+ * */
+static struct ChunkIoRequest *finish_save(struct ChunkIo *io, struct ChunkIoRequest *request)
+{
+    struct ChunkIoRequest **link = &io->saving;
+    while (*link != request)
+        link = &(*link)->save_next;
+
+    struct ChunkIoRequest *chained = request->chained;
+    if (chained)
+    {
+        chained->save_next = request->save_next;
+        *link = chained;
+    }
+    else
+    {
+        *link = request->save_next;
+    }
+    return chained;
+}
+
+static void complete(struct ChunkIo *io, struct ChunkIoRequest *request)
+{
+    bool cancelled = __atomic_load_n(&request->cancelled, __ATOMIC_ACQUIRE);
+    struct ChunkIoRequest *chained = NULL;
+
+    pthread_mutex_lock(&io->lock);
+    request->next = NULL;
+    if (io->completed_tail)
+        io->completed_tail->next = request;
+    else
+        io->completed_head = request;
+    io->completed_tail = request;
+
+    if (request->kind == CHUNK_IO_LOAD)
+    {
+        io->stats.loads++;
+        if (cancelled)
+            io->stats.cancelled++;
+        else if (request->result == REGION_MISSING)
+            io->stats.missing++;
+    }
+    else
+    {
+        io->stats.saves++;
+        chained = finish_save(io, request);
+    }
+    if (request->result == REGION_CORRUPT)
+        io->stats.corrupt++;
+
+    if (--io->in_flight == 0)
+        pthread_cond_broadcast(&io->idle);
+    pthread_mutex_unlock(&io->lock);
+
+    if (chained && job_pool_submit(io->workers, encode_job, chained))
+        encode_job(chained);
+}
+
+static struct ChunkIoRequest *create_request(struct ChunkIo *io, enum ChunkIoKind kind, struct ChunkCoord coord, struct Chunk *chunk, ChunkIoDone done, void *user)
+{
+    struct ChunkIoRequest *request = (struct ChunkIoRequest *) calloc(1, sizeof(struct ChunkIoRequest));
+    if (request == NULL)
+    {
+        LOG_ERROR(LOG_CHUNKIO, "Unable to allocate a request.");
+        return NULL;
+    }
+
+    request->kind = kind;
+    request->coord = coord;
+    request->chunk = chunk;
+    request->done = done;
+    request->user = user;
+    request->io = io;
+    region_from_chunk(coord, &request->region, &request->index);
+    return request;
+}
+
+struct ChunkIoRequest *chunk_io_load(struct ChunkIo *io, struct ChunkCoord coord, struct Chunk *chunk, ChunkIoDone done, void *user)
+{
+    struct ChunkIoRequest *request = create_request(io, CHUNK_IO_LOAD, coord, chunk, done, user);
+    if (request == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&io->lock);
+    io->in_flight++;
+    pthread_mutex_unlock(&io->lock);
+
+    queue_pending(io, request);
+    return request;
+}
+
+static void encode_job(void *user)
+{
+    struct ChunkIoRequest *request = (struct ChunkIoRequest *) user;
+    region_encode(request->chunk, request->io->store->compression, request->payload, &request->entry);
+    queue_pending(request->io, request);
+}
+
+struct ChunkIoRequest *chunk_io_save(struct ChunkIo *io, struct ChunkCoord coord, struct Chunk *chunk, ChunkIoDone done, void *user)
+{
+    struct ChunkIoRequest *request = create_request(io, CHUNK_IO_SAVE, coord, chunk, done, user);
+    if (request == NULL)
+        return NULL;
+
+    request->payload = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, REGION_PAYLOAD_MAX);
+    if (request->payload == NULL)
+    {
+        LOG_ERROR(LOG_CHUNKIO, "Unable to allocate a payload.");
+        free(request);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&io->lock);
+
+    // Two saves of a chunk in flight at once could land in either order,
+    // the later one waits for the earlier to complete
+    struct ChunkIoRequest *previous = io->saving;
+    while (previous && !chunk_coord_equal(previous->coord, coord))
+        previous = previous->save_next;
+    if (previous)
+    {
+        while (previous->chained)
+            previous = previous->chained;
+        previous->chained = request;
+        io->in_flight++;
+        pthread_mutex_unlock(&io->lock);
+        return request;
+    }
+
+    // Compressed on a worker, the I/O threads only ever wait on the disk
+    if (job_pool_submit(io->workers, encode_job, request))
+    {
+        pthread_mutex_unlock(&io->lock);
+        mem_free(request->payload);
+        free(request);
+        return NULL;
+    }
+    request->save_next = io->saving;
+    io->saving = request;
+    io->in_flight++;
+    pthread_mutex_unlock(&io->lock);
+    return request;
+}
+
+void chunk_io_cancel(struct ChunkIo *io, struct ChunkIoRequest *request)
+{
+    if (request->kind == CHUNK_IO_LOAD)
+        __atomic_store_n(&request->cancelled, true, __ATOMIC_RELEASE);
+}
+
+// LOADS
+
+static void release_buffer(struct ChunkIoBuffer *buffer)
+{
+    if (__atomic_sub_fetch(&buffer->references, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        mem_free(buffer->data);
+        free(buffer);
+    }
+}
+
+static void decode_job(void *user)
+{
+    struct ChunkIoRequest *request = (struct ChunkIoRequest *) user;
+
+    if (__atomic_load_n(&request->cancelled, __ATOMIC_ACQUIRE))
+    {
+        request->result = REGION_MISSING;
+    }
+    else
+    {
+        request->result = region_decode(&request->entry, request->payload, request->chunk);
+        if (request->result == REGION_CORRUPT)
+            LOG_WARN(LOG_CHUNKIO, "Chunk %d %d %d is corrupt.", request->coord.x, request->coord.y, request->coord.z);
+    }
+
+    request->payload = NULL;
+    release_buffer(request->buffer);
+    request->buffer = NULL;
+    complete(request->io, request);
+}
+
+static int compare_sector(const void *a, const void *b)
+{
+    const struct ChunkIoRequest *x = *(const struct ChunkIoRequest **) a;
+    const struct ChunkIoRequest *y = *(const struct ChunkIoRequest **) b;
+    return (x->entry.sector > y->entry.sector) - (x->entry.sector < y->entry.sector);
+}
+
+static void read_span(struct ChunkIo *io, struct Region *region, struct ChunkIoRequest **requests, int count)
+{
+    uint64_t start = (uint64_t) requests[0]->entry.sector*REGION_SECTOR_SIZE;
+    uint64_t end = start;
+    for (int i = 0 ; i < count ; i++)
+    {
+        uint64_t payload_end = (uint64_t) requests[i]->entry.sector*REGION_SECTOR_SIZE + requests[i]->entry.length;
+        if (payload_end > end)
+            end = payload_end;
+    }
+
+    struct ChunkIoBuffer *buffer = (struct ChunkIoBuffer *) malloc(sizeof(struct ChunkIoBuffer));
+    uint8_t *data = buffer ? (uint8_t *) mem_alloc(MEM_IO_BUFFERS, end - start) : NULL;
+    bool failed = data == NULL || region_pread(region, data, end - start, requests[0]->entry.sector);
+
+    pthread_mutex_lock(&io->lock);
+    io->stats.preads++;
+    if (!failed)
+        io->stats.bytes_read += end - start;
+    pthread_mutex_unlock(&io->lock);
+
+    if (failed)
+    {
+        LOG_ERROR(LOG_CHUNKIO, "Unable to read %d chunks from %s", count, region->path);
+        mem_free(data);
+        free(buffer);
+        for (int i = 0 ; i < count ; i++)
+        {
+            requests[i]->result = REGION_CORRUPT;
+            complete(io, requests[i]);
+        }
+        return;
+    }
+
+    buffer->data = data;
+    buffer->references = count;
+
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkIoRequest *request = requests[i];
+        request->payload = data + ((uint64_t) request->entry.sector*REGION_SECTOR_SIZE - start);
+        request->buffer = buffer;
+        if (job_pool_submit(io->workers, decode_job, request))
+            decode_job(request);
+    }
+}
+
+static void load_group(struct ChunkIo *io, struct ChunkIoRequest **requests, int count)
+{
+    PROFILE_ZONE("chunk io load");
+    struct Region *region = region_store_acquire(io->store, requests[0]->region, false);
+    if (region == NULL)
+    {
+        for (int i = 0 ; i < count ; i++)
+        {
+            requests[i]->result = REGION_MISSING;
+            complete(io, requests[i]);
+        }
+        return;
+    }
+
+    region_begin_io(region);
+
+    int stored = 0;
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkIoRequest *request = requests[i];
+        if (!__atomic_load_n(&request->cancelled, __ATOMIC_ACQUIRE))
+        {
+            request->entry = region_lookup(region, request->index);
+            if (request->entry.sector)
+            {
+                requests[stored++] = request;
+                continue;
+            }
+        }
+        request->result = REGION_MISSING;
+        complete(io, request);
+    }
+
+    // Close payloads share a read, a short gap costs less than another system call
+    qsort(requests, stored, sizeof(struct ChunkIoRequest *), compare_sector);
+    for (int i = 0 ; i < stored ; )
+    {
+        uint64_t start = (uint64_t) requests[i]->entry.sector*REGION_SECTOR_SIZE;
+        uint64_t end = start + requests[i]->entry.length;
+        int j = i + 1;
+        while (j < stored)
+        {
+            uint64_t next = (uint64_t) requests[j]->entry.sector*REGION_SECTOR_SIZE;
+            uint64_t next_end = next + requests[j]->entry.length;
+            if (next > end + CHUNK_IO_MAX_GAP || next_end - start > CHUNK_IO_MAX_SPAN)
+                break;
+            if (next_end > end)
+                end = next_end;
+            j++;
+        }
+
+        read_span(io, region, requests + i, j - i);
+        i = j;
+    }
+
+    region_end_io(region);
+    region_store_release(io->store, region);
+}
+
+// SAVES
+
+static void save_group(struct ChunkIo *io, struct ChunkIoRequest **requests, int count)
+{
+    PROFILE_ZONE("chunk io save");
+    struct Region *region = region_store_acquire(io->store, requests[0]->region, true);
+    if (region == NULL)
+    {
+        for (int i = 0 ; i < count ; i++)
+        {
+            requests[i]->result = REGION_ERROR;
+            complete(io, requests[i]);
+        }
+        return;
+    }
+
+    region_begin_io(region);
+
+    // Back to back sectors, so the whole group goes out in one pwrite
+    uint32_t sectors = 0;
+    for (int i = 0 ; i < count ; i++)
+        sectors += REGION_SECTORS(requests[i]->entry.length);
+    uint32_t first = region_reserve(region, sectors);
+
+    struct ChunkIoRequest *last = requests[count-1];
+    size_t size = (size_t) (sectors - REGION_SECTORS(last->entry.length))*REGION_SECTOR_SIZE + last->entry.length;
+    uint8_t *data = (uint8_t *) mem_calloc(MEM_IO_BUFFERS, 1, size);
+
+    uint32_t sector = first;
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkIoRequest *request = requests[i];
+        request->entry.sector = sector;
+        if (data)
+            memcpy(data + (size_t) (sector - first)*REGION_SECTOR_SIZE, request->payload, request->entry.length);
+        sector += REGION_SECTORS(request->entry.length);
+    }
+
+    bool written = data && region_pwrite(region, data, size, first) == 0;
+    if (!written)
+        LOG_ERROR(LOG_CHUNKIO, "Unable to write %d chunks to %s", count, region->path);
+    mem_free(data);
+
+    pthread_mutex_lock(&io->lock);
+    io->stats.pwrites++;
+    if (written)
+        io->stats.bytes_written += size;
+    pthread_mutex_unlock(&io->lock);
+
+    // Entries only point at payloads once they are on disk
+    for (int i = 0 ; i < count ; i++)
+    {
+        requests[i]->result = region_commit(region, requests[i]->index, &requests[i]->entry, written);
+        complete(io, requests[i]);
+    }
+
+    region_end_io(region);
+    region_store_release(io->store, region);
+}
+
+static int compare_region(const void *a, const void *b)
+{
+    const struct ChunkIoRequest *x = *(const struct ChunkIoRequest **) a;
+    const struct ChunkIoRequest *y = *(const struct ChunkIoRequest **) b;
+    if (x->region.x != y->region.x)
+        return (x->region.x > y->region.x) - (x->region.x < y->region.x);
+    if (x->region.y != y->region.y)
+        return (x->region.y > y->region.y) - (x->region.y < y->region.y);
+    if (x->region.z != y->region.z)
+        return (x->region.z > y->region.z) - (x->region.z < y->region.z);
+    // A chunk has one save past encoding at a time, see chunk_io_save
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static void process(struct ChunkIo *io, struct ChunkIoRequest **requests, int count, void (*group)(struct ChunkIo *, struct ChunkIoRequest **, int))
+{
+    // Stable in submission order within a region, qsort alone isn't
+    for (int i = 1 ; i < count ; i++)
+    {
+        struct ChunkIoRequest *request = requests[i];
+        int j = i;
+        while (j > 0 && compare_region(&requests[j-1], &request) > 0)
+        {
+            requests[j] = requests[j-1];
+            j--;
+        }
+        requests[j] = request;
+    }
+
+    for (int i = 0 ; i < count ; )
+    {
+        int j = i + 1;
+        while (j < count && chunk_coord_equal(requests[j]->region, requests[i]->region))
+            j++;
+        group(io, requests + i, j - i);
+        i = j;
+    }
+}
+
+static void *io_thread(void *arg)
+{
+    struct ChunkIo *io = (struct ChunkIo *) arg;
+    struct ChunkIoRequest *loads[CHUNK_IO_BATCH];
+    struct ChunkIoRequest *saves[CHUNK_IO_BATCH];
+    PROFILE_THREAD("chunk io");
+
+    pthread_mutex_lock(&io->lock);
+    while (true)
+    {
+        while (io->running && io->pending_head == NULL)
+            pthread_cond_wait(&io->wake, &io->lock);
+        if (io->pending_head == NULL)
+            break;
+
+        int load_count = 0, save_count = 0;
+        while (io->pending_head && load_count + save_count < CHUNK_IO_BATCH)
+        {
+            struct ChunkIoRequest *request = io->pending_head;
+            io->pending_head = request->next;
+            if (request->kind == CHUNK_IO_LOAD)
+                loads[load_count++] = request;
+            else
+                saves[save_count++] = request;
+        }
+        if (io->pending_head == NULL)
+            io->pending_tail = NULL;
+        pthread_mutex_unlock(&io->lock);
+
+        // Saves first, a load queued behind a save of the same chunk sees the new data
+        process(io, saves, save_count, save_group);
+        process(io, loads, load_count, load_group);
+
+        pthread_mutex_lock(&io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+
+    return NULL;
+}
+
+void chunk_io_poll(struct ChunkIo *io)
+{
+    pthread_mutex_lock(&io->lock);
+    struct ChunkIoRequest *request = io->completed_head;
+    io->completed_head = io->completed_tail = NULL;
+    pthread_mutex_unlock(&io->lock);
+
+    while (request)
+    {
+        struct ChunkIoRequest *next = request->next;
+        if (request->done)
+            request->done(request);
+        if (request->kind == CHUNK_IO_SAVE)
+            mem_free(request->payload);
+        free(request);
+        request = next;
+    }
+}
+
+void chunk_io_get_stats(struct ChunkIo *io, struct ChunkIoStats *out)
+{
+    pthread_mutex_lock(&io->lock);
+    *out = io->stats;
+    pthread_mutex_unlock(&io->lock);
+}
+
+void chunk_io_shutdown(struct ChunkIo *io)
+{
+    pthread_mutex_lock(&io->lock);
+    while (io->in_flight)
+        pthread_cond_wait(&io->idle, &io->lock);
+    io->running = false;
+    pthread_cond_broadcast(&io->wake);
+    pthread_mutex_unlock(&io->lock);
+
+    for (int i = 0 ; i < io->thread_count ; i++)
+        pthread_join(io->threads[i], NULL);
+    free(io->threads);
+    io->threads = NULL;
+    io->thread_count = 0;
+
+    chunk_io_poll(io);
+
+    pthread_cond_destroy(&io->idle);
+    pthread_cond_destroy(&io->wake);
+    pthread_mutex_destroy(&io->lock);
+}
+
+// BENCHMARK
+
+struct BenchState
+{
+    int completed;
+    int failures;
+    struct Chunk *expected;
+};
+
+struct BenchSlot
+{
+    struct BenchState *state;
+    int index;
+};
+
+static void bench_saved(struct ChunkIoRequest *request)
+{
+    struct BenchSlot *slot = (struct BenchSlot *) request->user;
+    slot->state->completed++;
+    if (request->result != REGION_OK)
+        slot->state->failures++;
+}
+
+static void bench_loaded(struct ChunkIoRequest *request)
+{
+    struct BenchSlot *slot = (struct BenchSlot *) request->user;
+    slot->state->completed++;
+    if (request->cancelled)
+        return;
+
+    if (request->result != REGION_OK
+        || memcmp(request->chunk->voxel_type, slot->state->expected[slot->index].voxel_type, REGION_PAYLOAD_MAX))
+    {
+        LOG_WARN(LOG_CHUNKIO, "Chunk %d %d %d didn't round trip", request->coord.x, request->coord.y, request->coord.z);
+        slot->state->failures++;
+    }
+}
+
+static void bench_wait(struct ChunkIo *io, struct BenchState *state, int count)
+{
+    while (state->completed < count)
+    {
+        chunk_io_poll(io);
+        usleep(100);
+    }
+}
+
+int chunk_io_benchmark(const struct Terrain *terrain, struct JobPool *workers, const char *directory, int count)
+{
+    struct Chunk *expected = (struct Chunk *) malloc(count*sizeof(struct Chunk));
+    struct Chunk *loaded = (struct Chunk *) malloc(count*sizeof(struct Chunk));
+    struct BenchSlot *slots = (struct BenchSlot *) calloc(count, sizeof(struct BenchSlot));
+    struct ChunkCoord *coords = (struct ChunkCoord *) calloc(count, sizeof(struct ChunkCoord));
+    struct RegionStore store;
+    struct ChunkIo io;
+
+    if (expected == NULL || loaded == NULL || slots == NULL || coords == NULL || region_store_init(&store, directory))
+    {
+        LOG_ERROR(LOG_CHUNKIO, "Unable to set up the benchmark.");
+        free(expected);
+        free(loaded);
+        free(slots);
+        free(coords);
+        return 1;
+    }
+
+    memset(loaded, 0, count*sizeof(struct Chunk));
+
+    // Offset from the region benchmark so they don't share files
+    int width = 1;
+    while (width*width*4 < count)
+        width++;
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkCoord coord = { 64 + i % width, (i / (width*width)) - 2, 64 + (i / width) % width };
+        coords[i] = coord;
+        terrain_generate_chunk(terrain, &expected[i], coord);
+    }
+
+    if (chunk_io_init(&io, &store, workers, 0))
+    {
+        region_store_close(&store);
+        free(expected);
+        free(loaded);
+        free(slots);
+        free(coords);
+        return 1;
+    }
+
+    // Every fourth chunk is saved empty right before, the second save has to win
+    struct BenchState state = { .expected = expected };
+    int saves = count + (count+3)/4;
+    for (int i = 0 ; i < count ; i++)
+    {
+        slots[i] = (struct BenchSlot){ &state, i };
+        if (i % 4 == 0 && chunk_io_save(&io, coords[i], &loaded[i], bench_saved, &slots[i]) == NULL)
+            state.completed++;
+        if (chunk_io_save(&io, coords[i], &expected[i], bench_saved, &slots[i]) == NULL)
+            state.completed++;
+    }
+    bench_wait(&io, &state, saves);
+    int failures = state.failures;
+
+    struct ChunkIoStats saved;
+    chunk_io_get_stats(&io, &saved);
+
+    // Every eighth load is cancelled right away, the rest have to come back intact
+    state.completed = 0;
+    state.failures = 0;
+    uint64_t start = timer_now_ns();
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkIoRequest *request = chunk_io_load(&io, coords[i], &loaded[i], bench_loaded, &slots[i]);
+        if (request == NULL)
+            state.completed++;
+        else if (i % 8 == 7)
+            chunk_io_cancel(&io, request);
+    }
+    bench_wait(&io, &state, count);
+    uint64_t load_ns = timer_now_ns() - start;
+    failures += state.failures;
+
+    struct ChunkIoStats stats;
+    chunk_io_get_stats(&io, &stats);
+    chunk_io_shutdown(&io);
+
+    uint64_t loads = stats.loads - stats.cancelled;
+    uint64_t preads = stats.preads - saved.preads;
+    printf("[ChunkIO] saved %d chunks in %llu pwrites, loaded %llu in %llu preads (%llu cancelled), %.1f chunks/s%s\n",
+            count, (unsigned long long) stats.pwrites, (unsigned long long) loads, (unsigned long long) preads,
+            (unsigned long long) stats.cancelled, loads / (load_ns * 1e-9),
+            failures ? ", FAILURES" : "");
+
+    // Leave nothing behind
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkCoord region_coord;
+        int index;
+        region_from_chunk(coords[i], &region_coord, &index);
+        region_store_delete(&store, region_coord);
+    }
+    region_store_close(&store);
+    rmdir(directory);
+
+    free(expected);
+    free(loaded);
+    free(slots);
+    free(coords);
+    return failures;
+}
@@ -0,0 +1,656 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <codec.h>
+#include <timer.h>
+#include <log.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define VOXEL_BYTES sizeof(((struct Chunk *) 0)->voxel_type)
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 13
+#define LZ_MAX_OFFSET 65535
+
+// VARINTS
+
+static size_t varint_size(uint32_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t value)
+{
+    size_t o = 0;
+    while (value >= 0x80)
+    {
+        out[o++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[o++] = (uint8_t) value;
+    return o;
+}
+
+static int get_varint(const uint8_t *in, size_t size, size_t *i, uint32_t *value)
+{
+    uint32_t result = 0;
+    for (int shift = 0 ; shift < 32 ; shift += 7)
+    {
+        if (*i >= size)
+            return -1;
+        uint8_t byte = in[(*i)++];
+        result |= (uint32_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// RUNS
+
+static size_t run_length_scalar(const uint8_t *data, size_t start, size_t size)
+{
+    size_t i = start + 1;
+    while (i < size && data[i] == data[start])
+        i++;
+    return i - start;
+}
+
+/*
+ * Compares 16 voxels at a time, the first mismatch falls out of the mask.
+ * Air and stone runs are often hundreds of voxels long.
+ * */
+static size_t run_length(const uint8_t *data, size_t start, size_t size)
+{
+#ifdef __SSE2__
+    __m128i value = _mm_set1_epi8((char) data[start]);
+    size_t i = start + 1;
+    while (i + 16 <= size)
+    {
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i)), value));
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask) - start;
+        i += 16;
+    }
+    while (i < size && data[i] == data[start])
+        i++;
+    return i - start;
+#else
+    return run_length_scalar(data, start, size);
+#endif
+}
+
+/*
+ * Small palettes pack the index and a run of up to 15 into one byte,
+ * a nibble of 15 means the run continues in a varint. Larger palettes
+ * spend a byte on the index and a varint on the run.
+ * */
+static size_t encode_runs(const uint8_t *in, size_t size, const uint8_t *lut, bool nibbles, uint8_t *out)
+{
+    size_t o = 0;
+    for (size_t i = 0 ; i < size ; )
+    {
+        size_t run = run_length(in, i, size);
+        uint8_t index = lut[in[i]];
+
+        if (nibbles)
+        {
+            if (run < 16)
+            {
+                out[o++] = (uint8_t) ((run-1) << 4 | index);
+            }
+            else
+            {
+                out[o++] = (uint8_t) (15 << 4 | index);
+                o += put_varint(out + o, (uint32_t) (run - 16));
+            }
+        }
+        else
+        {
+            out[o++] = index;
+            o += put_varint(out + o, (uint32_t) (run - 1));
+        }
+
+        i += run;
+    }
+    return o;
+}
+
+static int decode_runs(const uint8_t *in, size_t size, const uint8_t *palette, int palette_count, bool nibbles, uint8_t *out, size_t out_size)
+{
+    size_t o = 0;
+    for (size_t i = 0 ; i < size ; )
+    {
+        uint8_t index;
+        uint32_t run;
+
+        if (nibbles)
+        {
+            uint8_t byte = in[i++];
+            index = byte & 15;
+            run = (byte >> 4) + 1;
+            if (run == 16)
+            {
+                uint32_t extra;
+                if (get_varint(in, size, &i, &extra) || extra > out_size)
+                    return -1;
+                run = 16 + extra;
+            }
+        }
+        else
+        {
+            index = in[i++];
+            if (get_varint(in, size, &i, &run) || run >= out_size)
+                return -1;
+            run++;
+        }
+
+        if (index >= palette_count || run > out_size - o)
+            return -1;
+        memset(out + o, palette[index], run);
+        o += run;
+    }
+    return o == out_size ? 0 : -1;
+}
+
+// LZ
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t lz_hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static size_t put_length(uint8_t *out, size_t o, size_t capacity, size_t length)
+{
+    while (length >= 255)
+    {
+        if (o >= capacity)
+            return 0;
+        out[o++] = 255;
+        length -= 255;
+    }
+    if (o >= capacity)
+        return 0;
+    out[o++] = (uint8_t) length;
+    return o;
+}
+
+/*
+ * One sequence: a token with the literal count and match length in its
+ * nibbles, extra length bytes, the literals, then the match offset.
+ * The last sequence has no match. Returns the new position, 0 when full.
+ * */
+static size_t put_sequence(uint8_t *out, size_t o, size_t capacity, const uint8_t *literals, size_t literal_count, size_t offset, size_t match)
+{
+    if (o >= capacity)
+        return 0;
+
+    size_t match_code = match ? match - LZ_MIN_MATCH : 0;
+    size_t token = o++;
+    out[token] = (uint8_t) ((literal_count < 15 ? literal_count : 15) << 4 | (match_code < 15 ? match_code : 15));
+
+    if (literal_count >= 15 && (o = put_length(out, o, capacity, literal_count - 15)) == 0)
+        return 0;
+    if (literal_count > capacity - o)
+        return 0;
+    memcpy(out + o, literals, literal_count);
+    o += literal_count;
+
+    if (match == 0)
+        return o;
+
+    if (capacity - o < 2)
+        return 0;
+    out[o++] = (uint8_t) offset;
+    out[o++] = (uint8_t) (offset >> 8);
+
+    if (match_code >= 15 && (o = put_length(out, o, capacity, match_code - 15)) == 0)
+        return 0;
+    return o;
+}
+
+static size_t lz_encode(const uint8_t *in, size_t size, uint8_t *out, size_t capacity)
+{
+    // positions + 1, 0 is empty
+    uint32_t table[1 << LZ_HASH_BITS] = {0};
+    size_t o = 0;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while (i + LZ_MIN_MATCH <= size)
+    {
+        uint32_t value = read32(in + i);
+        uint32_t h = lz_hash(value);
+        size_t candidate = table[h];
+        table[h] = (uint32_t) (i + 1);
+
+        if (candidate == 0 || i - (candidate-1) > LZ_MAX_OFFSET || read32(in + candidate-1) != value)
+        {
+            i++;
+            continue;
+        }
+
+        size_t match_start = candidate - 1;
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < size && in[match_start + length] == in[i + length])
+            length++;
+
+        o = put_sequence(out, o, capacity, in + anchor, i - anchor, i - match_start, length);
+        if (o == 0)
+            return 0;
+
+        i += length;
+        anchor = i;
+    }
+
+    o = put_sequence(out, o, capacity, in + anchor, size - anchor, 0, 0);
+    return o;
+}
+
+static int lz_decode(const uint8_t *in, size_t size, uint8_t *out, size_t out_size)
+{
+    size_t i = 0, o = 0;
+    while (i < size)
+    {
+        uint8_t token = in[i++];
+
+        size_t literal_count = token >> 4;
+        if (literal_count == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (i >= size)
+                    return -1;
+                byte = in[i++];
+                literal_count += byte;
+            } while (byte == 255);
+        }
+
+        if (literal_count > size - i || literal_count > out_size - o)
+            return -1;
+        memcpy(out + o, in + i, literal_count);
+        i += literal_count;
+        o += literal_count;
+
+        if (i == size)
+            break;
+
+        if (size - i < 2)
+            return -1;
+        size_t offset = in[i] | (size_t) in[i+1] << 8;
+        i += 2;
+        if (offset == 0 || offset > o)
+            return -1;
+
+        size_t match = token & 15;
+        if (match == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (i >= size)
+                    return -1;
+                byte = in[i++];
+                match += byte;
+            } while (byte == 255);
+        }
+        match += LZ_MIN_MATCH;
+
+        if (match > out_size - o)
+            return -1;
+        // Byte by byte, matches may overlap what they produce
+        const uint8_t *from = out + o - offset;
+        for (size_t k = 0 ; k < match ; k++)
+            out[o + k] = from[k];
+        o += match;
+    }
+    return o == out_size ? 0 : -1;
+}
+
+// CODEC
+
+size_t codec_encode(const uint8_t *in, size_t size, uint8_t *out, size_t capacity)
+{
+    if (size == 0 || size > CODEC_MAX_INPUT)
+        return 0;
+
+    uint8_t lut[256];
+    uint8_t palette[256];
+    bool seen[256] = {0};
+    int palette_count = 0;
+    for (size_t i = 0 ; i < size ; )
+    {
+        uint8_t type = in[i];
+        if (!seen[type])
+        {
+            seen[type] = true;
+            lut[type] = (uint8_t) palette_count;
+            palette[palette_count++] = type;
+        }
+        i += run_length(in, i, size);
+    }
+
+    bool nibbles = palette_count <= 16;
+    uint8_t runs[CODEC_RUNS_BOUND];
+    size_t runs_size = encode_runs(in, size, lut, nibbles, runs);
+
+    size_t header = 2 + palette_count;
+    if (capacity < header)
+        return 0;
+    out[0] = nibbles ? CODEC_FLAG_NIBBLES : 0;
+    out[1] = (uint8_t) (palette_count - 1);
+    memcpy(out + 2, palette, palette_count);
+
+    // LZ straight into the output, it only stays if it beats the plain runs
+    size_t length_size = varint_size((uint32_t) runs_size);
+    if (capacity > header + length_size)
+    {
+        size_t limit = capacity - header - length_size;
+        if (limit > runs_size)
+            limit = runs_size;
+        size_t lz_size = lz_encode(runs, runs_size, out + header + length_size, limit);
+        if (lz_size && lz_size + length_size < runs_size)
+        {
+            out[0] |= CODEC_FLAG_LZ;
+            put_varint(out + header, (uint32_t) runs_size);
+            return header + length_size + lz_size;
+        }
+    }
+
+    if (runs_size > capacity - header)
+        return 0;
+    memcpy(out + header, runs, runs_size);
+    return header + runs_size;
+}
+
+int codec_decode(const uint8_t *in, size_t size, uint8_t *out, size_t out_size)
+{
+    if (size < 2 || out_size == 0 || out_size > CODEC_MAX_INPUT)
+        return -1;
+
+    uint8_t flags = in[0];
+    int palette_count = in[1] + 1;
+    size_t i = 2 + palette_count;
+    if (i > size || (flags & ~(CODEC_FLAG_LZ | CODEC_FLAG_NIBBLES)))
+        return -1;
+
+    const uint8_t *palette = in + 2;
+    bool nibbles = flags & CODEC_FLAG_NIBBLES;
+    if (nibbles && palette_count > 16)
+        return -1;
+
+    if ((flags & CODEC_FLAG_LZ) == 0)
+        return decode_runs(in + i, size - i, palette, palette_count, nibbles, out, out_size);
+
+    uint32_t runs_size;
+    if (get_varint(in, size, &i, &runs_size) || runs_size > CODEC_RUNS_BOUND)
+        return -1;
+
+    uint8_t runs[CODEC_RUNS_BOUND];
+    if (lz_decode(in + i, size - i, runs, runs_size))
+        return -1;
+    return decode_runs(runs, runs_size, palette, palette_count, nibbles, out, out_size);
+}
+
+// STREAMS
+
+void codec_stream_init(struct CodecStream *stream, uint8_t *buffer, size_t capacity)
+{
+    *stream = (struct CodecStream){
+        .buffer = buffer,
+        .capacity = capacity
+    };
+}
+
+int codec_stream_write(struct CodecStream *stream, const struct Chunk *chunk)
+{
+    if (stream->capacity - stream->used < 4)
+        return -1;
+
+    size_t size = codec_encode(chunk->voxel_type, VOXEL_BYTES, stream->buffer + stream->used + 4, stream->capacity - stream->used - 4);
+    if (size == 0)
+        return -1;
+
+    uint8_t *length = stream->buffer + stream->used;
+    length[0] = (uint8_t) size;
+    length[1] = (uint8_t) (size >> 8);
+    length[2] = (uint8_t) (size >> 16);
+    length[3] = (uint8_t) (size >> 24);
+
+    stream->used += 4 + size;
+    stream->raw_bytes += VOXEL_BYTES;
+    return 0;
+}
+
+int codec_stream_read(struct CodecStream *stream, struct Chunk *chunk)
+{
+    if (stream->used == stream->capacity)
+        return 1;
+    if (stream->capacity - stream->used < 4)
+        return -1;
+
+    const uint8_t *length = stream->buffer + stream->used;
+    size_t size = length[0] | (size_t) length[1] << 8 | (size_t) length[2] << 16 | (size_t) length[3] << 24;
+    if (size > stream->capacity - stream->used - 4)
+        return -1;
+
+    if (codec_decode(stream->buffer + stream->used + 4, size, chunk->voxel_type, VOXEL_BYTES))
+        return -1;
+
+    stream->used += 4 + size;
+    stream->raw_bytes += VOXEL_BYTES;
+    return 0;
+}
+
+// VERIFICATION
+
+static int round_trip(const struct Chunk *chunk, struct Chunk *decoded, uint8_t *encoded, const char *name)
+{
+    int failures = 0;
+
+    // A raw chunk always fits in the bound, even when it doesn't compress
+    size_t size = codec_encode(chunk->voxel_type, VOXEL_BYTES, encoded, CODEC_RUNS_BOUND + 512);
+    if (size == 0 || codec_decode(encoded, size, decoded->voxel_type, VOXEL_BYTES)
+        || memcmp(chunk->voxel_type, decoded->voxel_type, VOXEL_BYTES))
+    {
+        LOG_WARN(LOG_CODEC, "%s didn't round trip", name);
+        return 1;
+    }
+
+    // Cut short anywhere it has to be rejected, never read or written out of bounds
+    for (size_t cut = 0 ; cut < size ; cut += 1 + cut/8)
+    {
+        if (codec_decode(encoded, cut, decoded->voxel_type, VOXEL_BYTES) == 0)
+        {
+            LOG_INFO(LOG_CODEC, "%s decoded from %zu of %zu bytes", name, cut, size);
+            failures++;
+            break;
+        }
+    }
+
+    for (size_t i = 0 ; i < VOXEL_BYTES ; i += 7)
+    {
+        if (run_length(chunk->voxel_type, i, VOXEL_BYTES) != run_length_scalar(chunk->voxel_type, i, VOXEL_BYTES))
+        {
+            LOG_WARN(LOG_CODEC, "%s vector run length differs at %zu", name, i);
+            failures++;
+            break;
+        }
+    }
+
+    return failures;
+}
+
+int codec_verify(const struct Terrain *terrain)
+{
+    struct Chunk *chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    struct Chunk *decoded = (struct Chunk *) malloc(sizeof(struct Chunk));
+    uint8_t *encoded = (uint8_t *) malloc(CODEC_RUNS_BOUND + 512);
+    int failures = 0;
+
+    if (chunk == NULL || decoded == NULL || encoded == NULL)
+    {
+        LOG_ERROR(LOG_CODEC, "Unable to allocate verification buffers.");
+        free(chunk);
+        free(decoded);
+        free(encoded);
+        return 1;
+    }
+
+    // Sky, surface and underground
+    for (int y = -3 ; y <= 2 ; y++)
+    {
+        struct ChunkCoord coord = { y*3, y, -y*2 };
+        terrain_generate_chunk(terrain, chunk, coord);
+        failures += round_trip(chunk, decoded, encoded, "terrain");
+    }
+
+    memset(chunk->voxel_type, VOXEL_STONE, VOXEL_BYTES);
+    failures += round_trip(chunk, decoded, encoded, "uniform");
+
+    // Every run has length 1
+    for (size_t i = 0 ; i < VOXEL_BYTES ; i++)
+        chunk->voxel_type[i] = (uint8_t) (i & 1);
+    failures += round_trip(chunk, decoded, encoded, "alternating");
+
+    // Too many types for nibbles
+    for (size_t i = 0 ; i < VOXEL_BYTES ; i++)
+        chunk->voxel_type[i] = (uint8_t) ((i / 37) % 40);
+    failures += round_trip(chunk, decoded, encoded, "wide palette");
+
+    uint32_t state = 0x12345678u;
+    for (size_t i = 0 ; i < VOXEL_BYTES ; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        chunk->voxel_type[i] = (uint8_t) state;
+    }
+    failures += round_trip(chunk, decoded, encoded, "noise");
+
+    // Noise doesn't fit in less than its raw size
+    if (codec_encode(chunk->voxel_type, VOXEL_BYTES, encoded, VOXEL_BYTES) != 0)
+    {
+        LOG_WARN(LOG_CODEC, "noise claimed to fit in its raw size");
+        failures++;
+    }
+
+    uint8_t *buffer = (uint8_t *) malloc(4*VOXEL_BYTES);
+    if (buffer)
+    {
+        struct CodecStream stream;
+        codec_stream_init(&stream, buffer, 4*VOXEL_BYTES);
+        int written = 0;
+        for (int y = -2 ; y <= 1 ; y++)
+        {
+            struct ChunkCoord coord = { 0, y, 0 };
+            terrain_generate_chunk(terrain, chunk, coord);
+            if (codec_stream_write(&stream, chunk) == 0)
+                written++;
+        }
+
+        codec_stream_init(&stream, buffer, stream.used);
+        int read = 0;
+        for (int y = -2 ; codec_stream_read(&stream, decoded) == 0 ; y++, read++)
+        {
+            struct ChunkCoord coord = { 0, y, 0 };
+            terrain_generate_chunk(terrain, chunk, coord);
+            if (memcmp(chunk->voxel_type, decoded->voxel_type, VOXEL_BYTES))
+                failures++;
+        }
+        if (read != written || written != 4)
+        {
+            LOG_WARN(LOG_CODEC, "Stream gave back %d of %d chunks", read, written);
+            failures++;
+        }
+        free(buffer);
+    }
+
+    free(chunk);
+    free(decoded);
+    free(encoded);
+    return failures;
+}
+
+void codec_benchmark(const struct Terrain *terrain, int count)
+{
+    struct Chunk *chunks = (struct Chunk *) malloc(count*sizeof(struct Chunk));
+    struct Chunk *decoded = (struct Chunk *) malloc(sizeof(struct Chunk));
+    uint8_t *encoded = (uint8_t *) malloc(count*(size_t) (CODEC_RUNS_BOUND + 512));
+    size_t *sizes = (size_t *) calloc(count, sizeof(size_t));
+
+    if (chunks == NULL || decoded == NULL || encoded == NULL || sizes == NULL)
+    {
+        LOG_ERROR(LOG_CODEC, "Unable to allocate benchmark buffers.");
+        free(chunks);
+        free(decoded);
+        free(encoded);
+        free(sizes);
+        return;
+    }
+
+    // A slab around the surface, mostly what gets saved
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkCoord coord = { i % 8, (i / 64) % 4 - 2, (i / 8) % 8 };
+        terrain_generate_chunk(terrain, &chunks[i], coord);
+    }
+
+    const int repetitions = 8;
+    size_t stride = CODEC_RUNS_BOUND + 512;
+    size_t total = 0;
+
+    uint64_t start = timer_now_ns();
+    for (int r = 0 ; r < repetitions ; r++)
+    {
+        for (int i = 0 ; i < count ; i++)
+            sizes[i] = codec_encode(chunks[i].voxel_type, VOXEL_BYTES, encoded + i*stride, stride);
+    }
+    uint64_t encode_ns = timer_now_ns() - start;
+
+    int failures = 0;
+    start = timer_now_ns();
+    for (int r = 0 ; r < repetitions ; r++)
+    {
+        for (int i = 0 ; i < count ; i++)
+        {
+            if (codec_decode(encoded + i*stride, sizes[i], decoded->voxel_type, VOXEL_BYTES))
+                failures++;
+        }
+    }
+    uint64_t decode_ns = timer_now_ns() - start;
+
+    for (int i = 0 ; i < count ; i++)
+        total += sizes[i];
+
+    double raw = (double) count * VOXEL_BYTES * repetitions;
+    printf("[Codec] %d terrain chunks, ratio %.1f:1 (%.1f bytes per chunk), encode %.2f GB/s, decode %.2f GB/s%s\n",
+            count, (double) count * VOXEL_BYTES / total, (double) total / count,
+            raw / (encode_ns * 1e-9) / 1e9, raw / (decode_ns * 1e-9) / 1e9,
+            failures ? ", DECODE FAILURES" : "");
+
+    free(chunks);
+    free(decoded);
+    free(encoded);
+    free(sizes);
+}
@@ -0,0 +1,47 @@
+#include <pthread.h>
+#include <crc.h>
+
+#define CRC32_POLYNOMIAL 0xedb88320u
+
+// Four tables so the loop can eat a 32 bit word at a time
+static uint32_t tables[4][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void build_tables(void)
+{
+    for (uint32_t i = 0 ; i < 256 ; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0 ; bit < 8 ; bit++)
+            crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & -(crc & 1));
+        tables[0][i] = crc;
+    }
+
+    for (uint32_t i = 0 ; i < 256 ; i++)
+    {
+        for (int t = 1 ; t < 4 ; t++)
+            tables[t][i] = (tables[t-1][i] >> 8) ^ tables[0][tables[t-1][i] & 0xff];
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    pthread_once(&tables_once, build_tables);
+
+    const uint8_t *bytes = (const uint8_t *) data;
+    crc = ~crc;
+
+    // Assembled by hand so the result doesn't depend on byte order
+    while (size >= 4)
+    {
+        crc ^= (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+        crc = tables[3][crc & 0xff] ^ tables[2][(crc >> 8) & 0xff] ^ tables[1][(crc >> 16) & 0xff] ^ tables[0][crc >> 24];
+        bytes += 4;
+        size -= 4;
+    }
+
+    while (size--)
+        crc = (crc >> 8) ^ tables[0][(crc ^ *bytes++) & 0xff];
+
+    return ~crc;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <epoch.h>
+#include <log.h>
+
+// One per thread, on its own cache line so pins don't bounce each other
+struct EpochRecord
+{
+    // epoch the thread pinned at, 0 while it isn't pinned
+    uint64_t epoch;
+    bool used;
+} __attribute__((aligned(64)));
+
+struct Retired
+{
+    void *pointer;
+    EpochFree free_func;
+    uint64_t epoch;
+    struct Retired *next;
+};
+
+static uint64_t global_epoch = 1;
+static struct EpochRecord records[EPOCH_MAX_THREADS];
+
+// Retired in epoch order, collection frees from the head
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct Retired *retired_head, *retired_tail;
+static size_t since_collect;
+static struct EpochStats stats;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+static __thread struct EpochRecord *thread_record;
+static __thread int thread_depth;
+
+// Hands the slot back when a registered thread exits
+static void release_record(void *pointer)
+{
+    struct EpochRecord *record = (struct EpochRecord *) pointer;
+    __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&record->used, false, __ATOMIC_RELEASE);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+static struct EpochRecord *register_thread(void)
+{
+    pthread_once(&key_once, create_key);
+
+    for (int i = 0 ; i < EPOCH_MAX_THREADS ; i++)
+    {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&records[i].used, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            thread_record = &records[i];
+            pthread_setspecific(record_key, thread_record);
+            return thread_record;
+        }
+    }
+
+    // Pinning without a record would free memory under this thread's feet
+    LOG_ERROR(LOG_EPOCH, "More than %d threads touch world data.", EPOCH_MAX_THREADS);
+    log_flush();
+    abort();
+}
+
+void epoch_pin(void)
+{
+    if (thread_depth++ > 0)
+        return;
+
+    struct EpochRecord *record = thread_record ? thread_record : register_thread();
+    __atomic_store_n(&record->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    // Collectors either see the pin, or this thread sees everything they unlinked
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_unpin(void)
+{
+    if (--thread_depth > 0)
+        return;
+    __atomic_store_n(&thread_record->epoch, 0, __ATOMIC_RELEASE);
+}
+
+bool epoch_pinned(void)
+{
+    return thread_depth > 0;
+}
+
+void epoch_retire(void *pointer, EpochFree free_func)
+{
+    if (pointer == NULL)
+        return;
+
+    struct Retired *node = (struct Retired *) malloc(sizeof(struct Retired));
+    if (node == NULL)
+    {
+        LOG_ERROR(LOG_EPOCH, "Unable to retire %p, leaking it.", pointer);
+        return;
+    }
+    node->pointer = pointer;
+    node->free_func = free_func;
+    node->next = NULL;
+
+    pthread_mutex_lock(&retire_lock);
+    node->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    if (retired_tail)
+        retired_tail->next = node;
+    else
+        retired_head = node;
+    retired_tail = node;
+    stats.retired++;
+    bool collect = ++since_collect >= EPOCH_COLLECT_THRESHOLD;
+    pthread_mutex_unlock(&retire_lock);
+
+    if (collect)
+        epoch_collect();
+}
+
+size_t epoch_collect(void)
+{
+    pthread_mutex_lock(&retire_lock);
+    since_collect = 0;
+
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool behind = false;
+    for (int i = 0 ; i < EPOCH_MAX_THREADS && !behind ; i++)
+    {
+        if (!__atomic_load_n(&records[i].used, __ATOMIC_ACQUIRE))
+            continue;
+        uint64_t pinned = __atomic_load_n(&records[i].epoch, __ATOMIC_SEQ_CST);
+        behind = pinned != 0 && pinned != epoch;
+    }
+
+    if (behind)
+    {
+        stats.stalls++;
+    }
+    else
+    {
+        epoch++;
+        __atomic_store_n(&global_epoch, epoch, __ATOMIC_SEQ_CST);
+    }
+
+    // Two epochs back, every thread that could have seen these has unpinned since
+    struct Retired *head = NULL, *tail = NULL;
+    size_t count = 0;
+    while (retired_head && retired_head->epoch + 2 <= epoch)
+    {
+        struct Retired *node = retired_head;
+        retired_head = node->next;
+        node->next = NULL;
+        if (tail)
+            tail->next = node;
+        else
+            head = node;
+        tail = node;
+        count++;
+    }
+    if (retired_head == NULL)
+        retired_tail = NULL;
+    stats.freed += count;
+    pthread_mutex_unlock(&retire_lock);
+
+    while (head)
+    {
+        struct Retired *next = head->next;
+        head->free_func(head->pointer);
+        free(head);
+        head = next;
+    }
+    return count;
+}
+
+void epoch_barrier(void)
+{
+    for (;;)
+    {
+        epoch_collect();
+
+        pthread_mutex_lock(&retire_lock);
+        bool empty = retired_head == NULL;
+        pthread_mutex_unlock(&retire_lock);
+        if (empty)
+            return;
+        sched_yield();
+    }
+}
+
+void epoch_get_stats(struct EpochStats *out)
+{
+    pthread_mutex_lock(&retire_lock);
+    *out = stats;
+    out->epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    out->pending = stats.retired - stats.freed;
+    pthread_mutex_unlock(&retire_lock);
+}
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+#include <cglm/struct.h>
+#include <flythrough.h>
+#include <render.h>
+#include <voxel.h>
+#include <loader.h>
+#include <scheduler.h>
+#include <job.h>
+#include <stream.h>
+#include <terrain.h>
+#include <worldgen.h>
+#include <reclaim.h>
+#include <epoch.h>
+#include <nullgl.h>
+#include <framestats.h>
+#include <profile.h>
+#include <timer.h>
+#include <memtrack.h>
+#include <arena.h>
+#include <framepacket.h>
+#include <log.h>
+
+enum FlythroughPhase
+{
+    // whole frame without the pacing, what the percentiles are about
+    PHASE_FRAME,
+    // loader poll and scheduler
+    PHASE_POLL,
+    // frustum culling, unloading and dispatch to the workers
+    PHASE_UPDATE,
+    // visible list into a frame packet, and its draw commands
+    PHASE_RENDER,
+    // present and events
+    PHASE_SWAP,
+    // sleeping until the next frame is due, left out of the frame
+    PHASE_WAIT,
+    PHASE_COUNT
+};
+
+static const char *phase_names[PHASE_COUNT] = { "frame", "poll", "update", "render", "swap", "wait" };
+
+struct Flythrough
+{
+    GLFWwindow *window;
+    bool null_device;
+    struct FrameStats phases[PHASE_COUNT];
+    uint64_t visible_total;
+    // packets go through it like in the engine, only on one thread
+    struct FrameExchange exchange;
+};
+
+static void generate_terrain(struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    terrain_generate_chunk((struct Terrain *) user, chunk, coord);
+}
+
+/*
+ * The camera sweeps its heading left and right and bobs up and down while
+ * flying forward, so chunks enter the frustum from the sides as well.
+ * */
+static void camera_path(struct Camera *camera, int frame)
+{
+    float t = frame * FLYTHROUGH_FRAME_DELTA;
+
+    camera->yaw = 30.0f * sinf(t * 0.4f);
+    camera->pitch = -15.0f + 10.0f * sinf(t * 0.7f);
+    camera->direction[0] = cos(glm_rad(camera->yaw)) * cos(glm_rad(camera->pitch));
+    camera->direction[1] = sin(glm_rad(camera->pitch));
+    camera->direction[2] = sin(glm_rad(camera->yaw)) * cos(glm_rad(camera->pitch));
+
+    // forward along the heading, level so the path doesn't dive into the ground
+    vec3 heading = { camera->direction[0], 0.0f, camera->direction[2] };
+    glm_normalize(heading);
+    glm_vec3_scale(heading, FLYTHROUGH_SPEED * FLYTHROUGH_FRAME_DELTA, heading);
+    glm_vec3_add(camera->position, heading, camera->position);
+
+    camera_process(camera);
+}
+
+/*
+ * Stands in for vsync, the workers get the same wall clock time per frame
+ * as they would in the engine.
+ * */
+static void wait_until(uint64_t deadline_ns)
+{
+    uint64_t now = timer_now_ns();
+    if (now >= deadline_ns)
+        return;
+    uint64_t wait = deadline_ns - now;
+    struct timespec duration = { (time_t) (wait / 1000000000ull), (long) (wait % 1000000000ull) };
+    nanosleep(&duration, NULL);
+}
+
+/*
+ * OSMesa first, it rasterizes for real. Without it the window gets no
+ * context and GL goes to the null device.
+ * */
+static int open_window(struct Flythrough *bench)
+{
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if (!glfwInit())
+    {
+        LOG_ERROR(LOG_BENCH, "Unable to initialize glfw on the null platform.");
+        return -1;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    bench->window = glfwCreateWindow(900, 900, "Voyager [Bench]", NULL, NULL);
+    if (bench->window)
+    {
+        glfwMakeContextCurrent(bench->window);
+        if (gladLoadGL(glfwGetProcAddress))
+            return 0;
+        glfwDestroyWindow(bench->window);
+    }
+
+    LOG_INFO(LOG_BENCH, "No OSMesa context, using the null GL device.");
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    bench->window = glfwCreateWindow(900, 900, "Voyager [Bench]", NULL, NULL);
+    if (bench->window == NULL || null_gl_load())
+    {
+        LOG_ERROR(LOG_BENCH, "Unable to open a window.");
+        glfwTerminate();
+        return -1;
+    }
+    bench->null_device = true;
+    return 0;
+}
+
+static void write_phase(FILE *file, const char *name, struct FrameStats *stats, bool last)
+{
+    struct FrameStatsSummary summary;
+    frame_stats_compute(stats, &summary);
+    fprintf(file, "    \"%s\": {\"min_ms\": %.4f, \"avg_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+            name, summary.min_ms, summary.avg_ms, summary.p50_ms, summary.p95_ms, summary.p99_ms, summary.max_ms, last ? "" : ",");
+}
+
+static void write_work(FILE *file, const char *name, uint64_t count, uint64_t ns, bool last)
+{
+    fprintf(file, "    \"%s\": {\"count\": %llu, \"total_ms\": %.3f, \"avg_ms\": %.4f}%s\n",
+            name, (unsigned long long) count, ns / 1e6, count ? ns / 1e6 / count : 0.0, last ? "" : ",");
+}
+
+static int write_results(struct Flythrough *bench, const char *path, int frames, double seconds, struct ChunkStream *stream, struct Worldgen *worldgen)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        LOG_ERROR(LOG_BENCH, "Unable to write %s.", path);
+        return -1;
+    }
+
+    struct StreamStats stats;
+    stream_get_stats(stream, &stats);
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"mode\": \"flythrough\",\n");
+    fprintf(file, "  \"renderer\": \"%s\",\n", bench->null_device ? "null" : "osmesa");
+    fprintf(file, "  \"frames\": %d,\n", frames);
+    fprintf(file, "  \"seconds\": %.3f,\n", seconds);
+    fprintf(file, "  \"frame_delta\": %.6f,\n", FLYTHROUGH_FRAME_DELTA);
+
+    // percentiles cover the last FRAME_STATS_WINDOW frames
+    fprintf(file, "  \"phases\": {\n");
+    for (int phase = 0 ; phase < PHASE_COUNT ; phase++)
+        write_phase(file, phase_names[phase], &bench->phases[phase], phase == PHASE_COUNT-1);
+    fprintf(file, "  },\n");
+
+    // camera step to the end of the swap, pacing left out
+    struct FrameStatsSummary latency;
+    frame_stats_compute(&bench->exchange.latency, &latency);
+    fprintf(file, "  \"input_to_swap\": {\"avg_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f},\n",
+            latency.avg_ms, latency.p50_ms, latency.p95_ms, latency.p99_ms, latency.max_ms);
+
+    fprintf(file, "  \"workers\": {\n");
+    write_work(file, "generate", stats.work.generated, stats.work.generate_ns, false);
+    write_work(file, "mesh", stats.work.meshed, stats.work.mesh_ns, false);
+    write_work(file, "texture", stats.work.textures, stats.work.texture_ns, worldgen == NULL);
+    if (worldgen)
+    {
+        static const char *stage_names[WORLDGEN_STAGE_COUNT] = { "empty", "density", "caves", "surface", "structures" };
+        pthread_mutex_lock(&worldgen->lock);
+        for (int stage = WORLDGEN_DENSITY ; stage < WORLDGEN_STAGE_COUNT ; stage++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "worldgen_%s", stage_names[stage]);
+            write_work(file, name, worldgen->stage_runs[stage], worldgen->stage_ns[stage], stage == WORLDGEN_FINAL_STAGE);
+        }
+        pthread_mutex_unlock(&worldgen->lock);
+    }
+    fprintf(file, "  },\n");
+
+    fprintf(file, "  \"stream\": {\"loaded\": %llu, \"unloaded\": %llu, \"resident\": %zu, \"visible_per_frame\": %.2f, \"latency_avg_ms\": %.3f, \"latency_max_ms\": %.3f}",
+            (unsigned long long) stats.loaded, (unsigned long long) stats.unloaded, stats.resident,
+            frames ? (double) bench->visible_total / frames : 0.0,
+            stats.latency_samples ? stats.latency_total_ms / stats.latency_samples : 0.0, stats.latency_max_ms);
+
+    if (bench->null_device)
+    {
+        struct NullGlStats gl;
+        null_gl_get_stats(&gl);
+        fprintf(file, ",\n  \"gl\": {\"draws_per_frame\": %.2f, \"vertices_per_frame\": %.0f, \"textures\": %llu, \"texture_bytes\": %llu, \"buffer_bytes\": %llu}",
+                frames ? (double) gl.draws / frames : 0.0, frames ? (double) gl.vertices / frames : 0.0,
+                (unsigned long long) gl.textures, (unsigned long long) gl.texture_bytes, (unsigned long long) gl.buffer_bytes);
+    }
+
+    // while the world is still loaded, the GL tags are estimates
+    struct MemoryStats memory;
+    mem_get_stats(&memory);
+    fprintf(file, ",\n  \"memory\": {\n");
+    for (int tag = 0 ; tag < MEM_TAG_COUNT ; tag++)
+        fprintf(file, "    \"%s\": {\"live_bytes\": %lld, \"peak_bytes\": %lld, \"allocations\": %llu}%s\n",
+                mem_tag_name(tag), (long long) memory.tags[tag].live_bytes, (long long) memory.tags[tag].peak_bytes,
+                (unsigned long long) memory.tags[tag].allocations, tag == MEM_TAG_COUNT-1 ? "" : ",");
+    fprintf(file, "  },\n");
+
+    struct FrameArenaStats arena;
+    frame_arena_get_stats(&arena);
+    fprintf(file, "  \"frame_arena\": {\"threads\": %d, \"reserved_bytes\": %zu, \"peak_frame_bytes\": %zu, \"overflows\": %llu}",
+            arena.threads, arena.reserved_bytes, arena.peak_frame_bytes, (unsigned long long) arena.overflows);
+    fprintf(file, "\n}\n");
+
+    fclose(file);
+    return 0;
+}
+
+int flythrough_run(int frames, const char *path)
+{
+    struct Flythrough *bench = (struct Flythrough *) calloc(1, sizeof(struct Flythrough));
+    if (bench == NULL || open_window(bench))
+    {
+        free(bench);
+        return -1;
+    }
+    LOG_INFO(LOG_BENCH, "%d frames on %s", frames, glGetString(GL_VERSION));
+
+    for (int phase = 0 ; phase < PHASE_COUNT ; phase++)
+    {
+        frame_stats_init(&bench->phases[phase]);
+        bench->phases[phase].summary_seconds = 0.0;
+    }
+    frame_exchange_init(&bench->exchange);
+
+    struct Camera camera = {
+        .fov = 70.0f,
+        .speed = FLYTHROUGH_SPEED,
+        .position = {0.0f, 8.0f, 0.0f},
+        .up = {0.0f, 1.0f, 0.0f},
+        .width = 900,
+        .height = 900
+    };
+    glm_perspective(camera.fov, 1.0f, 0.001f, MAX_RENDER_DISTANCE, camera.projection);
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+
+    // textures are built on the render thread, one less thread to schedule
+    struct Loader loader;
+    loader_init(&loader, bench->window, false);
+    struct Lattice chunk_mesh;
+    load_lattice(&chunk_mesh, &loader, "resources/lattice_vertex.glsl", "resources/lattice_fragment.glsl", CHUNK_WIDTH);
+    struct GpuReclaim reclaim;
+    gpu_reclaim_init(&reclaim);
+    struct FrameScheduler scheduler;
+    scheduler_init(&scheduler);
+
+    struct JobPool workers;
+    if (job_pool_init(&workers, 0))
+    {
+        LOG_ERROR(LOG_BENCH, "Unable to start the worker threads.");
+        glfwTerminate();
+        free(bench);
+        return -1;
+    }
+
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+    struct Worldgen worldgen;
+    bool use_worldgen = worldgen_init(&worldgen, &terrain, &workers) == 0;
+
+    // nothing from disk, every run generates the same chunks
+    struct ChunkStream stream;
+    stream_init(&stream, &workers, &loader, &reclaim, &scheduler, generate_terrain, &terrain);
+    if (use_worldgen)
+        stream_use_worldgen(&stream, &worldgen);
+
+    PROFILE_THREAD("render");
+    uint64_t bench_start = timer_now_ns();
+    uint64_t frame_start = bench_start;
+
+    for (int frame = 0 ; frame < frames ; frame++)
+    {
+        PROFILE_FRAME();
+        frame_arena_begin();
+        gpu_reclaim_set_frame(&reclaim, frame + 1);
+        uint64_t times[PHASE_COUNT+1];
+
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        uint64_t input_ns = timer_now_ns();
+        camera_path(&camera, frame);
+
+        times[PHASE_POLL] = timer_now_ns();
+        loader_poll(&loader);
+        scheduler_run_frame(&scheduler, camera.position);
+
+        times[PHASE_UPDATE] = timer_now_ns();
+        stream_update(&stream, &camera, FLYTHROUGH_FRAME_DELTA);
+
+        times[PHASE_RENDER] = timer_now_ns();
+        struct FramePacket *packet = frame_exchange_write(&bench->exchange);
+        if (frame_packet_reserve(packet, stream.ready_count) == 0)
+        {
+            packet->frame = frame + 1;
+            packet->input_ns = input_ns;
+            packet->camera = camera;
+            size_t count = stream_collect_draws(&stream, &camera, packet->draws, packet->draw_capacity);
+            packet->draw_count = count < packet->draw_capacity ? count : packet->draw_capacity;
+            frame_exchange_publish(&bench->exchange);
+        }
+        packet = frame_exchange_acquire(&bench->exchange);
+        if (packet)
+        {
+            stream_draw_list(packet->draws, packet->draw_count, &chunk_mesh, &packet->camera);
+            gpu_reclaim_frame_drawn(&reclaim, packet->frame);
+        }
+
+        times[PHASE_SWAP] = timer_now_ns();
+        if (!bench->null_device)
+            glfwSwapBuffers(bench->window);
+        if (packet)
+            frame_exchange_presented(&bench->exchange, packet);
+        glfwPollEvents();
+
+        times[PHASE_WAIT] = timer_now_ns();
+        wait_until(bench_start + (uint64_t) ((frame + 1) * (double) FLYTHROUGH_FRAME_DELTA * 1e9));
+
+        times[PHASE_COUNT] = timer_now_ns();
+        for (int phase = PHASE_POLL ; phase < PHASE_COUNT ; phase++)
+            frame_stats_push(&bench->phases[phase], (times[phase+1] - times[phase]) / 1e6);
+        frame_stats_push(&bench->phases[PHASE_FRAME], (times[PHASE_WAIT] - frame_start) / 1e6);
+        frame_start = times[PHASE_COUNT];
+
+        struct StreamStats stats;
+        stream_get_stats(&stream, &stats);
+        bench->visible_total += stats.visible;
+    }
+
+    double seconds = (timer_now_ns() - bench_start) / 1e9;
+    stream_print_stats(&stream);
+    mem_print_stats();
+    frame_arena_print_stats();
+    // without the pacing, the rate is what the frames would sustain
+    frame_stats_print(&bench->phases[PHASE_FRAME]);
+    frame_exchange_print_stats(&bench->exchange);
+
+    int error = write_results(bench, path, frames, seconds, &stream, use_worldgen ? &worldgen : NULL);
+    if (error == 0)
+        LOG_INFO(LOG_BENCH, "results written to %s", path);
+
+    loader_shutdown(&loader);
+    stream_shutdown(&stream);
+    epoch_barrier();
+    gpu_reclaim_shutdown(&reclaim);
+    if (use_worldgen)
+        worldgen_shutdown(&worldgen);
+    scheduler_free(&scheduler);
+    job_pool_shutdown(&workers);
+
+    frame_exchange_free(&bench->exchange);
+    glfwDestroyWindow(bench->window);
+    glfwTerminate();
+    free(bench);
+    return error;
+}
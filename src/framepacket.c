@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <framepacket.h>
+#include <timer.h>
+#include <log.h>
+
+// Set on ready while the renderer hasn't taken the packet
+#define FRAME_EXCHANGE_FRESH 4
+#define FRAME_EXCHANGE_SLOT_MASK 3
+
+int frame_exchange_init(struct FrameExchange *exchange)
+{
+    memset(exchange, 0, sizeof(struct FrameExchange));
+    exchange->write = 0;
+    exchange->ready = 1;
+    exchange->read = 2;
+
+    frame_stats_init(&exchange->latency);
+    // Latencies don't add up to time passing, the frame stats summarize for us
+    exchange->latency.summary_seconds = 0.0;
+    return 0;
+}
+
+struct FramePacket *frame_exchange_write(struct FrameExchange *exchange)
+{
+    return &exchange->packets[exchange->write];
+}
+
+int frame_packet_reserve(struct FramePacket *packet, size_t count)
+{
+    if (count <= packet->draw_capacity)
+        return 0;
+
+    size_t grown = packet->draw_capacity ? packet->draw_capacity : 256;
+    while (grown < count)
+        grown *= 2;
+    struct ChunkDraw *draws = (struct ChunkDraw *) realloc(packet->draws, grown*sizeof(struct ChunkDraw));
+    if (draws == NULL)
+    {
+        LOG_ERROR(LOG_FRAME, "Unable to grow a frame packet to %zu draws.", count);
+        return -1;
+    }
+    packet->draws = draws;
+    packet->draw_capacity = grown;
+    return 0;
+}
+
+void frame_exchange_publish(struct FrameExchange *exchange)
+{
+    // Release hands the packet's contents over along with the index
+    int previous = __atomic_exchange_n(&exchange->ready, exchange->write | FRAME_EXCHANGE_FRESH, __ATOMIC_ACQ_REL);
+    exchange->write = previous & FRAME_EXCHANGE_SLOT_MASK;
+
+    __atomic_add_fetch(&exchange->stats.published, 1, __ATOMIC_RELAXED);
+    if (previous & FRAME_EXCHANGE_FRESH)
+        __atomic_add_fetch(&exchange->stats.dropped, 1, __ATOMIC_RELAXED);
+}
+
+struct FramePacket *frame_exchange_acquire(struct FrameExchange *exchange)
+{
+    if (__atomic_load_n(&exchange->ready, __ATOMIC_RELAXED) & FRAME_EXCHANGE_FRESH)
+    {
+        int previous = __atomic_exchange_n(&exchange->ready, exchange->read, __ATOMIC_ACQ_REL);
+        exchange->read = previous & FRAME_EXCHANGE_SLOT_MASK;
+        exchange->presented = false;
+    }
+
+    // Slots start out empty, the first publish is the first packet with a frame
+    struct FramePacket *packet = &exchange->packets[exchange->read];
+    return packet->frame ? packet : NULL;
+}
+
+void frame_exchange_presented(struct FrameExchange *exchange, const struct FramePacket *packet)
+{
+    frame_stats_push(&exchange->latency, (timer_now_ns() - packet->input_ns) / 1e6);
+
+    __atomic_add_fetch(&exchange->stats.presented, 1, __ATOMIC_RELAXED);
+    if (exchange->presented)
+        __atomic_add_fetch(&exchange->stats.repeated, 1, __ATOMIC_RELAXED);
+    exchange->presented = true;
+}
+
+void frame_exchange_get_stats(struct FrameExchange *exchange, struct FrameExchangeStats *out)
+{
+    out->published = __atomic_load_n(&exchange->stats.published, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&exchange->stats.dropped, __ATOMIC_RELAXED);
+    out->presented = __atomic_load_n(&exchange->stats.presented, __ATOMIC_RELAXED);
+    out->repeated = __atomic_load_n(&exchange->stats.repeated, __ATOMIC_RELAXED);
+}
+
+void frame_exchange_print_stats(struct FrameExchange *exchange)
+{
+    struct FrameExchangeStats stats;
+    frame_exchange_get_stats(exchange, &stats);
+    struct FrameStatsSummary latency;
+    frame_stats_compute(&exchange->latency, &latency);
+
+    LOG_INFO(LOG_FRAME, "input to swap: avg %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f ms | packets %llu published, %llu dropped, %llu presented, %llu repeated",
+            latency.avg_ms, latency.p50_ms, latency.p95_ms, latency.p99_ms, latency.max_ms,
+            (unsigned long long) stats.published, (unsigned long long) stats.dropped,
+            (unsigned long long) stats.presented, (unsigned long long) stats.repeated);
+}
+
+void frame_exchange_free(struct FrameExchange *exchange)
+{
+    for (int i = 0 ; i < FRAME_PACKET_SLOTS ; i++)
+    {
+        free(exchange->packets[i].draws);
+        exchange->packets[i] = (struct FramePacket){0};
+    }
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <framestats.h>
+#include <log.h>
+
+void frame_stats_init(struct FrameStats *stats)
+{
+    memset(stats, 0, sizeof(struct FrameStats));
+    stats->hitch_ms = FRAME_STATS_DEFAULT_HITCH_MS;
+    stats->summary_seconds = FRAME_STATS_DEFAULT_SUMMARY_SECONDS;
+}
+
+bool frame_stats_push(struct FrameStats *stats, double frame_ms)
+{
+    stats->times_ms[stats->next] = frame_ms;
+    stats->next = (stats->next + 1) % FRAME_STATS_WINDOW;
+    if (stats->count < FRAME_STATS_WINDOW)
+        stats->count++;
+
+    stats->total_frames++;
+    if (frame_ms > stats->hitch_ms)
+        stats->total_hitches++;
+
+    if (stats->summary_seconds <= 0.0)
+        return false;
+    stats->since_summary += frame_ms / 1000.0;
+    if (stats->since_summary < stats->summary_seconds)
+        return false;
+    stats->since_summary = 0.0;
+    return true;
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank
+static double percentile(const double *sorted, size_t count, double p)
+{
+    size_t rank = (size_t) (p * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return sorted[rank - 1];
+}
+
+void frame_stats_compute(struct FrameStats *stats, struct FrameStatsSummary *out)
+{
+    *out = (struct FrameStatsSummary){
+        .frames = stats->count,
+        .total_frames = stats->total_frames,
+        .total_hitches = stats->total_hitches
+    };
+    if (stats->count == 0)
+        return;
+
+    double total = 0.0;
+    for (size_t i = 0 ; i < stats->count ; i++)
+    {
+        total += stats->times_ms[i];
+        if (stats->times_ms[i] > stats->hitch_ms)
+            out->hitches++;
+    }
+
+    memcpy(stats->sorted, stats->times_ms, stats->count * sizeof(double));
+    qsort(stats->sorted, stats->count, sizeof(double), compare_ms);
+
+    out->min_ms = stats->sorted[0];
+    out->max_ms = stats->sorted[stats->count - 1];
+    out->avg_ms = total / stats->count;
+    out->p50_ms = percentile(stats->sorted, stats->count, 0.50);
+    out->p95_ms = percentile(stats->sorted, stats->count, 0.95);
+    out->p99_ms = percentile(stats->sorted, stats->count, 0.99);
+}
+
+void frame_stats_print(struct FrameStats *stats)
+{
+    struct FrameStatsSummary summary;
+    frame_stats_compute(stats, &summary);
+
+    double fps = summary.avg_ms > 0.0 ? 1000.0 / summary.avg_ms : 0.0;
+    LOG_INFO(LOG_FRAME, "last %zu: %.1f fps | min %.2f avg %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f ms | hitches over %.1f ms %zu, %llu of %llu total",
+            summary.frames, fps,
+            summary.min_ms, summary.avg_ms, summary.p50_ms, summary.p95_ms, summary.p99_ms, summary.max_ms,
+            stats->hitch_ms, summary.hitches,
+            (unsigned long long) summary.total_hitches, (unsigned long long) summary.total_frames);
+}
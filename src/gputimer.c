@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <glad/gl.h>
+#include <gputimer.h>
+#include <profile.h>
+#include <timer.h>
+#include <log.h>
+
+static void sync_clocks(struct GpuTimer *timer)
+{
+    GLint64 gpu_now = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+    timer->clock_offset = (int64_t) timer_now_ns() - (int64_t) gpu_now;
+    timer->frames_since_sync = 0;
+}
+
+int gpu_timer_init(struct GpuTimer *timer)
+{
+    *timer = (struct GpuTimer){0};
+    timer->current = -1;
+
+    if (!GLAD_GL_VERSION_3_3 || glQueryCounter == NULL)
+    {
+        LOG_INFO(LOG_GPUTIMER, "Timer queries need GL 3.3, GPU timing is off.");
+        return -1;
+    }
+
+    for (int i = 0 ; i < GPU_TIMER_FRAMES ; i++)
+        glGenQueries(GPU_TIMER_MAX_PASSES*2, timer->sets[i].queries);
+    sync_clocks(timer);
+    timer->available = true;
+    return 0;
+}
+
+static bool set_ready(struct GpuTimerSet *set)
+{
+    // The frame's own end query is written last
+    GLint available = 0;
+    glGetQueryObjectiv(set->queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    return available != 0;
+}
+
+static void resolve(struct GpuTimer *timer, struct GpuTimerSet *set)
+{
+    struct GpuTimerStats *stats = &timer->stats;
+    for (int i = 0 ; i < set->pass_count ; i++)
+    {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(set->queries[i*2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(set->queries[i*2+1], GL_QUERY_RESULT, &end);
+        uint64_t duration = end > begin ? end - begin : 0;
+
+        stats->passes[i] = (struct GpuTimerPass){ set->names[i], set->depths[i], duration / 1e6 };
+        profile_gpu_zone(set->names[i], (uint64_t) ((int64_t) begin + timer->clock_offset), duration);
+    }
+    stats->pass_count = set->pass_count;
+    stats->frame_ms = stats->passes[0].ms;
+    stats->frames++;
+    stats->total_ms += stats->frame_ms;
+    if (stats->frame_ms > stats->max_ms)
+        stats->max_ms = stats->frame_ms;
+    set->pending = false;
+}
+
+void gpu_timer_begin_frame(struct GpuTimer *timer)
+{
+    timer->current = -1;
+    if (!timer->available)
+        return;
+
+    if (++timer->frames_since_sync >= GPU_TIMER_SYNC_FRAMES)
+        sync_clocks(timer);
+
+    // Oldest first, results arrive in submission order
+    for (int i = 0 ; i < GPU_TIMER_FRAMES ; i++)
+    {
+        struct GpuTimerSet *set = &timer->sets[(timer->next + i) % GPU_TIMER_FRAMES];
+        if (!set->pending || !set_ready(set))
+            break;
+        resolve(timer, set);
+    }
+
+    struct GpuTimerSet *set = &timer->sets[timer->next];
+    if (set->pending)
+    {
+        // The GPU is more than GPU_TIMER_FRAMES behind, reading back would stall
+        timer->stats.skipped++;
+        return;
+    }
+
+    timer->current = timer->next;
+    timer->next = (timer->next + 1) % GPU_TIMER_FRAMES;
+    set->pass_count = 0;
+    timer->depth = 0;
+    gpu_timer_begin(timer, "gpu frame");
+}
+
+void gpu_timer_begin(struct GpuTimer *timer, const char *name)
+{
+    if (timer->current < 0)
+        return;
+    // Too deep, still counted so the matching end pops the right pass
+    if (timer->depth == GPU_TIMER_MAX_DEPTH)
+    {
+        timer->depth++;
+        return;
+    }
+
+    struct GpuTimerSet *set = &timer->sets[timer->current];
+    int pass = -1;
+    if (set->pass_count < GPU_TIMER_MAX_PASSES)
+    {
+        pass = set->pass_count++;
+        set->names[pass] = name;
+        set->depths[pass] = timer->depth;
+        glQueryCounter(set->queries[pass*2], GL_TIMESTAMP);
+    }
+    timer->stack[timer->depth++] = pass;
+}
+
+void gpu_timer_end(struct GpuTimer *timer)
+{
+    if (timer->current < 0 || timer->depth == 0)
+        return;
+    if (--timer->depth >= GPU_TIMER_MAX_DEPTH)
+        return;
+
+    int pass = timer->stack[timer->depth];
+    if (pass >= 0)
+        glQueryCounter(timer->sets[timer->current].queries[pass*2+1], GL_TIMESTAMP);
+}
+
+void gpu_timer_end_frame(struct GpuTimer *timer)
+{
+    if (timer->current < 0)
+        return;
+
+    // Passes left open end with the frame
+    while (timer->depth > 0)
+        gpu_timer_end(timer);
+    timer->sets[timer->current].pending = true;
+    timer->current = -1;
+}
+
+void gpu_timer_get_stats(struct GpuTimer *timer, struct GpuTimerStats *out)
+{
+    *out = timer->stats;
+}
+
+void gpu_timer_print(struct GpuTimer *timer)
+{
+    if (!timer->available)
+        return;
+
+    struct GpuTimerStats *stats = &timer->stats;
+    double average = stats->frames ? stats->total_ms / stats->frames : 0.0;
+
+    // one record, the passes are appended to the line
+    char passes[LOG_MESSAGE_BYTES] = "";
+    size_t length = 0;
+    for (int i = 1 ; i < stats->pass_count && length < sizeof(passes) ; i++)
+        length += snprintf(passes + length, sizeof(passes) - length, " %s %.3f", stats->passes[i].name, stats->passes[i].ms);
+
+    LOG_INFO(LOG_GPUTIMER, "frame %.3f ms, avg %.3f ms max %.3f ms over %llu frames, %llu unmeasured |%s",
+            stats->frame_ms, average, stats->max_ms,
+            (unsigned long long) stats->frames, (unsigned long long) stats->skipped, passes);
+}
+
+void gpu_timer_free(struct GpuTimer *timer)
+{
+    if (!timer->available)
+        return;
+    for (int i = 0 ; i < GPU_TIMER_FRAMES ; i++)
+        glDeleteQueries(GPU_TIMER_MAX_PASSES*2, timer->sets[i].queries);
+    timer->available = false;
+}
@@ -1,6 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <io.h>
+#include <log.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 int read_file(const char *path, char **out)
 {
@@ -10,7 +18,7 @@ int read_file(const char *path, char **out)
     // sys call to retrieve file size on linux
     if (stat(path, &st))
     {
-        printf("[IO] File %s does not exist.\n", path);
+        LOG_WARN(LOG_IO, "File %s does not exist.", path);
         return -1;
     }
     
@@ -19,23 +27,187 @@ int read_file(const char *path, char **out)
     file = fopen(path, "rb");
     if (!file)
     {
-        printf("[IO] Unable to retrieve size of file %s .\n",path);
+        LOG_ERROR(LOG_IO, "Unable to retrieve size of file %s .",path);
         return -1;
     }
     
-    *out = (char*) calloc(1,file_size);
+    // one extra byte so the contents can be used as a C string
+    *out = (char*) calloc(1,file_size+1);
+    if (*out == NULL)
+    {
+        LOG_ERROR(LOG_IO, "Unable to allocate %zu bytes for %s", file_size, path);
+        fclose(file);
+        return -1;
+    }
 
     size_t read_size = fread(*out, sizeof(char), file_size, file);
 
     if (read_size == file_size)
     {
-        printf("[IO] Read %s\n", path);
+        LOG_DEBUG(LOG_IO, "Read %s", path);
     }
     else
     {
-        printf("[IO] Error reading file | size/error: %zu\n", file_size);
+        LOG_WARN(LOG_IO, "Error reading file | size/error: %zu", file_size);
+        free(*out);
+        *out = NULL;
+        fclose(file);
+        return -1;
     }
 
     fclose(file);
     return 0;
 }
+
+#ifndef _WIN32
+
+int pread_full(int fd, void *buffer, size_t size, off_t offset)
+{
+    char *bytes = (char *) buffer;
+    while (size)
+    {
+        ssize_t done = pread(fd, bytes, size, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
+        bytes += done;
+        size -= done;
+        offset += done;
+    }
+    return 0;
+}
+
+int pwrite_full(int fd, const void *buffer, size_t size, off_t offset)
+{
+    const char *bytes = (const char *) buffer;
+    while (size)
+    {
+        ssize_t done = pwrite(fd, bytes, size, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
+        bytes += done;
+        size -= done;
+        offset += done;
+    }
+    return 0;
+}
+
+static int advice_flag(enum MapAdvice advice)
+{
+    switch (advice)
+    {
+        case MAP_ADVICE_SEQUENTIAL: return MADV_SEQUENTIAL;
+        case MAP_ADVICE_RANDOM: return MADV_RANDOM;
+        case MAP_ADVICE_WILLNEED: return MADV_WILLNEED;
+        default: return MADV_NORMAL;
+    }
+}
+
+int map_file(const char *path, enum MapAdvice advice, struct MappedFile *out)
+{
+    *out = (struct MappedFile){0};
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        LOG_WARN(LOG_IO, "File %s does not exist.", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        LOG_ERROR(LOG_IO, "Unable to retrieve size of file %s .", path);
+        close(fd);
+        return -1;
+    }
+
+    // mmap refuses empty files, an empty view is still a valid result
+    if (st.st_size == 0)
+    {
+        close(fd);
+        out->mapped = true;
+        return 0;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        LOG_WARN(LOG_IO, "Unable to map %s, reading it instead.", path);
+        char *copy;
+        if (read_file(path, &copy))
+            return -1;
+        out->data = copy;
+        out->size = st.st_size;
+        return 0;
+    }
+
+    out->data = (const char *) data;
+    out->size = st.st_size;
+    out->mapped = true;
+
+    if (advice != MAP_ADVICE_NORMAL)
+        madvise(data, st.st_size, advice_flag(advice));
+    return 0;
+}
+
+void map_file_advise(struct MappedFile *file, size_t offset, size_t length, enum MapAdvice advice)
+{
+    if (!file->mapped || offset >= file->size)
+        return;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(page-1);
+    if (length > file->size - offset)
+        length = file->size - offset;
+
+    madvise((void *) (file->data + start), length + (offset - start), advice_flag(advice));
+}
+
+void unmap_file(struct MappedFile *file)
+{
+    if (file->mapped)
+    {
+        if (file->data)
+            munmap((void *) file->data, file->size);
+    }
+    else
+    {
+        free((void *) file->data);
+    }
+    *file = (struct MappedFile){0};
+}
+
+#else
+
+int map_file(const char *path, enum MapAdvice advice, struct MappedFile *out)
+{
+    *out = (struct MappedFile){0};
+
+    struct stat st;
+    char *copy;
+    if (stat(path, &st) || read_file(path, &copy))
+        return -1;
+
+    out->data = copy;
+    out->size = st.st_size;
+    return 0;
+}
+
+void map_file_advise(struct MappedFile *file, size_t offset, size_t length, enum MapAdvice advice)
+{
+}
+
+void unmap_file(struct MappedFile *file)
+{
+    free((void *) file->data);
+    *file = (struct MappedFile){0};
+}
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <job.h>
+#include <profile.h>
+#include <log.h>
+
+static void *job_worker(void *arg)
+{
+    struct JobPool *pool = (struct JobPool *) arg;
+    PROFILE_THREAD("worker");
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (pool->running && pool->head == NULL)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+
+        struct Job *job = pool->head;
+        if (job == NULL)
+            break;
+
+        pool->head = job->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->run(job->user);
+        free(job);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->outstanding--;
+        if (pool->outstanding == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int job_pool_default_threads(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 2)
+        return 1;
+    return (int) cores - 1;
+}
+
+int job_pool_init(struct JobPool *pool, int thread_count)
+{
+    *pool = (struct JobPool){0};
+
+    if (thread_count <= 0)
+        thread_count = job_pool_default_threads();
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    pool->threads = (pthread_t *) calloc(thread_count, sizeof(pthread_t));
+    if (pool->threads == NULL)
+    {
+        LOG_ERROR(LOG_JOB, "Unable to allocate worker threads.");
+        return -1;
+    }
+
+    pool->running = true;
+    for (int i = 0 ; i < thread_count ; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, job_worker, pool))
+        {
+            LOG_ERROR(LOG_JOB, "Unable to start worker %d.", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0)
+    {
+        job_pool_shutdown(pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+int job_pool_submit(struct JobPool *pool, JobFunc run, void *user)
+{
+    struct Job *job = (struct Job *) malloc(sizeof(struct Job));
+    if (job == NULL)
+    {
+        LOG_ERROR(LOG_JOB, "Unable to allocate a job.");
+        return -1;
+    }
+
+    job->run = run;
+    job->user = user;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    pool->outstanding++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void job_pool_wait(struct JobPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->outstanding > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void job_pool_shutdown(struct JobPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->running = false;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    // Workers drain the queue before exiting
+    for (int i = 0 ; i < pool->thread_count ; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->thread_count = 0;
+
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+}
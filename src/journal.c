@@ -0,0 +1,1050 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <journal.h>
+#include <io.h>
+#include <profile.h>
+#include <crc.h>
+#include <timer.h>
+#include <memtrack.h>
+#include <log.h>
+
+struct EditList
+{
+    struct VoxelEdit *edits;
+    size_t count, capacity;
+};
+
+static void *commit_thread(void *arg);
+
+// New and renamed files only survive a crash once their directory entry does
+static int sync_directory(const char *directory)
+{
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result ? -1 : 0;
+}
+
+static int edit_list_push(struct EditList *list, const struct VoxelEdit *edits, size_t count)
+{
+    if (list->count + count > list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity : 1024;
+        while (capacity < list->count + count)
+            capacity *= 2;
+        struct VoxelEdit *grown = (struct VoxelEdit *) realloc(list->edits, capacity*sizeof(struct VoxelEdit));
+        if (grown == NULL)
+            return -1;
+        list->edits = grown;
+        list->capacity = capacity;
+    }
+    memcpy(list->edits + list->count, edits, count*sizeof(struct VoxelEdit));
+    list->count += count;
+    return 0;
+}
+
+static uint32_t frame_crc(const struct JournalFrame *frame, const struct VoxelEdit *edits)
+{
+    struct JournalFrame header = *frame;
+    header.crc = 0;
+    uint32_t crc = crc32_update(0, &header, sizeof(header));
+    return crc32_update(crc, edits, frame->count*sizeof(struct VoxelEdit));
+}
+
+// Bytes of the intact frame at offset, 0 if it is torn, corrupt or out of sequence
+static size_t frame_at(const uint8_t *data, size_t size, size_t offset, uint64_t last_sequence, struct JournalFrame *frame)
+{
+    if (size - offset < sizeof(struct JournalFrame))
+        return 0;
+    memcpy(frame, data + offset, sizeof(*frame));
+
+    size_t bytes = (size_t) frame->count*sizeof(struct VoxelEdit);
+    if (frame->magic != JOURNAL_MAGIC || frame->count == 0 || frame->sequence <= last_sequence
+        || bytes > size - offset - sizeof(*frame))
+        return 0;
+
+    if (frame_crc(frame, (const struct VoxelEdit *) (data + offset + sizeof(*frame))) != frame->crc)
+        return 0;
+    return sizeof(*frame) + bytes;
+}
+
+/*
+ * Collects the edits of every intact frame at the start of data and
+ * returns how many bytes those frames take up. Replay stops at the first
+ * frame that is torn, corrupt or out of sequence.
+ * */
+static size_t parse_frames(const uint8_t *data, size_t size, struct EditList *out, uint64_t *last_sequence)
+{
+    size_t offset = 0, bytes;
+    struct JournalFrame frame;
+    while ((bytes = frame_at(data, size, offset, *last_sequence, &frame)))
+    {
+        const struct VoxelEdit *edits = (const struct VoxelEdit *) (data + offset + sizeof(frame));
+        if (edit_list_push(out, edits, frame.count))
+            break;
+
+        *last_sequence = frame.sequence;
+        offset += bytes;
+    }
+    return offset;
+}
+
+static int compare_edits(const void *a, const void *b)
+{
+    const struct VoxelEdit *x = *(const struct VoxelEdit **) a;
+    const struct VoxelEdit *y = *(const struct VoxelEdit **) b;
+
+    struct ChunkCoord region_x, region_y;
+    int index_x, index_y;
+    region_from_chunk(x->chunk, &region_x, &index_x);
+    region_from_chunk(y->chunk, &region_y, &index_y);
+
+    if (region_x.x != region_y.x)
+        return region_x.x < region_y.x ? -1 : 1;
+    if (region_x.y != region_y.y)
+        return region_x.y < region_y.y ? -1 : 1;
+    if (region_x.z != region_y.z)
+        return region_x.z < region_y.z ? -1 : 1;
+    if (index_x != index_y)
+        return index_x < index_y ? -1 : 1;
+    // Journal order within a chunk, the last edit of a voxel wins
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Applies edits on top of the stored chunks, a region at a time, and syncs
+ * every region it wrote. Without generate, edits to chunks that aren't
+ * stored yet go to carried instead.
+ * */
+static int fold_edits(struct Journal *journal, const struct VoxelEdit *edits, size_t count, bool generate, struct EditList *carried)
+{
+    const struct VoxelEdit **order = (const struct VoxelEdit **) malloc(count*sizeof(struct VoxelEdit *));
+    struct Chunk *chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    if (order == NULL || chunk == NULL)
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to allocate the checkpoint buffers.");
+        free(order);
+        free(chunk);
+        return -1;
+    }
+
+    for (size_t i = 0 ; i < count ; i++)
+        order[i] = &edits[i];
+    qsort(order, count, sizeof(struct VoxelEdit *), compare_edits);
+
+    int result = 0;
+    size_t start = 0;
+    while (start < count && result == 0)
+    {
+        struct ChunkCoord region_coord, next_coord;
+        int index;
+        region_from_chunk(order[start]->chunk, &region_coord, &index);
+
+        size_t end = start + 1;
+        while (end < count)
+        {
+            region_from_chunk(order[end]->chunk, &next_coord, &index);
+            if (!chunk_coord_equal(region_coord, next_coord))
+                break;
+            end++;
+        }
+
+        struct Region *region = region_store_acquire(journal->store, region_coord, generate);
+        if (region == NULL && generate)
+        {
+            result = -1;
+            break;
+        }
+
+        size_t first = start;
+        while (first < end)
+        {
+            struct ChunkCoord coord = order[first]->chunk;
+            size_t last = first + 1;
+            while (last < end && chunk_coord_equal(order[last]->chunk, coord))
+                last++;
+
+            enum RegionResult loaded = region ? region_read_chunk(region, coord, chunk) : REGION_MISSING;
+            if (loaded != REGION_OK && !generate)
+            {
+                for (size_t i = first ; i < last && result == 0 ; i++)
+                    result = edit_list_push(carried, order[i], 1);
+            }
+            else
+            {
+                if (loaded != REGION_OK)
+                    journal->generate(chunk, coord, journal->generate_user);
+                for (size_t i = first ; i < last ; i++)
+                    chunk->voxel_type[order[i]->index % CHUNK_DATA_SIZE] = order[i]->new_type;
+                if (region_write_chunk(region, coord, chunk, journal->store->compression) != REGION_OK)
+                    result = -1;
+            }
+            first = last;
+        }
+
+        if (region)
+        {
+            if (result == 0)
+                result = region_sync(region);
+            region_store_release(journal->store, region);
+        }
+        start = end;
+    }
+
+    free(order);
+    free(chunk);
+    return result;
+}
+
+static uint8_t *read_journal(struct Journal *journal)
+{
+    uint8_t *data = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, journal->size ? journal->size : 1);
+    if (data == NULL || pread_full(journal->fd, data, journal->size, 0))
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to read %s back.", journal->path);
+        mem_free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/*
+ * Replaces the journal with data, atomically through a rename. Without
+ * data it is just emptied.
+ * */
+static int rewrite_journal(struct Journal *journal, const void *data, size_t size)
+{
+    if (size == 0)
+    {
+        if (ftruncate(journal->fd, 0) || fdatasync(journal->fd))
+        {
+            LOG_ERROR(LOG_JOURNAL, "Unable to truncate %s", journal->path);
+            return -1;
+        }
+        journal->size = 0;
+        return 0;
+    }
+
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", journal->path);
+
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || pwrite_full(fd, data, size, 0)
+        || fsync(fd) || rename(temp_path, journal->path)
+        || sync_directory(journal->store->directory))
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to rewrite %s", journal->path);
+        if (fd >= 0)
+            close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+
+    close(journal->fd);
+    journal->fd = fd;
+    journal->size = size;
+    return 0;
+}
+
+// One frame holding edits, for rewriting the journal
+static uint8_t *build_frame(const struct EditList *edits, uint64_t sequence, size_t *size)
+{
+    struct JournalFrame frame = {
+        .magic = JOURNAL_MAGIC,
+        .count = (uint32_t) edits->count,
+        .sequence = sequence
+    };
+    frame.crc = frame_crc(&frame, edits->edits);
+
+    *size = sizeof(frame) + edits->count*sizeof(struct VoxelEdit);
+    uint8_t *data = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, *size);
+    if (data)
+    {
+        memcpy(data, &frame, sizeof(frame));
+        memcpy(data + sizeof(frame), edits->edits, edits->count*sizeof(struct VoxelEdit));
+    }
+    return data;
+}
+
+static int checkpoint_locked(struct Journal *journal, bool generate)
+{
+    int result = 0;
+    uint8_t *data = NULL;
+    struct EditList edits = {0}, carried = {0};
+    uint64_t last_sequence = 0;
+
+    if (journal->size)
+    {
+        data = read_journal(journal);
+        if (data == NULL)
+            result = -1;
+        else
+            parse_frames(data, journal->size, &edits, &last_sequence);
+    }
+
+    // Regions first, the journal only forgets edits once they are durable elsewhere
+    if (result == 0 && edits.count)
+        result = fold_edits(journal, edits.edits, edits.count, generate, &carried);
+    if (result == 0 && edits.count && sync_directory(journal->store->directory))
+        result = -1;
+
+    if (result == 0)
+    {
+        size_t size = 0;
+        uint8_t *frame = carried.count ? build_frame(&carried, last_sequence, &size) : NULL;
+        if (carried.count && frame == NULL)
+            result = -1;
+        else
+            result = rewrite_journal(journal, frame, size);
+        mem_free(frame);
+    }
+
+    if (result == 0)
+    {
+        pthread_mutex_lock(&journal->lock);
+        journal->stats.checkpoints++;
+        journal->stats.carried = carried.count;
+        pthread_mutex_unlock(&journal->lock);
+    }
+
+    // Whatever happened, don't try again right away
+    journal->checkpoint_at = journal->size + journal->checkpoint_bytes;
+
+    mem_free(data);
+    free(edits.edits);
+    free(carried.edits);
+    return result;
+}
+
+/*
+ * Drops the frames up to sequence, the caller saved their edits to the
+ * region files. Those are synced first.
+ * */
+static int truncate_locked(struct Journal *journal, uint64_t sequence)
+{
+    if (journal->size == 0)
+        return 0;
+    if (region_store_sync(journal->store))
+        return -1;
+
+    uint8_t *data = read_journal(journal);
+    if (data == NULL)
+        return -1;
+
+    size_t offset = 0, keep = 0, bytes;
+    uint64_t last_sequence = 0;
+    struct JournalFrame frame;
+    while ((bytes = frame_at(data, journal->size, offset + keep, last_sequence, &frame)))
+    {
+        if (frame.sequence <= sequence)
+            offset += bytes;
+        else
+            keep += bytes;
+        last_sequence = frame.sequence;
+    }
+
+    int result = offset ? rewrite_journal(journal, data + offset, keep) : 0;
+    if (result == 0 && offset)
+    {
+        pthread_mutex_lock(&journal->lock);
+        journal->stats.checkpoints++;
+        pthread_mutex_unlock(&journal->lock);
+    }
+    mem_free(data);
+    return result;
+}
+
+/*
+ * Writes the pending edits as one frame. On failure they go back in front
+ * of the pending ones and the next commit retries.
+ * */
+static void commit_locked(struct Journal *journal)
+{
+    PROFILE_ZONE("journal commit");
+    pthread_mutex_lock(&journal->lock);
+    size_t count = journal->pending_count;
+    if (count == 0)
+    {
+        pthread_mutex_unlock(&journal->lock);
+        return;
+    }
+
+    struct VoxelEdit *edits = journal->pending;
+    size_t capacity = journal->pending_capacity;
+    journal->pending = journal->writing;
+    journal->pending_capacity = journal->writing_capacity;
+    journal->pending_count = 0;
+    journal->writing = edits;
+    journal->writing_capacity = capacity;
+    uint64_t sequence = journal->next_sequence++;
+    pthread_mutex_unlock(&journal->lock);
+
+    struct JournalFrame frame = {
+        .magic = JOURNAL_MAGIC,
+        .count = (uint32_t) count,
+        .sequence = sequence
+    };
+    frame.crc = frame_crc(&frame, edits);
+
+    size_t bytes = count*sizeof(struct VoxelEdit);
+    bool failed = pwrite_full(journal->fd, &frame, sizeof(frame), journal->size)
+        || pwrite_full(journal->fd, edits, bytes, journal->size + sizeof(frame))
+        || fdatasync(journal->fd);
+
+    pthread_mutex_lock(&journal->lock);
+    if (failed)
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to commit %zu edits to %s", count, journal->path);
+        struct EditList requeue = {0};
+        if (edit_list_push(&requeue, edits, count) || edit_list_push(&requeue, journal->pending, journal->pending_count))
+        {
+            LOG_WARN(LOG_JOURNAL, "Dropped %zu edits.", count);
+            free(requeue.edits);
+        }
+        else
+        {
+            free(journal->pending);
+            journal->pending = requeue.edits;
+            journal->pending_count = requeue.count;
+            journal->pending_capacity = requeue.capacity;
+        }
+    }
+    else
+    {
+        journal->size += sizeof(frame) + bytes;
+        journal->durable_sequence = sequence;
+        journal->stats.commits++;
+        journal->stats.bytes_written += sizeof(frame) + bytes;
+        pthread_cond_broadcast(&journal->committed);
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+/*
+ * Drops a torn tail, then folds whatever the previous session committed.
+ * */
+static int replay(struct Journal *journal)
+{
+    struct stat info;
+    if (fstat(journal->fd, &info))
+        return -1;
+    journal->size = (uint64_t) info.st_size;
+    if (journal->size == 0)
+        return 0;
+
+    uint8_t *data = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, journal->size);
+    if (data == NULL || pread_full(journal->fd, data, journal->size, 0))
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to read %s", journal->path);
+        mem_free(data);
+        return -1;
+    }
+
+    struct EditList edits = {0};
+    uint64_t last_sequence = 0;
+    size_t valid = parse_frames(data, journal->size, &edits, &last_sequence);
+    mem_free(data);
+    free(edits.edits);
+
+    if (valid < journal->size)
+    {
+        LOG_WARN(LOG_JOURNAL, "Dropping %llu bytes of torn or corrupt edits at the end of %s",
+                (unsigned long long) (journal->size - valid), journal->path);
+        if (ftruncate(journal->fd, valid) || fdatasync(journal->fd))
+            return -1;
+        journal->size = valid;
+    }
+
+    journal->next_sequence = last_sequence + 1;
+    journal->durable_sequence = last_sequence;
+    journal->stats.recovered = edits.count;
+
+    int result = checkpoint_locked(journal, true);
+    if (result == 0 && edits.count)
+        LOG_INFO(LOG_JOURNAL, "Recovered %zu edits.", edits.count);
+    return result;
+}
+
+int journal_open(struct Journal *journal, struct RegionStore *store, JournalGenerate generate, void *user)
+{
+    *journal = (struct Journal){
+        .store = store,
+        .generate = generate,
+        .generate_user = user,
+        .fd = -1,
+        .next_sequence = 1,
+        .checkpoint_bytes = JOURNAL_CHECKPOINT_BYTES
+    };
+
+    size_t length = strlen(store->directory) + sizeof("/" JOURNAL_FILE);
+    journal->path = (char *) malloc(length);
+    if (journal->path == NULL)
+        return -1;
+    snprintf(journal->path, length, "%s/%s", store->directory, JOURNAL_FILE);
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_mutex_init(&journal->file_lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+    pthread_cond_init(&journal->committed, NULL);
+
+    // Left by a checkpoint that died before its rename, the journal itself is intact
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", journal->path);
+    unlink(temp_path);
+
+    journal->fd = open(journal->path, O_RDWR | O_CREAT, 0644);
+    if (journal->fd < 0 || sync_directory(store->directory))
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to open %s", journal->path);
+        journal_close(journal);
+        return -1;
+    }
+
+    if (replay(journal))
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to replay %s, leaving it as it is.", journal->path);
+        journal_close(journal);
+        return -1;
+    }
+
+    journal->checkpoint_at = journal->size + journal->checkpoint_bytes;
+    journal->running = true;
+    if (pthread_create(&journal->thread, NULL, commit_thread, journal))
+    {
+        LOG_ERROR(LOG_JOURNAL, "Unable to start the commit thread.");
+        journal->running = false;
+        journal_close(journal);
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t journal_append(struct Journal *journal, const struct VoxelEdit *edits, size_t count)
+{
+    pthread_mutex_lock(&journal->lock);
+    struct EditList pending = {
+        .edits = journal->pending,
+        .count = journal->pending_count,
+        .capacity = journal->pending_capacity
+    };
+    if (edit_list_push(&pending, edits, count))
+        LOG_ERROR(LOG_JOURNAL, "Unable to queue %zu edits.", count);
+
+    // The first edit starts the commit timer, a full batch cuts it short
+    if ((journal->pending_count == 0 && pending.count) || pending.count >= JOURNAL_COMMIT_EDITS)
+        pthread_cond_signal(&journal->wake);
+
+    journal->pending = pending.edits;
+    journal->pending_count = pending.count;
+    journal->pending_capacity = pending.capacity;
+    journal->stats.edits += count;
+    uint64_t sequence = journal->next_sequence;
+    pthread_mutex_unlock(&journal->lock);
+    return sequence;
+}
+
+void journal_wait(struct Journal *journal, uint64_t sequence)
+{
+    pthread_mutex_lock(&journal->lock);
+    while (journal->running && journal->durable_sequence < sequence)
+        pthread_cond_wait(&journal->committed, &journal->lock);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_flush(struct Journal *journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    uint64_t sequence = journal->pending_count ? journal->next_sequence : journal->next_sequence - 1;
+    journal->flush_requested = true;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+
+    journal_wait(journal, sequence);
+}
+
+int journal_checkpoint(struct Journal *journal)
+{
+    pthread_mutex_lock(&journal->file_lock);
+    commit_locked(journal);
+    int result = checkpoint_locked(journal, true);
+    pthread_mutex_unlock(&journal->file_lock);
+    return result;
+}
+
+uint64_t journal_truncate(struct Journal *journal, uint64_t sequence)
+{
+    pthread_mutex_lock(&journal->lock);
+    // Later appends never land in a durable frame
+    if (sequence > journal->durable_sequence)
+        sequence = journal->durable_sequence;
+    if (sequence > journal->truncate_sequence)
+    {
+        journal->truncate_sequence = sequence;
+        pthread_cond_signal(&journal->wake);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return sequence;
+}
+
+void journal_set_checkpoint_bytes(struct Journal *journal, size_t bytes)
+{
+    pthread_mutex_lock(&journal->file_lock);
+    journal->checkpoint_bytes = bytes;
+    journal->checkpoint_at = journal->size + bytes;
+    pthread_mutex_unlock(&journal->file_lock);
+}
+
+void journal_get_stats(struct Journal *journal, struct JournalStats *out)
+{
+    pthread_mutex_lock(&journal->lock);
+    *out = journal->stats;
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_close(struct Journal *journal)
+{
+    if (journal->running)
+    {
+        pthread_mutex_lock(&journal->lock);
+        journal->running = false;
+        pthread_cond_broadcast(&journal->wake);
+        pthread_cond_broadcast(&journal->committed);
+        pthread_mutex_unlock(&journal->lock);
+        pthread_join(journal->thread, NULL);
+
+        if (journal_checkpoint(journal))
+            LOG_WARN(LOG_JOURNAL, "Final checkpoint failed, %s is replayed on the next start.", journal->path);
+    }
+
+    if (journal->fd >= 0)
+        close(journal->fd);
+    free(journal->path);
+    free(journal->pending);
+    free(journal->writing);
+    pthread_cond_destroy(&journal->committed);
+    pthread_cond_destroy(&journal->wake);
+    pthread_mutex_destroy(&journal->file_lock);
+    pthread_mutex_destroy(&journal->lock);
+    *journal = (struct Journal){ .fd = -1 };
+}
+
+static void *commit_thread(void *arg)
+{
+    struct Journal *journal = (struct Journal *) arg;
+    PROFILE_THREAD("journal");
+
+    pthread_mutex_lock(&journal->lock);
+    while (journal->running)
+    {
+        if (journal->pending_count == 0 && !journal->flush_requested && journal->truncate_sequence == 0)
+        {
+            pthread_cond_wait(&journal->wake, &journal->lock);
+            continue;
+        }
+
+        // Group commit, edits keep coming in until the timer runs out
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += JOURNAL_COMMIT_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (journal->running && journal->pending_count && !journal->flush_requested
+            && journal->pending_count < JOURNAL_COMMIT_EDITS)
+        {
+            if (pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        journal->flush_requested = false;
+        uint64_t truncate = journal->truncate_sequence;
+        journal->truncate_sequence = 0;
+        pthread_mutex_unlock(&journal->lock);
+
+        pthread_mutex_lock(&journal->file_lock);
+        commit_locked(journal);
+        if (truncate)
+            truncate_locked(journal, truncate);
+        else if (journal->checkpoint_bytes && journal->size >= journal->checkpoint_at)
+            checkpoint_locked(journal, false);
+        pthread_mutex_unlock(&journal->file_lock);
+
+        pthread_mutex_lock(&journal->lock);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return NULL;
+}
+
+#define VERIFY_CHUNKS 8
+// Chunks below this are saved before any edits, the rest only exist in the journal
+#define VERIFY_SAVED 4
+#define VERIFY_EDITS 8
+// Checkpoint often so the kill can land in one
+#define VERIFY_CHECKPOINT_BYTES (8*1024)
+#define VERIFY_TORN_FRAMES 10
+
+static void verify_generate(struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    for (int i = 0 ; i < CHUNK_DATA_SIZE ; i++)
+        chunk->voxel_type[i] = (uint8_t) ((i*7 + coord.x*13) % 5);
+}
+
+/*
+ * Batch b edits random voxels of every chunk, then writes b into the
+ * first voxels of chunk 0. It goes out in one append, so the marker
+ * tells exactly which batches made it.
+ * */
+static size_t verify_batch(uint32_t b, struct VoxelEdit *out)
+{
+    size_t count = 0;
+    uint32_t state = b*2654435761u + 1;
+    for (int i = 0 ; i < VERIFY_EDITS ; i++)
+    {
+        state = state*1664525u + 1013904223u;
+        out[count++] = (struct VoxelEdit){
+            .chunk = { (int32_t) (state >> 8) % VERIFY_CHUNKS, 0, 0 },
+            .index = (uint16_t) ((state >> 12) % CHUNK_DATA_SIZE),
+            .new_type = (uint8_t) (state >> 24)
+        };
+    }
+    for (int i = 0 ; i < 4 ; i++)
+    {
+        out[count++] = (struct VoxelEdit){
+            .chunk = { 0, 0, 0 },
+            .index = (uint16_t) i,
+            .new_type = (uint8_t) (b >> (8*i))
+        };
+    }
+    return count;
+}
+
+static void verify_expected(struct Chunk *chunks, uint32_t batches)
+{
+    struct VoxelEdit edits[VERIFY_EDITS + 4];
+    for (int c = 0 ; c < VERIFY_CHUNKS ; c++)
+        verify_generate(&chunks[c], (struct ChunkCoord){ c, 0, 0 }, NULL);
+    for (uint32_t b = 0 ; b < batches ; b++)
+    {
+        size_t count = verify_batch(b, edits);
+        for (size_t i = 0 ; i < count ; i++)
+            chunks[edits[i].chunk.x].voxel_type[edits[i].index] = edits[i].new_type;
+    }
+}
+
+/*
+ * The child side, commits batches until it is killed and reports every
+ * batch it knows is durable.
+ * */
+static void verify_writer(const char *directory, int report, uint32_t stop_after)
+{
+    struct RegionStore store;
+    struct Journal journal;
+    struct Chunk *chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    if (chunk == NULL || region_store_init(&store, directory)
+        || journal_open(&journal, &store, verify_generate, NULL))
+        _exit(1);
+    journal_set_checkpoint_bytes(&journal, VERIFY_CHECKPOINT_BYTES);
+
+    for (int c = 0 ; c < VERIFY_SAVED ; c++)
+    {
+        verify_generate(chunk, (struct ChunkCoord){ c, 0, 0 }, NULL);
+        region_store_save(&store, (struct ChunkCoord){ c, 0, 0 }, chunk);
+        struct Region *region = region_store_acquire(&store, (struct ChunkCoord){0}, false);
+        if (region)
+        {
+            region_sync(region);
+            region_store_release(&store, region);
+        }
+    }
+    sync_directory(directory);
+
+    struct VoxelEdit edits[VERIFY_EDITS + 4];
+    for (uint32_t b = 0 ; b < stop_after ; b++)
+    {
+        uint64_t sequence = journal_append(&journal, edits, verify_batch(b, edits));
+        if (stop_after != UINT32_MAX || b % 16 == 15)
+        {
+            journal_wait(&journal, sequence);
+            uint32_t durable = b + 1;
+            if (report >= 0 && write(report, &durable, sizeof(durable)) != sizeof(durable))
+                _exit(1);
+        }
+    }
+    // Leave without closing, as if the process died right after
+    _exit(0);
+}
+
+static int verify_recovery(const char *directory, uint32_t minimum, uint32_t maximum, const char *step)
+{
+    struct RegionStore store;
+    struct Journal journal;
+    struct Chunk *expected = (struct Chunk *) malloc(VERIFY_CHUNKS*sizeof(struct Chunk));
+    struct Chunk *loaded = (struct Chunk *) malloc(sizeof(struct Chunk));
+    if (expected == NULL || loaded == NULL || region_store_init(&store, directory))
+    {
+        free(expected);
+        free(loaded);
+        return 1;
+    }
+
+    int failures = 0;
+    if (journal_open(&journal, &store, verify_generate, NULL))
+    {
+        LOG_WARN(LOG_JOURNAL, "%s: replay failed.", step);
+        failures++;
+    }
+    else
+    {
+        journal_close(&journal);
+
+        uint32_t batches = 0;
+        if (region_store_load(&store, (struct ChunkCoord){0}, loaded) == REGION_OK)
+        {
+            for (int i = 0 ; i < 4 ; i++)
+                batches |= (uint32_t) loaded->voxel_type[i] << (8*i);
+            // The marker holds the last batch, not the count
+            batches++;
+        }
+
+        if (batches < minimum || batches > maximum)
+        {
+            LOG_WARN(LOG_JOURNAL, "%s: recovered %u batches, expected %u to %u.", step, batches, minimum, maximum);
+            failures++;
+        }
+
+        verify_expected(expected, batches);
+        for (int c = 0 ; c < VERIFY_CHUNKS && failures == 0 ; c++)
+        {
+            if (region_store_load(&store, (struct ChunkCoord){ c, 0, 0 }, loaded) != REGION_OK
+                || memcmp(loaded->voxel_type, expected[c].voxel_type, CHUNK_DATA_SIZE))
+            {
+                LOG_WARN(LOG_JOURNAL, "%s: chunk %d doesn't match %u replayed batches.", step, c, batches);
+                failures++;
+            }
+        }
+    }
+
+    region_store_delete(&store, (struct ChunkCoord){0});
+    region_store_close(&store);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", directory, JOURNAL_FILE);
+    unlink(path);
+
+    free(expected);
+    free(loaded);
+    return failures;
+}
+
+static int verify_crash(const char *directory, int round)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds))
+        return 1;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return 1;
+    }
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        verify_writer(directory, pipe_fds[1], UINT32_MAX);
+    }
+    close(pipe_fds[1]);
+
+    // Let a few checkpoints go by, then kill it at a different point every round
+    uint32_t durable = 0, value;
+    int reports = 0;
+    while (reports < 8 + round*3 && read(pipe_fds[0], &value, sizeof(value)) == sizeof(value))
+    {
+        durable = value;
+        reports++;
+    }
+    usleep(1000 + round*1700);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    while (read(pipe_fds[0], &value, sizeof(value)) == sizeof(value))
+        durable = value;
+    close(pipe_fds[0]);
+
+    char step[64];
+    snprintf(step, sizeof(step), "kill %d after %u durable batches", round, durable);
+    return verify_recovery(directory, durable, UINT32_MAX, step);
+}
+
+/*
+ * Leaves a journal of VERIFY_TORN_FRAMES frames behind, breaks the last one
+ * and checks replay keeps exactly the others.
+ * */
+static int verify_torn(const char *directory, int mode)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        return 1;
+    if (pid == 0)
+        verify_writer(directory, -1, VERIFY_TORN_FRAMES);
+    waitpid(pid, NULL, 0);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", directory, JOURNAL_FILE);
+    int fd = open(path, O_RDWR);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info))
+    {
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    off_t frame = sizeof(struct JournalFrame) + (VERIFY_EDITS + 4)*sizeof(struct VoxelEdit);
+    off_t last = info.st_size - frame;
+    const char *step;
+    int result = 0;
+    if (info.st_size != VERIFY_TORN_FRAMES*frame)
+    {
+        LOG_WARN(LOG_JOURNAL, "Expected %d frames of %lld bytes, found %lld bytes.",
+                VERIFY_TORN_FRAMES, (long long) frame, (long long) info.st_size);
+        result = 1;
+        step = "frame layout";
+    }
+    else if (mode == 0)
+    {
+        step = "torn header";
+        result = ftruncate(fd, last + sizeof(struct JournalFrame)/2);
+    }
+    else if (mode == 1)
+    {
+        step = "torn edits";
+        result = ftruncate(fd, last + frame/2);
+    }
+    else
+    {
+        step = "corrupt edits";
+        uint8_t byte;
+        result = pread_full(fd, &byte, 1, last + frame - 3);
+        byte ^= 0x40;
+        result |= pwrite_full(fd, &byte, 1, last + frame - 3);
+    }
+    close(fd);
+
+    int failures = verify_recovery(directory, VERIFY_TORN_FRAMES-1, VERIFY_TORN_FRAMES-1, step);
+    return failures + (result ? 1 : 0);
+}
+
+int journal_verify(const char *directory)
+{
+    int failures = 0;
+
+    for (int round = 0 ; round < 4 ; round++)
+        failures += verify_crash(directory, round);
+
+    log_flush();
+    printf("[Journal] Expecting three dropped frames:\n");
+    for (int mode = 0 ; mode < 3 ; mode++)
+        failures += verify_torn(directory, mode);
+
+    rmdir(directory);
+    return failures;
+}
+
+struct BenchmarkWriter
+{
+    struct Journal *journal;
+    pthread_t thread;
+    int id;
+    int edits;
+};
+
+static void *benchmark_writer(void *arg)
+{
+    struct BenchmarkWriter *writer = (struct BenchmarkWriter *) arg;
+    for (int i = 0 ; i < writer->edits ; i++)
+    {
+        struct VoxelEdit edit = {
+            .chunk = { writer->id, 0, 0 },
+            .index = (uint16_t) ((i*31) % CHUNK_DATA_SIZE),
+            .new_type = (uint8_t) (i % 5)
+        };
+        uint64_t sequence = journal_append(writer->journal, &edit, 1);
+        // Every so often a writer needs to know its edits are safe
+        if (i % 256 == 255)
+            journal_wait(writer->journal, sequence);
+    }
+    return NULL;
+}
+
+void journal_benchmark(const char *directory, int writers, int edits_per_writer)
+{
+    struct RegionStore store;
+    struct Journal journal;
+    struct BenchmarkWriter *threads = (struct BenchmarkWriter *) calloc(writers, sizeof(struct BenchmarkWriter));
+    if (threads == NULL || region_store_init(&store, directory))
+    {
+        free(threads);
+        return;
+    }
+    if (journal_open(&journal, &store, verify_generate, NULL))
+    {
+        region_store_close(&store);
+        free(threads);
+        return;
+    }
+    // Checkpoints are measured on their own below
+    journal_set_checkpoint_bytes(&journal, 0);
+
+    uint64_t start = timer_now_ns();
+    int started = 0;
+    for (int i = 0 ; i < writers ; i++)
+    {
+        threads[i] = (struct BenchmarkWriter){ &journal, 0, i, edits_per_writer };
+        if (pthread_create(&threads[i].thread, NULL, benchmark_writer, &threads[i]) == 0)
+            started++;
+        else
+            break;
+    }
+    for (int i = 0 ; i < started ; i++)
+        pthread_join(threads[i].thread, NULL);
+    journal_flush(&journal);
+    double seconds = (timer_now_ns() - start) / 1e9;
+
+    struct JournalStats stats;
+    journal_get_stats(&journal, &stats);
+
+    start = timer_now_ns();
+    journal_checkpoint(&journal);
+    double checkpoint_ms = (timer_now_ns() - start) / 1e6;
+
+    printf("[Journal] %d writers, %llu edits in %.2f s, %.0f edits/s | %llu commits, %.1f edits each, %.1f KiB | checkpoint %.1f ms\n",
+            started, (unsigned long long) stats.edits, seconds, stats.edits / seconds,
+            (unsigned long long) stats.commits, stats.commits ? (double) stats.edits / stats.commits : 0.0,
+            stats.bytes_written / 1024.0, checkpoint_ms);
+
+    journal_close(&journal);
+    for (int i = 0 ; i < writers ; i++)
+    {
+        struct ChunkCoord region;
+        int index;
+        region_from_chunk((struct ChunkCoord){ i, 0, 0 }, &region, &index);
+        region_store_delete(&store, region);
+    }
+    region_store_close(&store);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", directory, JOURNAL_FILE);
+    unlink(path);
+    rmdir(directory);
+    free(threads);
+}
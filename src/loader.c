@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <glad/gl.h>
+#include <loader.h>
+#include <profile.h>
+#include <log.h>
+
+static void *loader_thread(void *arg);
+
+int loader_init(struct Loader *loader, GLFWwindow *main_window, bool want_thread)
+{
+    *loader = (struct Loader){0};
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->wake, NULL);
+
+    if (!want_thread || main_window == NULL)
+    {
+        LOG_INFO(LOG_LOADER, "Using the main thread queue.");
+        return 0;
+    }
+
+    // The shared context has to match the main one, only hide it
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    loader->context = glfwCreateWindow(1, 1, "Voyager loader", NULL, main_window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+    if (!loader->context)
+    {
+        LOG_WARN(LOG_LOADER, "Unable to create a shared context, using the main thread queue.");
+        return 0;
+    }
+
+    loader->threaded = true;
+    loader->running = true;
+
+    if (pthread_create(&loader->thread, NULL, loader_thread, loader))
+    {
+        LOG_WARN(LOG_LOADER, "Unable to start the loader thread, using the main thread queue.");
+        glfwDestroyWindow(loader->context);
+        loader->context = NULL;
+        loader->threaded = false;
+        loader->running = false;
+        return 0;
+    }
+
+    return 0;
+}
+
+// Holding the lock
+static void push_job(struct LoaderJob **head, struct LoaderJob **tail, struct LoaderJob *job)
+{
+    if (*tail)
+        (*tail)->next = job;
+    else
+        *head = job;
+    *tail = job;
+}
+
+void loader_submit(struct Loader *loader, LoaderWork work, LoaderDone done, void *user)
+{
+    struct LoaderJob *job = (struct LoaderJob *) calloc(1, sizeof(struct LoaderJob));
+    if (job == NULL)
+    {
+        LOG_ERROR(LOG_LOADER, "Unable to allocate a job.");
+        return;
+    }
+
+    job->work = work;
+    job->done = done;
+    job->user = user;
+
+    pthread_mutex_lock(&loader->lock);
+    push_job(&loader->pending_head, &loader->pending_tail, job);
+    pthread_cond_signal(&loader->wake);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static struct LoaderJob *pop_job(struct LoaderJob **head, struct LoaderJob **tail)
+{
+    struct LoaderJob *job = *head;
+    if (job)
+    {
+        *head = job->next;
+        if (*head == NULL)
+            *tail = NULL;
+        job->next = NULL;
+    }
+    return job;
+}
+
+static void *loader_thread(void *arg)
+{
+    struct Loader *loader = (struct Loader *) arg;
+
+    glfwMakeContextCurrent(loader->context);
+    PROFILE_THREAD("loader");
+
+    pthread_mutex_lock(&loader->lock);
+    while (true)
+    {
+        while (loader->running && loader->pending_head == NULL)
+            pthread_cond_wait(&loader->wake, &loader->lock);
+
+        struct LoaderJob *job = pop_job(&loader->pending_head, &loader->pending_tail);
+        if (job == NULL)
+            break;
+        pthread_mutex_unlock(&loader->lock);
+
+        if (job->work)
+            job->work(job->user);
+
+        // The flush makes sure the fence actually reaches the GPU,
+        // otherwise the render thread could wait on it forever
+        job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+
+        pthread_mutex_lock(&loader->lock);
+        push_job(&loader->completed_head, &loader->completed_tail, job);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    glfwMakeContextCurrent(NULL);
+    return NULL;
+}
+
+void loader_collect(struct Loader *loader)
+{
+    if (!loader->threaded)
+    {
+        for (int i = 0 ; i < LOADER_MAIN_THREAD_JOBS_PER_POLL ; i++)
+        {
+            pthread_mutex_lock(&loader->lock);
+            struct LoaderJob *job = pop_job(&loader->pending_head, &loader->pending_tail);
+            pthread_mutex_unlock(&loader->lock);
+
+            if (job == NULL)
+                break;
+
+            // Same context, GL already orders the commands for us
+            if (job->work)
+                job->work(job->user);
+
+            pthread_mutex_lock(&loader->lock);
+            push_job(&loader->finished_head, &loader->finished_tail, job);
+            pthread_mutex_unlock(&loader->lock);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    struct LoaderJob *ready = loader->completed_head;
+    loader->completed_head = NULL;
+    loader->completed_tail = NULL;
+    pthread_mutex_unlock(&loader->lock);
+
+    // Jobs whose fences haven't signaled yet, kept in submission order
+    struct LoaderJob *waiting_head = NULL, *waiting_tail = NULL;
+    struct LoaderJob *finished_head = NULL, *finished_tail = NULL;
+
+    while (ready)
+    {
+        struct LoaderJob *job = ready;
+        ready = job->next;
+        job->next = NULL;
+
+        GLenum status = glClientWaitSync((GLsync) job->fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            push_job(&waiting_head, &waiting_tail, job);
+            continue;
+        }
+
+        if (status == GL_WAIT_FAILED)
+            LOG_WARN(LOG_LOADER, "Waiting on a loader fence failed.");
+
+        glDeleteSync((GLsync) job->fence);
+        job->fence = NULL;
+        push_job(&finished_head, &finished_tail, job);
+    }
+
+    if (waiting_head == NULL && finished_head == NULL)
+        return;
+
+    pthread_mutex_lock(&loader->lock);
+    if (waiting_head)
+    {
+        waiting_tail->next = loader->completed_head;
+        if (loader->completed_head == NULL)
+            loader->completed_tail = waiting_tail;
+        loader->completed_head = waiting_head;
+    }
+    if (finished_head)
+    {
+        if (loader->finished_tail)
+            loader->finished_tail->next = finished_head;
+        else
+            loader->finished_head = finished_head;
+        loader->finished_tail = finished_tail;
+    }
+    pthread_mutex_unlock(&loader->lock);
+}
+
+void loader_finish(struct Loader *loader)
+{
+    pthread_mutex_lock(&loader->lock);
+    struct LoaderJob *job = loader->finished_head;
+    loader->finished_head = NULL;
+    loader->finished_tail = NULL;
+    pthread_mutex_unlock(&loader->lock);
+
+    while (job)
+    {
+        struct LoaderJob *next = job->next;
+        if (job->done)
+            job->done(job->user);
+        free(job);
+        job = next;
+    }
+}
+
+void loader_poll(struct Loader *loader)
+{
+    loader_collect(loader);
+    loader_finish(loader);
+}
+
+void loader_shutdown(struct Loader *loader)
+{
+    // Collected before, the thread that would have finished them is gone
+    loader_finish(loader);
+
+    if (loader->threaded)
+    {
+        pthread_mutex_lock(&loader->lock);
+        loader->running = false;
+        pthread_cond_signal(&loader->wake);
+        pthread_mutex_unlock(&loader->lock);
+
+        // The loader drains its queue before leaving
+        pthread_join(loader->thread, NULL);
+
+        struct LoaderJob *job;
+        while ((job = pop_job(&loader->completed_head, &loader->completed_tail)))
+        {
+            glClientWaitSync((GLsync) job->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync((GLsync) job->fence);
+            if (job->done)
+                job->done(job->user);
+            free(job);
+        }
+
+        glfwDestroyWindow(loader->context);
+        loader->context = NULL;
+        loader->threaded = false;
+    }
+    else
+    {
+        struct LoaderJob *job;
+        while ((job = pop_job(&loader->pending_head, &loader->pending_tail)))
+        {
+            if (job->work)
+                job->work(job->user);
+            if (job->done)
+                job->done(job->user);
+            free(job);
+        }
+    }
+
+    pthread_cond_destroy(&loader->wake);
+    pthread_mutex_destroy(&loader->lock);
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <log.h>
+#include <timer.h>
+
+// One per thread, the owner moves head and the writer moves tail
+struct LogRing
+{
+    struct LogRecord records[LOG_RING_RECORDS];
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t dropped;
+    // rings of exited threads are handed to the next new one
+    bool owned;
+    struct LogRing *next;
+};
+
+enum WriterState
+{
+    WRITER_IDLE,
+    WRITER_RUNNING,
+    // writing synchronously from the logging thread
+    WRITER_STOPPED
+};
+
+static const char *category_names[LOG_CATEGORY_COUNT] = {
+    "Core", "Render", "IO", "Loader", "Scheduler", "Job", "Stream", "Worldgen",
+    "Terrain", "Columns", "Region", "Codec", "ChunkIO", "Journal", "Epoch",
+    "Snapshot", "Reclaim", "Profile", "GpuTimer", "Frame", "Memory", "Bench"
+};
+
+static const char *level_prefixes[LOG_LEVEL_COUNT] = { "trace: ", "debug: ", "", "warning: ", "error: " };
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+// only ever prepended to, a reader can walk it without the lock
+static struct LogRing *rings;
+static int ring_count;
+static __thread struct LogRing *thread_ring;
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t writer;
+static int state = WRITER_IDLE;
+static int runtime_level = LOG_MIN_LEVEL;
+
+// held by whoever drains, the writer thread, log_flush or a synchronous write
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t written, dropped_reported;
+
+static void write_record(const struct LogRecord *record)
+{
+    fprintf(stdout, "[%s] %s%.*s\n", category_names[record->category], level_prefixes[record->level], (int) record->length, record->message);
+}
+
+/*
+ * Merges the rings by timestamp, so records of different threads come out
+ * in the order they were logged.
+ * */
+static void drain(void)
+{
+    struct LogRing *first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    uint64_t dropped = 0;
+    bool any = false;
+
+    for (;;)
+    {
+        struct LogRing *oldest = NULL;
+        for (struct LogRing *ring = first ; ring ; ring = ring->next)
+        {
+            uint64_t tail = ring->tail;
+            if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+                continue;
+            if (oldest == NULL || ring->records[tail % LOG_RING_RECORDS].time_ns < oldest->records[oldest->tail % LOG_RING_RECORDS].time_ns)
+                oldest = ring;
+        }
+        if (oldest == NULL)
+            break;
+
+        write_record(&oldest->records[oldest->tail % LOG_RING_RECORDS]);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+        written++;
+        any = true;
+    }
+
+    for (struct LogRing *ring = first ; ring ; ring = ring->next)
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped > dropped_reported)
+    {
+        fprintf(stdout, "[Log] %llu records dropped, the rings were full\n", (unsigned long long) (dropped - dropped_reported));
+        dropped_reported = dropped;
+        any = true;
+    }
+
+    if (any)
+        fflush(stdout);
+}
+
+static void *writer_thread(void *user)
+{
+    struct timespec interval = { 0, LOG_FLUSH_MS * 1000000L };
+    while (__atomic_load_n(&state, __ATOMIC_ACQUIRE) == WRITER_RUNNING)
+    {
+        pthread_mutex_lock(&drain_lock);
+        drain();
+        pthread_mutex_unlock(&drain_lock);
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+static void release_ring(void *pointer)
+{
+    struct LogRing *ring = (struct LogRing *) pointer;
+    __atomic_store_n(&ring->owned, false, __ATOMIC_RELEASE);
+}
+
+// A forked child has no writer thread, and the drain lock may have been held
+static void after_fork_child(void)
+{
+    pthread_mutex_init(&drain_lock, NULL);
+    __atomic_store_n(&state, WRITER_STOPPED, __ATOMIC_RELEASE);
+}
+
+static void start_writer(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+    pthread_atfork(NULL, NULL, after_fork_child);
+
+    __atomic_store_n(&state, WRITER_RUNNING, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, writer_thread, NULL) == 0)
+    {
+        atexit(log_shutdown);
+    }
+    else
+    {
+        __atomic_store_n(&state, WRITER_STOPPED, __ATOMIC_RELEASE);
+    }
+}
+
+static struct LogRing *create_ring(void)
+{
+    pthread_once(&start_once, start_writer);
+
+    struct LogRing *ring = NULL;
+    for (struct LogRing *free_ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE) ; free_ring && ring == NULL ; free_ring = free_ring->next)
+    {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&free_ring->owned, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            ring = free_ring;
+    }
+
+    if (ring == NULL)
+    {
+        ring = (struct LogRing *) calloc(1, sizeof(struct LogRing));
+        if (ring == NULL)
+            return NULL;
+        ring->owned = true;
+        pthread_mutex_lock(&rings_lock);
+        ring->next = rings;
+        __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+        ring_count++;
+        pthread_mutex_unlock(&rings_lock);
+    }
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static void format_record(struct LogRecord *record, int level, enum LogCategory category, const char *format, va_list args)
+{
+    record->time_ns = timer_now_ns();
+    record->level = (uint8_t) level;
+    record->category = (uint8_t) category;
+    int length = vsnprintf(record->message, LOG_MESSAGE_BYTES, format, args);
+    if (length < 0)
+        length = 0;
+    record->length = length < LOG_MESSAGE_BYTES ? length : LOG_MESSAGE_BYTES - 1;
+}
+
+void log_write(int level, enum LogCategory category, const char *format, ...)
+{
+    if (level < __atomic_load_n(&runtime_level, __ATOMIC_RELAXED))
+        return;
+
+    va_list args;
+    va_start(args, format);
+
+    struct LogRing *ring = thread_ring ? thread_ring : create_ring();
+    if (ring == NULL || __atomic_load_n(&state, __ATOMIC_ACQUIRE) == WRITER_STOPPED)
+    {
+        // after shutdown, behind everything still in the rings
+        struct LogRecord record;
+        format_record(&record, level, category, format, args);
+        pthread_mutex_lock(&drain_lock);
+        drain();
+        write_record(&record);
+        fflush(stdout);
+        written++;
+        pthread_mutex_unlock(&drain_lock);
+        va_end(args);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_RECORDS)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        va_end(args);
+        return;
+    }
+
+    format_record(&ring->records[head % LOG_RING_RECORDS], level, category, format, args);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    va_end(args);
+}
+
+void log_set_level(int level)
+{
+    __atomic_store_n(&runtime_level, level < LOG_MIN_LEVEL ? LOG_MIN_LEVEL : level, __ATOMIC_RELAXED);
+}
+
+void log_flush(void)
+{
+    pthread_mutex_lock(&drain_lock);
+    drain();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void log_shutdown(void)
+{
+    int expected = WRITER_RUNNING;
+    if (__atomic_compare_exchange_n(&state, &expected, WRITER_STOPPED, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        pthread_join(writer, NULL);
+    log_flush();
+}
+
+void log_get_stats(struct LogStats *out)
+{
+    pthread_mutex_lock(&drain_lock);
+    out->written = written;
+    pthread_mutex_unlock(&drain_lock);
+
+    out->dropped = 0;
+    pthread_mutex_lock(&rings_lock);
+    out->rings = ring_count;
+    for (struct LogRing *ring = rings ; ring ; ring = ring->next)
+        out->dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&rings_lock);
+}
@@ -1,21 +1,101 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
 #include <cglm/struct.h>
 #include <io.h>
 #include <render.h>
 #include <voxel.h>
+#include <loader.h>
+#include <scheduler.h>
+#include <job.h>
+#include <stream.h>
+#include <terrain.h>
+#include <worldgen.h>
+#include <region.h>
+#include <codec.h>
+#include <chunkio.h>
+#include <journal.h>
+#include <snapshot.h>
+#include <reclaim.h>
+#include <profile.h>
+#include <gputimer.h>
+#include <framestats.h>
+#include <flythrough.h>
+#include <memtrack.h>
+#include <arena.h>
+#include <framepacket.h>
+#include <timer.h>
+#include <log.h>
+
+// Simulation steps per second, the render thread draws as fast as it can
+#define SIMULATION_HZ 240
 
-float frame_delta = 0.0f;
 double last_x, last_y;
 bool first_mouse = true;
 
 void cursor_position_callback(GLFWwindow* window, double x, double y);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
+// Written by the callbacks on the render thread, sampled by the simulation
+pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
 bool w=false, a=false, s=false, d=false, shift=false, space=false, wire_frame=false;
-void input_process();
+// mouse movement and window size the simulation hasn't applied yet
+float look_x = 0.0f, look_y = 0.0f;
+int resize_width = 0, resize_height = 0;
+// F3 picks a work class, F4 and F5 halve and double its scheduler budget
+int budget_class = WORK_UPLOAD, budget_steps = 0;
+bool budget_selected = false;
+
+bool print_stream_stats=false;
+bool dump_profile=false;
+
+/*
+ * Everything but drawing, on a thread of its own: input, the camera and
+ * the world. Every step ends with a frame packet for the render thread.
+ * */
+struct Simulation
+{
+    struct ChunkStream *stream;
+    struct Loader *loader;
+    struct FrameScheduler *scheduler;
+    // NULL without saved chunks
+    struct ChunkIo *chunk_io;
+    struct GpuReclaim *reclaim;
+    struct FrameExchange *exchange;
+
+    bool running;
+    // set by the render thread, the world's stats are printed by the simulation
+    bool print_stats;
+    pthread_t thread;
+};
+
+static int simulation_start(struct Simulation *simulation);
+static void simulation_stop(struct Simulation *simulation);
+void input_process(float frame_delta);
+void input_budgets(struct FrameScheduler *scheduler);
+
+void generate_terrain_chunk(struct Chunk *chunk, struct ChunkCoord coord, void *user);
+void generate_world_chunk(struct Chunk *chunk, struct ChunkCoord coord, void *user);
+int terrain_bench(void);
+int region_bench(const char *directory);
+int codec_bench(void);
+int journal_bench(const char *directory);
+int stream_bench(const char *directory);
+int snapshot_bench(void);
+int profile_bench(void);
+int flythrough_bench(int frames, const char *path);
+
+// what the stream generates, the journal needs the same chunks to replay edits onto
+struct WorldSource
+{
+    struct Terrain *terrain;
+    struct Worldgen *worldgen;
+};
 
 struct Camera camera = {
     .fov = 70.0f,
@@ -29,10 +109,27 @@ struct Camera camera = {
     .roll = 0.0f
 };
 
-int main (void)
+int main (int argc, char **argv)
 {
     int error = 0;
 
+    if (argc > 1 && strcmp(argv[1], "terrain-bench") == 0)
+        return terrain_bench();
+    if (argc > 1 && strcmp(argv[1], "region-bench") == 0)
+        return region_bench(argc > 2 ? argv[2] : "region_bench");
+    if (argc > 1 && strcmp(argv[1], "codec-bench") == 0)
+        return codec_bench();
+    if (argc > 1 && strcmp(argv[1], "journal-bench") == 0)
+        return journal_bench(argc > 2 ? argv[2] : "journal_bench");
+    if (argc > 1 && strcmp(argv[1], "stream-bench") == 0)
+        return stream_bench(argc > 2 ? argv[2] : "stream_bench");
+    if (argc > 1 && strcmp(argv[1], "snapshot-bench") == 0)
+        return snapshot_bench();
+    if (argc > 1 && strcmp(argv[1], "profile-bench") == 0)
+        return profile_bench();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return flythrough_bench(argc > 2 ? atoi(argv[2]) : FLYTHROUGH_DEFAULT_FRAMES, argc > 3 ? argv[3] : FLYTHROUGH_DEFAULT_FILE);
+
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
 
@@ -43,7 +140,7 @@ int main (void)
 
     if (!glfwInit())
     {
-        printf("Unable to initialize glfw.\n");
+        LOG_ERROR(LOG_CORE, "Unable to initialize glfw.");
         return -1;
     }
 
@@ -51,38 +148,34 @@ int main (void)
     if (!window)
     {
         glfwTerminate();
-        printf("Unable to open a window context.\n");
+        LOG_ERROR(LOG_CORE, "Unable to open a window context.");
         return -1;
     }
 
     glfwMakeContextCurrent(window);
     gladLoadGL(glfwGetProcAddress);
 
-    printf("Opengl Version: %s\n",glGetString(GL_VERSION));
+    LOG_INFO(LOG_RENDER, "Opengl Version: %s",glGetString(GL_VERSION));
 
     glfwSetFramebufferSizeCallback(window, window_resize_callback);
     glfwSetCursorPosCallback(window, cursor_position_callback);
     glfwSetKeyCallback(window, key_callback);
 
     error = glGetError();
-    printf("[Initialization] error: 0x%x\n", error);
+    LOG_INFO(LOG_RENDER, "Initialization error: 0x%x", error);
 
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    // 32**3 = 32768
-    struct Chunk chunk;
-    for ( int i = 0 ; i < CHUNK_DATA_SIZE ; i++)
-    {
-        chunk.voxel_type[i] = rand() % 2;
-    }
-
-    generate_chunk_bitmask(&chunk);
+    struct Loader loader;
+    loader_init(&loader, window, true);
 
+    // every chunk shares the lattice mesh, only the texture and transform change
     struct Lattice chunk_mesh;
+    load_lattice(&chunk_mesh, &loader, "resources/lattice_vertex.glsl", "resources/lattice_fragment.glsl", CHUNK_WIDTH);
 
-    chunk_mesh = create_lattice("resources/lattice_vertex.glsl", "resources/lattice_fragment.glsl", 32);
-
-    chunk_mesh.texture = generate_chunk_lattice_texture(&chunk);
+    // GL objects the last frames may still be drawing with
+    struct GpuReclaim reclaim;
+    gpu_reclaim_init(&reclaim);
 
     // initialize camera view matrix
     glm_mat4_identity(camera.view);
@@ -95,11 +188,6 @@ int main (void)
     camera.width = width;
     camera.height = height;
 
-    // initialize object variables
-    glm_mat4_identity(chunk_mesh.object_transform);
-    vec3 transform = {0.0f,0.0f,1.0f};
-    glm_translate(chunk_mesh.object_transform, transform);
-
     // set to zero for no vsync
     glfwSwapInterval(0);
 
@@ -117,47 +205,416 @@ int main (void)
     //    exit(-1);
     //}
 
-    printf("chunk mesh texture id: %d\n", chunk_mesh.texture);
-    glBindTexture(GL_TEXTURE_3D, chunk_mesh.texture);
-
-    printf("client render loop start\n");
+    LOG_INFO(LOG_CORE, "client render loop start");
 
     error = glGetError();
-    printf("[Post Initialization] error: 0x%x\n", error);
+    LOG_INFO(LOG_RENDER, "Post initialization error: 0x%x", error);
+
+    // deferred main thread work, budgeted per frame
+    struct FrameScheduler scheduler;
+    scheduler_init(&scheduler);
+
+    struct JobPool workers;
+    if (job_pool_init(&workers, 0))
+    {
+        LOG_ERROR(LOG_CORE, "Unable to start the worker threads.");
+        return -1;
+    }
+
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+    LOG_INFO(LOG_TERRAIN, "seed %u, noise kernels: %s", terrain.seed, terrain_level_name(terrain.level));
+
+    struct ChunkStream stream;
+    stream_init(&stream, &workers, &loader, &reclaim, &scheduler, generate_terrain_chunk, &terrain);
 
-    printf("Lattice info:\n\ttexture: %u\n", chunk_mesh.texture);
+    // staged generation with trees, falls back to plain terrain without it
+    struct Worldgen worldgen;
+    bool use_worldgen = worldgen_init(&worldgen, &terrain, &workers) == 0;
+    if (use_worldgen)
+        stream_use_worldgen(&stream, &worldgen);
+
+    // saved chunks come from disk, everything else is generated
+    struct RegionStore regions;
+    struct ChunkIo chunk_io;
+    bool use_io = region_store_init(&regions, "world") == 0;
+    if (use_io && chunk_io_init(&chunk_io, &regions, &workers, CHUNK_IO_DEFAULT_THREADS))
+    {
+        region_store_close(&regions);
+        use_io = false;
+    }
+    if (use_io)
+        stream_use_io(&stream, &chunk_io);
+
+    // edits of the last session are replayed before anything is loaded
+    struct WorldSource source = { &terrain, use_worldgen ? &worldgen : NULL };
+    struct Journal journal;
+    bool use_journal = use_io && journal_open(&journal, &regions, generate_world_chunk, &source) == 0;
+    if (use_journal)
+        stream_use_journal(&stream, &journal);
+
+    PROFILE_THREAD("render");
+
+    // GPU time per pass, read back a few frames late
+    struct GpuTimer gpu_timer;
+    gpu_timer_init(&gpu_timer);
+
+    // frame time percentiles and hitches, summarized every few seconds
+    struct FrameStats frame_stats;
+    frame_stats_init(&frame_stats);
+
+    // what the simulation publishes, the newest is drawn every frame
+    struct FrameExchange exchange;
+    frame_exchange_init(&exchange);
+
+    struct Simulation simulation = {
+        .stream = &stream,
+        .loader = &loader,
+        .scheduler = &scheduler,
+        .chunk_io = use_io ? &chunk_io : NULL,
+        .reclaim = &reclaim,
+        .exchange = &exchange
+    };
+    if (simulation_start(&simulation))
+    {
+        LOG_ERROR(LOG_CORE, "Unable to start the simulation thread.");
+        return -1;
+    }
 
     float prev_frame_time = 0.0f;
     // render loop
     while(!glfwWindowShouldClose(window))
     {
-        printf("\r");
+        PROFILE_FRAME();
+        gpu_timer_begin_frame(&gpu_timer);
 
+        gpu_timer_begin(&gpu_timer, "clear");
         glClearColor(0.1f,0.1f,0.1f,1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        gpu_timer_end(&gpu_timer);
 
         float current_frame_time = glfwGetTime();
-        frame_delta = current_frame_time - prev_frame_time;
+        float frame_delta = current_frame_time - prev_frame_time;
         prev_frame_time = current_frame_time;
+        if (frame_stats_push(&frame_stats, frame_delta * 1000.0))
+        {
+            frame_stats_print(&frame_stats);
+            frame_exchange_print_stats(&exchange);
+        }
+
+        // Fences and the main thread queue, the simulation runs the callbacks
+        PROFILE_ZONE_BEGIN(poll_zone, "poll");
+        loader_collect(&loader);
+        PROFILE_ZONE_END(poll_zone);
+
+        struct FramePacket *packet = frame_exchange_acquire(&exchange);
+        gpu_timer_begin(&gpu_timer, "lattice");
+        if (packet)
+            stream_draw_list(packet->draws, packet->draw_count, &chunk_mesh, &packet->camera);
+        gpu_timer_end(&gpu_timer);
+        gpu_timer_end_frame(&gpu_timer);
+        // Older packets are never drawn again, what only they used can go
+        if (packet)
+            gpu_reclaim_frame_drawn(&reclaim, packet->frame);
+
+        if (print_stream_stats)
+        {
+            frame_stats_print(&frame_stats);
+            frame_exchange_print_stats(&exchange);
+            gpu_timer_print(&gpu_timer);
+            __atomic_store_n(&simulation.print_stats, true, __ATOMIC_RELAXED);
+            print_stream_stats = false;
+        }
+        if (dump_profile)
+        {
+            profile_dump(PROFILE_TRACE_FILE);
+            dump_profile = false;
+        }
+
+        PROFILE_ZONE_BEGIN(swap_zone, "swap");
+        glfwSwapBuffers(window);
+        PROFILE_ZONE_END(swap_zone);
+        if (packet)
+            frame_exchange_presented(&exchange, packet);
+
+        glfwPollEvents();
+    }
+
+    // Nothing but this thread touches the world from here on
+    simulation_stop(&simulation);
+    frame_exchange_print_stats(&exchange);
+
+    loader_shutdown(&loader);
+    if (use_io)
+    {
+        // whatever was edited since the last save
+        stream_save(&stream);
+        chunk_io_shutdown(&chunk_io);
+    }
+    if (use_journal)
+        journal_close(&journal);
+    stream_shutdown(&stream);
+    // chunks and versions the last frames replaced
+    epoch_barrier();
+    gpu_reclaim_shutdown(&reclaim);
+    gpu_timer_free(&gpu_timer);
+    frame_exchange_free(&exchange);
+    profile_dump(PROFILE_TRACE_FILE);
+    profile_shutdown();
+    if (use_worldgen)
+        worldgen_shutdown(&worldgen);
+    if (use_io)
+        region_store_close(&regions);
+    scheduler_free(&scheduler);
+    job_pool_shutdown(&workers);
+
+    glfwTerminate();
+    return 0;
+}
+
+void generate_terrain_chunk(struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    terrain_generate_chunk((struct Terrain *) user, chunk, coord);
+}
+
+void generate_world_chunk(struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    struct WorldSource *source = (struct WorldSource *) user;
+    if (source->worldgen == NULL || worldgen_generate(source->worldgen, coord, chunk))
+        terrain_generate_chunk(source->terrain, chunk, coord);
+}
+
+/*
+ * Checks the vector noise kernels against the scalar reference and the
+ * staged pipeline against itself across thread counts, then reports
+ * single core generation throughput for every supported level.
+ * */
+int terrain_bench(void)
+{
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+
+    int mismatches = terrain_verify(&terrain, 64);
+    log_flush();
+    printf("[Terrain] bit exact check: %s\n", mismatches ? "FAILED" : "ok");
+
+    int threads = job_pool_default_threads();
+    if (threads < 4)
+        threads = 4;
+    int differences = worldgen_verify(&terrain, threads);
+    log_flush();
+    printf("[Worldgen] determinism check up to %d threads: %s\n", threads, differences ? "FAILED" : "ok");
+    mismatches += differences;
+
+    column_cache_benchmark(&terrain, 8, 16);
+
+    for (int level = 0 ; level < TERRAIN_LEVEL_COUNT ; level++)
+    {
+        if (!terrain_level_supported(level))
+            continue;
+
+        // warm up the caches before measuring
+        terrain_benchmark(&terrain, level, 8);
+        double rate = terrain_benchmark(&terrain, level, 256);
+        printf("[Terrain] %-8s %8.2f Mvoxels/s per core, %7.1f chunks/s\n", terrain_level_name(level), rate / 1e6, rate / CHUNK_DATA_SIZE);
+    }
+
+    return mismatches ? 1 : 0;
+}
+
+/*
+ * Round trip and corruption checks for the region format, then save and
+ * load throughput, synchronous and through the I/O service. Region files
+ * are created in directory and removed again.
+ * */
+int region_bench(const char *directory)
+{
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+
+    int failures = region_verify(directory);
+    log_flush();
+    printf("[Region] round trip and corruption check: %s\n", failures ? "FAILED" : "ok");
+
+    region_benchmark(&terrain, directory, 1024);
+
+    struct JobPool workers;
+    if (job_pool_init(&workers, 0))
+    {
+        LOG_ERROR(LOG_CORE, "Unable to start the worker threads.");
+        return 1;
+    }
+    int io_failures = chunk_io_benchmark(&terrain, &workers, directory, 1024);
+    log_flush();
+    printf("[ChunkIO] async round trip check: %s\n", io_failures ? "FAILED" : "ok");
+    failures += io_failures;
+    job_pool_shutdown(&workers);
+
+    return failures ? 1 : 0;
+}
 
-        printf("fd: %f ", frame_delta);
+/*
+ * Round trips and edge cases of the chunk codec, then ratio and
+ * throughput on generated terrain.
+ * */
+int codec_bench(void)
+{
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+
+    int failures = codec_verify(&terrain);
+    log_flush();
+    printf("[Codec] round trip check: %s\n", failures ? "FAILED" : "ok");
+
+    codec_benchmark(&terrain, 256);
+    return failures ? 1 : 0;
+}
+
+/*
+ * Crash recovery checks for the edit journal, then group commit throughput.
+ * */
+int journal_bench(const char *directory)
+{
+    int failures = journal_verify(directory);
+    log_flush();
+    printf("[Journal] crash recovery check: %s\n", failures ? "FAILED" : "ok");
+
+    journal_benchmark(directory, 1, 20000);
+    journal_benchmark(directory, 4, 20000);
+    return failures ? 1 : 0;
+}
+
+/*
+ * Voxel edits through the stream, saved incrementally and loaded back.
+ * */
+int stream_bench(const char *directory)
+{
+    int failures = stream_verify(directory);
+    log_flush();
+    printf("[Stream] edit, save and reload check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
+
+/*
+ * Copy on write chunk versions read by several threads while one edits,
+ * build with -fsanitize=thread to check the reclamation as well.
+ * */
+int snapshot_bench(void)
+{
+    int failures = shared_chunk_stress(4, 2.0);
+    log_flush();
+    printf("[Snapshot] concurrent read check: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
+
+/*
+ * Cost of a zone, then a trace of several threads dumped while they record.
+ * */
+int profile_bench(void)
+{
+    int failures = profile_benchmark(PROFILE_TRACE_FILE);
+    profile_shutdown();
+    return failures;
+}
+
+/*
+ * Scripted flight on the null platform, timings go to path as JSON.
+ * */
+int flythrough_bench(int frames, const char *path)
+{
+    if (frames <= 0)
+        frames = FLYTHROUGH_DEFAULT_FRAMES;
+    int error = flythrough_run(frames, path);
+    profile_dump(PROFILE_TRACE_FILE);
+    profile_shutdown();
+    return error ? 1 : 0;
+}
+
+static void *simulation_thread(void *arg)
+{
+    struct Simulation *simulation = (struct Simulation *) arg;
+    PROFILE_THREAD("simulation");
+
+    const uint64_t step_ns = 1000000000ull / SIMULATION_HZ;
+    uint64_t last_step = timer_now_ns();
+    uint64_t frame = 0;
 
-        input_process();
-        printf("wire_frame: %d ", wire_frame);
+    while (__atomic_load_n(&simulation->running, __ATOMIC_ACQUIRE))
+    {
+        uint64_t step_start = timer_now_ns();
+        float frame_delta = (step_start - last_step) / 1e9f;
+        last_step = step_start;
+
+        // Textures retired from here on may still be in the packets before this one
+        frame++;
+        frame_arena_begin();
+        gpu_reclaim_set_frame(simulation->reclaim, frame);
+
+        uint64_t input_ns = timer_now_ns();
+        input_process(frame_delta);
+        input_budgets(simulation->scheduler);
+
+        PROFILE_ZONE_BEGIN(poll_zone, "poll");
+        loader_finish(simulation->loader);
+        if (simulation->chunk_io)
+            chunk_io_poll(simulation->chunk_io);
+        PROFILE_ZONE_END(poll_zone);
+        PROFILE_ZONE_BEGIN(scheduler_zone, "scheduler");
+        scheduler_run_frame(simulation->scheduler, camera.position);
+        PROFILE_ZONE_END(scheduler_zone);
 
         camera_process(&camera);
+        stream_update(simulation->stream, &camera, frame_delta);
 
-        render_lattice(&chunk_mesh, &camera);
+        // Without room for the draws the renderer keeps the last packet
+        struct ChunkStream *stream = simulation->stream;
+        struct FramePacket *packet = frame_exchange_write(simulation->exchange);
+        if (frame_packet_reserve(packet, stream->ready_count) == 0)
+        {
+            packet->frame = frame;
+            packet->input_ns = input_ns;
+            packet->camera = camera;
+            size_t count = stream_collect_draws(stream, &camera, packet->draws, packet->draw_capacity);
+            packet->draw_count = count < packet->draw_capacity ? count : packet->draw_capacity;
+            frame_exchange_publish(simulation->exchange);
+        }
 
-        glfwSwapBuffers(window);
+        if (__atomic_exchange_n(&simulation->print_stats, false, __ATOMIC_RELAXED))
+        {
+            stream_print_stats(stream);
+            mem_print_stats();
+            frame_arena_print_stats();
+        }
 
-        glfwPollEvents();
+        uint64_t elapsed = timer_now_ns() - step_start;
+        if (elapsed < step_ns)
+        {
+            uint64_t wait = step_ns - elapsed;
+            struct timespec duration = { (time_t) (wait / 1000000000ull), (long) (wait % 1000000000ull) };
+            nanosleep(&duration, NULL);
+        }
     }
 
-    glfwTerminate();
+    return NULL;
+}
+
+static int simulation_start(struct Simulation *simulation)
+{
+    simulation->running = true;
+    if (pthread_create(&simulation->thread, NULL, simulation_thread, simulation))
+    {
+        simulation->running = false;
+        return -1;
+    }
     return 0;
 }
 
+static void simulation_stop(struct Simulation *simulation)
+{
+    __atomic_store_n(&simulation->running, false, __ATOMIC_RELEASE);
+    pthread_join(simulation->thread, NULL);
+}
+
 void cursor_position_callback(GLFWwindow *window, double x, double y)
 {
     if (first_mouse)
@@ -172,8 +629,23 @@ void cursor_position_callback(GLFWwindow *window, double x, double y)
     last_x = x;
     last_y = y;
 
-    x_offset *= camera.sensitivity;
-    y_offset *= camera.sensitivity;
+    // The camera belongs to the simulation, it turns on its next step
+    pthread_mutex_lock(&input_lock);
+    look_x += x_offset;
+    look_y += y_offset;
+    pthread_mutex_unlock(&input_lock);
+}
+
+// Simulation thread, holding the input lock
+static void apply_look(void)
+{
+    if (look_x == 0.0f && look_y == 0.0f)
+        return;
+
+    float x_offset = look_x * camera.sensitivity;
+    float y_offset = look_y * camera.sensitivity;
+    look_x = 0.0f;
+    look_y = 0.0f;
 
     camera.yaw += x_offset;
     camera.pitch -= y_offset;
@@ -198,6 +670,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
+    pthread_mutex_lock(&input_lock);
+
     if (key == GLFW_KEY_W && action == GLFW_PRESS)
         w = true;
     if (key == GLFW_KEY_W && action == GLFW_RELEASE)
@@ -228,6 +702,23 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if (key == GLFW_KEY_LEFT_SHIFT && action == GLFW_RELEASE)
         shift = false;
 
+    if (key == GLFW_KEY_F3 && action == GLFW_RELEASE)
+    {
+        budget_class = (budget_class + 1) % WORK_CLASS_COUNT;
+        budget_selected = true;
+    }
+    if (key == GLFW_KEY_F4 && action == GLFW_RELEASE)
+        budget_steps--;
+    if (key == GLFW_KEY_F5 && action == GLFW_RELEASE)
+        budget_steps++;
+
+    pthread_mutex_unlock(&input_lock);
+
+    if (key == GLFW_KEY_F1 && action == GLFW_RELEASE)
+        print_stream_stats = true;
+    if (key == GLFW_KEY_F2 && action == GLFW_RELEASE)
+        dump_profile = true;
+
     if (key == GLFW_KEY_G && action == GLFW_RELEASE)
     {
         if (wire_frame)
@@ -241,8 +732,23 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     }
 }
 
-void input_process(void)
+/*
+ * Simulation thread, moves the camera by what came in since the last step.
+ * */
+void input_process(float frame_delta)
 {
+    pthread_mutex_lock(&input_lock);
+
+    apply_look();
+    if (resize_width > 0 && resize_height > 0)
+    {
+        camera.width = resize_width;
+        camera.height = resize_height;
+        glm_perspective(camera.fov, (float) resize_width/resize_height, 0.000001f, MAX_RENDER_DISTANCE, camera.projection);
+        resize_width = 0;
+        resize_height = 0;
+    }
+
     if (w)
     {
         vec3 transform;
@@ -297,6 +803,33 @@ void input_process(void)
         glm_vec3_scale(transform, -frame_delta*camera.speed, transform);
         glm_vec3_add(camera.position, transform, camera.position);
     }
+
+    pthread_mutex_unlock(&input_lock);
+}
+
+/*
+ * Simulation thread, applies the budget keys to the scheduler it runs.
+ * */
+void input_budgets(struct FrameScheduler *scheduler)
+{
+    pthread_mutex_lock(&input_lock);
+    enum WorkClass work_class = (enum WorkClass) budget_class;
+    int steps = budget_steps;
+    bool selected = budget_selected;
+    budget_steps = 0;
+    budget_selected = false;
+    pthread_mutex_unlock(&input_lock);
+
+    if (steps == 0 && !selected)
+        return;
+
+    uint32_t budget = scheduler_get_budget(scheduler, work_class);
+    for ( ; steps > 0 && budget < SCHEDULER_MAX_BUDGET_US ; steps--)
+        budget *= 2;
+    for ( ; steps < 0 && budget > SCHEDULER_MIN_BUDGET_US ; steps++)
+        budget /= 2;
+    scheduler_set_budget(scheduler, work_class, budget);
+    LOG_INFO(LOG_SCHEDULER, "%s budget %u us per frame", scheduler_class_name(work_class), budget);
 }
 
 /*
@@ -304,11 +837,14 @@ void input_process(void)
  * perspective matrix according to the new viewport height and width.
  *
  * Without updating the perspective matrix we end up warping the environment.
+ * The camera is the simulation's, it picks the size up on its next step.
  * */
 void window_resize_callback(GLFWwindow *window, int width, int height)
 {
     glViewport(0,0, width, height);
-    camera.width = width;
-    camera.height = height;
-    glm_perspective(camera.fov, (float) width/height, 0.000001f, MAX_RENDER_DISTANCE, camera.projection);
+    pthread_mutex_lock(&input_lock);
+    resize_width = width;
+    resize_height = height;
+    pthread_mutex_unlock(&input_lock);
 }
+
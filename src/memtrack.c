@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <voxel.h>
+#include <memtrack.h>
+#include <log.h>
+
+// In front of every block, keeps what follows aligned like malloc does
+struct MemoryHeader
+{
+    size_t size;
+    uint32_t tag;
+    // whole struct Chunk in the block, see mem_alloc_chunks
+    uint32_t chunks;
+} __attribute__((aligned(16)));
+
+// Tags are bumped from every thread, one cache line each
+struct MemoryCounters
+{
+    int64_t live_bytes, peak_bytes;
+    uint64_t allocations, live_allocations;
+} __attribute__((aligned(64)));
+
+static struct MemoryCounters counters[MEM_TAG_COUNT];
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+    "chunk voxels", "bitmasks", "mesh staging", "texture staging", "io buffers",
+    "frame arenas", "gl buffers", "gl textures"
+};
+
+#define BITMASK_BYTES sizeof(((struct Chunk *) 0)->bitmask)
+
+static void count(enum MemoryTag tag, int64_t bytes, int64_t allocations)
+{
+    struct MemoryCounters *counter = &counters[tag];
+    int64_t live = __atomic_add_fetch(&counter->live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->live_allocations, allocations, __ATOMIC_RELAXED);
+    if (allocations <= 0)
+        return;
+    __atomic_add_fetch(&counter->allocations, allocations, __ATOMIC_RELAXED);
+
+    int64_t peak = __atomic_load_n(&counter->peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&counter->peak_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// The block's bytes split over the tags it is counted under
+static void count_block(const struct MemoryHeader *header, int64_t sign)
+{
+    int64_t bitmasks = (int64_t) (header->chunks*BITMASK_BYTES);
+    count((enum MemoryTag) header->tag, sign*((int64_t) header->size - bitmasks), sign);
+    if (bitmasks)
+        count(MEM_BITMASKS, sign*bitmasks, sign);
+}
+
+static void *allocate(enum MemoryTag tag, size_t size, size_t chunks, bool zero)
+{
+    if (size > SIZE_MAX - sizeof(struct MemoryHeader))
+        return NULL;
+
+    size_t total = sizeof(struct MemoryHeader) + size;
+    struct MemoryHeader *header = (struct MemoryHeader *) (zero ? calloc(1, total) : malloc(total));
+    if (header == NULL)
+        return NULL;
+
+    header->size = size;
+    header->tag = tag;
+    header->chunks = (uint32_t) chunks;
+    count_block(header, 1);
+    return header + 1;
+}
+
+void *mem_alloc(enum MemoryTag tag, size_t size)
+{
+    return allocate(tag, size, 0, false);
+}
+
+void *mem_calloc(enum MemoryTag tag, size_t count, size_t size)
+{
+    if (size && count > SIZE_MAX / size)
+        return NULL;
+    return allocate(tag, count*size, 0, true);
+}
+
+void *mem_alloc_chunks(size_t size, size_t count)
+{
+    return allocate(MEM_CHUNK_VOXELS, size, count, false);
+}
+
+void mem_free(void *pointer)
+{
+    if (pointer == NULL)
+        return;
+
+    struct MemoryHeader *header = (struct MemoryHeader *) pointer - 1;
+    count_block(header, -1);
+    free(header);
+}
+
+void mem_account(enum MemoryTag tag, int64_t bytes)
+{
+    if (bytes)
+        count(tag, bytes, bytes > 0 ? 1 : -1);
+}
+
+const char *mem_tag_name(enum MemoryTag tag)
+{
+    return tag < MEM_TAG_COUNT ? tag_names[tag] : "unknown";
+}
+
+void mem_get_stats(struct MemoryStats *out)
+{
+    *out = (struct MemoryStats){0};
+    for (int i = 0 ; i < MEM_TAG_COUNT ; i++)
+    {
+        struct MemoryTagStats *tag = &out->tags[i];
+        tag->live_bytes = __atomic_load_n(&counters[i].live_bytes, __ATOMIC_RELAXED);
+        tag->peak_bytes = __atomic_load_n(&counters[i].peak_bytes, __ATOMIC_RELAXED);
+        tag->allocations = __atomic_load_n(&counters[i].allocations, __ATOMIC_RELAXED);
+        tag->live_allocations = __atomic_load_n(&counters[i].live_allocations, __ATOMIC_RELAXED);
+
+        if (i < MEM_FIRST_GL_TAG)
+            out->heap_bytes += tag->live_bytes;
+        else
+            out->gl_bytes += tag->live_bytes;
+    }
+}
+
+void mem_print_stats(void)
+{
+    struct MemoryStats stats;
+    mem_get_stats(&stats);
+
+    LOG_INFO(LOG_MEMORY, "tracked %.2f MiB on the heap, %.2f MiB estimated on the GPU",
+            stats.heap_bytes / (1024.0*1024.0), stats.gl_bytes / (1024.0*1024.0));
+    for (int i = 0 ; i < MEM_TAG_COUNT ; i++)
+    {
+        struct MemoryTagStats *tag = &stats.tags[i];
+        LOG_INFO(LOG_MEMORY, "%-16s live %9.2f MiB peak %9.2f MiB | %llu live of %llu allocations",
+                tag_names[i], tag->live_bytes / (1024.0*1024.0), tag->peak_bytes / (1024.0*1024.0),
+                (unsigned long long) tag->live_allocations, (unsigned long long) tag->allocations);
+    }
+}
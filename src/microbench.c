@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+#include <bench.h>
+#include <nullgl.h>
+#include <render.h>
+#include <voxel.h>
+#include <world.h>
+#include <terrain.h>
+#include <codec.h>
+#include <memtrack.h>
+#include <arena.h>
+
+/*
+ * Entry point of the bench binary. Times the hot paths of chunk
+ * generation, meshing, culling and compression in isolation, GL calls go
+ * to the null device so only the CPU side is measured.
+ *
+ *   bench [--out file] [--repetitions n] [--warmup n] [--filter name]
+ *         [--baseline file] [--threshold percent]
+ *   bench compare baseline current [--threshold percent]
+ *
+ * With a baseline, or when comparing two stored runs, the exit status is
+ * 1 on a significant slowdown. Usage errors and unreadable runs exit 2.
+ * */
+
+// Radius of the box grid culled per call, about the stream's unload radius
+#define CULL_RADIUS 8
+
+struct ChunkInput
+{
+    struct Terrain *terrain;
+    struct Chunk *chunk;
+    uint8_t *encoded;
+    size_t encoded_size;
+};
+
+struct TerrainInput
+{
+    struct Terrain *terrain;
+    struct Chunk *chunk;
+    enum TerrainLevel level;
+    int next;
+};
+
+struct CullInput
+{
+    vec4 planes[6];
+    vec3 (*boxes)[2];
+    size_t count;
+};
+
+static void run_lattice_mesh(void *user)
+{
+    float *data;
+    size_t size;
+    create_lattice_mesh_data(CHUNK_WIDTH, WORLD_VOXEL_SCALE, &data, &size);
+    bench_consume(size + (data ? (uint64_t) data[size / sizeof(float) - 1] : 0));
+    mem_free(data);
+}
+
+static void run_chunk_bitmask(void *user)
+{
+    struct ChunkInput *input = (struct ChunkInput *) user;
+    generate_chunk_bitmask(input->chunk);
+    bench_consume(input->chunk->bitmask[0]);
+}
+
+static void run_lattice_texture(void *user)
+{
+    struct ChunkInput *input = (struct ChunkInput *) user;
+    unsigned int texture = generate_chunk_lattice_texture(input->chunk);
+    glDeleteTextures(1, &texture);
+    bench_consume(texture);
+}
+
+static void run_frustum_cull(void *user)
+{
+    struct CullInput *input = (struct CullInput *) user;
+    uint64_t visible = 0;
+    for (size_t i = 0 ; i < input->count ; i++)
+        visible += glm_aabb_frustum(input->boxes[i], input->planes);
+    bench_consume(visible);
+}
+
+// What stream_collect_draws does with the visible chunks
+static void run_draw_sort(void *user)
+{
+    struct CullInput *input = (struct CullInput *) user;
+    frame_arena_begin();
+    struct FrameSortItem *draws = FRAME_ALLOC(struct FrameSortItem, input->count);
+    size_t visible = 0;
+    for (size_t i = 0 ; draws && i < input->count ; i++)
+    {
+        if (!glm_aabb_frustum(input->boxes[i], input->planes))
+            continue;
+        vec3 center;
+        glm_aabb_center(input->boxes[i], center);
+        draws[visible++] = (struct FrameSortItem){ glm_vec3_norm2(center), input->boxes[i] };
+    }
+    frame_sort(draws, visible);
+    bench_consume(visible ? (uint64_t) draws[visible-1].key : 0);
+}
+
+static void run_terrain(void *user)
+{
+    struct TerrainInput *input = (struct TerrainInput *) user;
+    // underground like terrain_benchmark, every row runs the cave noise
+    struct ChunkCoord coord = { input->next % 16, -4, input->next / 16 % 16 };
+    input->next++;
+    terrain_generate_chunk_level(input->terrain, input->level, input->chunk, coord);
+    bench_consume(input->chunk->voxel_type[0]);
+}
+
+static void run_codec_encode(void *user)
+{
+    struct ChunkInput *input = (struct ChunkInput *) user;
+    uint8_t out[CODEC_RUNS_BOUND];
+    bench_consume(codec_encode(input->chunk->voxel_type, CHUNK_DATA_SIZE, out, sizeof(out)));
+}
+
+static void run_codec_decode(void *user)
+{
+    struct ChunkInput *input = (struct ChunkInput *) user;
+    uint8_t out[CHUNK_DATA_SIZE];
+    bench_consume(codec_decode(input->encoded, input->encoded_size, out, sizeof(out)) + out[0]);
+}
+
+/*
+ * Every chunk around a camera at the origin looking down negative Z.
+ * */
+static int init_cull(struct CullInput *input)
+{
+    int side = 2*CULL_RADIUS + 1;
+    input->count = (size_t) side * side * side;
+    input->boxes = malloc(input->count * sizeof(*input->boxes));
+    if (input->boxes == NULL)
+        return -1;
+
+    size_t i = 0;
+    for (int z = -CULL_RADIUS ; z <= CULL_RADIUS ; z++)
+        for (int y = -CULL_RADIUS ; y <= CULL_RADIUS ; y++)
+            for (int x = -CULL_RADIUS ; x <= CULL_RADIUS ; x++)
+                world_chunk_aabb((struct ChunkCoord){ x, y, z }, input->boxes[i++]);
+
+    mat4 view, projection, view_projection;
+    vec3 eye = {0.0f, 0.0f, 0.0f}, direction = {0.0f, -0.2f, -1.0f}, up = {0.0f, 1.0f, 0.0f};
+    glm_look(eye, direction, up, view);
+    glm_perspective(70.0f, 1.0f, 0.001f, MAX_RENDER_DISTANCE, projection);
+    glm_mat4_mul(projection, view, view_projection);
+    glm_frustum_planes(view_projection, input->planes);
+    return 0;
+}
+
+struct CommandLine
+{
+    const char *path;
+    const char *baseline;
+    double threshold;
+};
+
+static void print_usage(const char *program)
+{
+    printf("usage: %s [--out file] [--repetitions n] [--warmup n] [--filter name] [--baseline file] [--threshold percent]\n", program);
+    printf("       %s compare baseline current [--threshold percent]\n", program);
+}
+
+static int parse_options(int argc, char **argv, int first, struct BenchOptions *options, struct CommandLine *command)
+{
+    for (int i = first ; i < argc ; i++)
+    {
+        if (i+1 < argc && strcmp(argv[i], "--out") == 0)
+            command->path = argv[++i];
+        else if (i+1 < argc && strcmp(argv[i], "--baseline") == 0)
+            command->baseline = argv[++i];
+        else if (i+1 < argc && strcmp(argv[i], "--threshold") == 0)
+            command->threshold = atof(argv[++i]);
+        else if (i+1 < argc && strcmp(argv[i], "--repetitions") == 0)
+            options->repetitions = atoi(argv[++i]);
+        else if (i+1 < argc && strcmp(argv[i], "--warmup") == 0)
+            options->warmup = atoi(argv[++i]);
+        else if (i+1 < argc && strcmp(argv[i], "--filter") == 0)
+            options->filter = argv[++i];
+        else
+        {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Two stored runs, no benchmarks are run.
+ * */
+static int compare_files(int argc, char **argv, struct BenchOptions *options, struct CommandLine *command)
+{
+    if (argc < 4 || parse_options(argc, argv, 4, options, command))
+    {
+        if (argc < 4)
+            print_usage(argv[0]);
+        return 2;
+    }
+
+    static struct BenchReport baseline, current;
+    if (bench_load_json(argv[2], &baseline) || bench_load_json(argv[3], &current))
+        return 2;
+    return bench_compare(&baseline, &current, command->threshold) ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct BenchOptions options;
+    bench_default_options(&options);
+    struct CommandLine command = { BENCH_DEFAULT_FILE, NULL, BENCH_COMPARE_DEFAULT_PERCENT };
+
+    if (argc > 1 && strcmp(argv[1], "compare") == 0)
+        return compare_files(argc, argv, &options, &command);
+    if (parse_options(argc, argv, 1, &options, &command))
+        return 2;
+
+    // read up front, a missing baseline shouldn't cost a whole run
+    static struct BenchReport baseline;
+    if (command.baseline && bench_load_json(command.baseline, &baseline))
+        return 2;
+
+    if (null_gl_load())
+        return 1;
+
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+
+    // a surface chunk, a mix of air, ground and trees like most resident ones
+    struct ChunkInput chunk = { &terrain };
+    chunk.chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    chunk.encoded = (uint8_t *) malloc(CODEC_RUNS_BOUND);
+    struct TerrainInput terrain_input = { &terrain };
+    terrain_input.chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    struct CullInput cull;
+    if (chunk.chunk == NULL || chunk.encoded == NULL || terrain_input.chunk == NULL || init_cull(&cull))
+    {
+        printf("[Bench] Unable to allocate the inputs.\n");
+        return 1;
+    }
+    terrain_generate_chunk(&terrain, chunk.chunk, (struct ChunkCoord){ 0, 0, 0 });
+    generate_chunk_bitmask(chunk.chunk);
+    chunk.encoded_size = codec_encode(chunk.chunk->voxel_type, CHUNK_DATA_SIZE, chunk.encoded, CODEC_RUNS_BOUND);
+
+    struct BenchCase cases[9 + TERRAIN_LEVEL_COUNT];
+    struct TerrainInput levels[TERRAIN_LEVEL_COUNT];
+    char level_names[TERRAIN_LEVEL_COUNT][32];
+    size_t count = 0;
+    cases[count++] = (struct BenchCase){ "lattice_mesh", run_lattice_mesh, NULL, CHUNK_WIDTH*6 };
+    cases[count++] = (struct BenchCase){ "chunk_bitmask", run_chunk_bitmask, &chunk, CHUNK_DATA_SIZE };
+    cases[count++] = (struct BenchCase){ "lattice_texture", run_lattice_texture, &chunk, CHUNK_DATA_SIZE };
+    cases[count++] = (struct BenchCase){ "frustum_cull", run_frustum_cull, &cull, cull.count };
+    cases[count++] = (struct BenchCase){ "draw_sort", run_draw_sort, &cull, cull.count };
+    for (int level = 0 ; level < TERRAIN_LEVEL_COUNT ; level++)
+    {
+        if (!terrain_level_supported(level))
+            continue;
+        levels[level] = terrain_input;
+        levels[level].level = level;
+        snprintf(level_names[level], sizeof(level_names[level]), "terrain_%s", terrain_level_name(level));
+        cases[count++] = (struct BenchCase){ level_names[level], run_terrain, &levels[level], CHUNK_DATA_SIZE };
+    }
+    cases[count++] = (struct BenchCase){ "codec_encode", run_codec_encode, &chunk, CHUNK_DATA_SIZE };
+    cases[count++] = (struct BenchCase){ "codec_decode", run_codec_decode, &chunk, CHUNK_DATA_SIZE };
+
+    static struct BenchReport report;
+    int failures = 0;
+    for (size_t i = 0 ; i < count ; i++)
+    {
+        if (!bench_selected(&options, cases[i].name))
+            continue;
+        if (bench_run(&cases[i], &options, &report.results[report.count]))
+        {
+            failures++;
+            continue;
+        }
+        bench_print(&report.results[report.count++]);
+    }
+
+    if (bench_write_json(command.path, &options, report.results, report.count) == 0)
+        printf("[Bench] %zu results written to %s\n", report.count, command.path);
+    else
+        failures++;
+
+    if (command.baseline && bench_compare(&baseline, &report, command.threshold))
+        failures++;
+
+    free(cull.boxes);
+    free(terrain_input.chunk);
+    free(chunk.encoded);
+    free(chunk.chunk);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+#include <glad/gl.h>
+#include <nullgl.h>
+#include <log.h>
+
+static struct NullGlStats stats;
+static GLuint next_name = 1;
+// Textures aren't kept, level queries describe the last upload
+static GLint last_image[3], last_texel_bits;
+
+// Stands in for every entry point without a stub, returning 0 covers the
+// ones that return something
+static uintptr_t GLAD_API_PTR null_any(void)
+{
+    return 0;
+}
+
+static const GLubyte *GLAD_API_PTR null_get_string(GLenum name)
+{
+    switch (name)
+    {
+        case GL_VERSION:
+            return (const GLubyte *) "3.2 Null device";
+        case GL_RENDERER:
+            return (const GLubyte *) "null";
+        case GL_VENDOR:
+            return (const GLubyte *) "none";
+        default:
+            return (const GLubyte *) "";
+    }
+}
+
+static const GLubyte *GLAD_API_PTR null_get_stringi(GLenum name, GLuint index)
+{
+    return (const GLubyte *) "";
+}
+
+static void GLAD_API_PTR null_get_integerv(GLenum name, GLint *data)
+{
+    *data = 0;
+}
+
+static void GLAD_API_PTR null_get_integer64v(GLenum name, GLint64 *data)
+{
+    *data = 0;
+}
+
+static void generate(GLsizei n, GLuint *names)
+{
+    for (GLsizei i = 0 ; i < n ; i++)
+        names[i] = next_name++;
+}
+
+static void GLAD_API_PTR null_gen_textures(GLsizei n, GLuint *textures)
+{
+    generate(n, textures);
+    stats.textures += n;
+}
+
+static void GLAD_API_PTR null_gen_buffers(GLsizei n, GLuint *buffers)
+{
+    generate(n, buffers);
+    stats.buffers += n;
+}
+
+static void GLAD_API_PTR null_gen_names(GLsizei n, GLuint *names)
+{
+    generate(n, names);
+}
+
+static GLuint GLAD_API_PTR null_create_object(void)
+{
+    return next_name++;
+}
+
+static GLuint GLAD_API_PTR null_create_shader(GLenum type)
+{
+    return next_name++;
+}
+
+// Compile and link status, everything else reads as 0
+static void GLAD_API_PTR null_get_objectiv(GLuint object, GLenum name, GLint *params)
+{
+    *params = name == GL_COMPILE_STATUS || name == GL_LINK_STATUS || name == GL_VALIDATE_STATUS;
+}
+
+static GLsync GLAD_API_PTR null_fence_sync(GLenum condition, GLbitfield flags)
+{
+    return (GLsync) (uintptr_t) next_name++;
+}
+
+static GLenum GLAD_API_PTR null_client_wait_sync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+    return GL_ALREADY_SIGNALED;
+}
+
+static size_t texel_bytes(GLenum format, GLenum type)
+{
+    size_t channels = format == GL_RED || format == GL_RED_INTEGER ? 1 : format == GL_RG ? 2 : format == GL_RGB ? 3 : 4;
+    size_t size = type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT ? 4 : type == GL_UNSIGNED_SHORT || type == GL_SHORT || type == GL_HALF_FLOAT ? 2 : 1;
+    return channels * size;
+}
+
+static void GLAD_API_PTR null_tex_image_2d(GLenum target, GLint level, GLint internal_format, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels)
+{
+    stats.texture_bytes += (uint64_t) width * height * texel_bytes(format, type);
+    last_image[0] = width;
+    last_image[1] = height;
+    last_image[2] = 1;
+    last_texel_bits = (GLint) texel_bytes(format, type)*8;
+}
+
+static void GLAD_API_PTR null_tex_image_3d(GLenum target, GLint level, GLint internal_format, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void *pixels)
+{
+    stats.texture_bytes += (uint64_t) width * height * depth * texel_bytes(format, type);
+    last_image[0] = width;
+    last_image[1] = height;
+    last_image[2] = depth;
+    last_texel_bits = (GLint) texel_bytes(format, type)*8;
+}
+
+// Every bit is reported as red
+static void GLAD_API_PTR null_get_tex_level_parameteriv(GLenum target, GLint level, GLenum name, GLint *params)
+{
+    switch (name)
+    {
+        case GL_TEXTURE_WIDTH:
+            *params = last_image[0];
+            break;
+        case GL_TEXTURE_HEIGHT:
+            *params = last_image[1];
+            break;
+        case GL_TEXTURE_DEPTH:
+            *params = last_image[2];
+            break;
+        case GL_TEXTURE_RED_SIZE:
+            *params = last_texel_bits;
+            break;
+        default:
+            *params = 0;
+            break;
+    }
+}
+
+static void GLAD_API_PTR null_buffer_data(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+    stats.buffer_bytes += size;
+}
+
+static void GLAD_API_PTR null_draw_arrays(GLenum mode, GLint first, GLsizei count)
+{
+    stats.draws++;
+    stats.vertices += count;
+}
+
+static void GLAD_API_PTR null_draw_elements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    stats.draws++;
+    stats.vertices += count;
+}
+
+static void GLAD_API_PTR null_use_program(GLuint program)
+{
+    stats.program_binds++;
+}
+
+static void GLAD_API_PTR null_uniform_matrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+    stats.uniform_sets++;
+}
+
+static GLint GLAD_API_PTR null_get_uniform_location(GLuint program, const GLchar *name)
+{
+    return 0;
+}
+
+static GLenum GLAD_API_PTR null_check_framebuffer_status(GLenum target)
+{
+    return GL_FRAMEBUFFER_COMPLETE;
+}
+
+static const struct
+{
+    const char *name;
+    GLADapiproc proc;
+} stubs[] = {
+    { "glGetString", (GLADapiproc) null_get_string },
+    { "glGetStringi", (GLADapiproc) null_get_stringi },
+    { "glGetIntegerv", (GLADapiproc) null_get_integerv },
+    { "glGetInteger64v", (GLADapiproc) null_get_integer64v },
+    { "glGenTextures", (GLADapiproc) null_gen_textures },
+    { "glGenBuffers", (GLADapiproc) null_gen_buffers },
+    { "glGenVertexArrays", (GLADapiproc) null_gen_names },
+    { "glGenFramebuffers", (GLADapiproc) null_gen_names },
+    { "glGenRenderbuffers", (GLADapiproc) null_gen_names },
+    { "glGenQueries", (GLADapiproc) null_gen_names },
+    { "glCreateProgram", (GLADapiproc) null_create_object },
+    { "glCreateShader", (GLADapiproc) null_create_shader },
+    { "glGetShaderiv", (GLADapiproc) null_get_objectiv },
+    { "glGetProgramiv", (GLADapiproc) null_get_objectiv },
+    { "glFenceSync", (GLADapiproc) null_fence_sync },
+    { "glClientWaitSync", (GLADapiproc) null_client_wait_sync },
+    { "glTexImage2D", (GLADapiproc) null_tex_image_2d },
+    { "glTexImage3D", (GLADapiproc) null_tex_image_3d },
+    { "glGetTexLevelParameteriv", (GLADapiproc) null_get_tex_level_parameteriv },
+    { "glBufferData", (GLADapiproc) null_buffer_data },
+    { "glDrawArrays", (GLADapiproc) null_draw_arrays },
+    { "glDrawElements", (GLADapiproc) null_draw_elements },
+    { "glUseProgram", (GLADapiproc) null_use_program },
+    { "glUniformMatrix4fv", (GLADapiproc) null_uniform_matrix4fv },
+    { "glGetUniformLocation", (GLADapiproc) null_get_uniform_location },
+    { "glCheckFramebufferStatus", (GLADapiproc) null_check_framebuffer_status },
+};
+
+static GLADapiproc null_proc(void *user, const char *name)
+{
+    for (size_t i = 0 ; i < sizeof(stubs) / sizeof(stubs[0]) ; i++)
+    {
+        if (strcmp(stubs[i].name, name) == 0)
+            return stubs[i].proc;
+    }
+    return (GLADapiproc) null_any;
+}
+
+int null_gl_load(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    if (gladLoadGLUserPtr(null_proc, NULL) == 0)
+    {
+        LOG_ERROR(LOG_RENDER, "Unable to load the null device.");
+        return -1;
+    }
+    return 0;
+}
+
+void null_gl_get_stats(struct NullGlStats *out)
+{
+    *out = stats;
+}
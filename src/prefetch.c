@@ -0,0 +1,85 @@
+#include <math.h>
+#include <stdlib.h>
+#include <prefetch.h>
+
+void prefetch_init(struct Prefetch *prefetch)
+{
+    *prefetch = (struct Prefetch){
+        .horizon = PREFETCH_DEFAULT_HORIZON
+    };
+}
+
+void prefetch_update(struct Prefetch *prefetch, vec3 position, float frame_delta)
+{
+    if (prefetch->has_position && frame_delta > 0.0f)
+    {
+        vec3 measured;
+        glm_vec3_sub(position, prefetch->last_position, measured);
+        glm_vec3_scale(measured, 1.0f / frame_delta, measured);
+
+        // Key presses make the raw velocity jump around, smooth it out
+        float blend = 1.0f - expf(-PREFETCH_SMOOTHING * frame_delta);
+        glm_vec3_lerp(prefetch->velocity, measured, blend, prefetch->velocity);
+    }
+    glm_vec3_copy(position, prefetch->last_position);
+    prefetch->has_position = true;
+
+    prefetch->path_count = 0;
+    if (glm_vec3_norm(prefetch->velocity) < PREFETCH_MIN_SPEED || prefetch->horizon <= 0.0f)
+        return;
+
+    struct ChunkCoord previous = {0};
+    for (int i = 1 ; i <= PREFETCH_SAMPLES ; i++)
+    {
+        float t = prefetch->horizon * i / PREFETCH_SAMPLES;
+        vec3 predicted;
+        glm_vec3_scale(prefetch->velocity, t, predicted);
+        glm_vec3_add(position, predicted, predicted);
+
+        struct ChunkCoord coord;
+        world_chunk_from_position(predicted, &coord);
+
+        // Slow movement lands several samples in the same chunk
+        if (prefetch->path_count > 0 && chunk_coord_equal(coord, previous))
+            continue;
+
+        prefetch->path[prefetch->path_count] = coord;
+        prefetch->path_time[prefetch->path_count] = t;
+        prefetch->path_count++;
+        previous = coord;
+    }
+}
+
+float prefetch_weight(struct Prefetch *prefetch, struct ChunkCoord coord)
+{
+    float weight = 1.0f;
+
+    for (int i = 0 ; i < prefetch->path_count ; i++)
+    {
+        struct ChunkCoord p = prefetch->path[i];
+        if (abs(coord.x - p.x) > PREFETCH_RADIUS || abs(coord.y - p.y) > PREFETCH_RADIUS || abs(coord.z - p.z) > PREFETCH_RADIUS)
+            continue;
+
+        // Chunks reached sooner are boosted more
+        float fade = prefetch->path_time[i] / prefetch->horizon;
+        float w = PREFETCH_BOOST + (1.0f - PREFETCH_BOOST) * fade;
+        if (w < weight)
+            weight = w;
+    }
+
+    return weight;
+}
+
+void prefetch_record_entry(struct Prefetch *prefetch, bool ready)
+{
+    prefetch->frustum_entries++;
+    if (!ready)
+        prefetch->misses++;
+}
+
+float prefetch_miss_rate(struct Prefetch *prefetch)
+{
+    if (prefetch->frustum_entries == 0)
+        return 0.0f;
+    return (float) prefetch->misses / prefetch->frustum_entries;
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <profile.h>
+#include <timer.h>
+#include <log.h>
+
+#ifdef PROFILE_ENABLED
+
+// Written by its thread only, the dump reads it while the thread keeps going
+struct ProfileRing
+{
+    struct ProfileEvent events[PROFILE_RING_EVENTS];
+    // events recorded so far, the ring holds the last PROFILE_RING_EVENTS
+    uint64_t head;
+    const char *name;
+    int tid;
+    struct ProfileRing *next;
+};
+
+// The dump needs at least this long between both clock readings to convert ticks
+#define CALIBRATION_NS 20000000ull
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ProfileRing *rings;
+static int next_tid = 1;
+static __thread struct ProfileRing *thread_ring;
+// Zones timed by the GPU, written by the render thread
+static struct ProfileRing *gpu_ring;
+// Both clocks read when the first ring was created
+static uint64_t start_ticks, start_ns;
+
+static struct ProfileRing *link_ring(void)
+{
+    struct ProfileRing *ring = (struct ProfileRing *) calloc(1, sizeof(struct ProfileRing));
+    if (ring == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&rings_lock);
+    if (rings == NULL && start_ns == 0)
+    {
+        start_ns = timer_now_ns();
+        start_ticks = profile_now();
+    }
+    ring->tid = next_tid++;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+    return ring;
+}
+
+static struct ProfileRing *create_ring(void)
+{
+    thread_ring = link_ring();
+    return thread_ring;
+}
+
+static void write_event(struct ProfileRing *ring, enum ProfileEventType type, const char *name, uint64_t timestamp, int64_t value)
+{
+    // Relaxed stores compile to plain ones, they only keep a concurrent dump well defined
+    uint64_t head = ring->head;
+    struct ProfileEvent *event = &ring->events[head & (PROFILE_RING_EVENTS-1)];
+    __atomic_store_n(&event->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->timestamp, timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->type, (uint32_t) type, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void profile_record(enum ProfileEventType type, const char *name, uint64_t timestamp, int64_t value)
+{
+    struct ProfileRing *ring = thread_ring ? thread_ring : create_ring();
+    if (ring)
+        write_event(ring, type, name, timestamp, value);
+}
+
+void profile_gpu_zone(const char *name, uint64_t zone_ns, uint64_t duration_ns)
+{
+    if (gpu_ring == NULL)
+    {
+        gpu_ring = link_ring();
+        if (gpu_ring == NULL)
+            return;
+        __atomic_store_n(&gpu_ring->name, "gpu", __ATOMIC_RELAXED);
+    }
+
+    // Into ticks at the rate seen since the start, the dump converts them back
+    uint64_t now_ns = timer_now_ns();
+    double ticks_per_ns = now_ns > start_ns ? (double) (profile_now() - start_ticks) / (double) (now_ns - start_ns) : 1.0;
+    double start = (double) start_ticks + ((double) zone_ns - (double) start_ns) * ticks_per_ns;
+    write_event(gpu_ring, PROFILE_EVENT_ZONE, name, start > 0.0 ? (uint64_t) start : 0, (int64_t) (duration_ns * ticks_per_ns));
+}
+
+void profile_thread_name(const char *name)
+{
+    struct ProfileRing *ring = thread_ring ? thread_ring : create_ring();
+    if (ring)
+        __atomic_store_n(&ring->name, name, __ATOMIC_RELAXED);
+}
+
+static void write_string(FILE *file, const char *string)
+{
+    fputc('"', file);
+    for ( ; *string ; string++)
+    {
+        if (*string == '"' || *string == '\\')
+            fprintf(file, "\\%c", *string);
+        else if ((unsigned char) *string < 0x20)
+            fprintf(file, "\\u%04x", *string);
+        else
+            fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+/*
+ * Copies what is left of a ring, dropping the events the thread may have
+ * overwritten during the copy. Returns the number copied.
+ * */
+static size_t copy_ring(struct ProfileRing *ring, struct ProfileEvent *out)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > PROFILE_RING_EVENTS ? head - PROFILE_RING_EVENTS : 0;
+
+    for (uint64_t i = first ; i < head ; i++)
+    {
+        struct ProfileEvent *event = &ring->events[i & (PROFILE_RING_EVENTS-1)];
+        struct ProfileEvent *copy = &out[i - first];
+        copy->name = __atomic_load_n(&event->name, __ATOMIC_RELAXED);
+        copy->timestamp = __atomic_load_n(&event->timestamp, __ATOMIC_RELAXED);
+        copy->value = __atomic_load_n(&event->value, __ATOMIC_RELAXED);
+        copy->type = __atomic_load_n(&event->type, __ATOMIC_RELAXED);
+    }
+
+    // The slot being written right now counts as overwritten too
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint64_t valid = now + 1 > PROFILE_RING_EVENTS ? now + 1 - PROFILE_RING_EVENTS : 0;
+    if (valid <= first)
+        return head - first;
+    if (valid >= head)
+        return 0;
+
+    size_t dropped = valid - first;
+    for (uint64_t i = 0 ; i < head - valid ; i++)
+        out[i] = out[i + dropped];
+    return head - valid;
+}
+
+int profile_dump(const char *path)
+{
+    struct ProfileEvent *events = (struct ProfileEvent *) malloc(PROFILE_RING_EVENTS * sizeof(struct ProfileEvent));
+    FILE *file = fopen(path, "w");
+    if (events == NULL || file == NULL)
+    {
+        LOG_ERROR(LOG_PROFILE, "Unable to write %s.", path);
+        free(events);
+        if (file)
+            fclose(file);
+        return -1;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    struct ProfileRing *list = rings;
+    uint64_t ticks = start_ticks, ns = start_ns;
+    pthread_mutex_unlock(&rings_lock);
+
+    // Ticks per microsecond over everything recorded so far
+    while (timer_now_ns() - ns < CALIBRATION_NS)
+        ;
+    double ticks_per_us = (double) (profile_now() - ticks) * 1000.0 / (double) (timer_now_ns() - ns);
+
+    // Rings are only ever prepended, the list from here on doesn't change
+    uint64_t base = UINT64_MAX;
+    for (struct ProfileRing *ring = list ; ring ; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == 0)
+            continue;
+        uint64_t first = head > PROFILE_RING_EVENTS ? head - PROFILE_RING_EVENTS : 0;
+        uint64_t timestamp = __atomic_load_n(&ring->events[first & (PROFILE_RING_EVENTS-1)].timestamp, __ATOMIC_RELAXED);
+        if (timestamp < base)
+            base = timestamp;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    size_t written = 0;
+    for (struct ProfileRing *ring = list ; ring ; ring = ring->next)
+    {
+        const char *name = __atomic_load_n(&ring->name, __ATOMIC_RELAXED);
+        if (name)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", written ? ",\n" : "", ring->tid);
+            write_string(file, name);
+            fprintf(file, "}}");
+            written++;
+        }
+
+        size_t count = copy_ring(ring, events);
+        for (size_t i = 0 ; i < count ; i++)
+        {
+            struct ProfileEvent *event = &events[i];
+            // Zones recorded before the base was taken may start a little earlier
+            double ts = ((double) event->timestamp - (double) base) / ticks_per_us;
+
+            fprintf(file, "%s{\"name\":", written ? ",\n" : "");
+            write_string(file, event->name);
+            switch (event->type)
+            {
+                case PROFILE_EVENT_ZONE:
+                    fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", ts, event->value / ticks_per_us, ring->tid);
+                    break;
+                case PROFILE_EVENT_COUNTER:
+                    fprintf(file, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%lld}}", ts, ring->tid, (long long) event->value);
+                    break;
+                default:
+                    fprintf(file, ",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", ts, ring->tid);
+                    break;
+            }
+            written++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    int failed = ferror(file);
+    failed |= fclose(file);
+    free(events);
+    if (failed)
+    {
+        LOG_ERROR(LOG_PROFILE, "Unable to write %s.", path);
+        return -1;
+    }
+    LOG_INFO(LOG_PROFILE, "Wrote %zu events to %s.", written, path);
+    return 0;
+}
+
+void profile_shutdown(void)
+{
+    pthread_mutex_lock(&rings_lock);
+    struct ProfileRing *ring = rings;
+    rings = NULL;
+    pthread_mutex_unlock(&rings_lock);
+
+    while (ring)
+    {
+        struct ProfileRing *next = ring->next;
+        free(ring);
+        ring = next;
+    }
+    thread_ring = NULL;
+    gpu_ring = NULL;
+}
+
+#define BENCHMARK_ZONES 1000000
+#define BENCHMARK_THREADS 4
+
+static void *benchmark_thread(void *arg)
+{
+    PROFILE_THREAD((const char *) arg);
+    for (int i = 0 ; i < 2000 ; i++)
+    {
+        PROFILE_ZONE("outer");
+        for (int j = 0 ; j < 8 ; j++)
+        {
+            PROFILE_ZONE("inner");
+        }
+        PROFILE_COUNTER("iteration", i);
+    }
+    return NULL;
+}
+
+int profile_benchmark(const char *path)
+{
+    uint64_t start = timer_now_ns();
+    for (int i = 0 ; i < BENCHMARK_ZONES ; i++)
+    {
+        PROFILE_ZONE("empty");
+    }
+    double zone_ns = (double) (timer_now_ns() - start) / BENCHMARK_ZONES;
+    printf("[Profile] %.1f ns per empty zone\n", zone_ns);
+
+    static const char *names[BENCHMARK_THREADS] = { "bench 0", "bench 1", "bench 2", "bench 3" };
+    pthread_t threads[BENCHMARK_THREADS];
+    int started = 0;
+    for (int i = 0 ; i < BENCHMARK_THREADS ; i++)
+    {
+        if (pthread_create(&threads[started], NULL, benchmark_thread, (void *) names[i]) == 0)
+            started++;
+    }
+    // The dump runs while the threads still record
+    int failed = profile_dump(path);
+    for (int i = 0 ; i < started ; i++)
+        pthread_join(threads[i], NULL);
+
+    PROFILE_FRAME();
+    failed |= profile_dump(path);
+    return failed ? 1 : 0;
+}
+
+#else
+
+void profile_gpu_zone(const char *name, uint64_t zone_ns, uint64_t duration_ns)
+{
+}
+
+int profile_dump(const char *path)
+{
+    return -1;
+}
+
+void profile_shutdown(void)
+{
+}
+
+int profile_benchmark(const char *path)
+{
+    LOG_INFO(LOG_PROFILE, "Compiled out, build with PROFILE=1.");
+    return 0;
+}
+
+#endif
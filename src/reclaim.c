@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <glad/gl.h>
+#include <reclaim.h>
+#include <log.h>
+
+void gpu_reclaim_init(struct GpuReclaim *reclaim)
+{
+    *reclaim = (struct GpuReclaim){0};
+    pthread_mutex_init(&reclaim->lock, NULL);
+}
+
+// Holding the lock
+static struct GpuReclaimBatch *open_batch(struct GpuReclaim *reclaim)
+{
+    if (reclaim->tail && reclaim->tail->fence == NULL && reclaim->tail->frame == reclaim->frame)
+        return reclaim->tail;
+
+    struct GpuReclaimBatch *batch = (struct GpuReclaimBatch *) calloc(1, sizeof(struct GpuReclaimBatch));
+    if (batch == NULL)
+        return NULL;
+    batch->frame = reclaim->frame;
+    if (reclaim->tail)
+        reclaim->tail->next = batch;
+    else
+        reclaim->head = batch;
+    reclaim->tail = batch;
+    reclaim->stats.pending_batches++;
+    return batch;
+}
+
+static int push_name(unsigned int **names, size_t *count, size_t *capacity, unsigned int name)
+{
+    if (*count == *capacity)
+    {
+        size_t grown = *capacity ? *capacity*2 : 64;
+        unsigned int *resized = (unsigned int *) realloc(*names, grown*sizeof(unsigned int));
+        if (resized == NULL)
+            return -1;
+        *names = resized;
+        *capacity = grown;
+    }
+    (*names)[(*count)++] = name;
+    return 0;
+}
+
+void gpu_reclaim_texture(struct GpuReclaim *reclaim, unsigned int texture)
+{
+    if (texture == 0)
+        return;
+
+    pthread_mutex_lock(&reclaim->lock);
+    struct GpuReclaimBatch *batch = open_batch(reclaim);
+    if (batch == NULL || push_name(&batch->textures, &batch->texture_count, &batch->texture_capacity, texture))
+        // This may not be the render thread, and queued frames may still draw it
+        LOG_ERROR(LOG_RECLAIM, "Unable to defer a texture, leaking it.");
+    else
+        reclaim->stats.pending_textures++;
+    pthread_mutex_unlock(&reclaim->lock);
+}
+
+void gpu_reclaim_buffer(struct GpuReclaim *reclaim, unsigned int buffer)
+{
+    if (buffer == 0)
+        return;
+
+    pthread_mutex_lock(&reclaim->lock);
+    struct GpuReclaimBatch *batch = open_batch(reclaim);
+    if (batch == NULL || push_name(&batch->buffers, &batch->buffer_count, &batch->buffer_capacity, buffer))
+        LOG_ERROR(LOG_RECLAIM, "Unable to defer a buffer, leaking it.");
+    else
+        reclaim->stats.pending_buffers++;
+    pthread_mutex_unlock(&reclaim->lock);
+}
+
+void gpu_reclaim_set_frame(struct GpuReclaim *reclaim, uint64_t frame)
+{
+    pthread_mutex_lock(&reclaim->lock);
+    reclaim->frame = frame;
+    pthread_mutex_unlock(&reclaim->lock);
+}
+
+// Holding the lock
+static void delete_batch(struct GpuReclaim *reclaim, struct GpuReclaimBatch *batch)
+{
+    if (batch->texture_count)
+        glDeleteTextures(batch->texture_count, batch->textures);
+    if (batch->buffer_count)
+        glDeleteBuffers(batch->buffer_count, batch->buffers);
+    if (batch->fence)
+        glDeleteSync((GLsync) batch->fence);
+
+    reclaim->stats.pending_textures -= batch->texture_count;
+    reclaim->stats.pending_buffers -= batch->buffer_count;
+    reclaim->stats.deleted_textures += batch->texture_count;
+    reclaim->stats.deleted_buffers += batch->buffer_count;
+    reclaim->stats.pending_batches--;
+
+    free(batch->textures);
+    free(batch->buffers);
+    free(batch);
+}
+
+void gpu_reclaim_frame_drawn(struct GpuReclaim *reclaim, uint64_t frame)
+{
+    pthread_mutex_lock(&reclaim->lock);
+
+    // Batches of frames not drawn yet stay open, they come last
+    for (struct GpuReclaimBatch *batch = reclaim->head ; batch && batch->frame <= frame ; batch = batch->next)
+    {
+        if (batch->fence)
+            continue;
+        batch->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (batch->fence == NULL)
+        {
+            LOG_ERROR(LOG_RECLAIM, "Unable to create a fence.");
+            break;
+        }
+    }
+
+    // Fences signal in order, the first one that hasn't ends the scan
+    while (reclaim->head && reclaim->head->fence)
+    {
+        struct GpuReclaimBatch *batch = reclaim->head;
+        GLenum status = glClientWaitSync((GLsync) batch->fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            break;
+        if (status == GL_WAIT_FAILED)
+            LOG_WARN(LOG_RECLAIM, "Waiting on a fence failed.");
+
+        reclaim->head = batch->next;
+        if (reclaim->head == NULL)
+            reclaim->tail = NULL;
+        delete_batch(reclaim, batch);
+    }
+
+    pthread_mutex_unlock(&reclaim->lock);
+}
+
+void gpu_reclaim_frame(struct GpuReclaim *reclaim)
+{
+    gpu_reclaim_frame_drawn(reclaim, UINT64_MAX);
+}
+
+void gpu_reclaim_get_stats(struct GpuReclaim *reclaim, struct GpuReclaimStats *out)
+{
+    pthread_mutex_lock(&reclaim->lock);
+    *out = reclaim->stats;
+    pthread_mutex_unlock(&reclaim->lock);
+}
+
+void gpu_reclaim_shutdown(struct GpuReclaim *reclaim)
+{
+    while (reclaim->head)
+    {
+        struct GpuReclaimBatch *batch = reclaim->head;
+        reclaim->head = batch->next;
+        if (batch->fence)
+            glClientWaitSync((GLsync) batch->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        delete_batch(reclaim, batch);
+    }
+    reclaim->tail = NULL;
+    pthread_mutex_destroy(&reclaim->lock);
+}
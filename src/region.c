@@ -0,0 +1,964 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <region.h>
+#include <io.h>
+#include <crc.h>
+#include <codec.h>
+#include <timer.h>
+#include <memtrack.h>
+#include <log.h>
+
+#define VOXEL_BYTES REGION_PAYLOAD_MAX
+#define SECTORS(bytes) REGION_SECTORS(bytes)
+#define ENTRY_OFFSET(index) (sizeof(struct RegionHeader) + (size_t) (index)*sizeof(struct RegionEntry))
+
+struct Compression
+{
+    const char *name;
+    RegionEncode encode;
+    RegionDecode decode;
+};
+
+static struct Compression compressions[REGION_COMPRESSION_COUNT] = {
+    [REGION_COMPRESSION_NONE] = { "none", NULL, NULL },
+    [REGION_COMPRESSION_CODEC] = { "codec", codec_encode, codec_decode }
+};
+
+void region_register_compression(enum RegionCompression compression, const char *name, RegionEncode encode, RegionDecode decode)
+{
+    if (compression <= REGION_COMPRESSION_NONE || compression >= REGION_COMPRESSION_COUNT)
+        return;
+    compressions[compression] = (struct Compression){ name, encode, decode };
+}
+
+const char *region_compression_name(enum RegionCompression compression)
+{
+    if (compression < 0 || compression >= REGION_COMPRESSION_COUNT || compressions[compression].name == NULL)
+        return "unknown";
+    return compressions[compression].name;
+}
+
+static int32_t floor_div(int32_t value, int32_t divisor)
+{
+    return value < 0 ? (value + 1) / divisor - 1 : value / divisor;
+}
+
+void region_from_chunk(struct ChunkCoord chunk, struct ChunkCoord *region, int *index)
+{
+    region->x = floor_div(chunk.x, REGION_WIDTH);
+    region->y = floor_div(chunk.y, REGION_WIDTH);
+    region->z = floor_div(chunk.z, REGION_WIDTH);
+    *index = REGION_INDEX(chunk.x - region->x*REGION_WIDTH, chunk.y - region->y*REGION_WIDTH, chunk.z - region->z*REGION_WIDTH);
+}
+
+static int write_header(int fd, const struct RegionEntry *table)
+{
+    struct RegionHeader header = {
+        .version = REGION_VERSION,
+        .width = REGION_WIDTH
+    };
+    memcpy(header.magic, REGION_MAGIC, sizeof(header.magic));
+
+    if (pwrite_full(fd, &header, sizeof(header), 0))
+        return -1;
+    return pwrite_full(fd, table, REGION_CHUNKS*sizeof(struct RegionEntry), sizeof(header));
+}
+
+/*
+ * Rebuilds the allocation state from the table, dropping entries that point
+ * into the header, claim more than a raw chunk or run past the last sector.
+ * */
+static void scan_table(struct Region *region)
+{
+    region->next_sector = REGION_DATA_SECTOR;
+    region->live_sectors = 0;
+
+    for (int i = 0 ; i < REGION_CHUNKS ; i++)
+    {
+        struct RegionEntry *entry = &region->table[i];
+        if (entry->sector == 0)
+            continue;
+
+        if (entry->sector < REGION_DATA_SECTOR || entry->length == 0 || entry->length > REGION_PAYLOAD_MAX
+            || entry->sector > UINT32_MAX - SECTORS(entry->length))
+        {
+            LOG_WARN(LOG_REGION, "Dropping invalid entry %d in %s", i, region->path);
+            *entry = (struct RegionEntry){0};
+            continue;
+        }
+
+        uint32_t end = entry->sector + SECTORS(entry->length);
+        if (end > region->next_sector)
+            region->next_sector = end;
+        region->live_sectors += SECTORS(entry->length);
+    }
+
+    region->garbage_sectors = region->next_sector - REGION_DATA_SECTOR - region->live_sectors;
+}
+
+int region_open(struct Region *region, const char *path, struct ChunkCoord coord, bool create)
+{
+    *region = (struct Region){
+        .coord = coord,
+        .fd = -1
+    };
+
+    region->path = strdup(path);
+    region->table = (struct RegionEntry *) calloc(REGION_CHUNKS, sizeof(struct RegionEntry));
+    if (region->path == NULL || region->table == NULL)
+    {
+        LOG_ERROR(LOG_REGION, "Unable to allocate the table for %s", path);
+        goto fail;
+    }
+
+    region->fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (region->fd < 0 && !create && errno == ENOENT)
+    {
+        free(region->path);
+        free(region->table);
+        *region = (struct Region){ .fd = -1 };
+        return 1;
+    }
+    if (region->fd < 0)
+    {
+        LOG_ERROR(LOG_REGION, "Unable to open %s", path);
+        goto fail;
+    }
+
+    struct stat st;
+    if (fstat(region->fd, &st))
+    {
+        LOG_ERROR(LOG_REGION, "Unable to retrieve size of %s", path);
+        goto fail;
+    }
+
+    if (st.st_size == 0)
+    {
+        if (write_header(region->fd, region->table))
+        {
+            LOG_ERROR(LOG_REGION, "Unable to write the header of %s", path);
+            goto fail;
+        }
+    }
+    else
+    {
+        struct RegionHeader header;
+        if (pread_full(region->fd, &header, sizeof(header), 0)
+            || memcmp(header.magic, REGION_MAGIC, sizeof(header.magic))
+            || header.version != REGION_VERSION
+            || header.width != REGION_WIDTH)
+        {
+            LOG_WARN(LOG_REGION, "%s is not a region file of this version.", path);
+            goto fail;
+        }
+
+        if (pread_full(region->fd, region->table, REGION_CHUNKS*sizeof(struct RegionEntry), sizeof(header)))
+        {
+            LOG_ERROR(LOG_REGION, "Unable to read the table of %s", path);
+            goto fail;
+        }
+    }
+
+    scan_table(region);
+
+    pthread_rwlock_init(&region->file_lock, NULL);
+    pthread_mutex_init(&region->table_lock, NULL);
+    return 0;
+
+fail:
+    if (region->fd >= 0)
+        close(region->fd);
+    free(region->path);
+    free(region->table);
+    *region = (struct Region){ .fd = -1 };
+    return -1;
+}
+
+void region_close(struct Region *region)
+{
+    if (region->garbage_sectors >= REGION_COMPACT_MIN_SECTORS
+        && region->garbage_sectors > region->live_sectors * REGION_COMPACT_RATIO)
+        region_compact(region);
+
+    // Closed regions are out of reach of region_store_sync
+    fdatasync(region->fd);
+    close(region->fd);
+    free(region->path);
+    free(region->table);
+    pthread_rwlock_destroy(&region->file_lock);
+    pthread_mutex_destroy(&region->table_lock);
+    *region = (struct Region){ .fd = -1 };
+}
+
+static bool in_region(struct Region *region, struct ChunkCoord coord, int *index)
+{
+    struct ChunkCoord region_coord;
+    region_from_chunk(coord, &region_coord, index);
+    if (!chunk_coord_equal(region_coord, region->coord))
+    {
+        LOG_WARN(LOG_REGION, "Chunk %d %d %d is not part of %s", coord.x, coord.y, coord.z, region->path);
+        return false;
+    }
+    return true;
+}
+
+enum RegionResult region_decode(const struct RegionEntry *entry, const uint8_t *payload, struct Chunk *chunk)
+{
+    if (crc32_update(0, payload, entry->length) != entry->crc)
+        return REGION_CORRUPT;
+
+    if (entry->compression == REGION_COMPRESSION_NONE)
+    {
+        if (entry->length != VOXEL_BYTES)
+            return REGION_CORRUPT;
+        memcpy(chunk->voxel_type, payload, VOXEL_BYTES);
+        return REGION_OK;
+    }
+
+    if (entry->compression >= REGION_COMPRESSION_COUNT || compressions[entry->compression].decode == NULL)
+        return REGION_CORRUPT;
+    if (compressions[entry->compression].decode(payload, entry->length, chunk->voxel_type, VOXEL_BYTES))
+        return REGION_CORRUPT;
+    return REGION_OK;
+}
+
+void region_encode(const struct Chunk *chunk, enum RegionCompression compression, uint8_t *out, struct RegionEntry *entry)
+{
+    size_t length = 0;
+
+    // Only kept when it actually saves space, incompressible chunks are stored raw
+    if (compression > REGION_COMPRESSION_NONE && compression < REGION_COMPRESSION_COUNT && compressions[compression].encode)
+        length = compressions[compression].encode(chunk->voxel_type, VOXEL_BYTES, out, VOXEL_BYTES - 1);
+
+    if (length == 0)
+    {
+        compression = REGION_COMPRESSION_NONE;
+        length = VOXEL_BYTES;
+        memcpy(out, chunk->voxel_type, VOXEL_BYTES);
+    }
+
+    *entry = (struct RegionEntry){
+        .length = (uint32_t) length,
+        .crc = crc32_update(0, out, length),
+        .compression = (uint8_t) compression
+    };
+}
+
+void region_begin_io(struct Region *region)
+{
+    pthread_rwlock_rdlock(&region->file_lock);
+}
+
+void region_end_io(struct Region *region)
+{
+    pthread_rwlock_unlock(&region->file_lock);
+}
+
+struct RegionEntry region_lookup(struct Region *region, int index)
+{
+    pthread_mutex_lock(&region->table_lock);
+    struct RegionEntry entry = region->table[index];
+    pthread_mutex_unlock(&region->table_lock);
+    return entry;
+}
+
+uint32_t region_reserve(struct Region *region, uint32_t sectors)
+{
+    pthread_mutex_lock(&region->table_lock);
+    uint32_t sector = region->next_sector;
+    region->next_sector += sectors;
+    pthread_mutex_unlock(&region->table_lock);
+    return sector;
+}
+
+int region_pread(struct Region *region, void *buffer, size_t size, uint32_t sector)
+{
+    return pread_full(region->fd, buffer, size, (off_t) sector*REGION_SECTOR_SIZE);
+}
+
+int region_pwrite(struct Region *region, const void *buffer, size_t size, uint32_t sector)
+{
+    return pwrite_full(region->fd, buffer, size, (off_t) sector*REGION_SECTOR_SIZE);
+}
+
+int region_sync(struct Region *region)
+{
+    region_begin_io(region);
+    int result = fdatasync(region->fd);
+    region_end_io(region);
+    if (result)
+        LOG_ERROR(LOG_REGION, "Unable to sync %s", region->path);
+    return result ? -1 : 0;
+}
+
+enum RegionResult region_commit(struct Region *region, int index, const struct RegionEntry *entry, bool written)
+{
+    enum RegionResult result = REGION_OK;
+
+    pthread_mutex_lock(&region->table_lock);
+    if (written && pwrite_full(region->fd, entry, sizeof(*entry), ENTRY_OFFSET(index)) == 0)
+    {
+        struct RegionEntry old = region->table[index];
+        region->table[index] = *entry;
+        region->live_sectors += SECTORS(entry->length);
+        if (old.sector)
+        {
+            region->live_sectors -= SECTORS(old.length);
+            region->garbage_sectors += SECTORS(old.length);
+        }
+    }
+    else
+    {
+        if (written)
+            LOG_ERROR(LOG_REGION, "Unable to update the table of %s", region->path);
+        region->garbage_sectors += SECTORS(entry->length);
+        result = REGION_ERROR;
+    }
+    pthread_mutex_unlock(&region->table_lock);
+
+    return result;
+}
+
+enum RegionResult region_read_chunk(struct Region *region, struct ChunkCoord coord, struct Chunk *chunk)
+{
+    int index;
+    if (!in_region(region, coord, &index))
+        return REGION_ERROR;
+
+    region_begin_io(region);
+
+    struct RegionEntry entry = region_lookup(region, index);
+    if (entry.sector == 0)
+    {
+        region_end_io(region);
+        return REGION_MISSING;
+    }
+
+    // scan_table keeps these out, the table is only trusted that far
+    if (entry.length > REGION_PAYLOAD_MAX)
+    {
+        region_end_io(region);
+        LOG_WARN(LOG_REGION, "Chunk %d %d %d in %s claims %u bytes.", coord.x, coord.y, coord.z, region->path, entry.length);
+        return REGION_CORRUPT;
+    }
+
+    uint8_t *payload = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, entry.length);
+    if (payload == NULL)
+    {
+        region_end_io(region);
+        LOG_ERROR(LOG_REGION, "Unable to allocate %u bytes for a payload.", entry.length);
+        return REGION_ERROR;
+    }
+
+    // Payloads are never overwritten in place, a concurrent write leaves this one intact
+    int failed = region_pread(region, payload, entry.length, entry.sector);
+    region_end_io(region);
+
+    enum RegionResult result = failed ? REGION_CORRUPT : region_decode(&entry, payload, chunk);
+    if (result == REGION_CORRUPT)
+        LOG_WARN(LOG_REGION, "Chunk %d %d %d in %s is corrupt.", coord.x, coord.y, coord.z, region->path);
+
+    mem_free(payload);
+    return result;
+}
+
+enum RegionResult region_write_chunk(struct Region *region, struct ChunkCoord coord, const struct Chunk *chunk, enum RegionCompression compression)
+{
+    int index;
+    if (!in_region(region, coord, &index))
+        return REGION_ERROR;
+
+    uint8_t *payload = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, REGION_PAYLOAD_MAX);
+    if (payload == NULL)
+    {
+        LOG_ERROR(LOG_REGION, "Unable to allocate a payload.");
+        return REGION_ERROR;
+    }
+
+    struct RegionEntry entry;
+    region_encode(chunk, compression, payload, &entry);
+
+    region_begin_io(region);
+    entry.sector = region_reserve(region, REGION_SECTORS(entry.length));
+
+    // The payload is written before the entry points at it
+    bool written = region_pwrite(region, payload, entry.length, entry.sector) == 0;
+    if (!written)
+        LOG_ERROR(LOG_REGION, "Unable to write chunk %d %d %d to %s", coord.x, coord.y, coord.z, region->path);
+    enum RegionResult result = region_commit(region, index, &entry, written);
+
+    region_end_io(region);
+    mem_free(payload);
+    return result;
+}
+
+int region_compact(struct Region *region)
+{
+    pthread_rwlock_wrlock(&region->file_lock);
+
+    size_t path_length = strlen(region->path);
+    char *temp_path = (char *) malloc(path_length + sizeof(".compact"));
+    struct RegionEntry *table = (struct RegionEntry *) calloc(REGION_CHUNKS, sizeof(struct RegionEntry));
+    uint8_t *payload = (uint8_t *) mem_alloc(MEM_IO_BUFFERS, VOXEL_BYTES);
+    int fd = -1;
+
+    if (temp_path == NULL || table == NULL || payload == NULL)
+    {
+        LOG_ERROR(LOG_REGION, "Unable to allocate buffers to compact %s", region->path);
+        goto fail;
+    }
+
+    memcpy(temp_path, region->path, path_length);
+    memcpy(temp_path + path_length, ".compact", sizeof(".compact"));
+
+    fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG_ERROR(LOG_REGION, "Unable to create %s", temp_path);
+        goto fail;
+    }
+
+    // Index order, so neighbouring chunks end up next to each other on disk
+    uint32_t next_sector = REGION_DATA_SECTOR;
+    for (int i = 0 ; i < REGION_CHUNKS ; i++)
+    {
+        struct RegionEntry entry = region->table[i];
+        if (entry.sector == 0)
+            continue;
+
+        // Payloads are never larger than a raw chunk
+        if (entry.length > VOXEL_BYTES
+            || pread_full(region->fd, payload, entry.length, (off_t) entry.sector*REGION_SECTOR_SIZE)
+            || pwrite_full(fd, payload, entry.length, (off_t) next_sector*REGION_SECTOR_SIZE))
+        {
+            LOG_ERROR(LOG_REGION, "Unable to move chunk %d while compacting %s", i, region->path);
+            goto fail;
+        }
+
+        entry.sector = next_sector;
+        table[i] = entry;
+        next_sector += SECTORS(entry.length);
+    }
+
+    if (write_header(fd, table) || fsync(fd) || rename(temp_path, region->path))
+    {
+        LOG_ERROR(LOG_REGION, "Unable to replace %s with its compacted copy", region->path);
+        goto fail;
+    }
+
+    close(region->fd);
+    region->fd = fd;
+    free(region->table);
+    region->table = table;
+    region->next_sector = next_sector;
+    region->garbage_sectors = 0;
+
+    pthread_rwlock_unlock(&region->file_lock);
+    free(temp_path);
+    mem_free(payload);
+    return 0;
+
+fail:
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(temp_path);
+    }
+    pthread_rwlock_unlock(&region->file_lock);
+    free(temp_path);
+    free(table);
+    mem_free(payload);
+    return -1;
+}
+
+// STORE
+
+int region_store_init(struct RegionStore *store, const char *directory)
+{
+    *store = (struct RegionStore){
+        .compression = REGION_COMPRESSION_CODEC
+    };
+
+    if (mkdir(directory, 0755) && errno != EEXIST)
+    {
+        LOG_ERROR(LOG_REGION, "Unable to create the save directory %s", directory);
+        return -1;
+    }
+
+    store->directory = strdup(directory);
+    if (store->directory == NULL)
+        return -1;
+
+    pthread_mutex_init(&store->lock, NULL);
+    return 0;
+}
+
+void region_store_close(struct RegionStore *store)
+{
+    for (int i = 0 ; i < REGION_STORE_MAX_OPEN ; i++)
+    {
+        if (store->open[i] == NULL)
+            continue;
+        if (store->users[i])
+            LOG_WARN(LOG_REGION, "%s closed while still in use.", store->open[i]->path);
+        region_close(store->open[i]);
+        free(store->open[i]);
+        store->open[i] = NULL;
+    }
+
+    free(store->directory);
+    store->directory = NULL;
+    pthread_mutex_destroy(&store->lock);
+}
+
+static void region_path(const char *directory, struct ChunkCoord region_coord, char *out, size_t size)
+{
+    snprintf(out, size, "%s/r.%d.%d.%d.vxr", directory, region_coord.x, region_coord.y, region_coord.z);
+}
+
+struct Region *region_store_acquire(struct RegionStore *store, struct ChunkCoord region_coord, bool create)
+{
+    pthread_mutex_lock(&store->lock);
+    store->clock++;
+
+    int slot = -1;
+    for (int i = 0 ; i < REGION_STORE_MAX_OPEN ; i++)
+    {
+        if (store->open[i] && chunk_coord_equal(store->open[i]->coord, region_coord))
+        {
+            store->users[i]++;
+            store->last_use[i] = store->clock;
+            pthread_mutex_unlock(&store->lock);
+            return store->open[i];
+        }
+
+        // Prefer an empty slot, then the least recently used idle one
+        if (store->users[i])
+            continue;
+        if (slot < 0 || (store->open[slot] && (store->open[i] == NULL || store->last_use[i] < store->last_use[slot])))
+            slot = i;
+    }
+
+    if (slot < 0)
+    {
+        pthread_mutex_unlock(&store->lock);
+        LOG_WARN(LOG_REGION, "Every open region is in use.");
+        return NULL;
+    }
+
+    char path[4096];
+    region_path(store->directory, region_coord, path, sizeof(path));
+
+    // Opened before anything is closed, lookups of regions that were never saved are common
+    struct Region *region = (struct Region *) malloc(sizeof(struct Region));
+    if (region == NULL || region_open(region, path, region_coord, create))
+    {
+        pthread_mutex_unlock(&store->lock);
+        free(region);
+        return NULL;
+    }
+
+    if (store->open[slot])
+    {
+        region_close(store->open[slot]);
+        free(store->open[slot]);
+    }
+
+    store->open[slot] = region;
+    store->users[slot] = 1;
+    store->last_use[slot] = store->clock;
+    pthread_mutex_unlock(&store->lock);
+    return region;
+}
+
+void region_store_release(struct RegionStore *store, struct Region *region)
+{
+    pthread_mutex_lock(&store->lock);
+    for (int i = 0 ; i < REGION_STORE_MAX_OPEN ; i++)
+    {
+        if (store->open[i] == region)
+            store->users[i]--;
+    }
+    pthread_mutex_unlock(&store->lock);
+}
+
+void region_store_delete(struct RegionStore *store, struct ChunkCoord region_coord)
+{
+    pthread_mutex_lock(&store->lock);
+    for (int i = 0 ; i < REGION_STORE_MAX_OPEN ; i++)
+    {
+        if (store->open[i] && chunk_coord_equal(store->open[i]->coord, region_coord))
+        {
+            if (store->users[i])
+            {
+                pthread_mutex_unlock(&store->lock);
+                LOG_WARN(LOG_REGION, "%s is still in use, not deleting it.", store->open[i]->path);
+                return;
+            }
+            region_close(store->open[i]);
+            free(store->open[i]);
+            store->open[i] = NULL;
+        }
+    }
+
+    char path[4096];
+    region_path(store->directory, region_coord, path, sizeof(path));
+    unlink(path);
+    pthread_mutex_unlock(&store->lock);
+}
+
+int region_store_sync(struct RegionStore *store)
+{
+    struct Region *regions[REGION_STORE_MAX_OPEN];
+    int count = 0;
+
+    // Held like any other user, so nothing closes them during the slow part
+    pthread_mutex_lock(&store->lock);
+    for (int i = 0 ; i < REGION_STORE_MAX_OPEN ; i++)
+    {
+        if (store->open[i])
+        {
+            store->users[i]++;
+            regions[count++] = store->open[i];
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    int result = 0;
+    for (int i = 0 ; i < count ; i++)
+    {
+        if (region_sync(regions[i]))
+            result = -1;
+        region_store_release(store, regions[i]);
+    }
+
+    int fd = open(store->directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0 || fsync(fd))
+        result = -1;
+    if (fd >= 0)
+        close(fd);
+    return result;
+}
+
+enum RegionResult region_store_load(struct RegionStore *store, struct ChunkCoord coord, struct Chunk *chunk)
+{
+    struct ChunkCoord region_coord;
+    int index;
+    region_from_chunk(coord, &region_coord, &index);
+
+    // Never saved regions don't get created just for looking
+    struct Region *region = region_store_acquire(store, region_coord, false);
+    if (region == NULL)
+        return REGION_MISSING;
+
+    enum RegionResult result = region_read_chunk(region, coord, chunk);
+    region_store_release(store, region);
+    return result;
+}
+
+enum RegionResult region_store_save(struct RegionStore *store, struct ChunkCoord coord, const struct Chunk *chunk)
+{
+    struct ChunkCoord region_coord;
+    int index;
+    region_from_chunk(coord, &region_coord, &index);
+
+    struct Region *region = region_store_acquire(store, region_coord, true);
+    if (region == NULL)
+        return REGION_ERROR;
+
+    enum RegionResult result = region_write_chunk(region, coord, chunk, store->compression);
+    region_store_release(store, region);
+    return result;
+}
+
+// VERIFICATION
+
+// Straddles region borders on every axis, plus one far away
+static const struct ChunkCoord verify_coords[] = {
+    { -1, -1, -1 }, { 0, -1, -1 }, { -1, 0, -1 }, { 0, 0, -1 },
+    { -1, -1, 0 }, { 0, -1, 0 }, { -1, 0, 0 }, { 0, 0, 0 },
+    { 31, 0, 0 }, { 32, 0, 0 }, { 5, 7, 9 }, { 6, 7, 9 },
+    { -33, -32, 64 }, { 1000, -1000, 77 }
+};
+#define VERIFY_COUNT (sizeof(verify_coords) / sizeof(verify_coords[0]))
+
+// Runs of voxels with some noise, roughly what terrain looks like to a compressor
+static void verify_fill(struct Chunk *chunk, struct ChunkCoord coord, uint32_t version)
+{
+    uint32_t state = chunk_coord_hash(coord) ^ (version * 0x9e3779b9u) ^ 1u;
+    uint8_t type = 0;
+    for (size_t i = 0 ; i < VOXEL_BYTES ; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        if ((state & 63) == 0)
+            type = (uint8_t) (state >> 8) % 6;
+        chunk->voxel_type[i] = type;
+    }
+}
+
+static int verify_all(struct RegionStore *store, uint32_t *versions, struct Chunk *expected, struct Chunk *loaded, const char *step)
+{
+    int failures = 0;
+    for (size_t i = 0 ; i < VERIFY_COUNT ; i++)
+    {
+        verify_fill(expected, verify_coords[i], versions[i]);
+        if (region_store_load(store, verify_coords[i], loaded) != REGION_OK
+            || memcmp(expected->voxel_type, loaded->voxel_type, VOXEL_BYTES))
+        {
+            LOG_WARN(LOG_REGION, "%s: chunk %d %d %d didn't round trip", step, verify_coords[i].x, verify_coords[i].y, verify_coords[i].z);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+/*
+ * Writes entry over the stored one of index behind the store's back, then
+ * reopens the store so the table is scanned again. The entry has to be
+ * dropped: the chunk reads as missing and compaction still goes through.
+ * */
+static int verify_bad_entry(struct RegionStore *store, const char *directory, struct ChunkCoord coord, struct RegionEntry entry, const char *step)
+{
+    struct ChunkCoord region_coord;
+    int index;
+    region_from_chunk(coord, &region_coord, &index);
+
+    struct Region *region = region_store_acquire(store, region_coord, true);
+    if (region == NULL)
+        return 1;
+    int failed = pwrite_full(region->fd, &entry, sizeof(entry), ENTRY_OFFSET(index));
+    region_store_release(store, region);
+    region_store_close(store);
+    if (failed || region_store_init(store, directory))
+        return 1;
+
+    struct Chunk *chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    int failures = 0;
+    if (chunk == NULL || region_store_load(store, coord, chunk) != REGION_MISSING)
+    {
+        LOG_WARN(LOG_REGION, "%s: bad table entry wasn't dropped.", step);
+        failures++;
+    }
+    free(chunk);
+
+    region = region_store_acquire(store, region_coord, true);
+    if (region == NULL || region_compact(region))
+    {
+        LOG_WARN(LOG_REGION, "%s: compaction failed after a bad table entry.", step);
+        failures++;
+    }
+    if (region)
+        region_store_release(store, region);
+    return failures;
+}
+
+static void remove_regions(const char *directory, const struct ChunkCoord *coords, size_t count)
+{
+    char path[4096];
+    for (size_t i = 0 ; i < count ; i++)
+    {
+        struct ChunkCoord region_coord;
+        int index;
+        region_from_chunk(coords[i], &region_coord, &index);
+        region_path(directory, region_coord, path, sizeof(path));
+        unlink(path);
+    }
+}
+
+int region_verify(const char *directory)
+{
+    struct Chunk *expected = (struct Chunk *) malloc(sizeof(struct Chunk));
+    struct Chunk *loaded = (struct Chunk *) malloc(sizeof(struct Chunk));
+    uint32_t versions[VERIFY_COUNT] = {0};
+    struct RegionStore store;
+    int failures = 0;
+
+    if (expected == NULL || loaded == NULL || region_store_init(&store, directory))
+    {
+        LOG_ERROR(LOG_REGION, "Unable to set up the verification.");
+        free(expected);
+        free(loaded);
+        return 1;
+    }
+
+    remove_regions(directory, verify_coords, VERIFY_COUNT);
+
+    for (int compression = 0 ; compression < REGION_COMPRESSION_COUNT ; compression++)
+    {
+        store.compression = compression;
+
+        for (size_t i = 0 ; i < VERIFY_COUNT ; i++)
+        {
+            versions[i]++;
+            verify_fill(expected, verify_coords[i], versions[i]);
+            if (region_store_save(&store, verify_coords[i], expected) != REGION_OK)
+                failures++;
+        }
+        failures += verify_all(&store, versions, expected, loaded, region_compression_name(compression));
+
+        // Rewrites leave garbage behind, the newest payload has to win
+        for (size_t i = 0 ; i < VERIFY_COUNT ; i += 2)
+        {
+            versions[i]++;
+            verify_fill(expected, verify_coords[i], versions[i]);
+            if (region_store_save(&store, verify_coords[i], expected) != REGION_OK)
+                failures++;
+        }
+        failures += verify_all(&store, versions, expected, loaded, "rewrite");
+    }
+
+    // Everything has to survive closing and reopening the files
+    region_store_close(&store);
+    region_store_init(&store, directory);
+    failures += verify_all(&store, versions, expected, loaded, "reopen");
+
+    struct ChunkCoord region_coord;
+    int index;
+    region_from_chunk(verify_coords[0], &region_coord, &index);
+    struct Region *region = region_store_acquire(&store, region_coord, true);
+    if (region == NULL)
+    {
+        failures++;
+    }
+    else
+    {
+        uint32_t before = region->next_sector;
+        if (region->garbage_sectors == 0 || region_compact(region) || region->garbage_sectors || region->next_sector >= before)
+        {
+            LOG_WARN(LOG_REGION, "Compaction didn't reclaim anything.");
+            failures++;
+        }
+        region_store_release(&store, region);
+        failures += verify_all(&store, versions, expected, loaded, "compact");
+
+        struct ChunkCoord missing = { verify_coords[0].x - 5, verify_coords[0].y, verify_coords[0].z };
+        if (region_store_load(&store, missing, loaded) != REGION_MISSING)
+        {
+            LOG_WARN(LOG_REGION, "Missing chunk wasn't reported as missing.");
+            failures++;
+        }
+
+        // Flip one payload byte behind the store's back
+        region = region_store_acquire(&store, region_coord, true);
+        struct RegionEntry entry = region->table[index];
+        uint8_t byte;
+        off_t offset = (off_t) entry.sector*REGION_SECTOR_SIZE + entry.length/2;
+        if (pread_full(region->fd, &byte, 1, offset) == 0)
+        {
+            byte ^= 0x10;
+            pwrite_full(region->fd, &byte, 1, offset);
+        }
+        region_store_release(&store, region);
+
+        log_flush();
+        printf("[Region] Expecting a corrupt chunk report:\n");
+        if (region_store_load(&store, verify_coords[0], loaded) != REGION_CORRUPT)
+        {
+            LOG_WARN(LOG_REGION, "Corrupted payload wasn't detected.");
+            failures++;
+        }
+
+        // Table entries no writer could have produced
+        log_flush();
+        printf("[Region] Expecting two invalid entry reports:\n");
+        struct RegionEntry oversized = { REGION_DATA_SECTOR, UINT32_MAX - 64, 0, 0, {0} };
+        failures += verify_bad_entry(&store, directory, verify_coords[0], oversized, "oversized");
+        struct RegionEntry wrapping = { UINT32_MAX - 1, REGION_SECTOR_SIZE*4, 0, 0, {0} };
+        failures += verify_bad_entry(&store, directory, verify_coords[0], wrapping, "wrapping");
+    }
+
+    region_store_close(&store);
+    remove_regions(directory, verify_coords, VERIFY_COUNT);
+    // the store created it, only goes if nothing else lives there
+    rmdir(directory);
+    free(expected);
+    free(loaded);
+    return failures;
+}
+
+void region_benchmark(const struct Terrain *terrain, const char *directory, int count)
+{
+    struct Chunk *chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    struct ChunkCoord *coords = (struct ChunkCoord *) calloc(count, sizeof(struct ChunkCoord));
+    struct RegionStore store;
+
+    if (chunk == NULL || coords == NULL || region_store_init(&store, directory))
+    {
+        LOG_ERROR(LOG_REGION, "Unable to set up the benchmark.");
+        free(chunk);
+        free(coords);
+        return;
+    }
+
+    // A slab around the surface, the part of the world a save mostly holds
+    int width = 1;
+    while (width*width*4 < count)
+        width++;
+    for (int i = 0 ; i < count ; i++)
+    {
+        struct ChunkCoord coord = { i % width, (i / (width*width)) - 2, (i / width) % width };
+        coords[i] = coord;
+    }
+    remove_regions(directory, coords, count);
+
+    for (int compression = 0 ; compression < REGION_COMPRESSION_COUNT ; compression++)
+    {
+        if (compression != REGION_COMPRESSION_NONE && compressions[compression].decode == NULL)
+            continue;
+        store.compression = compression;
+
+        uint64_t stored = 0;
+        uint64_t start = timer_now_ns();
+        for (int i = 0 ; i < count ; i++)
+        {
+            terrain_generate_chunk(terrain, chunk, coords[i]);
+            region_store_save(&store, coords[i], chunk);
+        }
+        uint64_t save_ns = timer_now_ns() - start;
+
+        // Reopen so the tables come from disk, the page cache stays warm though
+        region_store_close(&store);
+        region_store_init(&store, directory);
+        store.compression = compression;
+
+        int failures = 0;
+        start = timer_now_ns();
+        for (int i = 0 ; i < count ; i++)
+        {
+            if (region_store_load(&store, coords[i], chunk) != REGION_OK)
+                failures++;
+        }
+        uint64_t load_ns = timer_now_ns() - start;
+
+        for (int i = 0 ; i < REGION_STORE_MAX_OPEN ; i++)
+        {
+            if (store.open[i] == NULL)
+                continue;
+            for (int c = 0 ; c < REGION_CHUNKS ; c++)
+                stored += store.open[i]->table[c].length;
+        }
+
+        double seconds = load_ns * 1e-9;
+        printf("[Region] %-6s %d chunks, %.1f%% of raw size, generate+save %.1f ms, load %.1f chunks/s, %.1f MB/s%s\n",
+                region_compression_name(compression), count, 100.0 * stored / ((double) count * VOXEL_BYTES),
+                save_ns * 1e-6, count / seconds, count * VOXEL_BYTES / seconds / 1e6,
+                failures ? ", LOAD FAILURES" : "");
+
+        // Start over for the next compression
+        region_store_close(&store);
+        remove_regions(directory, coords, count);
+        region_store_init(&store, directory);
+    }
+
+    region_store_close(&store);
+    rmdir(directory);
+    free(chunk);
+    free(coords);
+}
@@ -1,27 +1,31 @@
+#include <stdlib.h>
 #include <glad/gl.h>
 #include <render.h>
 #include <io.h>
+#include <memtrack.h>
+#include <log.h>
 
 void camera_process(struct Camera *camera)
 {
-    printf("%5.3f %5.3f %5.3f %f %f", camera->position[0], camera->position[1], camera->position[2], camera->yaw, camera->pitch);
     glm_look(camera->position, camera->direction, camera->up, camera->view);
 }
 
 unsigned int load_shader(const char * vertex_shader_path, const char * fragment_shader_path)
 {
     // VERTEX
-    char * vertex_source;
-    int vertex_file = read_file(vertex_shader_path, &vertex_source);
+    struct MappedFile vertex_source;
+    int vertex_file = map_file(vertex_shader_path, MAP_ADVICE_SEQUENTIAL, &vertex_source);
     if (vertex_file != 0)
     {
-        printf("Unable to compile shader. Vertex shader couldn't be found.\n");
+        LOG_ERROR(LOG_RENDER, "Unable to compile shader. Vertex shader couldn't be found.");
         return -1;
     }
 
     unsigned int vertex_shader;
     vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader, 1, (const char* const*)&vertex_source, NULL);
+    // the mapping isn't NUL terminated, pass the length along
+    int vertex_length = (int) vertex_source.size;
+    glShaderSource(vertex_shader, 1, &vertex_source.data, &vertex_length);
     glCompileShader(vertex_shader);
 
     int vertex_success;
@@ -30,23 +34,24 @@ unsigned int load_shader(const char * vertex_shader_path, const char * fragment_
     if (!vertex_success)
     {
         glGetShaderInfoLog(vertex_shader, 512, NULL, vertex_info_log);
-        printf("Unable to compile shader. Error compiling. %s\n", vertex_info_log);
+        LOG_ERROR(LOG_RENDER, "Unable to compile shader. Error compiling. %s", vertex_info_log);
     }
-    free(vertex_source);
+    unmap_file(&vertex_source);
 
     // FRAGMENT
 
-    char * fragment_source;
-    int fragment_file = read_file(fragment_shader_path, &fragment_source);
+    struct MappedFile fragment_source;
+    int fragment_file = map_file(fragment_shader_path, MAP_ADVICE_SEQUENTIAL, &fragment_source);
     if (fragment_file != 0)
     {
-        printf("Unable to compile shader. Fragment shader couldn't be found.\n");
+        LOG_ERROR(LOG_RENDER, "Unable to compile shader. Fragment shader couldn't be found.");
         return -1;
     }
 
     unsigned int fragment_shader;
     fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader, 1, (const char* const*)&fragment_source, NULL);
+    int fragment_length = (int) fragment_source.size;
+    glShaderSource(fragment_shader, 1, &fragment_source.data, &fragment_length);
     glCompileShader(fragment_shader);
 
     int fragment_success;
@@ -55,9 +60,9 @@ unsigned int load_shader(const char * vertex_shader_path, const char * fragment_
     if (!fragment_success)
     {
         glGetShaderInfoLog(fragment_shader, 512, NULL, fragment_info_log);
-        printf("Unable to compile shader. Error compiling %s\n",fragment_info_log);
+        LOG_ERROR(LOG_RENDER, "Unable to compile shader. Error compiling %s",fragment_info_log);
     }
-    free(fragment_source);
+    unmap_file(&fragment_source);
 
     // SHADER LINKING
     unsigned int shader = glCreateProgram();
@@ -71,7 +76,7 @@ unsigned int load_shader(const char * vertex_shader_path, const char * fragment_
     if(!shader_success)
     {
         glGetProgramInfoLog(shader, 512, NULL, shader_info_log);
-        printf("Unable to Link the shader program. %s\n",shader_info_log);
+        LOG_ERROR(LOG_RENDER, "Unable to Link the shader program. %s",shader_info_log);
     }
 
     glDeleteShader(vertex_shader);
@@ -126,28 +131,73 @@ void set_shader_value_matrix4(const char *loc, mat4 value, unsigned int shader_p
         glUniformMatrix4fv(location, 1, GL_FALSE, value[0]);
 }
 
-struct Lattice create_lattice(const char *vertex_path, const char *fragment_path, uint16_t size)
+struct LatticeLoad
 {
-    struct Lattice result = {
-        .scale = 0.1f,
-        .size = size
-    };
+    struct Lattice *lattice;
+    const char *vertex_path, *fragment_path;
+};
+
+/*
+ * Loader context, buffers and programs are shared with the main one.
+ * */
+static void lattice_load_work(void *user)
+{
+    struct LatticeLoad *load = (struct LatticeLoad *) user;
+    struct Lattice *lattice = load->lattice;
 
-    glGenVertexArrays(1, &result.vao);
+    // Generate lattice data
+    float *vbo_data;
+    create_lattice_mesh_data(lattice->size, lattice->scale, &vbo_data, &lattice->vbo_size);
 
-    glGenBuffers(1, &result.vbo);
+    glGenBuffers(1, &lattice->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, lattice->vbo);
+    glBufferData(GL_ARRAY_BUFFER, lattice->vbo_size, vbo_data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    mem_account(MEM_GL_BUFFERS, lattice->vbo_size);
+    mem_free(vbo_data);
 
-    glBindVertexArray(result.vao);
+    lattice->shader = load_shader(load->vertex_path, load->fragment_path);
+    if (lattice->shader == -1)
+    {
+        LOG_WARN(LOG_RENDER, "Shader program didn't compile properly.");
+    }
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, result.vbo);
+static void lattice_load_done(void *user)
+{
+    struct LatticeLoad *load = (struct LatticeLoad *) user;
+    // The fence signaled, the drawing thread can use what work built
+    __atomic_store_n(&load->lattice->loaded, true, __ATOMIC_RELEASE);
+    free(load);
+}
 
-    // Generate lattice data
-    
-    float *vbo_data;
+void load_lattice(struct Lattice *lattice, struct Loader *loader, const char *vertex_path, const char *fragment_path, uint16_t size)
+{
+    *lattice = (struct Lattice){
+        .scale = 0.1f,
+        .size = size
+    };
 
-    create_lattice_mesh_data(result.size, result.scale, &vbo_data, &result.vbo_size);
+    struct LatticeLoad *load = (struct LatticeLoad *) malloc(sizeof(struct LatticeLoad));
+    if (load == NULL)
+    {
+        LOG_ERROR(LOG_RENDER, "Unable to allocate the lattice load.");
+        return;
+    }
+    *load = (struct LatticeLoad){ lattice, vertex_path, fragment_path };
+    loader_submit(loader, lattice_load_work, lattice_load_done, load);
+}
+
+bool lattice_ready(struct Lattice *lattice)
+{
+    if (lattice->vao)
+        return true;
+    if (!__atomic_load_n(&lattice->loaded, __ATOMIC_ACQUIRE))
+        return false;
 
-    glBufferData(GL_ARRAY_BUFFER, result.vbo_size, vbo_data, GL_STATIC_DRAW);
+    glGenVertexArrays(1, &lattice->vao);
+    glBindVertexArray(lattice->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, lattice->vbo);
 
     // Configure vertex data
 
@@ -161,14 +211,7 @@ struct Lattice create_lattice(const char *vertex_path, const char *fragment_path
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
-
-    result.shader = load_shader(vertex_path, fragment_path);
-    if (result.shader == -1)
-    {
-        printf("Shader program didn't compile properly.\n");
-    }
-
-    return result;
+    return true;
 }
 
 void create_lattice_mesh_data(uint16_t size, float voxel_scale, float **out, size_t *out_size)
@@ -183,15 +226,12 @@ void create_lattice_mesh_data(uint16_t size, float voxel_scale, float **out, siz
     size_t float_count = face_count * index_stride * vertex_stride;
     size_t byte_count = float_count*sizeof(float);
     
-    *out = (float *) calloc(1, byte_count);
+    *out = (float *) mem_calloc(MEM_MESH_STAGING, 1, byte_count);
     *out_size = byte_count;
 
-    printf("vertex count: %zu\n", float_count / 6);
-    printf("lattice data size: %zu\n", byte_count);
-
     if (*out == NULL)
     {
-        printf("Unable to create lattice data heap.\n");
+        LOG_ERROR(LOG_RENDER, "Unable to create lattice data heap.");
     }
     
     // Negative Z faces
@@ -582,7 +622,7 @@ struct Mesh create_mesh(float *vbo_data, size_t vbo_size, const char* vertex_sha
     mesh.shader = load_shader(vertex_shader_path, fragment_shader_path);
 
     if (mesh.shader == -1)
-        printf("Error encountered while compiling shader for mesh\n");
+        LOG_WARN(LOG_RENDER, "Error encountered while compiling shader for mesh");
 
     glGenVertexArrays(1, &mesh.vao);
     glGenBuffers(1, &mesh.vbo);
@@ -590,6 +630,7 @@ struct Mesh create_mesh(float *vbo_data, size_t vbo_size, const char* vertex_sha
     glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
 
     glBufferData(GL_ARRAY_BUFFER, mesh.vbo_size, vbo_data, GL_STATIC_DRAW);
+    mem_account(MEM_GL_BUFFERS, mesh.vbo_size);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -600,6 +641,30 @@ struct Mesh create_mesh(float *vbo_data, size_t vbo_size, const char* vertex_sha
     return mesh;
 }
 
+size_t estimate_texture_bytes(unsigned int target, unsigned int texture)
+{
+    if (texture == 0)
+        return 0;
+
+    int width = 0, height = 0, depth = 0, bits = 0;
+    glBindTexture(target, texture);
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_DEPTH, &depth);
+
+    const GLenum channels[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE };
+    for (int i = 0 ; i < sizeof(channels)/sizeof(channels[0]) ; i++)
+    {
+        int channel_bits = 0;
+        glGetTexLevelParameteriv(target, 0, channels[i], &channel_bits);
+        bits += channel_bits;
+    }
+    glBindTexture(target, 0);
+
+    // Base level only, whatever padding the driver adds is unknown
+    return (size_t) width*(height ? height : 1)*(depth ? depth : 1)*((bits + 7)/8);
+}
+
 void render_mesh(struct Mesh *i, Camera *camera)
 {
     glUseProgram(i->shader);
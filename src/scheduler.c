@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <scheduler.h>
+#include <timer.h>
+#include <log.h>
+
+static const char *class_names[WORK_CLASS_COUNT] = {
+    "upload",
+    "mesh",
+    "texture",
+    "unload"
+};
+
+void scheduler_init(struct FrameScheduler *scheduler)
+{
+    *scheduler = (struct FrameScheduler){0};
+    scheduler->queues[WORK_UPLOAD].budget_us = SCHEDULER_DEFAULT_UPLOAD_US;
+    scheduler->queues[WORK_MESH].budget_us = SCHEDULER_DEFAULT_MESH_US;
+    scheduler->queues[WORK_TEXTURE].budget_us = SCHEDULER_DEFAULT_TEXTURE_US;
+    scheduler->queues[WORK_UNLOAD].budget_us = SCHEDULER_DEFAULT_UNLOAD_US;
+}
+
+void scheduler_free(struct FrameScheduler *scheduler)
+{
+    for (int i = 0 ; i < WORK_CLASS_COUNT ; i++)
+    {
+        free(scheduler->queues[i].tasks);
+        scheduler->queues[i].tasks = NULL;
+        scheduler->queues[i].count = 0;
+        scheduler->queues[i].capacity = 0;
+    }
+}
+
+void scheduler_set_budget(struct FrameScheduler *scheduler, enum WorkClass work_class, uint32_t budget_us)
+{
+    scheduler->queues[work_class].budget_us = budget_us;
+}
+
+uint32_t scheduler_get_budget(struct FrameScheduler *scheduler, enum WorkClass work_class)
+{
+    return scheduler->queues[work_class].budget_us;
+}
+
+size_t scheduler_pending(struct FrameScheduler *scheduler, enum WorkClass work_class)
+{
+    return scheduler->queues[work_class].count;
+}
+
+const char *scheduler_class_name(enum WorkClass work_class)
+{
+    return class_names[work_class];
+}
+
+static int task_before(struct ScheduledTask *a, struct ScheduledTask *b)
+{
+    if (a->priority != b->priority)
+        return a->priority < b->priority;
+    return a->sequence < b->sequence;
+}
+
+static void sift_down(struct WorkQueue *queue, size_t i)
+{
+    while (true)
+    {
+        size_t smallest = i;
+        size_t left = i*2+1;
+        size_t right = i*2+2;
+
+        if (left < queue->count && task_before(&queue->tasks[left], &queue->tasks[smallest]))
+            smallest = left;
+        if (right < queue->count && task_before(&queue->tasks[right], &queue->tasks[smallest]))
+            smallest = right;
+        if (smallest == i)
+            return;
+
+        struct ScheduledTask tmp = queue->tasks[i];
+        queue->tasks[i] = queue->tasks[smallest];
+        queue->tasks[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void sift_up(struct WorkQueue *queue, size_t i)
+{
+    while (i > 0)
+    {
+        size_t parent = (i-1)/2;
+        if (!task_before(&queue->tasks[i], &queue->tasks[parent]))
+            return;
+
+        struct ScheduledTask tmp = queue->tasks[i];
+        queue->tasks[i] = queue->tasks[parent];
+        queue->tasks[parent] = tmp;
+        i = parent;
+    }
+}
+
+int scheduler_submit(struct FrameScheduler *scheduler, enum WorkClass work_class, ScheduledWork run, void *user, vec3 position)
+{
+    struct WorkQueue *queue = &scheduler->queues[work_class];
+
+    if (queue->count == queue->capacity)
+    {
+        size_t capacity = queue->capacity ? queue->capacity*2 : 64;
+        struct ScheduledTask *tasks = (struct ScheduledTask *) realloc(queue->tasks, capacity*sizeof(struct ScheduledTask));
+        if (tasks == NULL)
+        {
+            LOG_ERROR(LOG_SCHEDULER, "Unable to grow the %s queue.", class_names[work_class]);
+            return -1;
+        }
+        queue->tasks = tasks;
+        queue->capacity = capacity;
+    }
+
+    struct ScheduledTask *task = &queue->tasks[queue->count];
+    task->run = run;
+    task->user = user;
+    glm_vec3_copy(position, task->position);
+    task->priority = glm_vec3_distance2(position, scheduler->camera_position);
+    task->sequence = scheduler->sequence++;
+
+    queue->count++;
+    sift_up(queue, queue->count-1);
+
+    return 0;
+}
+
+/*
+ * Distances change every frame as the camera moves, rescoring and
+ * rebuilding the heap in place is O(n) which is cheaper than tracking moves.
+ * */
+static void reprioritize(struct WorkQueue *queue, vec3 camera_position)
+{
+    for (size_t i = 0 ; i < queue->count ; i++)
+        queue->tasks[i].priority = glm_vec3_distance2(queue->tasks[i].position, camera_position);
+
+    for (size_t i = queue->count/2 ; i-- > 0 ;)
+        sift_down(queue, i);
+}
+
+void scheduler_run_frame(struct FrameScheduler *scheduler, vec3 camera_position)
+{
+    glm_vec3_copy(camera_position, scheduler->camera_position);
+
+    for (int c = 0 ; c < WORK_CLASS_COUNT ; c++)
+    {
+        struct WorkQueue *queue = &scheduler->queues[c];
+        queue->executed = 0;
+        queue->spent_us = 0;
+
+        if (queue->count == 0)
+            continue;
+
+        reprioritize(queue, camera_position);
+
+        uint64_t start = timer_now_us();
+        uint64_t elapsed = 0;
+
+        while (queue->count > 0 && (queue->executed == 0 || elapsed < queue->budget_us))
+        {
+            // Pop before running, the task may submit more work
+            struct ScheduledTask task = queue->tasks[0];
+            queue->count--;
+            if (queue->count > 0)
+            {
+                queue->tasks[0] = queue->tasks[queue->count];
+                sift_down(queue, 0);
+            }
+
+            task.run(task.user);
+            queue->executed++;
+            elapsed = timer_now_us() - start;
+        }
+
+        queue->spent_us = elapsed;
+    }
+}
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <snapshot.h>
+#include <timer.h>
+#include <memtrack.h>
+#include <log.h>
+
+// Allocated and not yet freed, for catching leaks in the stress test
+static int64_t live_versions;
+
+static struct ChunkVersion *create_version(void)
+{
+    struct ChunkVersion *version = (struct ChunkVersion *) mem_alloc_chunks(sizeof(struct ChunkVersion), 1);
+    if (version == NULL)
+    {
+        LOG_ERROR(LOG_SNAPSHOT, "Unable to allocate a chunk version.");
+        return NULL;
+    }
+    version->references = 0;
+    version->generation = 0;
+    __atomic_add_fetch(&live_versions, 1, __ATOMIC_RELAXED);
+    return version;
+}
+
+static void free_version(struct ChunkVersion *version)
+{
+    __atomic_sub_fetch(&live_versions, 1, __ATOMIC_RELAXED);
+    mem_free(version);
+}
+
+int shared_chunk_init(struct SharedChunk *shared)
+{
+    // Readers may already be looking at where it lives
+    __atomic_store_n(&shared->current, NULL, __ATOMIC_RELEASE);
+    shared->generation = 0;
+    shared->draft = create_version();
+    if (shared->draft == NULL)
+        return -1;
+    memset(&shared->draft->chunk, 0, sizeof(struct Chunk));
+    return 0;
+}
+
+struct Chunk *shared_chunk_edit(struct SharedChunk *shared)
+{
+    if (shared->draft)
+        return &shared->draft->chunk;
+
+    shared->draft = create_version();
+    if (shared->draft == NULL)
+        return NULL;
+    if (shared->current)
+        memcpy(&shared->draft->chunk, &shared->current->chunk, sizeof(struct Chunk));
+    else
+        memset(&shared->draft->chunk, 0, sizeof(struct Chunk));
+    return &shared->draft->chunk;
+}
+
+static void release_retired(void *pointer)
+{
+    chunk_version_release((struct ChunkVersion *) pointer);
+}
+
+void shared_chunk_publish(struct SharedChunk *shared)
+{
+    struct ChunkVersion *version = shared->draft;
+    if (version == NULL)
+        return;
+
+    version->references = 1;
+    version->generation = ++shared->generation;
+    shared->draft = NULL;
+
+    struct ChunkVersion *previous = shared->current;
+    __atomic_store_n(&shared->current, version, __ATOMIC_RELEASE);
+    // Readers pinned right now may still be about to take a reference
+    epoch_retire(previous, release_retired);
+}
+
+struct Chunk *shared_chunk_view(struct SharedChunk *shared)
+{
+    if (shared->draft)
+        return &shared->draft->chunk;
+    return shared->current ? &shared->current->chunk : NULL;
+}
+
+void shared_chunk_free(struct SharedChunk *shared)
+{
+    if (shared->draft)
+        free_version(shared->draft);
+    shared->draft = NULL;
+    struct ChunkVersion *version = shared->current;
+    __atomic_store_n(&shared->current, NULL, __ATOMIC_RELEASE);
+    epoch_retire(version, release_retired);
+}
+
+const struct ChunkVersion *shared_chunk_peek(const struct SharedChunk *shared)
+{
+    return __atomic_load_n(&shared->current, __ATOMIC_ACQUIRE);
+}
+
+struct ChunkVersion *shared_chunk_acquire(const struct SharedChunk *shared)
+{
+    // The owner's reference is only dropped once nobody is pinned from before the swap
+    epoch_pin();
+    struct ChunkVersion *version = __atomic_load_n(&shared->current, __ATOMIC_ACQUIRE);
+    if (version)
+        __atomic_add_fetch(&version->references, 1, __ATOMIC_RELAXED);
+    epoch_unpin();
+    return version;
+}
+
+void chunk_version_acquire(struct ChunkVersion *version)
+{
+    __atomic_add_fetch(&version->references, 1, __ATOMIC_RELAXED);
+}
+
+void chunk_version_release(struct ChunkVersion *version)
+{
+    if (version && __atomic_sub_fetch(&version->references, 1, __ATOMIC_ACQ_REL) == 0)
+        free_version(version);
+}
+
+#define STRESS_HELD 4
+
+struct StressReader
+{
+    struct SharedChunk *shared;
+    pthread_t thread;
+    bool *running;
+    uint64_t reads;
+    int failures;
+};
+
+// A whole version has every voxel set to its generation
+static bool version_whole(const struct ChunkVersion *version)
+{
+    uint8_t expected = (uint8_t) version->generation;
+    for (int i = 0 ; i < CHUNK_DATA_SIZE ; i++)
+    {
+        if (version->chunk.voxel_type[i] != expected)
+            return false;
+    }
+    return true;
+}
+
+static void *stress_reader(void *arg)
+{
+    struct StressReader *reader = (struct StressReader *) arg;
+    struct ChunkVersion *held[STRESS_HELD] = {0};
+    uint64_t i = 0;
+
+    while (__atomic_load_n(reader->running, __ATOMIC_ACQUIRE))
+    {
+        // Borrowed for the length of a pin
+        epoch_pin();
+        const struct ChunkVersion *peeked = shared_chunk_peek(reader->shared);
+        if (peeked && !version_whole(peeked))
+            reader->failures++;
+        epoch_unpin();
+
+        // Held across many publishes, checked again before letting go
+        int slot = i % STRESS_HELD;
+        if (held[slot])
+        {
+            if (!version_whole(held[slot]))
+                reader->failures++;
+            chunk_version_release(held[slot]);
+        }
+        held[slot] = shared_chunk_acquire(reader->shared);
+
+        reader->reads += 2;
+        i++;
+    }
+
+    for (int slot = 0 ; slot < STRESS_HELD ; slot++)
+        chunk_version_release(held[slot]);
+    return NULL;
+}
+
+int shared_chunk_stress(int threads, double seconds)
+{
+    struct SharedChunk shared;
+    struct StressReader *readers = (struct StressReader *) calloc(threads, sizeof(struct StressReader));
+    if (readers == NULL || shared_chunk_init(&shared))
+    {
+        free(readers);
+        return 1;
+    }
+    int64_t live_before = __atomic_load_n(&live_versions, __ATOMIC_RELAXED) - 1;
+    memset(shared_chunk_view(&shared)->voxel_type, 1, CHUNK_DATA_SIZE);
+    shared_chunk_publish(&shared);
+
+    struct EpochStats before;
+    epoch_get_stats(&before);
+
+    bool running = true;
+    int started = 0;
+    for (int i = 0 ; i < threads ; i++)
+    {
+        readers[i] = (struct StressReader){ &shared, 0, &running, 0, 0 };
+        if (pthread_create(&readers[i].thread, NULL, stress_reader, &readers[i]))
+            break;
+        started++;
+    }
+
+    // The owner keeps rewriting the whole chunk, a torn read can't go unnoticed
+    uint64_t publishes = 0, pending_max = 0;
+    uint64_t start = timer_now_ns();
+    while ((timer_now_ns() - start) / 1e9 < seconds)
+    {
+        struct Chunk *chunk = shared_chunk_edit(&shared);
+        if (chunk == NULL)
+            break;
+        memset(chunk->voxel_type, (uint8_t) (shared.generation + 1), CHUNK_DATA_SIZE);
+        shared_chunk_publish(&shared);
+        publishes++;
+
+        epoch_collect();
+        struct EpochStats stats;
+        epoch_get_stats(&stats);
+        if (stats.pending > pending_max)
+            pending_max = stats.pending;
+    }
+
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    uint64_t reads = 0;
+    int failures = 0;
+    for (int i = 0 ; i < started ; i++)
+    {
+        pthread_join(readers[i].thread, NULL);
+        reads += readers[i].reads;
+        failures += readers[i].failures;
+    }
+
+    shared_chunk_free(&shared);
+    epoch_barrier();
+
+    struct EpochStats after;
+    epoch_get_stats(&after);
+    int64_t leaked = __atomic_load_n(&live_versions, __ATOMIC_RELAXED) - live_before;
+    if (leaked)
+    {
+        LOG_WARN(LOG_SNAPSHOT, "%lld chunk versions were never freed.", (long long) leaked);
+        failures++;
+    }
+
+    printf("[Snapshot] %d readers, %llu publishes, %llu reads, %d torn | %llu epochs, %llu stalls, at most %llu versions waiting\n",
+            started, (unsigned long long) publishes, (unsigned long long) reads, failures,
+            (unsigned long long) (after.epoch - before.epoch), (unsigned long long) (after.stalls - before.stalls),
+            (unsigned long long) pending_max);
+
+    free(readers);
+    return failures;
+}
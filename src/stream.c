@@ -0,0 +1,1568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glad/gl.h>
+#include <stream.h>
+#include <terrain.h>
+#include <epoch.h>
+#include <nullgl.h>
+#include <timer.h>
+#include <profile.h>
+#include <memtrack.h>
+#include <arena.h>
+#include <log.h>
+
+static void generate_job(void *user);
+static void worldgen_done(const struct Chunk *chunk, struct ChunkCoord coord, void *user);
+static void load_done(struct ChunkIoRequest *request);
+static void save_done(struct ChunkIoRequest *request);
+static void bitmask_job(void *user);
+static void upload_task(void *user);
+static void upload_work(void *user);
+static void upload_done(void *user);
+static void remesh_work(void *user);
+static void remesh_done(void *user);
+static void unload_task(void *user);
+static void remesh_task(void *user);
+static void texture_task(void *user);
+
+int stream_init(struct ChunkStream *stream, struct JobPool *pool, struct Loader *loader, struct GpuReclaim *reclaim, struct FrameScheduler *scheduler, StreamGenerate generate, void *generate_user)
+{
+    *stream = (struct ChunkStream){
+        .load_radius = STREAM_DEFAULT_LOAD_RADIUS,
+        .unload_radius = STREAM_DEFAULT_UNLOAD_RADIUS,
+        .max_in_flight = STREAM_DEFAULT_MAX_IN_FLIGHT,
+        .generate = generate,
+        .generate_user = generate_user,
+        .pool = pool,
+        .loader = loader,
+        .reclaim = reclaim,
+        .scheduler = scheduler
+    };
+
+    stream->buckets = (struct StreamChunk **) calloc(STREAM_HASH_BUCKETS, sizeof(struct StreamChunk *));
+    if (stream->buckets == NULL)
+    {
+        LOG_ERROR(LOG_STREAM, "Unable to allocate the chunk table.");
+        return -1;
+    }
+
+    prefetch_init(&stream->prefetch);
+    pthread_mutex_init(&stream->done_lock, NULL);
+    return 0;
+}
+
+void stream_use_worldgen(struct ChunkStream *stream, struct Worldgen *worldgen)
+{
+    stream->worldgen = worldgen;
+}
+
+void stream_use_io(struct ChunkStream *stream, struct ChunkIo *io)
+{
+    stream->io = io;
+}
+
+void stream_use_journal(struct ChunkStream *stream, struct Journal *journal)
+{
+    stream->journal = journal;
+    journal_set_checkpoint_bytes(journal, 0);
+}
+
+static struct StreamChunk *find_chunk(struct ChunkStream *stream, struct ChunkCoord coord)
+{
+    struct StreamChunk *entry = stream->buckets[chunk_coord_hash(coord) & (STREAM_HASH_BUCKETS-1)];
+    while (entry && !chunk_coord_equal(entry->coord, coord))
+        entry = entry->hash_next;
+    return entry;
+}
+
+/*
+ * entry keeps its hash_next, a pinned reader standing on it still finds
+ * the rest of the bucket.
+ * */
+static void detach_chunk(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    struct StreamChunk **link = &stream->buckets[chunk_coord_hash(entry->coord) & (STREAM_HASH_BUCKETS-1)];
+    while (*link && *link != entry)
+        link = &(*link)->hash_next;
+    if (*link)
+        __atomic_store_n(link, entry->hash_next, __ATOMIC_RELEASE);
+}
+
+struct ChunkVersion *stream_acquire_chunk(struct ChunkStream *stream, struct ChunkCoord coord)
+{
+    epoch_pin();
+    struct StreamChunk *entry = __atomic_load_n(&stream->buckets[chunk_coord_hash(coord) & (STREAM_HASH_BUCKETS-1)], __ATOMIC_ACQUIRE);
+    while (entry && !chunk_coord_equal(entry->coord, coord))
+        entry = __atomic_load_n(&entry->hash_next, __ATOMIC_ACQUIRE);
+    // Still generating if nothing was published yet
+    struct ChunkVersion *version = entry ? shared_chunk_acquire(&entry->voxels) : NULL;
+    epoch_unpin();
+    return version;
+}
+
+static void dirty_link(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    if (entry->dirty)
+        return;
+    entry->dirty = true;
+    entry->dirty_prev = NULL;
+    entry->dirty_next = stream->dirty_head;
+    if (stream->dirty_head)
+        stream->dirty_head->dirty_prev = entry;
+    stream->dirty_head = entry;
+}
+
+static void dirty_unlink(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    if (!entry->dirty)
+        return;
+    if (entry->dirty_prev)
+        entry->dirty_prev->dirty_next = entry->dirty_next;
+    else
+        stream->dirty_head = entry->dirty_next;
+    if (entry->dirty_next)
+        entry->dirty_next->dirty_prev = entry->dirty_prev;
+    entry->dirty = false;
+    entry->dirty_prev = entry->dirty_next = NULL;
+}
+
+// Loader or render thread, whichever holds the context
+static void build_texture(struct StreamChunk *entry)
+{
+    entry->texture = generate_chunk_lattice_texture(entry->chunk);
+    entry->texture_bytes = estimate_texture_bytes(GL_TEXTURE_3D, entry->texture);
+    mem_account(MEM_GL_TEXTURES, entry->texture_bytes);
+}
+
+// The last frames may still be drawing with it, reclaim deletes it later
+static void retire_texture(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    gpu_reclaim_texture(stream->reclaim, entry->texture);
+    mem_account(MEM_GL_TEXTURES, -(int64_t) entry->texture_bytes);
+    entry->texture = 0;
+    entry->texture_bytes = 0;
+}
+
+static void free_chunk(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    dirty_unlink(stream, entry);
+    if (entry->save)
+        entry->save->entry = NULL;
+
+    if (entry->all_prev)
+        entry->all_prev->all_next = entry->all_next;
+    else
+        stream->all = entry->all_next;
+    if (entry->all_next)
+        entry->all_next->all_prev = entry->all_prev;
+
+    if (entry->chunk)
+    {
+        shared_chunk_free(&entry->voxels);
+        stream->stats.resident_bytes -= sizeof(struct Chunk);
+    }
+    stream->stats.resident_bytes -= sizeof(struct StreamChunk);
+    epoch_retire(entry, free);
+}
+
+/*
+ * Room for one more request.
+ * */
+static int reserve_queue(struct ChunkStream *stream)
+{
+    if (stream->queue_count < stream->queue_capacity)
+        return 0;
+
+    size_t capacity = stream->queue_capacity ? stream->queue_capacity*2 : 256;
+    struct StreamChunk **queue = (struct StreamChunk **) realloc(stream->queue, capacity*sizeof(struct StreamChunk *));
+    if (queue == NULL)
+    {
+        LOG_ERROR(LOG_STREAM, "Unable to grow the request queue.");
+        return -1;
+    }
+    stream->queue = queue;
+    stream->queue_capacity = capacity;
+    return 0;
+}
+
+static struct StreamChunk *request_chunk(struct ChunkStream *stream, struct ChunkCoord coord)
+{
+    if (reserve_queue(stream))
+        return NULL;
+
+    struct StreamChunk *entry = (struct StreamChunk *) calloc(1, sizeof(struct StreamChunk));
+    if (entry == NULL)
+    {
+        LOG_ERROR(LOG_STREAM, "Unable to allocate a chunk entry.");
+        return NULL;
+    }
+
+    entry->coord = coord;
+    entry->state = STREAM_QUEUED;
+    entry->stream = stream;
+    entry->request_us = timer_now_us();
+
+    vec3 box[2];
+    world_chunk_aabb(coord, box);
+    entry->in_frustum = glm_aabb_frustum(box, stream->frustum);
+    if (entry->in_frustum)
+    {
+        stream->stats.late_requests++;
+        entry->entered = true;
+        prefetch_record_entry(&stream->prefetch, false);
+    }
+
+    size_t bucket = chunk_coord_hash(coord) & (STREAM_HASH_BUCKETS-1);
+    entry->hash_next = stream->buckets[bucket];
+    __atomic_store_n(&stream->buckets[bucket], entry, __ATOMIC_RELEASE);
+
+    entry->all_next = stream->all;
+    if (stream->all)
+        stream->all->all_prev = entry;
+    stream->all = entry;
+
+    stream->queue[stream->queue_count++] = entry;
+    stream->stats.resident_bytes += sizeof(struct StreamChunk);
+
+    return entry;
+}
+
+static int chunk_distance2(struct ChunkCoord a, struct ChunkCoord b)
+{
+    int dx = a.x - b.x;
+    int dy = a.y - b.y;
+    int dz = a.z - b.z;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+static void request_radius(struct ChunkStream *stream)
+{
+    int r = stream->load_radius;
+    for (int dy = -r ; dy <= r ; dy++)
+    for (int dz = -r ; dz <= r ; dz++)
+    for (int dx = -r ; dx <= r ; dx++)
+    {
+        if (dx*dx + dy*dy + dz*dz > r*r)
+            continue;
+
+        struct ChunkCoord coord = {
+            stream->center.x + dx,
+            stream->center.y + dy,
+            stream->center.z + dz
+        };
+        if (find_chunk(stream, coord) == NULL)
+            request_chunk(stream, coord);
+    }
+}
+
+/*
+ * Requests what the camera will reach soon even if it is outside the load
+ * radius, as long as it wouldn't be unloaded again right away.
+ * */
+static void request_path(struct ChunkStream *stream)
+{
+    struct Prefetch *prefetch = &stream->prefetch;
+    int unload_distance2 = stream->unload_radius * stream->unload_radius;
+
+    for (int i = 0 ; i < prefetch->path_count ; i++)
+    {
+        for (int dy = -PREFETCH_RADIUS ; dy <= PREFETCH_RADIUS ; dy++)
+        for (int dz = -PREFETCH_RADIUS ; dz <= PREFETCH_RADIUS ; dz++)
+        for (int dx = -PREFETCH_RADIUS ; dx <= PREFETCH_RADIUS ; dx++)
+        {
+            struct ChunkCoord coord = {
+                prefetch->path[i].x + dx,
+                prefetch->path[i].y + dy,
+                prefetch->path[i].z + dz
+            };
+            if (chunk_distance2(coord, stream->center) >= unload_distance2)
+                continue;
+            if (find_chunk(stream, coord) == NULL)
+                request_chunk(stream, coord);
+        }
+    }
+}
+
+/*
+ * Makes the edits so far visible to other threads. The texture is rebuilt
+ * separately, see remesh_edited.
+ * */
+static void publish_edits(struct StreamChunk *entry)
+{
+    if (entry->voxels.draft == NULL)
+        return;
+    generate_chunk_bitmask(entry->chunk);
+    shared_chunk_publish(&entry->voxels);
+    entry->chunk = shared_chunk_view(&entry->voxels);
+}
+
+/*
+ * Hands the current version to the I/O service, the chunk can be edited
+ * again right away and copies on the first write.
+ * */
+static int start_save(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    struct StreamSave *save = (struct StreamSave *) malloc(sizeof(struct StreamSave));
+    if (save == NULL)
+    {
+        LOG_ERROR(LOG_STREAM, "Unable to allocate a save.");
+        return -1;
+    }
+    publish_edits(entry);
+    struct ChunkVersion *snapshot = entry->voxels.current;
+    chunk_version_acquire(snapshot);
+
+    *save = (struct StreamSave){
+        .coord = entry->coord,
+        .snapshot = snapshot,
+        .entry = entry,
+        .generation = entry->generation,
+        .first_sequence = entry->dirty_sequence,
+        .stream = stream
+    };
+    if (chunk_io_save(stream->io, entry->coord, &snapshot->chunk, save_done, save) == NULL)
+    {
+        chunk_version_release(snapshot);
+        free(save);
+        return -1;
+    }
+
+    // An older save still in flight is superseded, it only matters for the journal now
+    if (entry->save)
+        entry->save->entry = NULL;
+    entry->save = save;
+    entry->dirty_sequence = 0;
+
+    save->next = stream->saves;
+    stream->saves = save;
+    return 0;
+}
+
+static struct StreamSave *find_save(struct ChunkStream *stream, struct ChunkCoord coord)
+{
+    for (struct StreamSave *save = stream->saves ; save ; save = save->next)
+    {
+        if (chunk_coord_equal(save->coord, coord))
+            return save;
+    }
+    return NULL;
+}
+
+/*
+ * Drops the journal frames older than every edit that isn't on disk yet.
+ * */
+static void truncate_journal(struct ChunkStream *stream)
+{
+    uint64_t oldest = stream->last_sequence + 1;
+    if (stream->unsaved_sequence && stream->unsaved_sequence < oldest)
+        oldest = stream->unsaved_sequence;
+    for (struct StreamChunk *entry = stream->dirty_head ; entry ; entry = entry->dirty_next)
+    {
+        if (entry->dirty_sequence && entry->dirty_sequence < oldest)
+            oldest = entry->dirty_sequence;
+    }
+    for (struct StreamSave *save = stream->saves ; save ; save = save->next)
+    {
+        if (save->first_sequence && save->first_sequence < oldest)
+            oldest = save->first_sequence;
+    }
+
+    if (oldest - 1 > stream->truncated_sequence)
+        stream->truncated_sequence = journal_truncate(stream->journal, oldest - 1);
+}
+
+int stream_set_voxel(struct ChunkStream *stream, struct ChunkCoord coord, int index, uint8_t type)
+{
+    struct StreamChunk *entry = find_chunk(stream, coord);
+    if (entry == NULL || entry->state != STREAM_READY || index < 0 || index >= CHUNK_DATA_SIZE)
+        return -1;
+
+    uint8_t old_type = entry->chunk->voxel_type[index];
+    if (old_type == type)
+        return 0;
+    struct Chunk *chunk = shared_chunk_edit(&entry->voxels);
+    if (chunk == NULL)
+        return -1;
+    entry->chunk = chunk;
+    chunk->voxel_type[index] = type;
+    entry->generation++;
+    entry->remesh = true;
+
+    if (stream->journal)
+    {
+        struct VoxelEdit edit = { coord, (uint16_t) index, old_type, type };
+        uint64_t sequence = journal_append(stream->journal, &edit, 1);
+        if (entry->dirty_sequence == 0)
+            entry->dirty_sequence = sequence;
+        stream->last_sequence = sequence;
+    }
+
+    dirty_link(stream, entry);
+    return 0;
+}
+
+size_t stream_save(struct ChunkStream *stream)
+{
+    if (stream->io == NULL)
+        return 0;
+    PROFILE_ZONE("stream save");
+    uint64_t start = timer_now_ns();
+
+    if (stream->journal)
+        truncate_journal(stream);
+
+    size_t started = 0;
+    for (struct StreamChunk *entry = stream->dirty_head ; entry ; entry = entry->dirty_next)
+    {
+        // Chunks with a save in flight wait for it, their next one includes the new edits
+        if (entry->state != STREAM_READY || entry->save || entry->generation == entry->saved_generation)
+            continue;
+        if (start_save(stream, entry) == 0)
+            started++;
+    }
+
+    if (stream->ready_count > started)
+        stream->stats.save_skipped += stream->ready_count - started;
+    stream->stats.last_save_ms = (timer_now_ns() - start) / 1e6;
+    return started;
+}
+
+/*
+ * Rebuilds what was edited since the last frame. The loader builds from
+ * the version published here, edits in the meantime copy and come with
+ * the next remesh.
+ * */
+static void remesh_edited(struct ChunkStream *stream)
+{
+    PROFILE_ZONE("remesh");
+    for (struct StreamChunk *entry = stream->dirty_head ; entry ; entry = entry->dirty_next)
+    {
+        if (!entry->remesh || entry->remeshing || entry->state != STREAM_READY)
+            continue;
+
+        vec3 center;
+        world_chunk_center(entry->coord, center);
+        entry->remesh = false;
+        entry->remeshing = true;
+        if (scheduler_submit(stream->scheduler, WORK_MESH, remesh_task, entry, center))
+        {
+            entry->remesh = true;
+            entry->remeshing = false;
+        }
+    }
+}
+
+/*
+ * Remeshing, a scheduled step. Whatever was unloaded in the meantime is
+ * freed here, unload_task left it to the remesh.
+ * */
+static bool remesh_unloaded(struct StreamChunk *entry)
+{
+    if (!entry->unloaded)
+        return false;
+    if (entry->remesh_version)
+        chunk_version_release(entry->remesh_version);
+    entry->remesh_version = NULL;
+    entry->remeshing = false;
+    free_chunk(entry->stream, entry);
+    return true;
+}
+
+static void remesh_task(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    if (remesh_unloaded(entry))
+        return;
+
+    // Edits up to now go into the bitmask and the texture built from it
+    publish_edits(entry);
+    entry->remesh_version = shared_chunk_acquire(&entry->voxels);
+
+    vec3 center;
+    world_chunk_center(entry->coord, center);
+    if (entry->remesh_version == NULL
+        || scheduler_submit(entry->stream->scheduler, WORK_TEXTURE, texture_task, entry, center))
+    {
+        if (entry->remesh_version)
+            chunk_version_release(entry->remesh_version);
+        entry->remesh_version = NULL;
+        entry->remesh = true;
+        entry->remeshing = false;
+    }
+}
+
+static void texture_task(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    if (remesh_unloaded(entry))
+        return;
+    loader_submit(entry->stream->loader, remesh_work, remesh_done, entry);
+}
+
+/*
+ * Takes a chunk out of the world. Chunks owned by someone else are only
+ * flagged, their owner frees them once it hands them back.
+ * */
+static void unload_chunk(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    detach_chunk(stream, entry);
+
+    switch (entry->state)
+    {
+        case STREAM_QUEUED:
+            for (size_t i = 0 ; i < stream->queue_count ; i++)
+            {
+                if (stream->queue[i] == entry)
+                {
+                    stream->queue[i] = stream->queue[--stream->queue_count];
+                    break;
+                }
+            }
+            stream->stats.cancelled++;
+            free_chunk(stream, entry);
+            break;
+        case STREAM_LOADING:
+            // The read may still be queued, no need to wait for the disk
+            chunk_io_cancel(stream->io, entry->io_request);
+            entry->cancelled = true;
+            stream->stats.cancelled++;
+            break;
+        case STREAM_GENERATING:
+        case STREAM_GENERATED:
+        case STREAM_UPLOADING:
+            entry->cancelled = true;
+            stream->stats.cancelled++;
+            break;
+        case STREAM_READY:
+        {
+            // Edits since the last save go out one final time
+            if (entry->generation != entry->saved_generation && stream->io)
+                start_save(stream, entry);
+            stream->ready_count--;
+
+            vec3 center;
+            world_chunk_center(entry->coord, center);
+            entry->cancelled = true;
+            scheduler_submit(stream->scheduler, WORK_UNLOAD, unload_task, entry, center);
+            break;
+        }
+    }
+}
+
+/*
+ * Nothing owns the entry now, it goes back in line like a failed dispatch.
+ * Dropped if the queue can't take it, the next request brings it back.
+ * */
+static void requeue_chunk(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    if (reserve_queue(stream) == 0)
+    {
+        entry->state = STREAM_QUEUED;
+        entry->failed = false;
+        shared_chunk_free(&entry->voxels);
+        entry->chunk = NULL;
+        stream->stats.resident_bytes -= sizeof(struct Chunk);
+        stream->queue[stream->queue_count++] = entry;
+    }
+    else
+    {
+        detach_chunk(stream, entry);
+        free_chunk(stream, entry);
+    }
+}
+
+static void drain_completed(struct ChunkStream *stream)
+{
+    pthread_mutex_lock(&stream->done_lock);
+    struct StreamChunk *entry = stream->done_head;
+    stream->done_head = NULL;
+    pthread_mutex_unlock(&stream->done_lock);
+
+    while (entry)
+    {
+        struct StreamChunk *next = entry->done_next;
+        entry->done_next = NULL;
+        stream->in_flight--;
+
+        if (entry->cancelled)
+        {
+            free_chunk(stream, entry);
+        }
+        else if (entry->failed)
+        {
+            requeue_chunk(stream, entry);
+        }
+        else
+        {
+            // Workers wrote the draft, from here on it is read only
+            shared_chunk_publish(&entry->voxels);
+            entry->chunk = shared_chunk_view(&entry->voxels);
+
+            vec3 center;
+            world_chunk_center(entry->coord, center);
+            entry->state = STREAM_GENERATED;
+            scheduler_submit(stream->scheduler, WORK_UPLOAD, upload_task, entry, center);
+        }
+
+        entry = next;
+    }
+}
+
+static int compare_priority(const void *a, const void *b)
+{
+    const struct StreamChunk *x = *(const struct StreamChunk **) a;
+    const struct StreamChunk *y = *(const struct StreamChunk **) b;
+    if (x->priority < y->priority)
+        return -1;
+    if (x->priority > y->priority)
+        return 1;
+    return 0;
+}
+
+static float chunk_priority(struct ChunkStream *stream, struct StreamChunk *entry, struct Camera *camera, vec3 heading)
+{
+    vec3 center, offset;
+    world_chunk_center(entry->coord, center);
+    glm_vec3_sub(center, camera->position, offset);
+
+    float distance = glm_vec3_norm(offset) / CHUNK_WORLD_SIZE;
+    float priority = distance;
+
+    if (!entry->in_frustum)
+        priority *= STREAM_OUTSIDE_FRUSTUM_WEIGHT;
+
+    priority *= prefetch_weight(&stream->prefetch, entry->coord);
+
+    if (distance > 0.0f)
+    {
+        glm_vec3_scale(offset, 1.0f / (distance*CHUNK_WORLD_SIZE), offset);
+        priority *= 1.0f - STREAM_DIRECTION_WEIGHT * glm_vec3_dot(offset, heading);
+    }
+
+    return priority;
+}
+
+static int start_generation(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    entry->state = STREAM_GENERATING;
+    if (stream->worldgen)
+        return worldgen_request(stream->worldgen, entry->coord, worldgen_done, entry);
+    return job_pool_submit(stream->pool, generate_job, entry);
+}
+
+static int start_chunk(struct ChunkStream *stream, struct StreamChunk *entry)
+{
+    if (stream->io == NULL)
+        return start_generation(stream, entry);
+
+    // Unloaded before its save landed, the snapshot is newer than the disk
+    struct StreamSave *save = find_save(stream, entry->coord);
+    if (save)
+    {
+        memcpy(entry->chunk->voxel_type, save->snapshot->chunk.voxel_type, sizeof(entry->chunk->voxel_type));
+        entry->state = STREAM_GENERATING;
+        if (job_pool_submit(stream->pool, bitmask_job, entry))
+            return -1;
+        // Saved again once it is ready, in case this one fails
+        entry->generation = 1;
+        entry->dirty_sequence = save->first_sequence;
+        dirty_link(stream, entry);
+        return 0;
+    }
+
+    entry->state = STREAM_LOADING;
+    entry->io_request = chunk_io_load(stream->io, entry->coord, entry->chunk, load_done, entry);
+    return entry->io_request ? 0 : -1;
+}
+
+static void dispatch_requests(struct ChunkStream *stream, struct Camera *camera)
+{
+    if (stream->queue_count == 0 || stream->in_flight >= (size_t) stream->max_in_flight)
+        return;
+
+    // Favour where we are moving, fall back to where we are looking
+    vec3 heading;
+    if (glm_vec3_norm(stream->prefetch.velocity) > PREFETCH_MIN_SPEED)
+        glm_vec3_normalize_to(stream->prefetch.velocity, heading);
+    else
+        glm_vec3_normalize_to(camera->direction, heading);
+
+    for (size_t i = 0 ; i < stream->queue_count ; i++)
+    {
+        struct StreamChunk *entry = stream->queue[i];
+        entry->priority = chunk_priority(stream, entry, camera, heading);
+    }
+
+    // qsort allocates for anything past a few hundred bytes, the frame arena doesn't
+    struct FrameSortItem *items = FRAME_ALLOC(struct FrameSortItem, stream->queue_count);
+    if (items)
+    {
+        for (size_t i = 0 ; i < stream->queue_count ; i++)
+            items[i] = (struct FrameSortItem){ stream->queue[i]->priority, stream->queue[i] };
+    }
+    if (items && frame_sort(items, stream->queue_count) == 0)
+    {
+        for (size_t i = 0 ; i < stream->queue_count ; i++)
+            stream->queue[i] = (struct StreamChunk *) items[i].value;
+    }
+    else
+    {
+        qsort(stream->queue, stream->queue_count, sizeof(struct StreamChunk *), compare_priority);
+    }
+
+    size_t count = stream->max_in_flight - stream->in_flight;
+    if (count > stream->queue_count)
+        count = stream->queue_count;
+
+    size_t dispatched = 0;
+    for ( ; dispatched < count ; dispatched++)
+    {
+        struct StreamChunk *entry = stream->queue[dispatched];
+
+        // Filled in the draft, published once the chunk is back on this thread
+        if (shared_chunk_init(&entry->voxels))
+        {
+            LOG_ERROR(LOG_STREAM, "Unable to allocate chunk data.");
+            break;
+        }
+        entry->chunk = shared_chunk_view(&entry->voxels);
+        stream->stats.resident_bytes += sizeof(struct Chunk);
+
+        stream->in_flight++;
+        if (start_chunk(stream, entry))
+        {
+            stream->in_flight--;
+            entry->state = STREAM_QUEUED;
+            shared_chunk_free(&entry->voxels);
+            entry->chunk = NULL;
+            stream->stats.resident_bytes -= sizeof(struct Chunk);
+            break;
+        }
+    }
+
+    stream->queue_count -= dispatched;
+    for (size_t i = 0 ; i < stream->queue_count ; i++)
+        stream->queue[i] = stream->queue[i+dispatched];
+}
+
+void stream_update(struct ChunkStream *stream, struct Camera *camera, float frame_delta)
+{
+    PROFILE_ZONE("stream update");
+    prefetch_update(&stream->prefetch, camera->position, frame_delta);
+
+    mat4 view_projection;
+    glm_mat4_mul(camera->projection, camera->view, view_projection);
+    glm_frustum_planes(view_projection, stream->frustum);
+
+    drain_completed(stream);
+
+    struct ChunkCoord center;
+    world_chunk_from_position(camera->position, &center);
+    bool moved = !stream->has_center || !chunk_coord_equal(center, stream->center);
+    stream->center = center;
+    stream->has_center = true;
+
+    int unload_distance2 = stream->unload_radius * stream->unload_radius;
+
+    for (size_t b = 0 ; b < STREAM_HASH_BUCKETS ; b++)
+    {
+        struct StreamChunk *entry = stream->buckets[b];
+        while (entry)
+        {
+            struct StreamChunk *next = entry->hash_next;
+
+            if (moved && chunk_distance2(entry->coord, center) > unload_distance2)
+            {
+                unload_chunk(stream, entry);
+            }
+            else
+            {
+                vec3 box[2];
+                world_chunk_aabb(entry->coord, box);
+                bool in_frustum = glm_aabb_frustum(box, stream->frustum);
+                if (in_frustum && !entry->entered)
+                {
+                    entry->entered = true;
+                    prefetch_record_entry(&stream->prefetch, entry->state == STREAM_READY);
+                }
+                entry->in_frustum = in_frustum;
+            }
+
+            entry = next;
+        }
+    }
+
+    if (moved)
+    {
+        request_radius(stream);
+        // Keep the neighbourhoods of chunks near the border around, they
+        // are what the next requests will need
+        if (stream->worldgen)
+            worldgen_evict(stream->worldgen, center, stream->load_radius + WORLDGEN_FINAL_STAGE);
+    }
+    request_path(stream);
+
+    dispatch_requests(stream, camera);
+
+    remesh_edited(stream);
+    stream->save_timer += frame_delta;
+    if (stream->save_timer >= STREAM_SAVE_INTERVAL)
+    {
+        stream->save_timer = 0.0f;
+        stream_save(stream);
+    }
+
+    // Versions replaced this frame are freed once no reader can still see them
+    epoch_collect();
+
+    PROFILE_COUNTER("chunks queued", stream->queue_count);
+    PROFILE_COUNTER("chunks in flight", stream->in_flight);
+    PROFILE_COUNTER("chunks ready", stream->ready_count);
+}
+
+static void count_first_draw(struct ChunkStream *stream, struct StreamChunk *entry, uint64_t *now)
+{
+    if (entry->visible)
+        return;
+    if (*now == 0)
+        *now = timer_now_us();
+    double latency = (*now - entry->request_us) / 1000.0;
+    stream->stats.latency_samples++;
+    stream->stats.latency_total_ms += latency;
+    if (latency > stream->stats.latency_max_ms)
+        stream->stats.latency_max_ms = latency;
+    entry->visible = true;
+}
+
+size_t stream_collect_draws(struct ChunkStream *stream, struct Camera *camera, struct ChunkDraw *out, size_t capacity)
+{
+    PROFILE_ZONE("stream collect");
+    size_t visible = 0;
+    uint64_t now = 0;
+
+    // Front to back, nearer chunks hide what is behind them before it is shaded
+    struct FrameSortItem *order = FRAME_ALLOC(struct FrameSortItem, stream->ready_count);
+
+    for (size_t b = 0 ; b < STREAM_HASH_BUCKETS ; b++)
+    {
+        for (struct StreamChunk *entry = stream->buckets[b] ; entry ; entry = entry->hash_next)
+        {
+            if (entry->state != STREAM_READY || !entry->in_frustum)
+                continue;
+
+            if (order && visible < stream->ready_count)
+            {
+                vec3 center;
+                world_chunk_center(entry->coord, center);
+                order[visible] = (struct FrameSortItem){ glm_vec3_distance2(center, camera->position), entry };
+            }
+            else if (visible < capacity)
+            {
+                count_first_draw(stream, entry, &now);
+                out[visible] = (struct ChunkDraw){ entry->coord, entry->texture };
+            }
+            visible++;
+        }
+    }
+
+    if (order)
+    {
+        // Every candidate is sorted before truncating, out keeps the nearest
+        size_t sorted = visible < stream->ready_count ? visible : stream->ready_count;
+        // Unsorted is only slower
+        frame_sort(order, sorted);
+        size_t count = sorted < capacity ? sorted : capacity;
+        for (size_t i = 0 ; i < count ; i++)
+        {
+            struct StreamChunk *entry = (struct StreamChunk *) order[i].value;
+            count_first_draw(stream, entry, &now);
+            out[i] = (struct ChunkDraw){ entry->coord, entry->texture };
+        }
+    }
+
+    stream->stats.visible = visible;
+    return visible;
+}
+
+void stream_draw_list(const struct ChunkDraw *draws, size_t count, struct Lattice *lattice, struct Camera *camera)
+{
+    PROFILE_ZONE("stream draw");
+    if (!lattice_ready(lattice))
+        return;
+    for (size_t i = 0 ; i < count ; i++)
+    {
+        world_chunk_transform(draws[i].coord, lattice->object_transform);
+        lattice->texture = draws[i].texture;
+        render_lattice(lattice, camera);
+    }
+}
+
+void stream_get_stats(struct ChunkStream *stream, struct StreamStats *out)
+{
+    *out = stream->stats;
+    out->work = (struct StreamWorkStats){
+        __atomic_load_n(&stream->work.generated, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream->work.generate_ns, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream->work.meshed, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream->work.mesh_ns, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream->work.textures, __ATOMIC_RELAXED),
+        __atomic_load_n(&stream->work.texture_ns, __ATOMIC_RELAXED)
+    };
+    out->queued = stream->queue_count;
+    out->generating = stream->in_flight;
+    out->uploading = 0;
+    out->resident = 0;
+    out->version_bytes = 0;
+    out->worldgen_bytes = 0;
+
+    for (struct StreamSave *save = stream->saves ; save ; save = save->next)
+    {
+        if (save->entry == NULL || save->snapshot != save->entry->voxels.current)
+            out->version_bytes += sizeof(struct ChunkVersion);
+    }
+
+    for (struct StreamChunk *entry = stream->all ; entry ; entry = entry->all_next)
+    {
+        if (entry->voxels.draft)
+            out->version_bytes += sizeof(struct ChunkVersion);
+        if (entry->remesh_version && entry->remesh_version != entry->voxels.current)
+            out->version_bytes += sizeof(struct ChunkVersion);
+        if (entry->cancelled)
+            continue;
+        if (entry->state == STREAM_GENERATED || entry->state == STREAM_UPLOADING)
+            out->uploading++;
+        else if (entry->state == STREAM_READY)
+            out->resident++;
+    }
+
+    if (stream->worldgen)
+    {
+        pthread_mutex_lock(&stream->worldgen->lock);
+        out->worldgen_bytes = stream->worldgen->buffer_count * sizeof(struct Chunk);
+        pthread_mutex_unlock(&stream->worldgen->lock);
+    }
+}
+
+void stream_print_stats(struct ChunkStream *stream)
+{
+    struct StreamStats stats;
+    stream_get_stats(stream, &stats);
+
+    double latency_avg = stats.latency_samples ? stats.latency_total_ms / stats.latency_samples : 0.0;
+    struct StreamWorkStats *work = &stats.work;
+
+    LOG_INFO(LOG_STREAM, "radius %d/%d | queued %zu generating %zu uploading %zu resident %zu visible %zu",
+            stream->load_radius, stream->unload_radius,
+            stats.queued, stats.generating, stats.uploading, stats.resident, stats.visible);
+    size_t memory = stats.resident_bytes + stats.version_bytes + stats.worldgen_bytes;
+    LOG_INFO(LOG_STREAM, "memory %.2f MiB (chunks %.2f versions %.2f worldgen %.2f) | loaded %llu (%llu from disk) unloaded %llu cancelled %llu | latency avg %.2f ms max %.2f ms",
+            memory / (1024.0*1024.0), stats.resident_bytes / (1024.0*1024.0),
+            stats.version_bytes / (1024.0*1024.0), stats.worldgen_bytes / (1024.0*1024.0),
+            (unsigned long long) stats.loaded, (unsigned long long) stats.disk_loads,
+            (unsigned long long) stats.unloaded, (unsigned long long) stats.cancelled,
+            latency_avg, stats.latency_max_ms);
+    LOG_INFO(LOG_STREAM, "prefetch horizon %.1f s path %d | frustum entries %llu misses %llu (%.1f%%) late requests %llu",
+            stream->prefetch.horizon, stream->prefetch.path_count,
+            (unsigned long long) stream->prefetch.frustum_entries, (unsigned long long) stream->prefetch.misses,
+            prefetch_miss_rate(&stream->prefetch) * 100.0f, (unsigned long long) stats.late_requests);
+    LOG_INFO(LOG_STREAM, "saved %llu chunks, %.1f KiB, skipped %llu, failed %llu | last save %.2f ms",
+            (unsigned long long) stats.saves, stats.save_bytes / 1024.0,
+            (unsigned long long) stats.save_skipped, (unsigned long long) stats.save_failures, stats.last_save_ms);
+
+    LOG_INFO(LOG_STREAM, "workers | generate %llu avg %.3f ms | mesh %llu avg %.3f ms | texture %llu avg %.3f ms",
+            (unsigned long long) work->generated, work->generated ? work->generate_ns / 1e6 / work->generated : 0.0,
+            (unsigned long long) work->meshed, work->meshed ? work->mesh_ns / 1e6 / work->meshed : 0.0,
+            (unsigned long long) work->textures, work->textures ? work->texture_ns / 1e6 / work->textures : 0.0);
+
+    struct GpuReclaimStats gpu;
+    gpu_reclaim_get_stats(stream->reclaim, &gpu);
+    struct EpochStats epoch;
+    epoch_get_stats(&epoch);
+    LOG_INFO(LOG_STREAM, "reclaim | %zu textures waiting on the GPU, %llu deleted | %llu retired waiting on readers, epoch %llu",
+            gpu.pending_textures, (unsigned long long) gpu.deleted_textures,
+            (unsigned long long) epoch.pending, (unsigned long long) epoch.epoch);
+}
+
+void stream_shutdown(struct ChunkStream *stream)
+{
+    job_pool_wait(stream->pool);
+    drain_completed(stream);
+
+    while (stream->all)
+    {
+        struct StreamChunk *entry = stream->all;
+        retire_texture(stream, entry);
+        free_chunk(stream, entry);
+    }
+
+    // Only left without a chunk_io_shutdown, their callbacks never run now
+    while (stream->saves)
+    {
+        struct StreamSave *save = stream->saves;
+        stream->saves = save->next;
+        chunk_version_release(save->snapshot);
+        free(save);
+    }
+
+    free(stream->queue);
+    free(stream->buckets);
+    stream->queue = NULL;
+    stream->buckets = NULL;
+    stream->queue_count = 0;
+
+    pthread_mutex_destroy(&stream->done_lock);
+}
+
+static void count_work(uint64_t *count, uint64_t *total_ns, uint64_t ns)
+{
+    __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(total_ns, ns, __ATOMIC_RELAXED);
+}
+
+static void generate_job(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    struct ChunkStream *stream = entry->stream;
+    PROFILE_ZONE("generate chunk");
+
+    uint64_t start = timer_now_ns();
+    stream->generate(entry->chunk, entry->coord, stream->generate_user);
+    uint64_t generated = timer_now_ns();
+    generate_chunk_bitmask(entry->chunk);
+    count_work(&stream->work.generated, &stream->work.generate_ns, generated - start);
+    count_work(&stream->work.meshed, &stream->work.mesh_ns, timer_now_ns() - generated);
+
+    pthread_mutex_lock(&stream->done_lock);
+    entry->done_next = stream->done_head;
+    stream->done_head = entry;
+    pthread_mutex_unlock(&stream->done_lock);
+}
+
+static void worldgen_done(const struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    struct ChunkStream *stream = entry->stream;
+    PROFILE_ZONE("chunk bitmask");
+
+    if (chunk)
+    {
+        memcpy(entry->chunk, chunk, sizeof(struct Chunk));
+        uint64_t start = timer_now_ns();
+        generate_chunk_bitmask(entry->chunk);
+        count_work(&stream->work.meshed, &stream->work.mesh_ns, timer_now_ns() - start);
+    }
+    else
+    {
+        entry->failed = true;
+    }
+
+    pthread_mutex_lock(&stream->done_lock);
+    entry->done_next = stream->done_head;
+    stream->done_head = entry;
+    pthread_mutex_unlock(&stream->done_lock);
+}
+
+/*
+ * Runs on the render thread from chunk_io_poll. Chunks that were never
+ * saved, or didn't survive on disk, are generated after all.
+ * */
+static void load_done(struct ChunkIoRequest *request)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) request->user;
+    struct ChunkStream *stream = entry->stream;
+    entry->io_request = NULL;
+
+    if (entry->cancelled)
+    {
+        stream->in_flight--;
+        free_chunk(stream, entry);
+        return;
+    }
+
+    int failed;
+    if (request->result == REGION_OK)
+    {
+        stream->stats.disk_loads++;
+        entry->state = STREAM_GENERATING;
+        failed = job_pool_submit(stream->pool, bitmask_job, entry);
+    }
+    else
+    {
+        failed = start_generation(stream, entry);
+    }
+
+    if (failed)
+    {
+        stream->in_flight--;
+        requeue_chunk(stream, entry);
+    }
+}
+
+static void bitmask_job(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    struct ChunkStream *stream = entry->stream;
+    PROFILE_ZONE("chunk bitmask");
+
+    uint64_t start = timer_now_ns();
+    generate_chunk_bitmask(entry->chunk);
+    count_work(&stream->work.meshed, &stream->work.mesh_ns, timer_now_ns() - start);
+
+    pthread_mutex_lock(&stream->done_lock);
+    entry->done_next = stream->done_head;
+    stream->done_head = entry;
+    pthread_mutex_unlock(&stream->done_lock);
+}
+
+/*
+ * Runs on the render thread from chunk_io_poll.
+ * */
+static void save_done(struct ChunkIoRequest *request)
+{
+    struct StreamSave *save = (struct StreamSave *) request->user;
+    struct ChunkStream *stream = save->stream;
+    struct StreamChunk *entry = save->entry;
+
+    if (request->result == REGION_OK)
+    {
+        stream->stats.saves++;
+        stream->stats.save_bytes += request->entry.length;
+        if (entry)
+            entry->saved_generation = save->generation;
+    }
+    else
+    {
+        // The edits only live in the journal now, it has to keep them
+        stream->stats.save_failures++;
+        uint64_t *oldest = entry ? &entry->dirty_sequence : &stream->unsaved_sequence;
+        if (save->first_sequence && (*oldest == 0 || save->first_sequence < *oldest))
+            *oldest = save->first_sequence;
+    }
+
+    if (entry)
+    {
+        entry->save = NULL;
+        if (entry->generation == entry->saved_generation && !entry->remesh)
+            dirty_unlink(stream, entry);
+    }
+
+    struct StreamSave **link = &stream->saves;
+    while (*link != save)
+        link = &(*link)->next;
+    *link = save->next;
+
+    chunk_version_release(save->snapshot);
+    free(save);
+}
+
+static void upload_task(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+
+    if (entry->cancelled)
+    {
+        free_chunk(entry->stream, entry);
+        return;
+    }
+
+    entry->state = STREAM_UPLOADING;
+    loader_submit(entry->stream->loader, upload_work, upload_done, entry);
+}
+
+static void upload_work(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    PROFILE_ZONE("chunk texture");
+    uint64_t start = timer_now_ns();
+    build_texture(entry);
+    count_work(&entry->stream->work.textures, &entry->stream->work.texture_ns, timer_now_ns() - start);
+}
+
+static void upload_done(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+
+    if (entry->cancelled)
+    {
+        retire_texture(entry->stream, entry);
+        free_chunk(entry->stream, entry);
+        return;
+    }
+
+    entry->state = STREAM_READY;
+    entry->stream->stats.loaded++;
+    entry->stream->ready_count++;
+}
+
+static void remesh_work(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+    PROFILE_ZONE("chunk texture");
+    uint64_t start = timer_now_ns();
+    entry->remesh_texture = generate_chunk_lattice_texture(&entry->remesh_version->chunk);
+    entry->remesh_texture_bytes = estimate_texture_bytes(GL_TEXTURE_3D, entry->remesh_texture);
+    mem_account(MEM_GL_TEXTURES, entry->remesh_texture_bytes);
+    count_work(&entry->stream->work.textures, &entry->stream->work.texture_ns, timer_now_ns() - start);
+}
+
+static void remesh_done(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+
+    chunk_version_release(entry->remesh_version);
+    entry->remesh_version = NULL;
+    entry->remeshing = false;
+
+    retire_texture(entry->stream, entry);
+    entry->texture = entry->remesh_texture;
+    entry->texture_bytes = entry->remesh_texture_bytes;
+    entry->remesh_texture = 0;
+    entry->remesh_texture_bytes = 0;
+
+    if (entry->unloaded)
+    {
+        retire_texture(entry->stream, entry);
+        free_chunk(entry->stream, entry);
+    }
+}
+
+static void unload_task(void *user)
+{
+    struct StreamChunk *entry = (struct StreamChunk *) user;
+
+    retire_texture(entry->stream, entry);
+    entry->stream->stats.unloaded++;
+    // A remesh is still scheduled or on the loader, it frees the chunk
+    if (entry->remeshing)
+    {
+        entry->unloaded = true;
+        return;
+    }
+    free_chunk(entry->stream, entry);
+}
+
+// VERIFICATION
+
+#define VERIFY_CHUNKS 3
+#define VERIFY_EDITS 24
+// Generous, a few dozen chunks settle in well under a second
+#define VERIFY_SETTLE_SECONDS 20.0
+
+static const struct ChunkCoord verify_coords[VERIFY_CHUNKS] = {
+    { 0, 0, 0 }, { 1, 0, 0 }, { 0, -1, 1 }
+};
+
+/*
+ * Everything a game session needs to stream from disk, without a window.
+ * */
+struct StreamVerifier
+{
+    struct Terrain *terrain;
+    struct JobPool *workers;
+    struct RegionStore store;
+    struct ChunkIo io;
+    struct Journal journal;
+    struct Loader loader;
+    struct GpuReclaim reclaim;
+    struct FrameScheduler scheduler;
+    struct ChunkStream stream;
+    struct Camera camera;
+};
+
+static void verify_generate(struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    terrain_generate_chunk((const struct Terrain *) user, chunk, coord);
+}
+
+static int verify_open(struct StreamVerifier *verifier, const char *directory)
+{
+    if (region_store_init(&verifier->store, directory))
+        return -1;
+    if (chunk_io_init(&verifier->io, &verifier->store, verifier->workers, CHUNK_IO_DEFAULT_THREADS))
+    {
+        region_store_close(&verifier->store);
+        return -1;
+    }
+    if (journal_open(&verifier->journal, &verifier->store, verify_generate, verifier->terrain))
+    {
+        chunk_io_shutdown(&verifier->io);
+        region_store_close(&verifier->store);
+        return -1;
+    }
+
+    loader_init(&verifier->loader, NULL, false);
+    gpu_reclaim_init(&verifier->reclaim);
+    scheduler_init(&verifier->scheduler);
+    stream_init(&verifier->stream, verifier->workers, &verifier->loader, &verifier->reclaim, &verifier->scheduler, verify_generate, verifier->terrain);
+    stream_use_io(&verifier->stream, &verifier->io);
+    stream_use_journal(&verifier->stream, &verifier->journal);
+    // Only what is around the origin, every edited chunk stays loaded
+    verifier->stream.load_radius = 2;
+    verifier->stream.unload_radius = 3;
+
+    verifier->camera = (struct Camera){
+        .fov = 70.0f,
+        .direction = { 0.0f, 0.0f, -1.0f },
+        .up = { 0.0f, 1.0f, 0.0f },
+        .width = 900,
+        .height = 900
+    };
+    // In the middle of the origin chunk
+    vec3 box[2];
+    world_chunk_aabb((struct ChunkCoord){0}, box);
+    glm_vec3_center(box[0], box[1], verifier->camera.position);
+    glm_mat4_identity(verifier->camera.view);
+    glm_perspective(verifier->camera.fov, 1.0f, 0.001f, 1000.0f, verifier->camera.projection);
+    return 0;
+}
+
+static void verify_close(struct StreamVerifier *verifier)
+{
+    loader_shutdown(&verifier->loader);
+    chunk_io_shutdown(&verifier->io);
+    journal_close(&verifier->journal);
+    stream_shutdown(&verifier->stream);
+    epoch_barrier();
+    gpu_reclaim_shutdown(&verifier->reclaim);
+    scheduler_free(&verifier->scheduler);
+    region_store_close(&verifier->store);
+}
+
+static bool verify_settled(struct ChunkStream *stream)
+{
+    if (stream->queue_count || stream->in_flight || stream->saves)
+        return false;
+    for (struct StreamChunk *entry = stream->all ; entry ; entry = entry->all_next)
+    {
+        if (entry->state != STREAM_READY || entry->remesh || entry->remeshing)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Runs frames until every chunk in the radius is ready and every save and
+ * remesh finished.
+ * */
+static int verify_settle(struct StreamVerifier *verifier, const char *step)
+{
+    struct ChunkStream *stream = &verifier->stream;
+    uint64_t start = timer_now_ns();
+    do
+    {
+        frame_arena_begin();
+        loader_poll(&verifier->loader);
+        chunk_io_poll(&verifier->io);
+        scheduler_run_frame(&verifier->scheduler, verifier->camera.position);
+        stream_update(stream, &verifier->camera, 1.0f / 60.0f);
+        gpu_reclaim_frame(&verifier->reclaim);
+        // Saves only start when the check asks for them
+        stream->save_timer = 0.0f;
+
+        if (stream->has_center && verify_settled(stream))
+            return 0;
+        usleep(1000);
+    }
+    while ((timer_now_ns() - start) / 1e9 < VERIFY_SETTLE_SECONDS);
+
+    LOG_WARN(LOG_STREAM, "%s: chunks didn't settle in %.0f seconds.", step, VERIFY_SETTLE_SECONDS);
+    return 1;
+}
+
+/*
+ * Writes VERIFY_EDITS voxels of a ready chunk through the stream and keeps
+ * the result in expected.
+ * */
+static int verify_edit(struct ChunkStream *stream, struct ChunkCoord coord, int seed, struct Chunk *expected)
+{
+    struct ChunkVersion *version = stream_acquire_chunk(stream, coord);
+    if (version == NULL)
+    {
+        LOG_WARN(LOG_STREAM, "Chunk %d %d %d isn't loaded.", coord.x, coord.y, coord.z);
+        return 1;
+    }
+    memcpy(expected->voxel_type, version->chunk.voxel_type, CHUNK_DATA_SIZE);
+    chunk_version_release(version);
+
+    for (int e = 0 ; e < VERIFY_EDITS ; e++)
+    {
+        int index = (int) (((uint32_t) e*2654435761u + (uint32_t) seed*40503u) % CHUNK_DATA_SIZE);
+        uint8_t type = expected->voxel_type[index] == 1 ? 2 : 1;
+        if (stream_set_voxel(stream, coord, index, type))
+        {
+            LOG_WARN(LOG_STREAM, "Unable to edit chunk %d %d %d.", coord.x, coord.y, coord.z);
+            return 1;
+        }
+        expected->voxel_type[index] = type;
+    }
+    return 0;
+}
+
+/*
+ * Every chunk loaded has to be in the store exactly if it was saved, with
+ * the voxels in expected.
+ * */
+static int verify_store(struct StreamVerifier *verifier, const struct Chunk *expected, struct Chunk *loaded, const char *step)
+{
+    int failures = 0;
+    for (struct StreamChunk *entry = verifier->stream.all ; entry ; entry = entry->all_next)
+    {
+        int c = 0;
+        while (c < VERIFY_CHUNKS && !chunk_coord_equal(entry->coord, verify_coords[c]))
+            c++;
+
+        enum RegionResult result = region_store_load(&verifier->store, entry->coord, loaded);
+        if (c == VERIFY_CHUNKS && result != REGION_MISSING)
+        {
+            LOG_WARN(LOG_STREAM, "%s: clean chunk %d %d %d was written.", step, entry->coord.x, entry->coord.y, entry->coord.z);
+            failures++;
+        }
+        else if (c < VERIFY_CHUNKS && (result != REGION_OK || memcmp(loaded->voxel_type, expected[c].voxel_type, CHUNK_DATA_SIZE)))
+        {
+            LOG_WARN(LOG_STREAM, "%s: edited chunk %d %d %d doesn't match.", step, entry->coord.x, entry->coord.y, entry->coord.z);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+/*
+ * Saving only what was edited since the last save, one session at a time:
+ * the second save of a session finds nothing, and the next session loads
+ * the edits from disk and rewrites the one chunk edited again.
+ * */
+static int verify_sessions(struct StreamVerifier *verifier, const char *directory, struct Chunk *expected, struct Chunk *loaded)
+{
+    struct ChunkStream *stream = &verifier->stream;
+    int failures = 0;
+
+    if (verify_open(verifier, directory))
+        return 1;
+    failures += verify_settle(verifier, "first load");
+    for (int c = 0 ; c < VERIFY_CHUNKS && failures == 0 ; c++)
+        failures += verify_edit(stream, verify_coords[c], c, &expected[c]);
+
+    if (failures == 0)
+    {
+        if (stream->last_sequence == 0)
+        {
+            LOG_WARN(LOG_STREAM, "The edits weren't journaled.");
+            failures++;
+        }
+        size_t started = stream_save(stream);
+        failures += verify_settle(verifier, "first save");
+        // Frames are only dropped once they are durable
+        journal_wait(&verifier->journal, stream->last_sequence);
+        size_t again = stream_save(stream);
+        if (started != VERIFY_CHUNKS || again != 0 || stream->stats.saves != VERIFY_CHUNKS || stream->stats.save_failures)
+        {
+            LOG_WARN(LOG_STREAM, "Saves started %zu then %zu, %llu done and %llu failed, expected %d then none.",
+                    started, again, (unsigned long long) stream->stats.saves, (unsigned long long) stream->stats.save_failures, VERIFY_CHUNKS);
+            failures++;
+        }
+        // The saved chunks hold every edit, their frames go
+        if (stream->truncated_sequence != stream->last_sequence)
+        {
+            LOG_WARN(LOG_STREAM, "Journal kept frames after %llu of %llu.",
+                    (unsigned long long) stream->truncated_sequence, (unsigned long long) stream->last_sequence);
+            failures++;
+        }
+        failures += verify_store(verifier, expected, loaded, "first save");
+    }
+    verify_close(verifier);
+    if (failures)
+        return failures;
+
+    if (verify_open(verifier, directory))
+        return 1;
+    failures += verify_settle(verifier, "reload");
+    if (failures == 0 && stream->stats.disk_loads != VERIFY_CHUNKS)
+    {
+        LOG_WARN(LOG_STREAM, "Reload found %llu chunks on disk, expected %d.", (unsigned long long) stream->stats.disk_loads, VERIFY_CHUNKS);
+        failures++;
+    }
+    for (int c = 0 ; c < VERIFY_CHUNKS && failures == 0 ; c++)
+    {
+        struct ChunkVersion *version = stream_acquire_chunk(stream, verify_coords[c]);
+        if (version == NULL || memcmp(version->chunk.voxel_type, expected[c].voxel_type, CHUNK_DATA_SIZE))
+        {
+            LOG_WARN(LOG_STREAM, "Reloaded chunk %d doesn't match its save.", c);
+            failures++;
+        }
+        if (version)
+            chunk_version_release(version);
+    }
+
+    if (failures == 0)
+    {
+        failures += verify_edit(stream, verify_coords[1], VERIFY_CHUNKS, &expected[1]);
+        size_t started = stream_save(stream);
+        failures += verify_settle(verifier, "second save");
+        struct ChunkIoStats io;
+        chunk_io_get_stats(&verifier->io, &io);
+        if (started != 1 || stream->stats.saves != 1 || io.saves != 1)
+        {
+            LOG_WARN(LOG_STREAM, "Second session wrote %llu chunks, expected only the edited one.", (unsigned long long) io.saves);
+            failures++;
+        }
+        failures += verify_store(verifier, expected, loaded, "second save");
+    }
+    verify_close(verifier);
+    return failures;
+}
+
+static void verify_remove(const char *directory)
+{
+    struct RegionStore store;
+    if (region_store_init(&store, directory) == 0)
+    {
+        for (int c = 0 ; c < VERIFY_CHUNKS ; c++)
+        {
+            struct ChunkCoord region_coord;
+            int index;
+            region_from_chunk(verify_coords[c], &region_coord, &index);
+            region_store_delete(&store, region_coord);
+        }
+        region_store_close(&store);
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", directory, JOURNAL_FILE);
+    unlink(path);
+}
+
+int stream_verify(const char *directory)
+{
+    if (null_gl_load())
+        return 1;
+
+    struct Terrain terrain;
+    terrain_init(&terrain, WORLD_DEFAULT_SEED);
+    struct JobPool workers;
+    struct StreamVerifier *verifier = (struct StreamVerifier *) malloc(sizeof(struct StreamVerifier));
+    struct Chunk *expected = (struct Chunk *) malloc(VERIFY_CHUNKS*sizeof(struct Chunk));
+    struct Chunk *loaded = (struct Chunk *) malloc(sizeof(struct Chunk));
+    if (verifier == NULL || expected == NULL || loaded == NULL || job_pool_init(&workers, 0))
+    {
+        LOG_ERROR(LOG_STREAM, "Unable to set up the verification.");
+        free(verifier);
+        free(expected);
+        free(loaded);
+        return 1;
+    }
+    *verifier = (struct StreamVerifier){ .terrain = &terrain, .workers = &workers };
+
+    // Whatever an earlier run left behind would be loaded instead of generated
+    verify_remove(directory);
+    int failures = verify_sessions(verifier, directory, expected, loaded);
+    verify_remove(directory);
+    rmdir(directory);
+
+    job_pool_shutdown(&workers);
+    free(verifier);
+    free(expected);
+    free(loaded);
+    return failures;
+}
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <terrain.h>
+#include <timer.h>
+#include <log.h>
+
+/*
+ * The vector kernels are only bit exact with the scalar reference as long as
+ * the compiler doesn't contract multiplies and adds into FMAs, terrain.o is
+ * built with -ffp-contract=off.
+ * */
+
+#define HASH_X 0x8da6b343u
+#define HASH_Y 0xd8163841u
+#define HASH_Z 0xcb1ab31fu
+#define HASH_M1 0x2c1b3c6du
+#define HASH_M2 0x297a2d39u
+#define CAVE_SEED 0x9e3779b9u
+
+static const char *level_names[TERRAIN_LEVEL_COUNT] = {
+    "scalar",
+    "sse4.1",
+    "avx2"
+};
+
+// SCALAR REFERENCE
+
+static inline float fade(float t)
+{
+    return t*t*t*(t*(t*6.0f-15.0f)+10.0f);
+}
+
+static inline float lerp(float a, float b, float t)
+{
+    return a + t*(b-a);
+}
+
+static inline uint32_t hash(int32_t x, int32_t y, int32_t z, uint32_t seed)
+{
+    uint32_t h = seed;
+    h ^= (uint32_t) x * HASH_X;
+    h ^= (uint32_t) y * HASH_Y;
+    h ^= (uint32_t) z * HASH_Z;
+    h ^= h >> 15;
+    h *= HASH_M1;
+    h ^= h >> 12;
+    h *= HASH_M2;
+    h ^= h >> 15;
+    return h;
+}
+
+/*
+ * 8 gradients, (+-1, +-0.5) and (+-0.5, +-1)
+ * */
+static inline float grad2(uint32_t h, float x, float y)
+{
+    float u = (h & 4) ? y : x;
+    float v = (h & 4) ? x : y;
+    u = (h & 1) ? -u : u;
+    v = (h & 2) ? -v : v;
+    return u + v*0.5f;
+}
+
+/*
+ * The 12 cube edge gradients of improved Perlin noise
+ * */
+static inline float grad3(uint32_t h, float x, float y, float z)
+{
+    h &= 15;
+    float u = h < 8 ? x : y;
+    float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+    u = (h & 1) ? -u : u;
+    v = (h & 2) ? -v : v;
+    return u + v;
+}
+
+static inline void split(float x, int32_t *cell, float *fraction)
+{
+    int32_t i = (int32_t) x;
+    if ((float) i > x)
+        i--;
+    *cell = i;
+    *fraction = x - (float) i;
+}
+
+static float noise2(float x, float y, uint32_t seed)
+{
+    int32_t ix, iy;
+    float fx, fy;
+    split(x, &ix, &fx);
+    split(y, &iy, &fy);
+
+    float n00 = grad2(hash(ix, iy, 0, seed), fx, fy);
+    float n10 = grad2(hash(ix+1, iy, 0, seed), fx-1.0f, fy);
+    float n01 = grad2(hash(ix, iy+1, 0, seed), fx, fy-1.0f);
+    float n11 = grad2(hash(ix+1, iy+1, 0, seed), fx-1.0f, fy-1.0f);
+
+    float u = fade(fx);
+    float v = fade(fy);
+
+    return lerp(lerp(n00, n10, u), lerp(n01, n11, u), v);
+}
+
+static float noise3(float x, float y, float z, uint32_t seed)
+{
+    int32_t ix, iy, iz;
+    float fx, fy, fz;
+    split(x, &ix, &fx);
+    split(y, &iy, &fy);
+    split(z, &iz, &fz);
+
+    float n000 = grad3(hash(ix, iy, iz, seed), fx, fy, fz);
+    float n100 = grad3(hash(ix+1, iy, iz, seed), fx-1.0f, fy, fz);
+    float n010 = grad3(hash(ix, iy+1, iz, seed), fx, fy-1.0f, fz);
+    float n110 = grad3(hash(ix+1, iy+1, iz, seed), fx-1.0f, fy-1.0f, fz);
+    float n001 = grad3(hash(ix, iy, iz+1, seed), fx, fy, fz-1.0f);
+    float n101 = grad3(hash(ix+1, iy, iz+1, seed), fx-1.0f, fy, fz-1.0f);
+    float n011 = grad3(hash(ix, iy+1, iz+1, seed), fx, fy-1.0f, fz-1.0f);
+    float n111 = grad3(hash(ix+1, iy+1, iz+1, seed), fx-1.0f, fy-1.0f, fz-1.0f);
+
+    float u = fade(fx);
+    float v = fade(fy);
+    float w = fade(fz);
+
+    float y0 = lerp(lerp(n000, n100, u), lerp(n010, n110, u), v);
+    float y1 = lerp(lerp(n001, n101, u), lerp(n011, n111, u), v);
+    return lerp(y0, y1, w);
+}
+
+static void height_row_scalar(const struct Terrain *terrain, int32_t x0, int32_t z, float *out)
+{
+    for (int i = 0 ; i < CHUNK_WIDTH ; i++)
+    {
+        float wx = (float) (x0 + i);
+        float wz = (float) z;
+        float sum = 0.0f;
+
+        for (int o = 0 ; o < terrain->octaves ; o++)
+        {
+            float frequency = terrain->octave_frequency[o];
+            float n = noise2(wx*frequency, wz*frequency, terrain->seed + o);
+            sum = sum + n*terrain->octave_amplitude[o];
+        }
+
+        out[i] = terrain->base_height + sum*terrain->height_scale;
+    }
+}
+
+static void cave_row_scalar(const struct Terrain *terrain, int32_t x0, int32_t y, int32_t z, float *out)
+{
+    float frequency = terrain->cave_frequency;
+    float wy = (float) y * frequency;
+    float wz = (float) z * frequency;
+
+    for (int i = 0 ; i < CHUNK_WIDTH ; i++)
+    {
+        float wx = (float) (x0 + i) * frequency;
+        out[i] = noise3(wx, wy, wz, terrain->seed ^ CAVE_SEED);
+    }
+}
+
+// VECTOR KERNELS
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TERRAIN_X86
+#include <immintrin.h>
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+
+#define K(name) name##_sse41
+#define LANES 4
+#define vf __m128
+#define vi __m128i
+#define V_SET1 _mm_set1_ps
+#define V_ADD _mm_add_ps
+#define V_SUB _mm_sub_ps
+#define V_MUL _mm_mul_ps
+#define V_GT(a, b) _mm_cmpgt_ps(a, b)
+#define V_BLEND _mm_blendv_ps
+#define V_CVT _mm_cvtepi32_ps
+#define V_TRUNC _mm_cvttps_epi32
+#define V_STORE _mm_storeu_ps
+#define V_CAST_F _mm_castsi128_ps
+#define V_CAST_I _mm_castps_si128
+#define VI_SET1 _mm_set1_epi32
+#define VI_ADD _mm_add_epi32
+#define VI_MUL _mm_mullo_epi32
+#define VI_AND _mm_and_si128
+#define VI_OR _mm_or_si128
+#define VI_XOR _mm_xor_si128
+#define VI_SRL _mm_srli_epi32
+#define VI_SLL _mm_slli_epi32
+#define VI_EQ _mm_cmpeq_epi32
+#define VI_GT _mm_cmpgt_epi32
+#define LANE_OFFSETS _mm_setr_epi32(0, 1, 2, 3)
+
+#include "terrain_kernel.h"
+
+#undef K
+#undef LANES
+#undef vf
+#undef vi
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_GT
+#undef V_BLEND
+#undef V_CVT
+#undef V_TRUNC
+#undef V_STORE
+#undef V_CAST_F
+#undef V_CAST_I
+#undef VI_SET1
+#undef VI_ADD
+#undef VI_MUL
+#undef VI_AND
+#undef VI_OR
+#undef VI_XOR
+#undef VI_SRL
+#undef VI_SLL
+#undef VI_EQ
+#undef VI_GT
+#undef LANE_OFFSETS
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#define K(name) name##_avx2
+#define LANES 8
+#define vf __m256
+#define vi __m256i
+#define V_SET1 _mm256_set1_ps
+#define V_ADD _mm256_add_ps
+#define V_SUB _mm256_sub_ps
+#define V_MUL _mm256_mul_ps
+#define V_GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define V_BLEND _mm256_blendv_ps
+#define V_CVT _mm256_cvtepi32_ps
+#define V_TRUNC _mm256_cvttps_epi32
+#define V_STORE _mm256_storeu_ps
+#define V_CAST_F _mm256_castsi256_ps
+#define V_CAST_I _mm256_castps_si256
+#define VI_SET1 _mm256_set1_epi32
+#define VI_ADD _mm256_add_epi32
+#define VI_MUL _mm256_mullo_epi32
+#define VI_AND _mm256_and_si256
+#define VI_OR _mm256_or_si256
+#define VI_XOR _mm256_xor_si256
+#define VI_SRL _mm256_srli_epi32
+#define VI_SLL _mm256_slli_epi32
+#define VI_EQ _mm256_cmpeq_epi32
+#define VI_GT _mm256_cmpgt_epi32
+#define LANE_OFFSETS _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+
+#include "terrain_kernel.h"
+
+#pragma GCC pop_options
+#endif
+
+bool terrain_level_supported(enum TerrainLevel level)
+{
+    switch (level)
+    {
+        case TERRAIN_SCALAR:
+            return true;
+#ifdef TERRAIN_X86
+        case TERRAIN_SSE41:
+            return __builtin_cpu_supports("sse4.1");
+        case TERRAIN_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *terrain_level_name(enum TerrainLevel level)
+{
+    return level_names[level];
+}
+
+void terrain_init(struct Terrain *terrain, uint32_t seed)
+{
+    *terrain = (struct Terrain){
+        .seed = seed,
+        .octaves = 5,
+        .frequency = 1.0f / 128.0f,
+        .lacunarity = 2.0f,
+        .persistence = 0.5f,
+        .base_height = 0.0f,
+        .height_scale = 48.0f,
+        .dirt_depth = 3,
+        .cave_frequency = 1.0f / 24.0f,
+        .cave_threshold = 0.3f
+    };
+
+    float frequency = terrain->frequency;
+    float amplitude = 1.0f;
+    for (int o = 0 ; o < TERRAIN_MAX_OCTAVES ; o++)
+    {
+        terrain->octave_frequency[o] = frequency;
+        terrain->octave_amplitude[o] = amplitude;
+        frequency *= terrain->lacunarity;
+        amplitude *= terrain->persistence;
+    }
+
+    terrain->level = TERRAIN_SCALAR;
+    for (int level = TERRAIN_LEVEL_COUNT-1 ; level > TERRAIN_SCALAR ; level--)
+    {
+        if (terrain_level_supported(level))
+        {
+            terrain->level = level;
+            break;
+        }
+    }
+}
+
+static void height_row(const struct Terrain *terrain, enum TerrainLevel level, int32_t x0, int32_t z, float *out)
+{
+    switch (level)
+    {
+#ifdef TERRAIN_X86
+        case TERRAIN_AVX2:
+            height_row_avx2(terrain, x0, z, out);
+            return;
+        case TERRAIN_SSE41:
+            height_row_sse41(terrain, x0, z, out);
+            return;
+#endif
+        default:
+            height_row_scalar(terrain, x0, z, out);
+            return;
+    }
+}
+
+static void cave_row(const struct Terrain *terrain, enum TerrainLevel level, int32_t x0, int32_t y, int32_t z, float *out)
+{
+    switch (level)
+    {
+#ifdef TERRAIN_X86
+        case TERRAIN_AVX2:
+            cave_row_avx2(terrain, x0, y, z, out);
+            return;
+        case TERRAIN_SSE41:
+            cave_row_sse41(terrain, x0, y, z, out);
+            return;
+#endif
+        default:
+            cave_row_scalar(terrain, x0, y, z, out);
+            return;
+    }
+}
+
+void terrain_heightmap(const struct Terrain *terrain, enum TerrainLevel level, int32_t chunk_x, int32_t chunk_z, float *out)
+{
+    // Chunk Z grows towards negative world Z, flip it so the noise is continuous
+    for (int z = 0 ; z < CHUNK_WIDTH ; z++)
+        height_row(terrain, level, chunk_x*CHUNK_WIDTH, -(chunk_z*CHUNK_WIDTH + z), out + z*CHUNK_WIDTH);
+}
+
+void terrain_column(const struct Terrain *terrain, enum TerrainLevel level, int32_t chunk_x, int32_t chunk_z, struct TerrainColumn *out)
+{
+    terrain_heightmap(terrain, level, chunk_x, chunk_z, out->heights);
+
+    out->highest = INT32_MIN;
+    out->lowest = INT32_MAX;
+    for (int i = 0 ; i < CHUNK_WIDTH*CHUNK_WIDTH ; i++)
+    {
+        int32_t h = (int32_t) out->heights[i];
+        if ((float) h > out->heights[i])
+            h--;
+        out->surface[i] = h;
+        if (h > out->highest)
+            out->highest = h;
+        if (h < out->lowest)
+            out->lowest = h;
+    }
+}
+
+void terrain_fill_density_column(const struct Terrain *terrain, const struct TerrainColumn *column, struct Chunk *chunk, struct ChunkCoord coord)
+{
+    int32_t y0 = coord.y*CHUNK_WIDTH;
+
+    if (y0 > column->highest)
+    {
+        memset(chunk->voxel_type, VOXEL_AIR, sizeof(chunk->voxel_type));
+        return;
+    }
+
+    for (int z = 0 ; z < CHUNK_WIDTH ; z++)
+    {
+        const int32_t *row_surface = column->surface + z*CHUNK_WIDTH;
+
+        for (int y = 0 ; y < CHUNK_WIDTH ; y++)
+        {
+            int32_t wy = y0 + y;
+
+            for (int x = 0 ; x < CHUNK_WIDTH ; x++)
+            {
+                int32_t h = row_surface[x];
+                uint8_t type;
+
+                if (wy > h)
+                    type = VOXEL_AIR;
+                else if (wy == h)
+                    type = VOXEL_GRASS;
+                else if (wy > h - terrain->dirt_depth)
+                    type = VOXEL_DIRT;
+                else
+                    type = VOXEL_STONE;
+
+                chunk->voxel_type[CHUNK_INDEX(x, y, z)] = type;
+            }
+        }
+    }
+}
+
+void terrain_fill_density(const struct Terrain *terrain, enum TerrainLevel level, struct Chunk *chunk, struct ChunkCoord coord)
+{
+    struct TerrainColumn column;
+    terrain_column(terrain, level, coord.x, coord.z, &column);
+    terrain_fill_density_column(terrain, &column, chunk, coord);
+}
+
+void terrain_carve_caves(const struct Terrain *terrain, enum TerrainLevel level, struct Chunk *chunk, struct ChunkCoord coord)
+{
+    float caves[CHUNK_WIDTH];
+    int32_t x0 = coord.x*CHUNK_WIDTH;
+
+    for (int z = 0 ; z < CHUNK_WIDTH ; z++)
+    {
+        int32_t wz = -(coord.z*CHUNK_WIDTH + z);
+
+        for (int y = 0 ; y < CHUNK_WIDTH ; y++)
+        {
+            // Only stone and dirt get carved, skip the noise for rows without any
+            bool carve = false;
+            for (int x = 0 ; x < CHUNK_WIDTH && !carve ; x++)
+            {
+                uint8_t type = chunk->voxel_type[CHUNK_INDEX(x, y, z)];
+                carve = type == VOXEL_STONE || type == VOXEL_DIRT;
+            }
+            if (!carve)
+                continue;
+
+            cave_row(terrain, level, x0, coord.y*CHUNK_WIDTH + y, wz, caves);
+
+            for (int x = 0 ; x < CHUNK_WIDTH ; x++)
+            {
+                int index = CHUNK_INDEX(x, y, z);
+                uint8_t type = chunk->voxel_type[index];
+                if ((type == VOXEL_STONE || type == VOXEL_DIRT) && caves[x] > terrain->cave_threshold)
+                    chunk->voxel_type[index] = VOXEL_AIR;
+            }
+        }
+    }
+}
+
+void terrain_generate_chunk_level(const struct Terrain *terrain, enum TerrainLevel level, struct Chunk *chunk, struct ChunkCoord coord)
+{
+    terrain_fill_density(terrain, level, chunk, coord);
+    terrain_carve_caves(terrain, level, chunk, coord);
+}
+
+void terrain_generate_chunk(const struct Terrain *terrain, struct Chunk *chunk, struct ChunkCoord coord)
+{
+    terrain_generate_chunk_level(terrain, terrain->level, chunk, coord);
+}
+
+int terrain_verify(const struct Terrain *terrain, int count)
+{
+    int mismatches = 0;
+    float reference[CHUNK_WIDTH*CHUNK_WIDTH], result[CHUNK_WIDTH*CHUNK_WIDTH];
+    float reference_row[CHUNK_WIDTH], result_row[CHUNK_WIDTH];
+
+    struct Chunk *reference_chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    struct Chunk *result_chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    if (reference_chunk == NULL || result_chunk == NULL)
+    {
+        LOG_ERROR(LOG_TERRAIN, "Unable to allocate verification chunks.");
+        free(reference_chunk);
+        free(result_chunk);
+        return -1;
+    }
+
+    for (int level = TERRAIN_SCALAR+1 ; level < TERRAIN_LEVEL_COUNT ; level++)
+    {
+        if (!terrain_level_supported(level))
+            continue;
+
+        for (int i = 0 ; i < count ; i++)
+        {
+            // Walk across the origin so negative coordinates get covered too
+            struct ChunkCoord coord = {
+                i*7 - count*3,
+                (i % 5) - 3,
+                count*2 - i*5
+            };
+
+            terrain_heightmap(terrain, TERRAIN_SCALAR, coord.x, coord.z, reference);
+            terrain_heightmap(terrain, level, coord.x, coord.z, result);
+            if (memcmp(reference, result, sizeof(reference)))
+            {
+                LOG_WARN(LOG_TERRAIN, "%s heightmap differs at chunk %d %d", level_names[level], coord.x, coord.z);
+                mismatches++;
+            }
+
+            cave_row(terrain, TERRAIN_SCALAR, coord.x*CHUNK_WIDTH, coord.y*CHUNK_WIDTH + i, -coord.z*CHUNK_WIDTH, reference_row);
+            cave_row(terrain, level, coord.x*CHUNK_WIDTH, coord.y*CHUNK_WIDTH + i, -coord.z*CHUNK_WIDTH, result_row);
+            if (memcmp(reference_row, result_row, sizeof(reference_row)))
+            {
+                LOG_WARN(LOG_TERRAIN, "%s cave noise differs at chunk %d %d %d", level_names[level], coord.x, coord.y, coord.z);
+                mismatches++;
+            }
+
+            terrain_generate_chunk_level(terrain, TERRAIN_SCALAR, reference_chunk, coord);
+            terrain_generate_chunk_level(terrain, level, result_chunk, coord);
+            if (memcmp(reference_chunk->voxel_type, result_chunk->voxel_type, sizeof(reference_chunk->voxel_type)))
+            {
+                LOG_WARN(LOG_TERRAIN, "%s voxels differ at chunk %d %d %d", level_names[level], coord.x, coord.y, coord.z);
+                mismatches++;
+            }
+        }
+    }
+
+    free(reference_chunk);
+    free(result_chunk);
+    return mismatches;
+}
+
+double terrain_benchmark(const struct Terrain *terrain, enum TerrainLevel level, int count)
+{
+    struct Chunk *chunk = (struct Chunk *) malloc(sizeof(struct Chunk));
+    if (chunk == NULL)
+        return 0.0;
+
+    uint64_t start = timer_now_ns();
+    for (int i = 0 ; i < count ; i++)
+    {
+        // Stay underground so every row runs the cave noise, the worst case
+        struct ChunkCoord coord = { i % 16, -4, i / 16 };
+        terrain_generate_chunk_level(terrain, level, chunk, coord);
+    }
+    uint64_t elapsed = timer_now_ns() - start;
+    free(chunk);
+
+    if (elapsed == 0)
+        return 0.0;
+    return (double) count * CHUNK_DATA_SIZE / (elapsed * 1e-9);
+}
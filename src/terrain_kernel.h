@@ -0,0 +1,174 @@
+/*
+ * Vectorized noise kernels, included once per instruction set by terrain.c
+ * with the vector type and operations defined as macros.
+ *
+ * Every operation here mirrors the scalar reference in terrain.c in the
+ * same order, so the results are bit exact. Don't reassociate anything.
+ * */
+
+static inline vf K(fade)(vf t)
+{
+    vf t3 = V_MUL(V_MUL(t, t), t);
+    vf a = V_SUB(V_MUL(t, V_SET1(6.0f)), V_SET1(15.0f));
+    a = V_ADD(V_MUL(t, a), V_SET1(10.0f));
+    return V_MUL(t3, a);
+}
+
+static inline vf K(lerp)(vf a, vf b, vf t)
+{
+    return V_ADD(a, V_MUL(t, V_SUB(b, a)));
+}
+
+static inline vi K(hash)(vi x, vi y, vi z, uint32_t seed)
+{
+    vi h = VI_SET1((int32_t) seed);
+    h = VI_XOR(h, VI_MUL(x, VI_SET1((int32_t) HASH_X)));
+    h = VI_XOR(h, VI_MUL(y, VI_SET1((int32_t) HASH_Y)));
+    h = VI_XOR(h, VI_MUL(z, VI_SET1((int32_t) HASH_Z)));
+    h = VI_XOR(h, VI_SRL(h, 15));
+    h = VI_MUL(h, VI_SET1((int32_t) HASH_M1));
+    h = VI_XOR(h, VI_SRL(h, 12));
+    h = VI_MUL(h, VI_SET1((int32_t) HASH_M2));
+    h = VI_XOR(h, VI_SRL(h, 15));
+    return h;
+}
+
+static inline vf K(flip)(vf value, vi h, int bit, int shift)
+{
+    vi sign = VI_SLL(VI_AND(h, VI_SET1(bit)), shift);
+    return V_CAST_F(VI_XOR(V_CAST_I(value), sign));
+}
+
+static inline vf K(grad2)(vi h, vf x, vf y)
+{
+    vf swap = V_CAST_F(VI_EQ(VI_AND(h, VI_SET1(4)), VI_SET1(4)));
+    vf u = V_BLEND(x, y, swap);
+    vf v = V_BLEND(y, x, swap);
+    u = K(flip)(u, h, 1, 31);
+    v = K(flip)(v, h, 2, 30);
+    return V_ADD(u, V_MUL(v, V_SET1(0.5f)));
+}
+
+static inline vf K(grad3)(vi h, vf x, vf y, vf z)
+{
+    h = VI_AND(h, VI_SET1(15));
+    vf below8 = V_CAST_F(VI_GT(VI_SET1(8), h));
+    vf below4 = V_CAST_F(VI_GT(VI_SET1(4), h));
+    vf x_axis = V_CAST_F(VI_OR(VI_EQ(h, VI_SET1(12)), VI_EQ(h, VI_SET1(14))));
+
+    vf u = V_BLEND(y, x, below8);
+    vf v = V_BLEND(z, x, x_axis);
+    v = V_BLEND(v, y, below4);
+
+    u = K(flip)(u, h, 1, 31);
+    v = K(flip)(v, h, 2, 30);
+    return V_ADD(u, v);
+}
+
+static inline void K(split)(vf x, vi *cell, vf *fraction)
+{
+    vi i = V_TRUNC(x);
+    vi below = V_CAST_I(V_GT(V_CVT(i), x));
+    // the comparison mask is -1 where truncation rounded up
+    i = VI_ADD(i, below);
+    *cell = i;
+    *fraction = V_SUB(x, V_CVT(i));
+}
+
+static inline vf K(noise2)(vf x, vf y, uint32_t seed)
+{
+    vi ix, iy;
+    vf fx, fy;
+    K(split)(x, &ix, &fx);
+    K(split)(y, &iy, &fy);
+
+    vi one = VI_SET1(1);
+    vi zero = VI_SET1(0);
+    vi ix1 = VI_ADD(ix, one);
+    vi iy1 = VI_ADD(iy, one);
+    vf fx1 = V_SUB(fx, V_SET1(1.0f));
+    vf fy1 = V_SUB(fy, V_SET1(1.0f));
+
+    vf n00 = K(grad2)(K(hash)(ix, iy, zero, seed), fx, fy);
+    vf n10 = K(grad2)(K(hash)(ix1, iy, zero, seed), fx1, fy);
+    vf n01 = K(grad2)(K(hash)(ix, iy1, zero, seed), fx, fy1);
+    vf n11 = K(grad2)(K(hash)(ix1, iy1, zero, seed), fx1, fy1);
+
+    vf u = K(fade)(fx);
+    vf v = K(fade)(fy);
+
+    vf nx0 = K(lerp)(n00, n10, u);
+    vf nx1 = K(lerp)(n01, n11, u);
+    return K(lerp)(nx0, nx1, v);
+}
+
+static inline vf K(noise3)(vf x, vf y, vf z, uint32_t seed)
+{
+    vi ix, iy, iz;
+    vf fx, fy, fz;
+    K(split)(x, &ix, &fx);
+    K(split)(y, &iy, &fy);
+    K(split)(z, &iz, &fz);
+
+    vi one = VI_SET1(1);
+    vi ix1 = VI_ADD(ix, one);
+    vi iy1 = VI_ADD(iy, one);
+    vi iz1 = VI_ADD(iz, one);
+    vf fx1 = V_SUB(fx, V_SET1(1.0f));
+    vf fy1 = V_SUB(fy, V_SET1(1.0f));
+    vf fz1 = V_SUB(fz, V_SET1(1.0f));
+
+    vf n000 = K(grad3)(K(hash)(ix, iy, iz, seed), fx, fy, fz);
+    vf n100 = K(grad3)(K(hash)(ix1, iy, iz, seed), fx1, fy, fz);
+    vf n010 = K(grad3)(K(hash)(ix, iy1, iz, seed), fx, fy1, fz);
+    vf n110 = K(grad3)(K(hash)(ix1, iy1, iz, seed), fx1, fy1, fz);
+    vf n001 = K(grad3)(K(hash)(ix, iy, iz1, seed), fx, fy, fz1);
+    vf n101 = K(grad3)(K(hash)(ix1, iy, iz1, seed), fx1, fy, fz1);
+    vf n011 = K(grad3)(K(hash)(ix, iy1, iz1, seed), fx, fy1, fz1);
+    vf n111 = K(grad3)(K(hash)(ix1, iy1, iz1, seed), fx1, fy1, fz1);
+
+    vf u = K(fade)(fx);
+    vf v = K(fade)(fy);
+    vf w = K(fade)(fz);
+
+    vf x00 = K(lerp)(n000, n100, u);
+    vf x10 = K(lerp)(n010, n110, u);
+    vf x01 = K(lerp)(n001, n101, u);
+    vf x11 = K(lerp)(n011, n111, u);
+    vf y0 = K(lerp)(x00, x10, v);
+    vf y1 = K(lerp)(x01, x11, v);
+    return K(lerp)(y0, y1, w);
+}
+
+static void K(height_row)(const struct Terrain *terrain, int32_t x0, int32_t z, float *out)
+{
+    for (int i = 0 ; i < CHUNK_WIDTH ; i += LANES)
+    {
+        vf wx = V_CVT(VI_ADD(VI_SET1(x0 + i), LANE_OFFSETS));
+        vf wz = V_CVT(VI_SET1(z));
+        vf sum = V_SET1(0.0f);
+
+        for (int o = 0 ; o < terrain->octaves ; o++)
+        {
+            vf frequency = V_SET1(terrain->octave_frequency[o]);
+            vf n = K(noise2)(V_MUL(wx, frequency), V_MUL(wz, frequency), terrain->seed + o);
+            sum = V_ADD(sum, V_MUL(n, V_SET1(terrain->octave_amplitude[o])));
+        }
+
+        vf height = V_ADD(V_SET1(terrain->base_height), V_MUL(sum, V_SET1(terrain->height_scale)));
+        V_STORE(out + i, height);
+    }
+}
+
+static void K(cave_row)(const struct Terrain *terrain, int32_t x0, int32_t y, int32_t z, float *out)
+{
+    vf frequency = V_SET1(terrain->cave_frequency);
+    vf wy = V_MUL(V_CVT(VI_SET1(y)), frequency);
+    vf wz = V_MUL(V_CVT(VI_SET1(z)), frequency);
+
+    for (int i = 0 ; i < CHUNK_WIDTH ; i += LANES)
+    {
+        vf wx = V_MUL(V_CVT(VI_ADD(VI_SET1(x0 + i), LANE_OFFSETS)), frequency);
+        V_STORE(out + i, K(noise3)(wx, wy, wz, terrain->seed ^ CAVE_SEED));
+    }
+}
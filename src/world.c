@@ -0,0 +1,51 @@
+#include <math.h>
+#include <world.h>
+
+bool chunk_coord_equal(struct ChunkCoord a, struct ChunkCoord b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+uint32_t chunk_coord_hash(struct ChunkCoord coord)
+{
+    uint32_t h = (uint32_t) coord.x * 73856093u;
+    h ^= (uint32_t) coord.y * 19349663u;
+    h ^= (uint32_t) coord.z * 83492791u;
+    return h;
+}
+
+void world_chunk_from_position(vec3 position, struct ChunkCoord *out)
+{
+    out->x = (int32_t) floorf(position[0] / CHUNK_WORLD_SIZE);
+    out->y = (int32_t) floorf(position[1] / CHUNK_WORLD_SIZE);
+    out->z = (int32_t) floorf((WORLD_VOXEL_SCALE - position[2]) / CHUNK_WORLD_SIZE);
+}
+
+void world_chunk_aabb(struct ChunkCoord coord, vec3 box[2])
+{
+    box[0][0] = coord.x * CHUNK_WORLD_SIZE;
+    box[0][1] = coord.y * CHUNK_WORLD_SIZE;
+    box[0][2] = WORLD_VOXEL_SCALE - (coord.z+1) * CHUNK_WORLD_SIZE;
+
+    box[1][0] = (coord.x+1) * CHUNK_WORLD_SIZE;
+    box[1][1] = (coord.y+1) * CHUNK_WORLD_SIZE;
+    box[1][2] = WORLD_VOXEL_SCALE - coord.z * CHUNK_WORLD_SIZE;
+}
+
+void world_chunk_center(struct ChunkCoord coord, vec3 out)
+{
+    vec3 box[2];
+    world_chunk_aabb(coord, box);
+    glm_aabb_center(box, out);
+}
+
+void world_chunk_transform(struct ChunkCoord coord, mat4 out)
+{
+    vec3 offset = {
+        coord.x * CHUNK_WORLD_SIZE,
+        coord.y * CHUNK_WORLD_SIZE,
+        -coord.z * CHUNK_WORLD_SIZE
+    };
+    glm_mat4_identity(out);
+    glm_translate(out, offset);
+}
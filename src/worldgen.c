@@ -0,0 +1,921 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <worldgen.h>
+#include <profile.h>
+#include <timer.h>
+#include <memtrack.h>
+#include <log.h>
+
+#define TREE_MIN_HEIGHT 4
+#define TREE_HEIGHT_RANGE 3
+#define TREE_LEAF_RADIUS 2
+
+typedef void (*WorldgenStageFunc)(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out);
+
+static void stage_density(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out);
+static void stage_caves(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out);
+static void stage_surface(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out);
+static void stage_structures(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out);
+
+static const WorldgenStageFunc stages[WORLDGEN_STAGE_COUNT] = {
+    NULL,
+    stage_density,
+    stage_caves,
+    stage_surface,
+    stage_structures
+};
+
+static void stage_job(void *user);
+
+static struct ChunkCoord offset_coord(struct ChunkCoord coord, int i)
+{
+    struct ChunkCoord result = {
+        coord.x + i%3 - 1,
+        coord.y + (i/3)%3 - 1,
+        coord.z + i/9 - 1
+    };
+    return result;
+}
+
+int worldgen_init(struct Worldgen *worldgen, const struct Terrain *terrain, struct JobPool *pool)
+{
+    *worldgen = (struct Worldgen){
+        .terrain = terrain,
+        .pool = pool,
+        .max_buffers = WORLDGEN_DEFAULT_MAX_BUFFERS
+    };
+
+    worldgen->buckets = (struct WorldgenNode **) calloc(WORLDGEN_HASH_BUCKETS, sizeof(struct WorldgenNode *));
+    if (worldgen->buckets == NULL)
+    {
+        LOG_ERROR(LOG_WORLDGEN, "Unable to allocate the chunk table.");
+        return -1;
+    }
+
+    if (column_cache_init(&worldgen->columns, terrain, COLUMN_CACHE_DEFAULT_CAPACITY))
+    {
+        free(worldgen->buckets);
+        return -1;
+    }
+
+    pthread_mutex_init(&worldgen->lock, NULL);
+    return 0;
+}
+
+static struct WorldgenNode *find_node(struct Worldgen *worldgen, struct ChunkCoord coord)
+{
+    struct WorldgenNode *node = worldgen->buckets[chunk_coord_hash(coord) & (WORLDGEN_HASH_BUCKETS-1)];
+    while (node && !chunk_coord_equal(node->coord, coord))
+        node = node->hash_next;
+    return node;
+}
+
+static struct WorldgenNode *create_node(struct Worldgen *worldgen, struct ChunkCoord coord)
+{
+    struct WorldgenNode *node = (struct WorldgenNode *) calloc(1, sizeof(struct WorldgenNode));
+    if (node == NULL)
+    {
+        LOG_ERROR(LOG_WORLDGEN, "Unable to allocate a chunk node.");
+        return NULL;
+    }
+
+    node->coord = coord;
+    node->worldgen = worldgen;
+
+    size_t bucket = chunk_coord_hash(coord) & (WORLDGEN_HASH_BUCKETS-1);
+    node->hash_next = worldgen->buckets[bucket];
+    worldgen->buckets[bucket] = node;
+    worldgen->node_count++;
+
+    return node;
+}
+
+static void free_node(struct WorldgenNode *node)
+{
+    while (node->waiters)
+    {
+        struct WorldgenWaiter *waiter = node->waiters;
+        node->waiters = waiter->next;
+        free(waiter);
+    }
+    mem_free(node->buffers[0]);
+    mem_free(node->buffers[1]);
+    free(node);
+}
+
+// Holding the lock, the node must not be running
+static void free_buffer(struct Worldgen *worldgen, struct WorldgenNode *node, int slot)
+{
+    if (node->buffers[slot] == NULL)
+        return;
+    mem_free(node->buffers[slot]);
+    node->buffers[slot] = NULL;
+    worldgen->buffer_count--;
+}
+
+/*
+ * Whether the node can still hand out stage to a neighbour, its own last
+ * stage or the one before if that wasn't freed yet.
+ * */
+static bool holds_stage(const struct WorldgenNode *node, int stage)
+{
+    if (stage == WORLDGEN_EMPTY)
+        return true;
+    if (node->stage != stage && node->stage != stage+1)
+        return false;
+    return node->buffers[stage & 1] != NULL;
+}
+
+/*
+ * Drops what the node generated, it runs every stage again. Target and
+ * waiters are kept.
+ * */
+static void reset_node(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    free_buffer(worldgen, node, 0);
+    free_buffer(worldgen, node, 1);
+    node->stage = WORLDGEN_EMPTY;
+    worldgen->resets++;
+}
+
+static void hold_node(struct Worldgen *worldgen, struct WorldgenNode *node, bool held)
+{
+    if (node->held == held)
+        return;
+    node->held = held;
+    if (held)
+        worldgen->held++;
+    else
+        worldgen->held--;
+}
+
+static bool neighbourhood_running(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+    {
+        struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+        if (neighbour && neighbour->running)
+            return true;
+    }
+    return false;
+}
+
+static struct WorldgenNode *request_locked(struct Worldgen *worldgen, struct ChunkCoord coord, int target);
+
+/*
+ * Starts the next stage of a node if it is wanted and its neighbourhood
+ * has caught up. Missing neighbours are requested, they may have been
+ * evicted. Neighbours too far ahead to hand out the stage this one reads
+ * start over, they were generated next to one that got evicted.
+ * */
+static void try_schedule(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    if (node->running || node->stage >= node->target)
+    {
+        hold_node(worldgen, node, false);
+        return;
+    }
+
+    // Density doesn't read anything, every later stage needs the neighbourhood
+    if (node->stage >= WORLDGEN_DENSITY)
+    {
+        bool ready = true;
+        for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+        {
+            if (i == WORLDGEN_SELF)
+                continue;
+
+            struct ChunkCoord coord = offset_coord(node->coord, i);
+            struct WorldgenNode *neighbour = find_node(worldgen, coord);
+            if (neighbour == NULL || neighbour->target < node->target-1)
+                neighbour = request_locked(worldgen, coord, node->target-1);
+            if (neighbour == NULL || neighbour->stage < node->stage)
+            {
+                ready = false;
+            }
+            else if (!holds_stage(neighbour, node->stage))
+            {
+                ready = false;
+                if (!neighbour->running && !neighbourhood_running(worldgen, neighbour))
+                {
+                    reset_node(worldgen, neighbour);
+                    try_schedule(worldgen, neighbour);
+                }
+            }
+        }
+        // Requesting a neighbour may have scheduled this node already
+        if (!ready || node->running)
+            return;
+    }
+
+    // Past the cap only stages that reuse a buffer run, unless nothing
+    // else does and the pipeline would stall
+    bool allocates = node->buffers[(node->stage+1) & 1] == NULL;
+    if (allocates && worldgen->buffer_count >= worldgen->max_buffers && worldgen->running)
+    {
+        hold_node(worldgen, node, true);
+        return;
+    }
+    hold_node(worldgen, node, false);
+
+    node->running = true;
+    worldgen->running++;
+    if (job_pool_submit(worldgen->pool, stage_job, node))
+    {
+        node->running = false;
+        worldgen->running--;
+    }
+}
+
+/*
+ * Frees the buffers of an idle node nobody reads anymore. The final stage
+ * is only ever read by the waiters, once they have their copy the node
+ * steps back to the stage before. That one, like every earlier stage, is
+ * kept until all 26 neighbours are past it, a missing neighbour may still
+ * need it when it comes back.
+ * */
+static void release_buffers(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    if (node->running || node->waiters)
+        return;
+
+    if (node->stage == WORLDGEN_FINAL_STAGE)
+    {
+        free_buffer(worldgen, node, WORLDGEN_FINAL_STAGE & 1);
+        node->stage = WORLDGEN_FINAL_STAGE-1;
+        if (node->target > node->stage)
+            node->target = node->stage;
+    }
+
+    int previous = node->stage - 1;
+    if (previous < WORLDGEN_DENSITY || node->buffers[previous & 1] == NULL)
+        return;
+    for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+    {
+        struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+        if (neighbour == NULL || neighbour->stage < node->stage)
+            return;
+    }
+    free_buffer(worldgen, node, previous & 1);
+}
+
+static struct WorldgenNode *request_locked(struct Worldgen *worldgen, struct ChunkCoord coord, int target)
+{
+    struct WorldgenNode *node = find_node(worldgen, coord);
+    if (node == NULL)
+        node = create_node(worldgen, coord);
+    if (node == NULL)
+        return NULL;
+
+    if (target > node->target)
+    {
+        node->target = target;
+
+        // To run stage target the neighbours need stage target-1
+        if (target-1 >= WORLDGEN_DENSITY)
+        {
+            for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+            {
+                if (i != WORLDGEN_SELF)
+                    request_locked(worldgen, offset_coord(coord, i), target-1);
+            }
+        }
+    }
+
+    try_schedule(worldgen, node);
+    return node;
+}
+
+/*
+ * Hands the final stage to the waiters, with the lock held on entry and
+ * exit. The node is flagged as running meanwhile so its buffers stay,
+ * waiters that come in during the calls are served as well.
+ * */
+static void deliver_locked(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    const struct Chunk *chunk = node->buffers[WORLDGEN_FINAL_STAGE & 1];
+    while (node->waiters)
+    {
+        struct WorldgenWaiter *waiters = node->waiters;
+        node->waiters = NULL;
+        pthread_mutex_unlock(&worldgen->lock);
+
+        while (waiters)
+        {
+            struct WorldgenWaiter *waiter = waiters;
+            waiters = waiter->next;
+            waiter->done(chunk, node->coord, waiter->user);
+            free(waiter);
+        }
+
+        pthread_mutex_lock(&worldgen->lock);
+    }
+}
+
+int worldgen_request(struct Worldgen *worldgen, struct ChunkCoord coord, WorldgenDone done, void *user)
+{
+    struct WorldgenWaiter *waiter = (struct WorldgenWaiter *) malloc(sizeof(struct WorldgenWaiter));
+    if (waiter == NULL)
+    {
+        LOG_ERROR(LOG_WORLDGEN, "Unable to allocate a waiter.");
+        return -1;
+    }
+    waiter->done = done;
+    waiter->user = user;
+    waiter->coord = coord;
+
+    pthread_mutex_lock(&worldgen->lock);
+    struct WorldgenNode *node = request_locked(worldgen, coord, WORLDGEN_FINAL_STAGE);
+    if (node)
+    {
+        waiter->next = node->waiters;
+        node->waiters = waiter;
+
+        // Finished and idle, nobody else is going to serve the waiter
+        if (node->stage == WORLDGEN_FINAL_STAGE && !node->running)
+        {
+            node->running = true;
+            deliver_locked(worldgen, node);
+            node->running = false;
+            release_buffers(worldgen, node);
+        }
+    }
+    pthread_mutex_unlock(&worldgen->lock);
+
+    if (node == NULL)
+    {
+        free(waiter);
+        return -1;
+    }
+    return 0;
+}
+
+struct GenerateWait
+{
+    struct Chunk *out;
+    bool finished, failed;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+static void generate_done(const struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    struct GenerateWait *wait = (struct GenerateWait *) user;
+    if (chunk)
+        memcpy(wait->out, chunk, sizeof(struct Chunk));
+
+    pthread_mutex_lock(&wait->lock);
+    wait->finished = true;
+    wait->failed = chunk == NULL;
+    pthread_cond_signal(&wait->done);
+    pthread_mutex_unlock(&wait->lock);
+}
+
+int worldgen_generate(struct Worldgen *worldgen, struct ChunkCoord coord, struct Chunk *out)
+{
+    struct GenerateWait wait = { .out = out };
+    pthread_mutex_init(&wait.lock, NULL);
+    pthread_cond_init(&wait.done, NULL);
+
+    int result = worldgen_request(worldgen, coord, generate_done, &wait);
+    if (result == 0)
+    {
+        pthread_mutex_lock(&wait.lock);
+        while (!wait.finished)
+            pthread_cond_wait(&wait.done, &wait.lock);
+        pthread_mutex_unlock(&wait.lock);
+        if (wait.failed)
+            result = -1;
+    }
+
+    pthread_cond_destroy(&wait.done);
+    pthread_mutex_destroy(&wait.lock);
+    return result;
+}
+
+/*
+ * Gives nodes held back by the cap another chance once there is room.
+ * */
+static void schedule_held(struct Worldgen *worldgen)
+{
+    if (worldgen->held == 0 || (worldgen->buffer_count >= worldgen->max_buffers && worldgen->running))
+        return;
+    for (size_t b = 0 ; b < WORLDGEN_HASH_BUCKETS && worldgen->held ; b++)
+    {
+        for (struct WorldgenNode *node = worldgen->buckets[b] ; node ; node = node->hash_next)
+        {
+            if (node->held)
+                try_schedule(worldgen, node);
+        }
+    }
+}
+
+/*
+ * The next stage of node couldn't run. Chunks close enough to depend on it
+ * stop where they are and their waiters get a NULL chunk, with the lock
+ * held on entry and exit. Requesting them again retries.
+ * */
+static void fail_node(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    struct WorldgenWaiter *failed = NULL;
+
+    // A chunk d chunks away reads stage FINAL-d of this one
+    int reach = WORLDGEN_FINAL_STAGE-1 - node->stage;
+    for (int dy = -reach ; dy <= reach ; dy++)
+    for (int dz = -reach ; dz <= reach ; dz++)
+    for (int dx = -reach ; dx <= reach ; dx++)
+    {
+        struct ChunkCoord coord = { node->coord.x + dx, node->coord.y + dy, node->coord.z + dz };
+        struct WorldgenNode *other = find_node(worldgen, coord);
+        if (other == NULL || other->stage >= other->target)
+            continue;
+
+        // Running ones finish their stage, the final one serves its waiters itself
+        hold_node(worldgen, other, false);
+        other->target = other->running ? other->stage+1 : other->stage;
+        if (other->target == WORLDGEN_FINAL_STAGE)
+            continue;
+
+        while (other->waiters)
+        {
+            struct WorldgenWaiter *waiter = other->waiters;
+            other->waiters = waiter->next;
+            waiter->next = failed;
+            failed = waiter;
+        }
+    }
+
+    if (failed == NULL)
+        return;
+
+    pthread_mutex_unlock(&worldgen->lock);
+    while (failed)
+    {
+        struct WorldgenWaiter *waiter = failed;
+        failed = waiter->next;
+        waiter->done(NULL, waiter->coord, waiter->user);
+        free(waiter);
+    }
+    pthread_mutex_lock(&worldgen->lock);
+}
+
+static void stage_job(void *user)
+{
+    struct WorldgenNode *node = (struct WorldgenNode *) user;
+    struct Worldgen *worldgen = node->worldgen;
+    const struct Chunk *neighbourhood[WORLDGEN_NEIGHBOURHOOD] = {0};
+    PROFILE_ZONE("worldgen stage");
+
+    // Nobody else touches the slot of a running node, it may have been
+    // released while nobody needed it
+    int stage = node->stage + 1;
+    struct Chunk *out = node->buffers[stage & 1];
+    bool allocated = out == NULL;
+    if (allocated)
+        out = (struct Chunk *) mem_alloc_chunks(sizeof(struct Chunk), 1);
+
+    pthread_mutex_lock(&worldgen->lock);
+    if (allocated && out)
+    {
+        node->buffers[stage & 1] = out;
+        worldgen->buffer_count++;
+    }
+    if (stage > WORLDGEN_DENSITY)
+    {
+        for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+        {
+            struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+            neighbourhood[i] = neighbour->buffers[(stage-1) & 1];
+        }
+    }
+    pthread_mutex_unlock(&worldgen->lock);
+
+    bool failed = out == NULL;
+    uint64_t start = timer_now_ns();
+
+    if (!failed)
+    {
+        // Stages refine the previous output of their own chunk
+        if (stage > WORLDGEN_DENSITY)
+            memcpy(out, neighbourhood[WORLDGEN_SELF], sizeof(struct Chunk));
+        stages[stage](worldgen, node->coord, neighbourhood, out);
+    }
+    else
+    {
+        LOG_ERROR(LOG_WORLDGEN, "Unable to allocate chunk buffers.");
+    }
+
+    pthread_mutex_lock(&worldgen->lock);
+    if (!failed)
+    {
+        node->stage = stage;
+        worldgen->stage_runs[stage]++;
+        worldgen->stage_ns[stage] += timer_now_ns() - start;
+        // Still flagged as running, so it can't be evicted under the waiters
+        if (stage == WORLDGEN_FINAL_STAGE)
+            deliver_locked(worldgen, node);
+    }
+
+    node->running = false;
+    worldgen->running--;
+    if (failed)
+    {
+        fail_node(worldgen, node);
+    }
+    else
+    {
+        try_schedule(worldgen, node);
+        for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+        {
+            struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+            if (neighbour)
+                try_schedule(worldgen, neighbour);
+        }
+        // The neighbours moving on may be what kept a buffer around
+        for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+        {
+            struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+            if (neighbour)
+                release_buffers(worldgen, neighbour);
+        }
+    }
+    schedule_held(worldgen);
+    pthread_mutex_unlock(&worldgen->lock);
+}
+
+/*
+ * Running neighbours read this node's buffers, unfinished ones will. That
+ * keeps the neighbourhoods of requests beyond the radius, prefetched
+ * along the camera path.
+ * */
+static bool evictable(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    if (node->waiters)
+        return false;
+    for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+    {
+        struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+        if (neighbour == NULL)
+            continue;
+        if (neighbour->running)
+            return false;
+        if (i != WORLDGEN_SELF && neighbour->stage < neighbour->target && neighbour->target > WORLDGEN_DENSITY)
+            return false;
+    }
+    return true;
+}
+
+static void evict_node(struct Worldgen *worldgen, struct WorldgenNode **link)
+{
+    struct WorldgenNode *node = *link;
+    *link = node->hash_next;
+    hold_node(worldgen, node, false);
+    worldgen->buffer_count -= (node->buffers[0] != NULL) + (node->buffers[1] != NULL);
+    worldgen->node_count--;
+    free_node(node);
+}
+
+static int center_distance2(struct WorldgenNode *node, struct ChunkCoord center)
+{
+    int dx = node->coord.x - center.x;
+    int dy = node->coord.y - center.y;
+    int dz = node->coord.z - center.z;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+struct EvictCandidate
+{
+    struct WorldgenNode *node;
+    int distance2;
+};
+
+static int compare_candidates(const void *a, const void *b)
+{
+    const struct EvictCandidate *x = (const struct EvictCandidate *) a;
+    const struct EvictCandidate *y = (const struct EvictCandidate *) b;
+    return (y->distance2 > x->distance2) - (y->distance2 < x->distance2);
+}
+
+static void unlink_node(struct Worldgen *worldgen, struct WorldgenNode *node)
+{
+    struct WorldgenNode **link = &worldgen->buckets[chunk_coord_hash(node->coord) & (WORLDGEN_HASH_BUCKETS-1)];
+    while (*link != node)
+        link = &(*link)->hash_next;
+    evict_node(worldgen, link);
+}
+
+/*
+ * Past the cap the furthest idle nodes holding buffers go, even inside the
+ * radius. Their neighbours start over when they are needed again.
+ * */
+static bool evict_over_cap(struct Worldgen *worldgen, struct ChunkCoord center)
+{
+    if (worldgen->buffer_count <= worldgen->max_buffers)
+        return false;
+
+    struct EvictCandidate *candidates = (struct EvictCandidate *) malloc(worldgen->node_count * sizeof(struct EvictCandidate));
+    if (candidates == NULL)
+    {
+        LOG_ERROR(LOG_WORLDGEN, "Unable to allocate the eviction candidates.");
+        return false;
+    }
+
+    size_t count = 0;
+    for (size_t b = 0 ; b < WORLDGEN_HASH_BUCKETS ; b++)
+    {
+        for (struct WorldgenNode *node = worldgen->buckets[b] ; node ; node = node->hash_next)
+        {
+            if ((node->buffers[0] || node->buffers[1]) && evictable(worldgen, node))
+                candidates[count++] = (struct EvictCandidate){ node, center_distance2(node, center) };
+        }
+    }
+    qsort(candidates, count, sizeof(struct EvictCandidate), compare_candidates);
+
+    size_t evicted = 0;
+    while (evicted < count && worldgen->buffer_count > worldgen->max_buffers)
+        unlink_node(worldgen, candidates[evicted++].node);
+
+    free(candidates);
+    return evicted > 0;
+}
+
+/*
+ * Whether a node that stays has gone past density next to this one. Its
+ * earlier stages may be gone, with this node generated again it would
+ * have to start over as well.
+ * */
+static bool borders_kept(struct Worldgen *worldgen, struct WorldgenNode *node, struct ChunkCoord center, int radius)
+{
+    for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+    {
+        struct WorldgenNode *neighbour = find_node(worldgen, offset_coord(node->coord, i));
+        if (neighbour && neighbour->stage > WORLDGEN_DENSITY && center_distance2(neighbour, center) <= radius*radius)
+            return true;
+    }
+    return false;
+}
+
+void worldgen_evict(struct Worldgen *worldgen, struct ChunkCoord center, int radius)
+{
+    pthread_mutex_lock(&worldgen->lock);
+
+    bool evicted = false;
+    for (size_t b = 0 ; b < WORLDGEN_HASH_BUCKETS ; b++)
+    {
+        struct WorldgenNode **link = &worldgen->buckets[b];
+        while (*link)
+        {
+            struct WorldgenNode *node = *link;
+            if (center_distance2(node, center) <= radius*radius || !evictable(worldgen, node)
+                || borders_kept(worldgen, node, center, radius))
+            {
+                link = &node->hash_next;
+                continue;
+            }
+
+            evict_node(worldgen, link);
+            evicted = true;
+        }
+    }
+    if (evict_over_cap(worldgen, center))
+        evicted = true;
+
+    // Anything that was waiting on an evicted neighbour asks for it again
+    if (evicted)
+    {
+        for (size_t b = 0 ; b < WORLDGEN_HASH_BUCKETS ; b++)
+        {
+            for (struct WorldgenNode *node = worldgen->buckets[b] ; node ; node = node->hash_next)
+                try_schedule(worldgen, node);
+        }
+    }
+
+    pthread_mutex_unlock(&worldgen->lock);
+}
+
+void worldgen_shutdown(struct Worldgen *worldgen)
+{
+    for (size_t b = 0 ; b < WORLDGEN_HASH_BUCKETS ; b++)
+    {
+        while (worldgen->buckets[b])
+        {
+            struct WorldgenNode *node = worldgen->buckets[b];
+            worldgen->buckets[b] = node->hash_next;
+            free_node(node);
+        }
+    }
+
+    free(worldgen->buckets);
+    worldgen->buckets = NULL;
+    worldgen->node_count = 0;
+    column_cache_free(&worldgen->columns);
+    pthread_mutex_destroy(&worldgen->lock);
+}
+
+// STAGES
+
+static void stage_density(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out)
+{
+    // Every chunk stacked on this column shares the heightmap
+    const struct TerrainColumn *column = column_cache_acquire(&worldgen->columns, coord.x, coord.z);
+    if (column)
+        terrain_fill_density_column(worldgen->terrain, column, out, coord);
+    else
+        terrain_fill_density(worldgen->terrain, worldgen->terrain->level, out, coord);
+    column_cache_release(&worldgen->columns, column);
+}
+
+static void stage_caves(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out)
+{
+    terrain_carve_caves(worldgen->terrain, worldgen->terrain->level, out, coord);
+}
+
+/*
+ * Caves leave dirt open to the sky and grass buried under overhangs,
+ * the top layer of a chunk looks into the chunk above for its neighbour.
+ * */
+static void stage_surface(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out)
+{
+    const struct Chunk *self = neighbourhood[WORLDGEN_SELF];
+    const struct Chunk *above = neighbourhood[WORLDGEN_NEIGHBOUR(0, 1, 0)];
+
+    for (int z = 0 ; z < CHUNK_WIDTH ; z++)
+    for (int y = 0 ; y < CHUNK_WIDTH ; y++)
+    for (int x = 0 ; x < CHUNK_WIDTH ; x++)
+    {
+        int index = CHUNK_INDEX(x, y, z);
+        uint8_t type = self->voxel_type[index];
+        uint8_t over = y < CHUNK_WIDTH-1 ? self->voxel_type[CHUNK_INDEX(x, y+1, z)] : above->voxel_type[CHUNK_INDEX(x, 0, z)];
+
+        if (type == VOXEL_DIRT && over == VOXEL_AIR)
+            out->voxel_type[index] = VOXEL_GRASS;
+        else if (type == VOXEL_GRASS && over != VOXEL_AIR)
+            out->voxel_type[index] = VOXEL_DIRT;
+    }
+}
+
+static uint32_t column_hash(int32_t x, int32_t z, uint32_t seed)
+{
+    uint32_t h = seed ^ 0x85ebca6bu;
+    h ^= (uint32_t) x * 0x8da6b343u;
+    h ^= (uint32_t) z * 0xcb1ab31fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static void place(struct Chunk *out, struct ChunkCoord coord, int32_t gx, int32_t gy, int32_t gz, uint8_t type)
+{
+    int x = gx - coord.x*CHUNK_WIDTH;
+    int y = gy - coord.y*CHUNK_WIDTH;
+    int z = gz - coord.z*CHUNK_WIDTH;
+    if (x < 0 || y < 0 || z < 0 || x >= CHUNK_WIDTH || y >= CHUNK_WIDTH || z >= CHUNK_WIDTH)
+        return;
+
+    // Trunks push leaves aside but nothing replaces terrain or a trunk,
+    // so the result doesn't depend on the order trees are placed in
+    uint8_t *voxel = &out->voxel_type[CHUNK_INDEX(x, y, z)];
+    if (*voxel == VOXEL_AIR || (type == VOXEL_LOG && *voxel == VOXEL_LEAVES))
+        *voxel = type;
+}
+
+/*
+ * Trees grow on grass in hashed columns. A tree rooted in a neighbour can
+ * reach into this chunk, so every column of the neighbourhood is checked.
+ * Coordinates are global voxel positions in chunk space.
+ * */
+static void stage_structures(struct Worldgen *worldgen, struct ChunkCoord coord, const struct Chunk **neighbourhood, struct Chunk *out)
+{
+    uint32_t seed = worldgen->terrain->seed;
+
+    for (int i = 0 ; i < WORLDGEN_NEIGHBOURHOOD ; i++)
+    {
+        const struct Chunk *chunk = neighbourhood[i];
+        struct ChunkCoord origin = offset_coord(coord, i);
+
+        for (int z = 0 ; z < CHUNK_WIDTH ; z++)
+        for (int x = 0 ; x < CHUNK_WIDTH ; x++)
+        {
+            int32_t gx = origin.x*CHUNK_WIDTH + x;
+            int32_t gz = origin.z*CHUNK_WIDTH + z;
+            uint32_t h = column_hash(gx, gz, seed);
+            if (h % WORLDGEN_TREE_RARITY)
+                continue;
+
+            int root = -1;
+            for (int y = CHUNK_WIDTH-1 ; y >= 0 ; y--)
+            {
+                if (chunk->voxel_type[CHUNK_INDEX(x, y, z)] != VOXEL_GRASS)
+                    continue;
+                if (y == CHUNK_WIDTH-1 || chunk->voxel_type[CHUNK_INDEX(x, y+1, z)] == VOXEL_AIR)
+                {
+                    root = y;
+                    break;
+                }
+            }
+            if (root < 0)
+                continue;
+
+            int32_t gy = origin.y*CHUNK_WIDTH + root;
+            int height = TREE_MIN_HEIGHT + (h >> 8) % TREE_HEIGHT_RANGE;
+            int32_t top = gy + height;
+
+            for (int32_t y = gy+1 ; y <= top ; y++)
+                place(out, coord, gx, y, gz, VOXEL_LOG);
+
+            for (int oy = -1 ; oy <= 1 ; oy++)
+            for (int oz = -TREE_LEAF_RADIUS ; oz <= TREE_LEAF_RADIUS ; oz++)
+            for (int ox = -TREE_LEAF_RADIUS ; ox <= TREE_LEAF_RADIUS ; ox++)
+            {
+                if (ox*ox + oy*oy + oz*oz > TREE_LEAF_RADIUS*TREE_LEAF_RADIUS + 1)
+                    continue;
+                place(out, coord, gx+ox, top+oy, gz+oz, VOXEL_LEAVES);
+            }
+        }
+    }
+}
+
+// DETERMINISM CHECK
+
+#define VERIFY_WIDTH 3
+#define VERIFY_HEIGHT 2
+#define VERIFY_CHUNKS (VERIFY_WIDTH*VERIFY_HEIGHT*VERIFY_WIDTH)
+
+static void verify_done(const struct Chunk *chunk, struct ChunkCoord coord, void *user)
+{
+    memcpy(user, chunk, sizeof(struct Chunk));
+}
+
+static int generate_region(const struct Terrain *terrain, int threads, struct Chunk *out)
+{
+    struct JobPool pool;
+    struct Worldgen worldgen;
+
+    if (job_pool_init(&pool, threads))
+        return -1;
+    if (worldgen_init(&worldgen, terrain, &pool))
+    {
+        job_pool_shutdown(&pool);
+        return -1;
+    }
+
+    // Straddles the surface so every stage has something to do
+    int i = 0;
+    for (int y = -1 ; y < VERIFY_HEIGHT-1 ; y++)
+    for (int z = 0 ; z < VERIFY_WIDTH ; z++)
+    for (int x = 0 ; x < VERIFY_WIDTH ; x++)
+    {
+        struct ChunkCoord coord = { x-1, y, z-1 };
+        if (worldgen_request(&worldgen, coord, verify_done, &out[i++]))
+            break;
+    }
+
+    job_pool_wait(&pool);
+    worldgen_shutdown(&worldgen);
+    job_pool_shutdown(&pool);
+    return 0;
+}
+
+int worldgen_verify(const struct Terrain *terrain, int max_threads)
+{
+    struct Chunk *reference = (struct Chunk *) calloc(VERIFY_CHUNKS, sizeof(struct Chunk));
+    struct Chunk *result = (struct Chunk *) calloc(VERIFY_CHUNKS, sizeof(struct Chunk));
+    if (reference == NULL || result == NULL || generate_region(terrain, 1, reference))
+    {
+        LOG_ERROR(LOG_WORLDGEN, "Unable to generate the reference region.");
+        free(reference);
+        free(result);
+        return -1;
+    }
+
+    int mismatches = 0;
+    for (int threads = 2 ; threads <= max_threads ; threads *= 2)
+    {
+        memset(result, 0, VERIFY_CHUNKS*sizeof(struct Chunk));
+        if (generate_region(terrain, threads, result))
+        {
+            LOG_ERROR(LOG_WORLDGEN, "Unable to generate the region with %d threads.", threads);
+            mismatches++;
+            continue;
+        }
+
+        // Only the voxels are generated, the bitmask is whatever the
+        // buffer held before
+        for (int i = 0 ; i < VERIFY_CHUNKS ; i++)
+        {
+            if (memcmp(reference[i].voxel_type, result[i].voxel_type, sizeof(reference[i].voxel_type)))
+            {
+                LOG_WARN(LOG_WORLDGEN, "Chunk %d differs with %d threads.", i, threads);
+                mismatches++;
+            }
+        }
+    }
+
+    free(reference);
+    free(result);
+    return mismatches;
+}